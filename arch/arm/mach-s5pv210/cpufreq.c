@@ -20,6 +20,7 @@
 #include <linux/reboot.h>
 #include <linux/regulator/consumer.h>
 #include <linux/cpufreq.h>
+#include <linux/cpufreq_stats.h>
 #include <linux/platform_device.h>
 
 #include <mach/map.h>
@@ -67,6 +68,8 @@ enum perf_level {
 	L0, L1, L2, L3, L4, L5, L6
 };
 
+#define NUM_LEVELS	(L6 + 1)
+
 enum s5pv210_mem_type {
 	LPDDR	= 0x1,
 	LPDDR2	= 0x2,
@@ -171,33 +174,41 @@ extern void cpufreq_stats_reset(void);
 
 static bool pllbus_changing = false;
 
-static int oc_value = 100;
-
 static unsigned long sleep_freq;
 static unsigned long original_fclk[] = {1400000, 1200000, 1000000, 800000, 800000, 800000, 800000};
 
-static u32 apll_values[sizeof(original_fclk) / sizeof(unsigned long)];
+/* APLL output range the PMS values are computed for (kHz) */
+#define LIVEOC_FCLK_MIN	800000
+#define LIVEOC_FCLK_MAX	2000000
+
+static u32 apll_values[NUM_LEVELS];
+
+/*
+ * Per level oc value in percent. L3 - L6 all run from the same 800MHz
+ * APLL setting, so they can only be overclocked together and always
+ * carry the value of L3.
+ */
+static unsigned int oc_values[NUM_LEVELS] = {100, 100, 100, 100, 100, 100, 100};
+
+/* stock dividers, the A2M and HCLK_MSYS dividers are recomputed from these */
+static u32 original_clkdiv[NUM_LEVELS][2];
+
+/* DMC1 frequency used for the refresh counter of every level (kHz) */
+static unsigned long dmc1_freq[NUM_LEVELS] = {200000, 200000, 200000, 200000, 200000, 200000, 100000};
+
+/* ARM clock read back from the PLL and dividers after a transition (kHz) */
+static unsigned long achieved_freq[NUM_LEVELS];
 #endif
 
 /*
- * This function set DRAM refresh counter
+ * This function calculates the DRAM refresh counter
  * accoriding to operating frequency of DRAM
  * ch: DMC port number 0 or 1
  * freq: Operating frequency of DRAM(KHz)
  */
-static void s5pv210_set_refresh(enum s5pv210_dmc_port ch, unsigned long freq)
+static u32 s5pv210_refresh_val(enum s5pv210_dmc_port ch, unsigned long freq)
 {
 	unsigned long tmp, tmp1;
-	void __iomem *reg = NULL;
-
-	if (ch == DMC0) {
-		reg = (S5P_VA_DMC0 + 0x30);
-	} else if (ch == DMC1) {
-		reg = (S5P_VA_DMC1 + 0x30);
-	} else {
-		printk(KERN_ERR "Cannot find DMC port\n");
-		return;
-	}
 
 	/* Find current DRAM frequency */
 	tmp = s5pv210_dram_conf[ch].freq;
@@ -207,15 +218,188 @@ static void s5pv210_set_refresh(enum s5pv210_dmc_port ch, unsigned long freq)
 	tmp1 = s5pv210_dram_conf[ch].refresh;
 
 	do_div(tmp1, tmp);
+
+	return tmp1;
+}
+
+static inline void s5pv210_write_refresh(enum s5pv210_dmc_port ch, u32 val)
+{
+	__raw_writel(val, (ch == DMC0 ? S5P_VA_DMC0 : S5P_VA_DMC1) + 0x30);
+}
+
+/*
+ * Register values for switching from one level to another. The whole
+ * table is rebuilt by s5pv210_build_transitions() whenever the levels
+ * or the DRAM configuration change, so s5pv210_target() does not have
+ * to work anything out while holding set_freq_lock.
+ */
+struct s5pv210_transition {
+	unsigned int pll_changing:1;
+	unsigned int bus_speed_changing:1;
+	u32 clkdiv0;		/* APLL, A2M, HCLK and PCLK dividers */
+	u32 clkdiv2;		/* MFC and G3D dividers */
+	u32 clkdiv6;		/* ONEDRAM divider */
+	u32 arm_mcs;
+	u32 apll_con;
+	u32 refresh_pre[2];	/* DMC0/DMC1 before changing dividers */
+	u32 refresh_mpll;	/* DMC1 while running from MPLL */
+	u32 refresh_apll;	/* DMC1 after switching back to APLL */
+	u32 refresh_post[2];	/* DMC0/DMC1 after the bus speed change */
+};
+
+static struct s5pv210_transition transitions[NUM_LEVELS][NUM_LEVELS];
+
+static void s5pv210_build_transition(struct s5pv210_transition *t,
+				     unsigned int old_freq,
+				     unsigned int index, bool force)
+{
+	u32 *div = clkdiv_val[index];
+	unsigned long dmc1;
+
+	memset(t, 0, sizeof(*t));
+
+	/* Check if there need to change PLL */
+	t->pll_changing = force || (index <= L2) ||
+		(old_freq >= s5pv210_freq_table[L2].frequency);
+
+	/* Check if there need to change System bus clock */
+	t->bus_speed_changing = force || (index == L6) ||
+		(old_freq == s5pv210_freq_table[L6].frequency);
+
+	t->clkdiv0 = (div[0] << S5P_CLKDIV0_APLL_SHIFT) |
+		(div[1] << S5P_CLKDIV0_A2M_SHIFT) |
+		(div[2] << S5P_CLKDIV0_HCLK200_SHIFT) |
+		(div[3] << S5P_CLKDIV0_PCLK100_SHIFT) |
+		(div[4] << S5P_CLKDIV0_HCLK166_SHIFT) |
+		(div[5] << S5P_CLKDIV0_PCLK83_SHIFT) |
+		(div[6] << S5P_CLKDIV0_HCLK133_SHIFT) |
+		(div[7] << S5P_CLKDIV0_PCLK66_SHIFT);
+
+	t->clkdiv2 = (div[10] << S5P_CLKDIV2_G3D_SHIFT) |
+		(div[9] << S5P_CLKDIV2_MFC_SHIFT);
+
+	t->clkdiv6 = div[8] << S5P_CLKDIV6_ONEDRAM_SHIFT;
+
+	t->arm_mcs = (index >= L5) ? 0x3 : 0x1;
+
 #ifdef CONFIG_LIVE_OC
-	if (ch == DMC1)
-	    __raw_writel((tmp1 * oc_value) / 100, reg);
-	else
-	    __raw_writel(tmp1, reg);
+	t->apll_con = apll_values[index];
 #else
-	__raw_writel(tmp1, reg);
+	switch (index) {
+	case L0:
+		t->apll_con = APLL_VAL_1400;
+		break;
+	case L1:
+		t->apll_con = APLL_VAL_1200;
+		break;
+	case L2:
+		t->apll_con = APLL_VAL_1000;
+		break;
+	default:
+		t->apll_con = APLL_VAL_800;
+	}
 #endif
+
+	/*
+	 * Reconfigure DRAM refresh counter value for minimum
+	 * temporary clock while changing divider.
+	 * expected clock is 83Mhz : 7.8usec/(1/83Mhz) = 0x287
+	 */
+	t->refresh_pre[DMC0] = s5pv210_refresh_val(DMC0, 83000);
+	t->refresh_pre[DMC1] = s5pv210_refresh_val(DMC1,
+					t->pll_changing ? 83000 : 100000);
+
+	t->refresh_mpll = s5pv210_refresh_val(DMC1, 133000);
+
+	/*
+	 * DMC1 runs from HCLK_MSYS, so with live oc its frequency
+	 * depends on the APLL setting of the target level.
+	 */
+#ifdef CONFIG_LIVE_OC
+	dmc1 = dmc1_freq[index];
+#else
+	dmc1 = (index != L6) ? 200000 : 100000;
+#endif
+	t->refresh_apll = s5pv210_refresh_val(DMC1, dmc1);
+
+	if (index != L6) {
+		/*
+		 * DMC0 : 166Mhz
+		 * DMC1 : 200Mhz
+		 */
+		t->refresh_post[DMC0] = s5pv210_refresh_val(DMC0, 166000);
+	} else {
+		/*
+		 * DMC0 : 83Mhz
+		 * DMC1 : 100Mhz
+		 */
+		t->refresh_post[DMC0] = s5pv210_refresh_val(DMC0, 83000);
+	}
+	t->refresh_post[DMC1] = s5pv210_refresh_val(DMC1, dmc1);
+}
+
+/* Must be called with set_freq_lock held */
+static void s5pv210_build_transitions(void)
+{
+	int i, j;
+
+	for (i = 0; i < NUM_LEVELS; i++)
+		for (j = 0; j < NUM_LEVELS; j++)
+			s5pv210_build_transition(&transitions[i][j],
+					s5pv210_freq_table[i].frequency,
+					j, false);
+}
+
+static int s5pv210_find_level(unsigned int freq)
+{
+	int i;
+
+	for (i = 0; i < NUM_LEVELS; i++)
+		if (s5pv210_freq_table[i].frequency == freq)
+			return i;
+
+	return -1;
+}
+
+#ifdef CONFIG_LIVE_OC
+/*
+ * ARM clock as actually programmed into the APLL and CLK_DIV0
+ * FOUT = MDIV * FIN / (PDIV * 2^(SDIV - 1)) with FIN = 24MHz
+ */
+static unsigned long s5pv210_read_armclk(void)
+{
+    u32 con, div0;
+
+    unsigned long mdiv, pdiv, sdiv, fout;
+
+    con = __raw_readl(S5P_APLL_CON);
+    div0 = __raw_readl(S5P_CLK_DIV0);
+
+    mdiv = (con >> 16) & 0x3ff;
+    pdiv = (con >> 8) & 0x3f;
+    sdiv = con & 0x7;
+
+    if (!pdiv)
+	return 0;
+
+    fout = (24000 * mdiv) / (pdiv << (sdiv ? sdiv - 1 : 0));
+
+    return fout / (((div0 & S5P_CLKDIV0_APLL_MASK) >> S5P_CLKDIV0_APLL_SHIFT) + 1);
+}
+
+static void liveoc_verify(unsigned int index)
+{
+    unsigned long freq = s5pv210_read_armclk();
+
+    if (freq != achieved_freq[index] && freq != s5pv210_freq_table[index].frequency)
+	pr_warn("LIVEOC L%u: requested %u kHz but running at %lu kHz\n",
+		index, s5pv210_freq_table[index].frequency, freq);
+
+    achieved_freq[index] = freq;
+
+    return;
 }
+#endif
 
 int s5pv210_verify_speed(struct cpufreq_policy *policy)
 {
@@ -239,13 +423,17 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 {
 	unsigned long reg;
 	unsigned int index;
-	unsigned int pll_changing = 0;
-	unsigned int bus_speed_changing = 0;
+	struct s5pv210_transition *t, forced;
 	unsigned int arm_volt, int_volt;
+	int old_index;
+	bool force = false;
 	int ret = 0;
 
 	mutex_lock(&set_freq_lock);
 
+	/* the regulator ramps are part of the transition as well */
+	cpufreq_stats_transition_begin(policy->cpu);
+
 	if (relation & ENABLE_FURTHER_CPUFREQ)
 		no_cpufreq_access = false;
 	if (no_cpufreq_access) {
@@ -274,6 +462,25 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 	if (freqs.new == freqs.old)
 		goto out;
 
+	/*
+	 * Use the precomputed transition unless we are coming from a
+	 * frequency which is not in the table (e.g. set up by the boot
+	 * loader) or the PLL and bus have to be reprogrammed anyway.
+	 */
+	old_index = s5pv210_find_level(freqs.old);
+#ifdef CONFIG_LIVE_OC
+	if (pllbus_changing) {
+		force = true;
+		pllbus_changing = false;
+	}
+#endif
+	if (old_index >= 0 && !force) {
+		t = &transitions[old_index][index];
+	} else {
+		s5pv210_build_transition(&forced, freqs.old, index, force);
+		t = &forced;
+	}
+
 	arm_volt = dvs_conf[index].arm_volt;
 	int_volt = dvs_conf[index].int_volt;
 
@@ -294,34 +501,9 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 
 	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
 
-	/* Check if there need to change PLL */
-	if ((index <= L2) || (freqs.old >= s5pv210_freq_table[L2].frequency))
-		pll_changing = 1;
-
-	/* Check if there need to change System bus clock */
-	if ((index == L6) || (freqs.old == s5pv210_freq_table[L6].frequency))
-		bus_speed_changing = 1;
-
-#ifdef CONFIG_LIVE_OC
-	if (pllbus_changing) {
-		pll_changing = 1;
-		bus_speed_changing = 1;
-		pllbus_changing = false;
-	}
-#endif
-
-	if (bus_speed_changing) {
-		/*
-		 * Reconfigure DRAM refresh counter value for minimum
-		 * temporary clock while changing divider.
-		 * expected clock is 83Mhz : 7.8usec/(1/83Mhz) = 0x287
-		 */
-		if (pll_changing)
-			s5pv210_set_refresh(DMC1, 83000);
-		else
-			s5pv210_set_refresh(DMC1, 100000);
-
-		s5pv210_set_refresh(DMC0, 83000);
+	if (t->bus_speed_changing) {
+		s5pv210_write_refresh(DMC1, t->refresh_pre[DMC1]);
+		s5pv210_write_refresh(DMC0, t->refresh_pre[DMC0]);
 	}
 
 	/*
@@ -330,7 +512,7 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 	 * Some clock source's clock API are not prepared.
 	 * Do not use clock API in below code.
 	 */
-	if (pll_changing) {
+	if (t->pll_changing) {
 		/*
 		 * 1. Temporary Change divider for MFC and G3D
 		 * SCLKA2M(200/1=200)->(200/4=50)Mhz
@@ -365,8 +547,8 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		 * true refresh counter is already programed in upper
 		 * code. 0x287@83Mhz
 		 */
-		if (!bus_speed_changing)
-			s5pv210_set_refresh(DMC1, 133000);
+		if (!t->bus_speed_changing)
+			s5pv210_write_refresh(DMC1, t->refresh_mpll);
 
 		/* 4. SCLKAPLL -> SCLKMPLL */
 		reg = __raw_readl(S5P_CLK_SRC0);
@@ -388,14 +570,7 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		S5P_CLKDIV0_HCLK166_MASK | S5P_CLKDIV0_PCLK83_MASK |
 		S5P_CLKDIV0_HCLK133_MASK | S5P_CLKDIV0_PCLK66_MASK);
 
-	reg |= ((clkdiv_val[index][0] << S5P_CLKDIV0_APLL_SHIFT) |
-		(clkdiv_val[index][1] << S5P_CLKDIV0_A2M_SHIFT) |
-		(clkdiv_val[index][2] << S5P_CLKDIV0_HCLK200_SHIFT) |
-		(clkdiv_val[index][3] << S5P_CLKDIV0_PCLK100_SHIFT) |
-		(clkdiv_val[index][4] << S5P_CLKDIV0_HCLK166_SHIFT) |
-		(clkdiv_val[index][5] << S5P_CLKDIV0_PCLK83_SHIFT) |
-		(clkdiv_val[index][6] << S5P_CLKDIV0_HCLK133_SHIFT) |
-		(clkdiv_val[index][7] << S5P_CLKDIV0_PCLK66_SHIFT));
+	reg |= t->clkdiv0;
 
 	__raw_writel(reg, S5P_CLK_DIV0);
 
@@ -406,14 +581,11 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 	/* ARM MCS value changed */
 	reg = __raw_readl(S5P_ARM_MCS_CON);
 	reg &= ~0x3;
-	if (index >= L5)
-		reg |= 0x3;
-	else
-		reg |= 0x1;
+	reg |= t->arm_mcs;
 
 	__raw_writel(reg, S5P_ARM_MCS_CON);
 
-	if (pll_changing) {
+	if (t->pll_changing) {
 		/* 5. Set Lock time = 30us*24Mhz = 0x2cf */
 		__raw_writel(0x2cf, S5P_APLL_LOCK);
 
@@ -422,23 +594,7 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		 * 6-1. Set PMS values
 		 * 6-2. Wait untile the PLL is locked
 		 */
-#ifdef CONFIG_LIVE_OC
-		__raw_writel(apll_values[index], S5P_APLL_CON);
-#else
-		switch (index) {
-		case L0:
-			__raw_writel(APLL_VAL_1400, S5P_APLL_CON);
-			break;
-		case L1:
-			__raw_writel(APLL_VAL_1200, S5P_APLL_CON);
-			break;
-		case L2:
-			__raw_writel(APLL_VAL_1000, S5P_APLL_CON);
-			break;
-		default:
-			__raw_writel(APLL_VAL_800, S5P_APLL_CON);
-		}
-#endif
+		__raw_writel(t->apll_con, S5P_APLL_CON);
 
 		do {
 			reg = __raw_readl(S5P_APLL_CON);
@@ -465,8 +621,7 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		 */
 		reg = __raw_readl(S5P_CLK_DIV2);
 		reg &= ~(S5P_CLKDIV2_G3D_MASK | S5P_CLKDIV2_MFC_MASK);
-		reg |= (clkdiv_val[index][10] << S5P_CLKDIV2_G3D_SHIFT) |
-			(clkdiv_val[index][9] << S5P_CLKDIV2_MFC_SHIFT);
+		reg |= t->clkdiv2;
 		__raw_writel(reg, S5P_CLK_DIV2);
 
 		/* For MFC, G3D dividing */
@@ -489,18 +644,18 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		 * L6 : DMC1 = 100Mhz 7.8us/(1/100) = 0x30c
 		 * Others : DMC1 = 200Mhz 7.8us/(1/200) = 0x618
 		 */
-		if (!bus_speed_changing)
-			s5pv210_set_refresh(DMC1, 200000);
+		if (!t->bus_speed_changing)
+			s5pv210_write_refresh(DMC1, t->refresh_apll);
 	}
 
 	/*
 	 * L6 level need to change memory bus speed, hence onedram clock divier
 	 * and memory refresh parameter should be changed
 	 */
-	if (bus_speed_changing) {
+	if (t->bus_speed_changing) {
 		reg = __raw_readl(S5P_CLK_DIV6);
 		reg &= ~S5P_CLKDIV6_ONEDRAM_MASK;
-		reg |= (clkdiv_val[index][8] << S5P_CLKDIV6_ONEDRAM_SHIFT);
+		reg |= t->clkdiv6;
 		__raw_writel(reg, S5P_CLK_DIV6);
 
 		do {
@@ -508,23 +663,14 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		} while (reg & (1 << 15));
 
 		/* Reconfigure DRAM refresh counter value */
-		if (index != L6) {
-			/*
-			 * DMC0 : 166Mhz
-			 * DMC1 : 200Mhz
-			 */
-			s5pv210_set_refresh(DMC0, 166000);
-			s5pv210_set_refresh(DMC1, 200000);
-		} else {
-			/*
-			 * DMC0 : 83Mhz
-			 * DMC1 : 100Mhz
-			 */
-			s5pv210_set_refresh(DMC0, 83000);
-			s5pv210_set_refresh(DMC1, 100000);
-		}
+		s5pv210_write_refresh(DMC0, t->refresh_post[DMC0]);
+		s5pv210_write_refresh(DMC1, t->refresh_post[DMC1]);
 	}
 
+#ifdef CONFIG_LIVE_OC
+	liveoc_verify(index);
+#endif
+
 	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
 
 	if (freqs.new < freqs.old) {
@@ -540,10 +686,25 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 
 	pr_debug("Perf changed[L%d]\n", index);
 out:
+	cpufreq_stats_transition_end(policy->cpu);
 	mutex_unlock(&set_freq_lock);
 	return ret;
 }
 
+static int s5pv210_get_voltage(unsigned int cpu, unsigned int freq,
+			       unsigned long *uv)
+{
+	int index = s5pv210_find_level(freq);
+
+	if (cpu || index < 0)
+		return 0;
+
+	uv[0] = dvs_conf[index].arm_volt;
+	uv[1] = dvs_conf[index].int_volt;
+
+	return 2;
+}
+
 #ifdef CONFIG_PM
 static int s5pv210_cpufreq_suspend(struct cpufreq_policy *policy)
 {
@@ -588,86 +749,187 @@ static int find_divider(int freq)
     return divider;
 }
 
-static void liveoc_init(void)
+/* APLL output of a level at the given oc value, clamped to what it supports */
+static unsigned long liveoc_fclk(int index, unsigned int value)
 {
-    int i, index, divider;
+    unsigned long fclk = (original_fclk[index] * value) / 100;
 
-    unsigned long fclk;
+    return clamp(fclk, (unsigned long)LIVEOC_FCLK_MIN, (unsigned long)LIVEOC_FCLK_MAX);
+}
 
-    i = 0;
+/*
+ * Recompute APLL PMS, A2M and HCLK_MSYS dividers and the DMC1 frequency
+ * of one level from its oc value. The bus dividers are chosen so that
+ * SCLKA2M and HCLK_MSYS stay at or below their stock frequency, which
+ * keeps G3D, MFC and DMC1 at the ratio they were validated for.
+ */
+static void liveoc_update_level(int index)
+{
+    int i, divider;
 
-    while (s5pv210_freq_table[i].frequency != CPUFREQ_TABLE_END) {
-	index = s5pv210_freq_table[i].index;
+    unsigned long fclk, armclk, a2m, hclk, stock_a2m, stock_hclk, mhz;
 
-	fclk = original_fclk[index] / 1000;
+    u32 * div = clkdiv_val[index];
 
-	divider = find_divider(fclk);
+    fclk = liveoc_fclk(index, oc_values[index]);
 
-	apll_values[index] = ((1 << 31) | (((fclk * divider) / 24) << 16) | (divider << 8) | (1));
+    stock_a2m = original_fclk[index] / (original_clkdiv[index][0] + 1);
+    stock_hclk = original_fclk[index] / (div[0] + 1) / (original_clkdiv[index][1] + 1);
 
-	i++;
-    }
+    armclk = fclk / (div[0] + 1);
 
-    sleep_freq = SLEEP_FREQ;
+    /* both dividers are 3 bits wide */
+    a2m = min(DIV_ROUND_UP(fclk, stock_a2m), 8UL);
+    hclk = min(DIV_ROUND_UP(armclk, stock_hclk), 8UL);
+
+    div[1] = a2m - 1;
+    div[2] = hclk - 1;
+
+    dmc1_freq[index] = (index != L6 ? 200000 : 100000) * (armclk / hclk / 1000) / (stock_hclk / 1000);
+
+    mhz = fclk / 1000;
+
+    divider = find_divider(mhz);
+
+    apll_values[index] = ((1 << 31) | (((mhz * divider) / 24) << 16) | (divider << 8) | (1));
+
+    for (i = 0; s5pv210_freq_table[i].frequency != CPUFREQ_TABLE_END; i++)
+	{
+	    if (s5pv210_freq_table[i].index == index)
+		{
+		    s5pv210_freq_table[i].frequency = armclk;
+
+		    if (original_fclk[index] / (div[0] + 1) == SLEEP_FREQ)
+			sleep_freq = armclk;
+		}
+	}
 
     return;
 }
 
-void liveoc_update(unsigned int oc_value)
+static void liveoc_init(void)
 {
-    int i, index, index_min = L0, index_max = L0, divider;
+    int i;
 
-    unsigned long fclk;
+    for (i = 0; i < NUM_LEVELS; i++)
+	{
+	    original_clkdiv[i][0] = clkdiv_val[i][1];
+	    original_clkdiv[i][1] = clkdiv_val[i][2];
 
-    struct cpufreq_policy * policy = cpufreq_cpu_get(0);
+	    liveoc_update_level(i);
+	}
 
-    mutex_lock(&set_freq_lock);
+    sleep_freq = SLEEP_FREQ;
 
-    i = 0;
+    return;
+}
 
-    while (s5pv210_freq_table[i].frequency != CPUFREQ_TABLE_END) {
+/*
+ * Apply per level oc values, L3 - L6 take the value of L3. The resulting
+ * ARM clocks have to stay strictly descending from L0 down, otherwise
+ * level lookup and the APLL change decisions break, and nothing is
+ * changed if they do not.
+ */
+int liveoc_update_levels(const unsigned int * values)
+{
+    int i, index_min = L0, index_max = L0;
 
-	index = s5pv210_freq_table[i].index;
-	
-	if (s5pv210_freq_table[i].frequency == policy->user_policy.min)
-	    index_min = index;
+    unsigned long armclk, prev_armclk = ULONG_MAX;
 
-	if (s5pv210_freq_table[i].frequency == policy->user_policy.max)
-	    index_max = index;
+    struct cpufreq_policy * policy;
 
-	fclk = (original_fclk[index] * oc_value) / 100;
+    for (i = 0; i < NUM_LEVELS; i++)
+	{
+	    armclk = liveoc_fclk(i, values[i < L3 ? i : L3]) / (clkdiv_val[i][0] + 1);
 
-	s5pv210_freq_table[i].frequency = fclk / (clkdiv_val[index][0] + 1);
+	    if (armclk >= prev_armclk)
+		return -EINVAL;
 
-	if (original_fclk[index] / (clkdiv_val[index][0] + 1) == SLEEP_FREQ)
-	    sleep_freq = s5pv210_freq_table[i].frequency;
+	    prev_armclk = armclk;
+	}
 
-	fclk /= 1000;
+    policy = cpufreq_cpu_get(0);
 
-	divider = find_divider(fclk);
+    if (!policy)
+	return -ENODEV;
 
-	apll_values[index] = ((1 << 31) | (((fclk * divider) / 24) << 16) | (divider << 8) | (1));
+    mutex_lock(&set_freq_lock);
 
-	i++;
-    }
+    for (i = 0; i < NUM_LEVELS; i++)
+	{
+	    if (s5pv210_freq_table[i].frequency == policy->user_policy.min)
+		index_min = i;
+
+	    if (s5pv210_freq_table[i].frequency == policy->user_policy.max)
+		index_max = i;
+	}
+
+    for (i = 0; i < NUM_LEVELS; i++)
+	{
+	    oc_values[i] = values[i < L3 ? i : L3];
+
+	    liveoc_update_level(i);
+
+	    achieved_freq[i] = 0;
+	}
 
     cpufreq_frequency_table_cpuinfo(policy, s5pv210_freq_table);
 
     policy->user_policy.min = s5pv210_freq_table[index_min].frequency;
     policy->user_policy.max = s5pv210_freq_table[index_max].frequency;  
 
+    s5pv210_build_transitions();
+
     pllbus_changing = true;
 
     mutex_unlock(&set_freq_lock);
 
+    cpufreq_cpu_put(policy);
+
 #ifdef CONFIG_CPU_FREQ_STAT
     cpufreq_stats_reset();
 #endif
 
-    return;
+    return 0;
+}
+EXPORT_SYMBOL(liveoc_update_levels);
+
+int liveoc_update(unsigned int oc_value)
+{
+    int i;
+
+    unsigned int values[NUM_LEVELS];
+
+    for (i = 0; i < NUM_LEVELS; i++)
+	values[i] = oc_value;
+
+    return liveoc_update_levels(values);
 }
 EXPORT_SYMBOL(liveoc_update);
 
+/*
+ * Fill in oc value, target and read back frequency of every level,
+ * achieved is 0 for levels not visited since the last update.
+ */
+int liveoc_get_levels(unsigned int * values, unsigned long * target, unsigned long * achieved)
+{
+    int i;
+
+    mutex_lock(&set_freq_lock);
+
+    for (i = 0; i < NUM_LEVELS; i++)
+	{
+	    values[i] = oc_values[i];
+	    target[i] = s5pv210_freq_table[i].frequency;
+	    achieved[i] = achieved_freq[i];
+	}
+
+    mutex_unlock(&set_freq_lock);
+
+    return NUM_LEVELS;
+}
+EXPORT_SYMBOL(liveoc_get_levels);
+
 unsigned long get_gpuminfreq(void)
 {
     return s5pv210_freq_table[L5].frequency;
@@ -678,9 +940,37 @@ EXPORT_SYMBOL(get_gpuminfreq);
 #ifdef CONFIG_CUSTOM_VOLTAGE
 static const int num_freqs = sizeof(dvs_conf) / sizeof(struct s5pv210_dvs_conf);
 
-void customvoltage_updatearmvolt(unsigned long * arm_voltages)
+/*
+ * Program the voltages of the current level right away instead of
+ * waiting for the next transition. Called with set_freq_lock held.
+ * Returns 0 once the current level runs at its configured voltages.
+ */
+static int customvoltage_apply(void)
 {
-    int i;
+    int index, ret;
+
+    if (no_cpufreq_access)
+	return -EBUSY;
+
+    if (IS_ERR_OR_NULL(arm_regulator) || IS_ERR_OR_NULL(internal_regulator))
+	return -ENODEV;
+
+    index = s5pv210_find_level(s5pv210_getspeed(0));
+
+    if (index < 0)
+	return -EINVAL;
+
+    ret = regulator_set_voltage(arm_regulator, dvs_conf[index].arm_volt, arm_volt_max);
+
+    if (ret)
+	return ret;
+
+    return regulator_set_voltage(internal_regulator, dvs_conf[index].int_volt, int_volt_max);
+}
+
+int customvoltage_updatearmvolt(unsigned long * arm_voltages)
+{
+    int i, ret;
 
     mutex_lock(&set_freq_lock);
 
@@ -690,9 +980,11 @@ void customvoltage_updatearmvolt(unsigned long * arm_voltages)
 	dvs_conf[i].arm_volt = arm_voltages[i];
     }
 
+    ret = customvoltage_apply();
+
     mutex_unlock(&set_freq_lock);
 
-    return;
+    return ret;
 }
 EXPORT_SYMBOL(customvoltage_updatearmvolt);
 
@@ -708,6 +1000,8 @@ void customvoltage_updateintvolt(unsigned long * int_voltages)
 	dvs_conf[i].int_volt = int_voltages[i];
     }
 
+    customvoltage_apply();
+
     mutex_unlock(&set_freq_lock);
 
     return;
@@ -727,6 +1021,36 @@ void customvoltage_updatemaxvolt(unsigned long * max_voltages)
 }
 EXPORT_SYMBOL(customvoltage_updatemaxvolt);
 
+/*
+ * Lowest and highest ARM voltage the regulator can be set to within its
+ * constraints.
+ */
+int customvoltage_armvolt_limits(unsigned long * min, unsigned long * max)
+{
+    int i, n, uv;
+
+    if (IS_ERR_OR_NULL(arm_regulator))
+	return -ENODEV;
+
+    *min = ULONG_MAX;
+    *max = 0;
+
+    n = regulator_count_voltages(arm_regulator);
+
+    for (i = 0; i < n; i++) {
+	uv = regulator_list_voltage(arm_regulator, i);
+	if (uv <= 0)
+	    continue;
+	if (uv < *min)
+	    *min = uv;
+	if (uv > *max)
+	    *max = uv;
+    }
+
+    return *max ? 0 : -ENODEV;
+}
+EXPORT_SYMBOL(customvoltage_armvolt_limits);
+
 int customvoltage_numfreqs(void)
 {
     return num_freqs;
@@ -810,6 +1134,8 @@ static int __init s5pv210_cpu_init(struct cpufreq_policy *policy)
 	liveoc_init();
 #endif
 
+	s5pv210_build_transitions();
+
 	ret = cpufreq_frequency_table_cpuinfo(policy, s5pv210_freq_table);
 
 	if (!ret)
@@ -879,6 +1205,7 @@ static struct cpufreq_driver s5pv210_driver = {
 	.verify		= s5pv210_verify_speed,
 	.target		= s5pv210_target,
 	.get		= s5pv210_getspeed,
+	.get_voltage	= s5pv210_get_voltage,
 	.init		= s5pv210_cpu_init,
 	.name		= "s5pv210",
 	.attr		= s5pv210_cpufreq_attr,
@@ -16,6 +16,8 @@
 #include <linux/platform_device.h>
 #include <linux/cpuidle.h>
 #include <linux/io.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
 #include <asm/proc-fns.h>
 #include <asm/cacheflush.h>
 
@@ -26,11 +28,21 @@
 #include <plat/pm.h>
 #include <plat/devs.h>
 
+/*
+ * Timestamps taken while going through an idle state, used to split the
+ * time spent into entry overhead, residency and exit overhead.
+ */
+struct s5p_idle_times {
+	u64 start;
+	u64 sleep;
+	u64 wake;
+	u64 end;
+};
+
 #ifdef CONFIG_CPU_DIDLE
 #include <linux/dma-mapping.h>
 #include <linux/deep_idle.h>
 
-#include <plat/regs-otg.h>
 #include <mach/cpuidle.h>
 #include <mach/power-domain.h>
 
@@ -47,90 +59,6 @@ static unsigned long vic_regs[4];
 static unsigned long *regs_save;
 static dma_addr_t phy_regs_save;
 
-#define MAX_CHK_DEV	0xf
-
-/*
- * Specific device list for checking before entering
- * didle mode
- */
-struct check_device_op {
-	void __iomem		*base;
-	struct platform_device	*pdev;
-};
-
-/* Array of checking devices list */
-static struct check_device_op chk_dev_op[] = {
-#if defined(CONFIG_S3C_DEV_HSMMC)
-	{.base = 0, .pdev = &s3c_device_hsmmc0},
-#endif
-#if defined(CONFIG_S3C_DEV_HSMMC1)
-	{.base = 0, .pdev = &s3c_device_hsmmc1},
-#endif
-#if 0
-	{.base = 0, .pdev = &s3c_device_hsmmc2},
-#endif
-#if defined(CONFIG_S3C_DEV_HSMMC3)
-	{.base = 0, .pdev = &s3c_device_hsmmc3},
-#endif
-	{.base = 0, .pdev = NULL},
-};
-
-#define S3C_HSMMC_PRNSTS	(0x24)
-#define S3C_HSMMC_CLKCON	(0x2c)
-#define S3C_HSMMC_CMD_INHIBIT	0x00000001
-#define S3C_HSMMC_DATA_INHIBIT	0x00000002
-#define S3C_HSMMC_CLOCK_CARD_EN	0x0004
-
-static int sdmmc_dev_num;
-/* If SD/MMC interface is working: return = 1 or not 0 */
-static int check_sdmmc_op(unsigned int ch)
-{
-	unsigned int reg1, reg2;
-	void __iomem *base_addr;
-
-	if (unlikely(ch > sdmmc_dev_num)) {
-		printk(KERN_ERR "Invalid ch[%d] for SD/MMC\n", ch);
-		return 0;
-	}
-
-	base_addr = chk_dev_op[ch].base;
-	/* Check CMDINHDAT[1] and CMDINHCMD [0] */
-	reg1 = readl(base_addr + S3C_HSMMC_PRNSTS);
-	/* Check CLKCON [2]: ENSDCLK */
-	reg2 = readl(base_addr + S3C_HSMMC_CLKCON);
-
-	return !!(reg1 & (S3C_HSMMC_CMD_INHIBIT | S3C_HSMMC_DATA_INHIBIT)) ||
-	       (reg2 & (S3C_HSMMC_CLOCK_CARD_EN));
-}
-
-/* Check all sdmmc controller */
-static int loop_sdmmc_check(void)
-{
-	unsigned int iter;
-
-	for (iter = 0; iter < sdmmc_dev_num + 1; iter++) {
-		if (check_sdmmc_op(iter))
-			return 1;
-	}
-	return 0;
-}
-
-/*
- * Check USBOTG is working or not
- * GOTGCTL(0xEC000000)
- * BSesVld (Indicates the Device mode transceiver status)
- * BSesVld =	1b : B-session is valid
- *		0b : B-session is not valid
- */
-static int check_usbotg_op(void)
-{
-	unsigned int val;
-
-	val = __raw_readl(S3C_UDC_OTG_GOTGCTL);
-
-	return val & (B_SESSION_VALID);
-}
-
 /*
  * Check power gating : LCD, CAM, TV, MFC, G3D
  * Check clock gating : DMA, USBHOST, I2C
@@ -253,7 +181,7 @@ static void s5p_gpio_restore_conf(void)
 	return;
 }
 
-static void s5p_enter_didle(bool top_on)
+static void s5p_enter_didle(bool top_on, struct s5p_idle_times *times)
 {
 	unsigned long tmp;
 	unsigned long save_eint_mask;
@@ -352,10 +280,12 @@ static void s5p_enter_didle(bool top_on)
 	 * we resume as it saves its own register state and restore it
 	 * during the resume.
 	 */
+	times->sleep = sched_clock();
 	s5pv210_didle_save(regs_save);
 
 	/* restore the cpu state using the kernel's cpu init code. */
 	cpu_init();
+	times->wake = sched_clock();
 
 skipped_didle:
 	__raw_writel(save_eint_mask, S5P_EINT_WAKEUP_MASK);
@@ -388,9 +318,87 @@ skipped_didle:
 	__raw_writel(vic_regs[2], S5P_VIC2REG(VIC_INT_ENABLE));
 	__raw_writel(vic_regs[3], S5P_VIC3REG(VIC_INT_ENABLE));
 }
+
+/* Deepest state allowed by the cached blockers for this idle period */
+static int s5p_idle_depth;
+
+/*
+ * Blockers whose state is pushed to us by their drivers. These are
+ * evaluated before the governor runs so it only considers states we
+ * are actually able to enter. The first blocker found is accounted as
+ * the reason why a deeper state was refused.
+ */
+static int s5p_idle_cached_depth(void)
+{
+	int veto;
+
+	if (!deepidle_is_enabled())
+		veto = DEEPIDLE_VETO_DISABLED;
+	else if (suspend_ongoing())
+		veto = DEEPIDLE_VETO_SUSPEND;
+	else if (deepidle_is_blocked(DEEPIDLE_VETO_SDMMC))
+		veto = DEEPIDLE_VETO_SDMMC;
+	else if (deepidle_is_blocked(DEEPIDLE_VETO_USBOTG))
+		veto = DEEPIDLE_VETO_USBOTG;
+	else if (bt_is_running())
+		veto = DEEPIDLE_VETO_BT;
+	else if (gps_is_running())
+		veto = DEEPIDLE_VETO_GPS;
+	else if (vibrator_is_running())
+		veto = DEEPIDLE_VETO_VIBRATOR;
+	else
+		return DEEPIDLE_STATE_TOP_OFF;
+
+	report_idle_veto(veto);
+
+	if (veto >= DEEPIDLE_VETO_BT)
+		return DEEPIDLE_STATE_TOP_ON;
+
+	return DEEPIDLE_STATE_IDLE;
+}
+
+/*
+ * Conditions nobody notifies us about. They are only sampled once the
+ * governor has actually chosen a didle state.
+ */
+static bool s5p_idle_didle_vetoed(void)
+{
+	int veto;
+
+	if (check_power_clock_gating())
+		veto = DEEPIDLE_VETO_POWER_CLOCK_GATING;
+	else if (check_rtcint())
+		veto = DEEPIDLE_VETO_RTCINT;
+#ifdef CONFIG_S5P_INTERNAL_DMA
+	else if (check_idmapos())
+		veto = DEEPIDLE_VETO_IDMAPOS;
+#endif
+	else
+		return false;
+
+	report_idle_veto(veto);
+
+	return true;
+}
+
+static int s5p_idle_prepare(struct cpuidle_device *dev)
+{
+	int i;
+
+	s5p_idle_depth = s5p_idle_cached_depth();
+
+	for (i = DEEPIDLE_STATE_TOP_ON; i < dev->state_count; i++) {
+		if (i > s5p_idle_depth)
+			dev->states[i].flags |= CPUIDLE_FLAG_IGNORE;
+		else
+			dev->states[i].flags &= ~CPUIDLE_FLAG_IGNORE;
+	}
+
+	return 0;
+}
 #endif
 
-static void s5p_enter_idle(void)
+static void s5p_enter_idle(struct s5p_idle_times *times)
 {
 	unsigned long tmp;
 
@@ -403,48 +411,63 @@ static void s5p_enter_idle(void)
 	tmp &= S5P_CFG_WFI_CLEAN;
 	__raw_writel(tmp, S5P_PWR_CFG);
 
+	times->sleep = sched_clock();
 	cpu_do_idle();
+	times->wake = sched_clock();
 }
 
 /* Actual code that puts the SoC in different idle states */
 static int s5p_enter_idle_state(struct cpuidle_device *dev,
 				struct cpuidle_state *state)
 {
-	struct timeval before, after;
-	int idle_time;
+	struct s5p_idle_times times;
 #ifdef CONFIG_CPU_DIDLE
-	int idle_state = 0;
+	int idle_state = state - dev->states;
 #endif
 
 	local_irq_disable();
-	do_gettimeofday(&before);
+	times.start = sched_clock();
+	times.sleep = times.wake = times.start;
 
 #ifdef CONFIG_CPU_DIDLE
-#ifdef CONFIG_S5P_INTERNAL_DMA
-	if (!deepidle_is_enabled() || check_power_clock_gating() || suspend_ongoing() || loop_sdmmc_check() || check_usbotg_op() || check_rtcint() || check_idmapos()) {
-#else
-	if (!deepidle_is_enabled() || check_power_clock_gating() || suspend_ongoing() || loop_sdmmc_check() || check_usbotg_op() || check_rtcint()) {
-#endif
-	    s5p_enter_idle();
-	} else if (bt_is_running() || gps_is_running() || vibrator_is_running()) {
-	    s5p_enter_didle(true);
-	    idle_state = 1;
-	} else {
-	    s5p_enter_didle(false);
-	    idle_state = 2;
+	/*
+	 * Governors that do not honour CPUIDLE_FLAG_IGNORE may still pick a
+	 * state the blockers refused, and a shallower choice than allowed
+	 * means the predicted idle period was too short for didle.
+	 */
+	if (idle_state > s5p_idle_depth)
+		idle_state = s5p_idle_depth;
+	else if (idle_state < s5p_idle_depth)
+		report_idle_veto(DEEPIDLE_VETO_PREDICTION);
+
+	if (idle_state != DEEPIDLE_STATE_IDLE && s5p_idle_didle_vetoed())
+		idle_state = DEEPIDLE_STATE_IDLE;
+
+	dev->last_state = &dev->states[idle_state];
+
+	switch (idle_state) {
+	case DEEPIDLE_STATE_TOP_OFF:
+		s5p_enter_didle(false, &times);
+		break;
+	case DEEPIDLE_STATE_TOP_ON:
+		s5p_enter_didle(true, &times);
+		break;
+	default:
+		s5p_enter_idle(&times);
+		break;
 	}
-#else   
-	s5p_enter_idle();
+#else
+	s5p_enter_idle(&times);
 #endif
 
-	do_gettimeofday(&after);
-	local_irq_enable();
-	idle_time = (after.tv_sec - before.tv_sec) * USEC_PER_SEC +
-	    (after.tv_usec - before.tv_usec);
+	times.end = sched_clock();
 #ifdef CONFIG_CPU_DIDLE
-	report_idle_time(idle_state, idle_time);
+	report_idle_time(idle_state, times.sleep - times.start,
+			 times.wake - times.sleep, times.end - times.wake);
 #endif
-	return idle_time;
+	local_irq_enable();
+
+	return (int)div_u64(times.end - times.start, NSEC_PER_USEC);
 }
 
 static DEFINE_PER_CPU(struct cpuidle_device, s5p_cpuidle_device);
@@ -454,16 +477,54 @@ static struct cpuidle_driver s5p_idle_driver = {
 	.owner =        THIS_MODULE,
 };
 
+#ifdef CONFIG_CPU_DIDLE
+/*
+ * Exit latencies and target residencies of the didle states, based on
+ * the entry/exit overhead reported in debugfs deepidle/stats.
+ */
+static struct s5p_idle_state_data {
+	const char *name;
+	const char *desc;
+	unsigned int exit_latency;
+	unsigned int target_residency;
+} s5p_idle_states[DEEPIDLE_NUM_STATES] = {
+	[DEEPIDLE_STATE_IDLE] = {
+		.name = "IDLE",
+		.desc = "ARM clock gating - WFI",
+		.exit_latency = 1,
+		.target_residency = 1,
+	},
+	[DEEPIDLE_STATE_TOP_ON] = {
+		.name = "DIDLE TOP-ON",
+		.desc = "ARM power gating - TOP on",
+		.exit_latency = 300,
+		.target_residency = 1500,
+	},
+	[DEEPIDLE_STATE_TOP_OFF] = {
+		.name = "DIDLE TOP-OFF",
+		.desc = "ARM power gating - TOP retention",
+		.exit_latency = 500,
+		.target_residency = 3000,
+	},
+};
+#endif
+
 /* Initialize CPU idle by registering the idle states */
 static int s5p_init_cpuidle(void)
 {
 	struct cpuidle_device *device;
 	int ret;
+#ifdef CONFIG_CPU_DIDLE
+	int i;
+#endif
 
 #ifdef CONFIG_CPU_DIDLE
-	struct resource *res;
-	struct platform_device *pdev;
-	int i = 0;
+	regs_save = dma_alloc_coherent(NULL, 4096, &phy_regs_save, GFP_KERNEL);
+	if (regs_save == NULL) {
+		printk(KERN_ERR "%s: DMA alloc error\n", __func__);
+		return -ENOMEM;
+	}
+	printk(KERN_INFO "cpuidle: phy_regs_save:0x%x\n", phy_regs_save);
 #endif
 
 	ret = cpuidle_register_driver(&s5p_idle_driver);
@@ -473,6 +534,23 @@ static int s5p_init_cpuidle(void)
 	}
 
 	device = &per_cpu(s5p_cpuidle_device, smp_processor_id());
+
+#ifdef CONFIG_CPU_DIDLE
+	device->state_count = DEEPIDLE_NUM_STATES;
+
+	for (i = 0; i < DEEPIDLE_NUM_STATES; i++) {
+		device->states[i].enter = s5p_enter_idle_state;
+		device->states[i].exit_latency = s5p_idle_states[i].exit_latency;
+		device->states[i].target_residency =
+			s5p_idle_states[i].target_residency;
+		device->states[i].flags = CPUIDLE_FLAG_TIME_VALID;
+		strcpy(device->states[i].name, s5p_idle_states[i].name);
+		strcpy(device->states[i].desc, s5p_idle_states[i].desc);
+	}
+
+	device->safe_state = &device->states[DEEPIDLE_STATE_IDLE];
+	device->prepare = s5p_idle_prepare;
+#else
 	device->state_count = 1;
 
 	/* Wait for interrupt state */
@@ -480,10 +558,6 @@ static int s5p_init_cpuidle(void)
 	device->states[0].exit_latency = 1;	/* uS */
 	device->states[0].target_residency = 10000;
 	device->states[0].flags = CPUIDLE_FLAG_TIME_VALID;
-#ifdef CONFIG_CPU_DIDLE
-	strcpy(device->states[0].name, "(DEEP)IDLE");
-	strcpy(device->states[0].desc, "ARM clock/power gating - WFI");
-#else
 	strcpy(device->states[0].name, "IDLE");
 	strcpy(device->states[0].desc, "ARM clock gating - WFI");
 #endif
@@ -494,57 +568,14 @@ static int s5p_init_cpuidle(void)
 		goto err_register_driver;
 	}
 
-#ifdef CONFIG_CPU_DIDLE
-	regs_save = dma_alloc_coherent(NULL, 4096, &phy_regs_save, GFP_KERNEL);
-	if (regs_save == NULL) {
-		printk(KERN_ERR "%s: DMA alloc error\n", __func__);
-		ret = -ENOMEM;
-		goto err_register_device;
-	}
-	printk(KERN_INFO "cpuidle: phy_regs_save:0x%x\n", phy_regs_save);
-
-	/* Allocate memory region to access IP's directly */
-	for (i = 0 ; i < MAX_CHK_DEV ; i++) {
-
-		pdev = chk_dev_op[i].pdev;
-
-		if (pdev == NULL) {
-			sdmmc_dev_num = i - 1;
-			break;
-		}
-
-		res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
-		if (!res) {
-			printk(KERN_ERR "%s: failed to get io memory region\n",
-					__func__);
-			ret = -EINVAL;
-			goto err_alloc;
-		}
-		chk_dev_op[i].base = ioremap_nocache(res->start, 4096);
-
-		if (!chk_dev_op[i].base) {
-			printk(KERN_ERR "failed to remap io region\n");
-			ret = -EINVAL;
-			goto err_resource;
-		}
-	}
-#endif
-
 	return 0;
 
-#ifdef CONFIG_CPU_DIDLE
-err_alloc:
-	while (--i >= 0) {
-		iounmap(chk_dev_op[i].base);
-	}
-err_resource:
-	dma_free_coherent(NULL, 4096, regs_save, phy_regs_save);
-err_register_device:
-	cpuidle_unregister_device(device);
-#endif
 err_register_driver:
 	cpuidle_unregister_driver(&s5p_idle_driver);
 err:
+#ifdef CONFIG_CPU_DIDLE
+	dma_free_coherent(NULL, 4096, regs_save, phy_regs_save);
+#endif
 	return ret;
 }
 
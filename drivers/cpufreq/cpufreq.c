@@ -1489,6 +1489,16 @@ int __cpufreq_driver_getavg(struct cpufreq_policy *policy, unsigned int cpu)
 }
 EXPORT_SYMBOL_GPL(__cpufreq_driver_getavg);
 
+int cpufreq_driver_get_voltage(unsigned int cpu, unsigned int freq,
+			       unsigned long *uv)
+{
+	if (!cpufreq_driver || !cpufreq_driver->get_voltage)
+		return 0;
+
+	return cpufreq_driver->get_voltage(cpu, freq, uv);
+}
+EXPORT_SYMBOL_GPL(cpufreq_driver_get_voltage);
+
 /*
  * when "event" is CPUFREQ_GOV_LIMITS
  */
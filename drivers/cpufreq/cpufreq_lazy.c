@@ -23,11 +23,19 @@
 #include <linux/tick.h>
 #include <linux/ktime.h>
 #include <linux/sched.h>
+#include <linux/input.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 
 #ifdef CONFIG_HAS_EARLYSUSPEND
 #include <linux/earlysuspend.h>
 #endif
 
+#include <trace/events/power.h>
+
+#include "cpufreq_lazy.h"
+
 /*
  * dbs is used in this file as a shortform for demandbased switching
  * It helps to keep variable names smaller, simpler
@@ -41,6 +49,12 @@
 #define MICRO_FREQUENCY_MIN_SAMPLE_RATE		(10000)
 #define MIN_FREQUENCY_UP_THRESHOLD		(11)
 #define MAX_FREQUENCY_UP_THRESHOLD		(100)
+#define DEF_TOUCH_BOOST_FREQ			(800000)
+#define DEF_TOUCH_BOOST_DURATION		(150000)
+#define DEF_KEY_BOOST_FREQ			(800000)
+#define DEF_KEY_BOOST_DURATION			(100000)
+#define DEF_BACKOFF_SAMPLES			(10)
+#define DEF_BACKOFF_MAX				(8)
 
 /*
  * The polling frequency of this governor depends on the capability of
@@ -96,6 +110,19 @@ struct cpu_dbs_info_s {
      * when user is changing the governor or limits.
      */
     struct mutex timer_mutex;
+    unsigned int enable:1;
+    /*
+     * idle_lock serializes lazy_idle_notifier() with starting and
+     * stopping the sampling work, which it may requeue while 'sampling'.
+     */
+    spinlock_t idle_lock;
+    bool sampling;
+    /* sampling backoff, see lazy_sample_delay() */
+    unsigned int idle_samples;
+    unsigned int backoff;
+    unsigned long last_sample;
+    unsigned long idle_exit;
+    unsigned long skipped;
 };
 static DEFINE_PER_CPU(struct cpu_dbs_info_s, od_cpu_dbs_info);
 
@@ -114,6 +141,12 @@ static struct dbs_tuners {
     unsigned int powersave_bias;
     unsigned int io_is_busy;
     unsigned int min_timeinstate;
+    unsigned int touch_boost_freq;
+    unsigned int touch_boost_duration;
+    unsigned int key_boost_freq;
+    unsigned int key_boost_duration;
+    unsigned int backoff_samples;
+    unsigned int backoff_max;
 #ifdef CONFIG_HAS_EARLYSUSPEND
     bool screenoff_maxfreq;
 #endif
@@ -122,6 +155,12 @@ static struct dbs_tuners {
     .down_differential = DEF_FREQUENCY_DOWN_DIFFERENTIAL,
     .ignore_nice = 0,
     .powersave_bias = 0,
+    .touch_boost_freq = DEF_TOUCH_BOOST_FREQ,
+    .touch_boost_duration = DEF_TOUCH_BOOST_DURATION,
+    .key_boost_freq = DEF_KEY_BOOST_FREQ,
+    .key_boost_duration = DEF_KEY_BOOST_DURATION,
+    .backoff_samples = DEF_BACKOFF_SAMPLES,
+    .backoff_max = DEF_BACKOFF_MAX,
 #ifdef CONFIG_HAS_EARLYSUSPEND
     .screenoff_maxfreq = false,
 #endif
@@ -151,6 +190,195 @@ static struct early_suspend lazy_suspend = {
 };
 #endif
 
+/*
+ * Input boost: a touch or key event raises the frequency to the boost
+ * frequency right away instead of waiting for the next sample, and the
+ * governor does not go below it until the boost expires. Further events
+ * during a boost only extend it.
+ */
+enum {BOOST_TOUCH, BOOST_KEY, BOOST_TYPES};
+
+static struct lazy_boost {
+    spinlock_t lock;
+    struct work_struct work;
+    unsigned int freq;
+    unsigned long until;
+    ktime_t start;
+    /* statistics */
+    unsigned long count[BOOST_TYPES];
+    unsigned long raised;
+    unsigned long clamped;
+    u64 latency_ns;
+} boost;
+
+/*
+ * Raise freq to the boost frequency while a boost is active and count
+ * it. Returns the frequency the governor may go down to.
+ */
+static unsigned int boost_clamp(unsigned int freq)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&boost.lock, flags);
+
+    if (time_before(jiffies, boost.until) && freq < boost.freq) {
+	freq = boost.freq;
+	boost.clamped++;
+    }
+
+    spin_unlock_irqrestore(&boost.lock, flags);
+
+    return freq;
+}
+
+static void lazy_boost_work(struct work_struct *work)
+{
+    unsigned int j, freq;
+    unsigned long flags;
+    ktime_t start;
+    bool raised = false;
+
+    spin_lock_irqsave(&boost.lock, flags);
+    freq = boost.freq;
+    start = boost.start;
+    spin_unlock_irqrestore(&boost.lock, flags);
+
+    mutex_lock(&dbs_mutex);
+
+    for_each_online_cpu(j) {
+	struct cpu_dbs_info_s *dbs_info = &per_cpu(od_cpu_dbs_info, j);
+	struct cpufreq_policy *policy;
+
+	/* only the CPU owning the policy runs the timer */
+	if (!dbs_info->enable || dbs_info->cpu != j)
+	    continue;
+
+	mutex_lock(&dbs_info->timer_mutex);
+	policy = dbs_info->cur_policy;
+	if (policy->cur < freq && policy->cur < policy->max) {
+	    __cpufreq_driver_target(policy, freq, CPUFREQ_RELATION_L);
+	    raised = true;
+	}
+	mutex_unlock(&dbs_info->timer_mutex);
+    }
+
+    mutex_unlock(&dbs_mutex);
+
+    if (raised) {
+	spin_lock_irqsave(&boost.lock, flags);
+	boost.raised++;
+	boost.latency_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	spin_unlock_irqrestore(&boost.lock, flags);
+    }
+}
+
+static void lazy_input_event(struct input_handle *handle, unsigned int type,
+			     unsigned int code, int value)
+{
+    unsigned int kind, freq, duration;
+    unsigned long flags, until;
+    bool active, queue = false;
+
+    if (type == EV_ABS || (type == EV_KEY && code == BTN_TOUCH)) {
+	kind = BOOST_TOUCH;
+	freq = dbs_tuners_ins.touch_boost_freq;
+	duration = dbs_tuners_ins.touch_boost_duration;
+    } else if (type == EV_KEY && value == 1) {
+	kind = BOOST_KEY;
+	freq = dbs_tuners_ins.key_boost_freq;
+	duration = dbs_tuners_ins.key_boost_duration;
+    } else {
+	return;
+    }
+
+    if (!freq || !duration)
+	return;
+
+    until = jiffies + usecs_to_jiffies(duration);
+
+    spin_lock_irqsave(&boost.lock, flags);
+
+    active = time_before(jiffies, boost.until);
+
+    if (!active || freq > boost.freq) {
+	boost.freq = active ? max(boost.freq, freq) : freq;
+	boost.start = ktime_get();
+	boost.count[kind]++;
+	queue = true;
+    }
+
+    if (!active || time_after(until, boost.until))
+	boost.until = until;
+
+    spin_unlock_irqrestore(&boost.lock, flags);
+
+    if (queue)
+	schedule_work(&boost.work);
+}
+
+static int lazy_input_connect(struct input_handler *handler,
+			      struct input_dev *dev,
+			      const struct input_device_id *id)
+{
+    struct input_handle *handle;
+    int error;
+
+    handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+    if (!handle)
+	return -ENOMEM;
+
+    handle->dev = dev;
+    handle->handler = handler;
+    handle->name = "cpufreq_lazy";
+
+    error = input_register_handle(handle);
+    if (error)
+	goto err_free;
+
+    error = input_open_device(handle);
+    if (error)
+	goto err_unregister;
+
+    return 0;
+
+ err_unregister:
+    input_unregister_handle(handle);
+ err_free:
+    kfree(handle);
+    return error;
+}
+
+static void lazy_input_disconnect(struct input_handle *handle)
+{
+    input_close_device(handle);
+    input_unregister_handle(handle);
+    kfree(handle);
+}
+
+static const struct input_device_id lazy_input_ids[] = {
+    /* multi-touch touchscreens */
+    {
+	.flags = INPUT_DEVICE_ID_MATCH_EVBIT | INPUT_DEVICE_ID_MATCH_ABSBIT,
+	.evbit = { BIT_MASK(EV_ABS) },
+	.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+		    BIT_MASK(ABS_MT_POSITION_X) | BIT_MASK(ABS_MT_POSITION_Y) },
+    },
+    /* keys and buttons */
+    {
+	.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+	.evbit = { BIT_MASK(EV_KEY) },
+    },
+    { },
+};
+
+static struct input_handler lazy_input_handler = {
+    .event      = lazy_input_event,
+    .connect    = lazy_input_connect,
+    .disconnect = lazy_input_disconnect,
+    .name       = "cpufreq_lazy",
+    .id_table   = lazy_input_ids,
+};
+
 static inline cputime64_t get_cpu_idle_time_jiffy(unsigned int cpu,
 						  cputime64_t *wall)
 {
@@ -287,6 +515,12 @@ show_one(up_threshold, up_threshold);
 show_one(ignore_nice_load, ignore_nice);
 show_one(powersave_bias, powersave_bias);
 show_one(min_timeinstate, min_timeinstate);
+show_one(touch_boost_freq, touch_boost_freq);
+show_one(touch_boost_duration, touch_boost_duration);
+show_one(key_boost_freq, key_boost_freq);
+show_one(key_boost_duration, key_boost_duration);
+show_one(backoff_samples, backoff_samples);
+show_one(backoff_max, backoff_max);
 #ifdef CONFIG_HAS_EARLYSUSPEND
 show_one(screenoff_maxfreq, screenoff_maxfreq);
 #endif
@@ -396,6 +630,76 @@ static ssize_t store_min_timeinstate(struct kobject *a, struct attribute *b,
     return count;
 }
 
+#define store_boost(file_name)					\
+    static ssize_t store_##file_name				\
+    (struct kobject *a, struct attribute *b,			\
+     const char *buf, size_t count)				\
+    {								\
+	unsigned int input;					\
+	int ret;						\
+	ret = sscanf(buf, "%u", &input);			\
+	if (ret != 1)						\
+	    return -EINVAL;					\
+	dbs_tuners_ins.file_name = input;			\
+	return count;						\
+    }
+store_boost(touch_boost_freq);
+store_boost(touch_boost_duration);
+store_boost(key_boost_freq);
+store_boost(key_boost_duration);
+store_boost(backoff_samples);
+
+static ssize_t store_backoff_max(struct kobject *a, struct attribute *b,
+				 const char *buf, size_t count)
+{
+    unsigned int input;
+    int ret;
+    ret = sscanf(buf, "%u", &input);
+    if (ret != 1 || input < 1)
+	return -EINVAL;
+    dbs_tuners_ins.backoff_max = input;
+    return count;
+}
+
+static ssize_t show_skipped_samples(struct kobject *kobj,
+				    struct attribute *attr, char *buf)
+{
+    unsigned long skipped = 0;
+    unsigned int j;
+
+    for_each_possible_cpu(j)
+	skipped += per_cpu(od_cpu_dbs_info, j).skipped;
+
+    return sprintf(buf, "%lu\n", skipped);
+}
+
+define_one_global_ro(skipped_samples);
+
+static ssize_t show_boost_stats(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+    unsigned long flags, raised;
+    u64 latency;
+    ssize_t len;
+
+    spin_lock_irqsave(&boost.lock, flags);
+    raised = boost.raised;
+    latency = boost.latency_ns;
+    len = sprintf(buf, "touch %lu\nkey %lu\nraised %lu\nclamped %lu\n",
+		  boost.count[BOOST_TOUCH], boost.count[BOOST_KEY],
+		  raised, boost.clamped);
+    spin_unlock_irqrestore(&boost.lock, flags);
+
+    if (raised)
+	do_div(latency, raised * NSEC_PER_USEC);
+
+    len += sprintf(buf + len, "latency_avg_us %llu\n", latency);
+
+    return len;
+}
+
+define_one_global_ro(boost_stats);
+
 #ifdef CONFIG_HAS_EARLYSUSPEND
 static ssize_t store_screenoff_maxfreq(struct kobject *a, struct attribute *b,
 				  const char *buf, size_t count)
@@ -416,6 +720,12 @@ define_one_global_rw(up_threshold);
 define_one_global_rw(ignore_nice_load);
 define_one_global_rw(powersave_bias);
 define_one_global_rw(min_timeinstate);
+define_one_global_rw(touch_boost_freq);
+define_one_global_rw(touch_boost_duration);
+define_one_global_rw(key_boost_freq);
+define_one_global_rw(key_boost_duration);
+define_one_global_rw(backoff_samples);
+define_one_global_rw(backoff_max);
 #ifdef CONFIG_HAS_EARLYSUSPEND
 define_one_global_rw(screenoff_maxfreq);
 #endif
@@ -428,6 +738,14 @@ static struct attribute *dbs_attributes[] = {
     &powersave_bias.attr,
     &io_is_busy.attr,
     &min_timeinstate.attr,
+    &touch_boost_freq.attr,
+    &touch_boost_duration.attr,
+    &key_boost_freq.attr,
+    &key_boost_duration.attr,
+    &boost_stats.attr,
+    &backoff_samples.attr,
+    &backoff_max.attr,
+    &skipped_samples.attr,
 #ifdef CONFIG_HAS_EARLYSUSPEND
     &screenoff_maxfreq.attr,
 #endif
@@ -443,10 +761,11 @@ static struct attribute_group dbs_attr_group = {
 
 static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 {
-    unsigned int max_load_freq;
+    unsigned int max_load_freq, freq_next;
 
     struct cpufreq_policy *policy;
     unsigned int j;
+    unsigned int screen_off = 0;
 
     this_dbs_info->freq_lo = 0;
     policy = this_dbs_info->cur_policy;
@@ -454,7 +773,11 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
     current_sampling_rate = dbs_tuners_ins.sampling_rate;
 
 #ifdef CONFIG_HAS_EARLYSUSPEND
+    screen_off = suspended;
+
     if (suspended && dbs_tuners_ins.screenoff_maxfreq) {
+	this_dbs_info->idle_samples = 0;
+
 	/* if we are already at full speed then break out early */
 	if (!dbs_tuners_ins.powersave_bias) {
 	    if (policy->cur == policy->max)
@@ -473,18 +796,6 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
     }
 #endif
 
-    /*
-     * Every sampling_rate, we check, if current idle time is less
-     * than 20% (default), then we try to increase frequency
-     * Every sampling_rate, we look for a the lowest
-     * frequency which can sustain the load while keeping idle time over
-     * 30%. If such a frequency exist, we try to decrease to this frequency.
-     *
-     * Any frequency increase takes it to the maximum frequency.
-     * Frequency reduction happens at minimum steps of
-     * 5% (default) of current frequency
-     */
-
     /* Get Absolute Load - in terms of freq */
     max_load_freq = 0;
 
@@ -492,8 +803,8 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	struct cpu_dbs_info_s *j_dbs_info;
 	cputime64_t cur_wall_time, cur_idle_time, cur_iowait_time;
 	unsigned int idle_time, wall_time, iowait_time;
-	unsigned int load, load_freq;
-	int freq_avg;
+	unsigned int load_freq;
+	int load, freq_avg;
 
 	j_dbs_info = &per_cpu(od_cpu_dbs_info, j);
 
@@ -529,21 +840,15 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	    idle_time += jiffies_to_usecs(cur_nice_jiffies);
 	}
 
-	/*
-	 * For the purpose of lazy, waiting for disk IO is an
-	 * indication that you're performance critical, and not that
-	 * the system is actually idle. So subtract the iowait time
-	 * from the cpu idle time.
-	 */
+	trace_cpufreq_load_sample(j, wall_time, idle_time, iowait_time,
+				  policy->cur, screen_off);
 
-	if (dbs_tuners_ins.io_is_busy && idle_time >= iowait_time)
-	    idle_time -= iowait_time;
+	load = lazy_sample_load(wall_time, idle_time, iowait_time,
+				dbs_tuners_ins.io_is_busy);
 
-	if (unlikely(!wall_time || wall_time < idle_time))
+	if (unlikely(load < 0))
 	    continue;
 
-	load = 100 * (wall_time - idle_time) / wall_time;
-
 	freq_avg = __cpufreq_driver_getavg(policy, j);
 	if (freq_avg <= 0)
 	    freq_avg = policy->cur;
@@ -553,45 +858,41 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	    max_load_freq = load_freq;
     }
 
-    /* Check for frequency increase */
-    if (max_load_freq > dbs_tuners_ins.up_threshold * policy->cur) {
+    /*
+     * Count the samples in a row which would have lowered the frequency
+     * if we were not at the minimum already.
+     */
+    if (policy->cur == policy->min &&
+	max_load_freq < (dbs_tuners_ins.up_threshold -
+			 dbs_tuners_ins.down_differential) * policy->cur)
+	this_dbs_info->idle_samples++;
+    else
+	this_dbs_info->idle_samples = 0;
+
+    switch (lazy_decide(max_load_freq, policy->cur, policy->min, policy->max,
+			dbs_tuners_ins.up_threshold,
+			dbs_tuners_ins.down_differential, &freq_next)) {
+    case LAZY_RAISE:
 	/* if we are already at full speed then break out early */
 	if (!dbs_tuners_ins.powersave_bias) {
 	    if (policy->cur == policy->max)
-		return;
+		break;
 
-	    __cpufreq_driver_target(policy, policy->max,
+	    __cpufreq_driver_target(policy, freq_next,
 				    CPUFREQ_RELATION_H);
 	} else {
-	    int freq = powersave_bias_target(policy, policy->max,
+	    int freq = powersave_bias_target(policy, freq_next,
 					     CPUFREQ_RELATION_H);
 	    __cpufreq_driver_target(policy, freq,
 				    CPUFREQ_RELATION_L);
 	}
 	current_sampling_rate = dbs_tuners_ins.min_timeinstate;
-	return;
-    }
-
-    /* Check for frequency decrease */
-    /* if we cannot reduce the frequency anymore, break out early */
-    if (policy->cur == policy->min)
-	return;
-
-    /*
-     * The optimal frequency is the frequency that is the lowest that
-     * can support the current CPU usage without triggering the up
-     * policy. To be safe, we focus 10 points under the threshold.
-     */
-    if (max_load_freq <
-	(dbs_tuners_ins.up_threshold - dbs_tuners_ins.down_differential) *
-	policy->cur) {
-	unsigned int freq_next;
-	freq_next = max_load_freq /
-	    (dbs_tuners_ins.up_threshold -
-	     dbs_tuners_ins.down_differential);
-
-	if (freq_next < policy->min)
-	    freq_next = policy->min;
+	break;
+    case LAZY_LOWER:
+	/* do not undercut an active input boost */
+	freq_next = boost_clamp(freq_next);
+	if (freq_next >= policy->cur)
+	    break;
 
 	if (!dbs_tuners_ins.powersave_bias) {
 	    __cpufreq_driver_target(policy, freq_next,
@@ -603,9 +904,71 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 				    CPUFREQ_RELATION_L);
 	}
 	current_sampling_rate = dbs_tuners_ins.min_timeinstate;
+	break;
+    case LAZY_KEEP:
+	break;
+    }
+}
+
+/*
+ * Once the CPU has been idle at the minimum frequency for
+ * backoff_samples samples the sampling interval is doubled with every
+ * sample, up to backoff_max times sampling_rate. lazy_idle_notifier()
+ * resumes normal sampling as soon as a tick hits a busy CPU.
+ */
+static int lazy_sample_delay(struct cpu_dbs_info_s *dbs_info)
+{
+    int delay = usecs_to_jiffies(current_sampling_rate);
+
+    if (!dbs_tuners_ins.backoff_samples ||
+	dbs_info->idle_samples < dbs_tuners_ins.backoff_samples) {
+	dbs_info->backoff = 1;
+	return delay;
     }
+
+    if (dbs_info->backoff * 2 <= dbs_tuners_ins.backoff_max)
+	dbs_info->backoff *= 2;
+
+    return delay * dbs_info->backoff;
 }
 
+static int lazy_idle_notifier(struct notifier_block *nb,
+			      unsigned long val, void *data)
+{
+    struct cpu_dbs_info_s *dbs_info =
+	&per_cpu(od_cpu_dbs_info, smp_processor_id());
+    unsigned long flags;
+
+    /* IDLE_END may be called from interrupts */
+    spin_lock_irqsave(&dbs_info->idle_lock, flags);
+
+    if (!dbs_info->sampling)
+	goto out;
+
+    switch (val) {
+    case IDLE_END:
+	dbs_info->idle_exit = jiffies;
+	break;
+    case IDLE_START:
+	/* did a tick pass while we were busy? */
+	if (dbs_info->backoff > 1 && dbs_info->idle_exit != jiffies) {
+	    dbs_info->idle_samples = 0;
+	    if (cancel_delayed_work(&dbs_info->work))
+		schedule_delayed_work_on(dbs_info->cpu, &dbs_info->work, 0);
+	}
+	break;
+    }
+
+ out:
+    spin_unlock_irqrestore(&dbs_info->idle_lock, flags);
+
+    return 0;
+}
+
+static struct notifier_block lazy_idle_nb = {
+    .notifier_call = lazy_idle_notifier,
+};
+
 static void do_dbs_timer(struct work_struct *work)
 {
     struct cpu_dbs_info_s *dbs_info =
@@ -616,6 +979,16 @@ static void do_dbs_timer(struct work_struct *work)
 
     mutex_lock(&dbs_info->timer_mutex);
 
+    /* Account for the samples we did not take while backed off */
+    if (dbs_info->backoff > 1) {
+	unsigned long base = usecs_to_jiffies(dbs_tuners_ins.sampling_rate);
+	unsigned long elapsed = jiffies - dbs_info->last_sample;
+
+	if (elapsed > base)
+	    dbs_info->skipped += elapsed / base - 1;
+    }
+    dbs_info->last_sample = jiffies;
+
     /* Common NORMAL_SAMPLE setup */
     dbs_info->sample_type = DBS_NORMAL_SAMPLE;
     if (!dbs_tuners_ins.powersave_bias ||
@@ -626,7 +999,7 @@ static void do_dbs_timer(struct work_struct *work)
 	    dbs_info->sample_type = DBS_SUB_SAMPLE;
 	    delay = dbs_info->freq_hi_jiffies;
 	} else {
-	    delay = usecs_to_jiffies(current_sampling_rate);
+	    delay = lazy_sample_delay(dbs_info);
 	    if (num_online_cpus() > 1)
 		delay -= jiffies % delay;
 	}
@@ -648,12 +1021,24 @@ static inline void dbs_timer_init(struct cpu_dbs_info_s *dbs_info)
     delay -= jiffies % delay;
 
     dbs_info->sample_type = DBS_NORMAL_SAMPLE;
+    dbs_info->idle_samples = 0;
+    dbs_info->backoff = 1;
+    dbs_info->last_sample = jiffies;
     INIT_DELAYED_WORK_DEFERRABLE(&dbs_info->work, do_dbs_timer);
     schedule_delayed_work_on(dbs_info->cpu, &dbs_info->work, delay);
+
+    spin_lock_irq(&dbs_info->idle_lock);
+    dbs_info->sampling = true;
+    spin_unlock_irq(&dbs_info->idle_lock);
 }
 
 static inline void dbs_timer_exit(struct cpu_dbs_info_s *dbs_info)
 {
+    /* once this is clear the idle notifier cannot requeue the work */
+    spin_lock_irq(&dbs_info->idle_lock);
+    dbs_info->sampling = false;
+    spin_unlock_irq(&dbs_info->idle_lock);
+
     cancel_delayed_work_sync(&dbs_info->work);
 }
 
@@ -695,6 +1080,8 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 	if ((!cpu_online(cpu)) || (!policy->cur))
 	    return -EINVAL;
 
+	mutex_init(&this_dbs_info->timer_mutex);
+
 	mutex_lock(&dbs_mutex);
 
 	dbs_enable++;
@@ -711,6 +1098,7 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 	    }
 	}
 	this_dbs_info->cpu = cpu;
+	this_dbs_info->enable = 1;
 	lazy_powersave_bias_init_cpu(cpu);
 	/*
 	 * Start the timerschedule work, when this governor
@@ -738,23 +1126,31 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 	    dbs_tuners_ins.min_timeinstate = latency * LATENCY_MULTIPLIER;
 	    dbs_tuners_ins.min_timeinstate = max(dbs_tuners_ins.sampling_rate, dbs_tuners_ins.min_timeinstate);
 	    dbs_tuners_ins.io_is_busy = should_io_be_busy();
+
+	    if (input_register_handler(&lazy_input_handler))
+		pr_warning("cpufreq_lazy: failed to register input boost\n");
 	}
 	mutex_unlock(&dbs_mutex);
 
-	mutex_init(&this_dbs_info->timer_mutex);
 	dbs_timer_init(this_dbs_info);
 	break;
 
     case CPUFREQ_GOV_STOP:
+	this_dbs_info->enable = 0;
+	smp_wmb();
 	dbs_timer_exit(this_dbs_info);
 
 	mutex_lock(&dbs_mutex);
 	mutex_destroy(&this_dbs_info->timer_mutex);
 	dbs_enable--;
-	mutex_unlock(&dbs_mutex);
 	if (!dbs_enable)
+	    input_unregister_handler(&lazy_input_handler);
+	mutex_unlock(&dbs_mutex);
+	if (!dbs_enable) {
+	    cancel_work_sync(&boost.work);
 	    sysfs_remove_group(cpufreq_global_kobject,
 			       &dbs_attr_group);
+	}
 
 	break;
 
@@ -776,7 +1172,7 @@ static int __init cpufreq_gov_dbs_init(void)
 {
     cputime64_t wall;
     u64 idle_time;
-    int cpu = get_cpu();
+    int i, cpu = get_cpu();
 
     idle_time = get_cpu_idle_time_us(cpu, &wall);
     put_cpu();
@@ -797,6 +1193,14 @@ static int __init cpufreq_gov_dbs_init(void)
 	    MIN_SAMPLING_RATE_RATIO * jiffies_to_usecs(10);
     }
 
+    spin_lock_init(&boost.lock);
+    INIT_WORK(&boost.work, lazy_boost_work);
+
+    for_each_possible_cpu(i)
+	spin_lock_init(&per_cpu(od_cpu_dbs_info, i).idle_lock);
+
+    idle_notifier_register(&lazy_idle_nb);
+
 #ifdef CONFIG_HAS_EARLYSUSPEND
     register_early_suspend(&lazy_suspend);
 #endif
@@ -807,6 +1211,7 @@ static int __init cpufreq_gov_dbs_init(void)
 static void __exit cpufreq_gov_dbs_exit(void)
 {
     cpufreq_unregister_governor(&cpufreq_gov_lazy);
+    idle_notifier_unregister(&lazy_idle_nb);
 }
 
 
@@ -0,0 +1,94 @@
+/*
+ *  drivers/cpufreq/cpufreq_lazy.h
+ *
+ *  Copyright (C)  2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Frequency decision of the lazy governor. This is shared with the
+ * offline simulator in tools/power/cpufreq-sim, so it must not depend
+ * on anything but plain C.
+ */
+
+#ifndef _CPUFREQ_LAZY_H
+#define _CPUFREQ_LAZY_H
+
+enum lazy_action {
+    LAZY_KEEP,		/* stay at the current frequency */
+    LAZY_RAISE,		/* go to policy max, even if already there */
+    LAZY_LOWER,		/* go to freq_next (RELATION_L) */
+};
+
+/*
+ * Load in percent of one sample, -1 if the sample has to be ignored.
+ */
+static inline int lazy_sample_load(unsigned int wall_time, unsigned int idle_time,
+				   unsigned int iowait_time, unsigned int io_is_busy)
+{
+    /*
+     * For the purpose of lazy, waiting for disk IO is an
+     * indication that you're performance critical, and not that
+     * the system is actually idle. So subtract the iowait time
+     * from the cpu idle time.
+     */
+    if (io_is_busy && idle_time >= iowait_time)
+	idle_time -= iowait_time;
+
+    if (!wall_time || wall_time < idle_time)
+	return -1;
+
+    return 100 * (wall_time - idle_time) / wall_time;
+}
+
+/*
+ * Every sampling_rate, we check, if current idle time is less
+ * than 20% (default), then we try to increase frequency
+ * Every sampling_rate, we look for a the lowest
+ * frequency which can sustain the load while keeping idle time over
+ * 30%. If such a frequency exist, we try to decrease to this frequency.
+ *
+ * Any frequency increase takes it to the maximum frequency.
+ *
+ * Whenever the frequency is changed the next sample is taken after
+ * min_timeinstate instead of sampling_rate.
+ */
+static inline enum lazy_action lazy_decide(unsigned int max_load_freq,
+					   unsigned int cur, unsigned int min,
+					   unsigned int max, unsigned int up_threshold,
+					   unsigned int down_differential,
+					   unsigned int *freq_next)
+{
+    /*
+     * Check for frequency increase. Already being at max is left to the
+     * caller, powersave_bias may still have to pick a lower frequency.
+     */
+    if (max_load_freq > up_threshold * cur) {
+	*freq_next = max;
+	return LAZY_RAISE;
+    }
+
+    /* Check for frequency decrease */
+    /* if we cannot reduce the frequency anymore, break out early */
+    if (cur == min)
+	return LAZY_KEEP;
+
+    /*
+     * The optimal frequency is the frequency that is the lowest that
+     * can support the current CPU usage without triggering the up
+     * policy. To be safe, we focus 10 points under the threshold.
+     */
+    if (max_load_freq < (up_threshold - down_differential) * cur) {
+	*freq_next = max_load_freq / (up_threshold - down_differential);
+
+	if (*freq_next < min)
+	    *freq_next = min;
+
+	return LAZY_LOWER;
+    }
+
+    return LAZY_KEEP;
+}
+
+#endif
@@ -23,6 +23,8 @@
 #include <linux/ktime.h>
 #include <linux/sched.h>
 
+#include <trace/events/power.h>
+
 /*
  * dbs is used in this file as a shortform for demandbased switching
  * It helps to keep variable names smaller, simpler
@@ -469,6 +471,9 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 			idle_time += jiffies_to_usecs(cur_nice_jiffies);
 		}
 
+		trace_cpufreq_load_sample(j, wall_time, idle_time, iowait_time,
+					  policy->cur, 0);
+
 		/*
 		 * For the purpose of ondemand, waiting for disk IO is an
 		 * indication that you're performance critical, and not that
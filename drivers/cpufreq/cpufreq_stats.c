@@ -18,12 +18,20 @@
 #include <linux/jiffies.h>
 #include <linux/percpu.h>
 #include <linux/kobject.h>
+#include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/notifier.h>
+#include <linux/hrtimer.h>
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
+#include <linux/cpufreq_stats.h>
 #include <asm/cputime.h>
 
 static spinlock_t cpufreq_stats_lock;
 
+/* Keeps the stats of a CPU from being freed while a snapshot is taken */
+static DEFINE_MUTEX(cpufreq_stats_snapshot_mutex);
+
 #define CPUFREQ_STATDEVICE_ATTR(_name, _mode, _show) \
 static struct freq_attr _attr_##_name = {\
 	.attr = {.name = __stringify(_name), .mode = _mode, }, \
@@ -42,27 +50,70 @@ struct cpufreq_stats {
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	unsigned int *trans_table;
 #endif
+	struct cpufreq_stats_state *states;
+	struct cpufreq_stats_trans *trans;
+	ktime_t trans_start;
+	bool driver_timed;	/* inside transition_begin/end */
+	int trans_from, trans_to;	/* indices seen at POSTCHANGE */
+	struct dentry *debugfs;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_stats *, cpufreq_stats_table);
 
+static struct dentry *cpufreq_stats_debugfs_dir;
+
 struct cpufreq_stats_attribute {
 	struct attribute attr;
 	ssize_t(*show) (struct cpufreq_stats *, char *);
 };
 
+/*
+ * Integrate the square of the supply voltages over the time spent at
+ * the current frequency. The voltages are looked up every time as they
+ * may be changed at runtime (e.g. by undervolting).
+ */
+static void cpufreq_stats_account_energy(struct cpufreq_stats *stat,
+					 unsigned long *uv, int nr,
+					 unsigned long long delta)
+{
+	struct cpufreq_stats_state *state;
+	u64 ms;
+	int i;
+
+	if (!stat->states || stat->last_index >= stat->state_num)
+		return;
+
+	state = &stat->states[stat->last_index];
+	ms = div_u64(delta * MSEC_PER_SEC, HZ);
+
+	for (i = 0; i < nr && i < CPUFREQ_STATS_SUPPLIES; i++) {
+		u64 mv = uv[i] / 1000;
+
+		state->volt[i] = uv[i];
+		state->volt_sq_time[i] += mv * mv * ms;
+	}
+}
+
 static int cpufreq_stats_update(unsigned int cpu)
 {
 	struct cpufreq_stats *stat;
 	unsigned long long cur_time;
+	unsigned long uv[CPUFREQ_MAX_SUPPLIES];
+	int nr = 0;
+
+	stat = per_cpu(cpufreq_stats_table, cpu);
+	if (stat->last_index < stat->state_num)
+		nr = cpufreq_driver_get_voltage(cpu,
+				stat->freq_table[stat->last_index], uv);
 
 	cur_time = get_jiffies_64();
 	spin_lock(&cpufreq_stats_lock);
-	stat = per_cpu(cpufreq_stats_table, cpu);
 	if (stat->time_in_state)
 		stat->time_in_state[stat->last_index] =
 			cputime64_add(stat->time_in_state[stat->last_index],
 				      cputime_sub(cur_time, stat->last_time));
+	cpufreq_stats_account_energy(stat, uv, nr,
+				     cur_time - stat->last_time);
 	stat->last_time = cur_time;
 	spin_unlock(&cpufreq_stats_lock);
 	return 0;
@@ -140,12 +191,71 @@ static ssize_t show_trans_table(struct cpufreq_policy *policy, char *buf)
 CPUFREQ_STATDEVICE_ATTR(trans_table, 0444, show_trans_table);
 #endif
 
+static ssize_t show_trans_latency(struct cpufreq_policy *policy, char *buf)
+{
+	ssize_t len = 0;
+	int i, j;
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	spin_lock(&cpufreq_stats_lock);
+	for (i = 0; i < stat->state_num; i++) {
+		for (j = 0; j < stat->state_num; j++) {
+			struct cpufreq_stats_trans *t =
+				&stat->trans[i * stat->max_state + j];
+			if (!t->count)
+				continue;
+			if (len >= PAGE_SIZE - 64)
+				break;
+			len += sprintf(buf + len, "%u %u %u %llu %u\n",
+				stat->freq_table[i], stat->freq_table[j],
+				t->count,
+				div64_u64(t->total_ns,
+					  (u64)t->count * NSEC_PER_USEC),
+				t->max_ns / (u32)NSEC_PER_USEC);
+		}
+	}
+	spin_unlock(&cpufreq_stats_lock);
+	return len;
+}
+
+/*
+ * freq, supply voltages (uV), integrated squared voltages (mV^2 * s)
+ * and the ARM dynamic energy per nF of switched capacitance (uJ).
+ */
+static ssize_t show_energy(struct cpufreq_policy *policy, char *buf)
+{
+	ssize_t len = 0;
+	int i;
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	cpufreq_stats_update(stat->cpu);
+	spin_lock(&cpufreq_stats_lock);
+	for (i = 0; i < stat->state_num; i++) {
+		struct cpufreq_stats_state *state = &stat->states[i];
+		u64 arm = div_u64(state->volt_sq_time[0], MSEC_PER_SEC);
+		u64 inl = div_u64(state->volt_sq_time[1], MSEC_PER_SEC);
+
+		len += sprintf(buf + len, "%u %u %u %llu %llu %llu\n",
+			stat->freq_table[i], state->volt[0], state->volt[1],
+			arm, inl,
+			div_u64(arm * (stat->freq_table[i] / 1000), 1000));
+	}
+	spin_unlock(&cpufreq_stats_lock);
+	return len;
+}
+
 CPUFREQ_STATDEVICE_ATTR(total_trans, 0444, show_total_trans);
 CPUFREQ_STATDEVICE_ATTR(time_in_state, 0444, show_time_in_state);
+CPUFREQ_STATDEVICE_ATTR(trans_latency, 0444, show_trans_latency);
+CPUFREQ_STATDEVICE_ATTR(energy, 0444, show_energy);
 
 static struct attribute *default_attrs[] = {
 	&_attr_total_trans.attr,
 	&_attr_time_in_state.attr,
+	&_attr_trans_latency.attr,
+	&_attr_energy.attr,
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	&_attr_trans_table.attr,
 #endif
@@ -156,6 +266,91 @@ static struct attribute_group stats_attr_group = {
 	.name = "stats"
 };
 
+/*
+ * debugfs cpufreq_stats/cpuN: binary snapshot, see
+ * include/linux/cpufreq_stats.h. It is taken when the file is opened.
+ */
+static int cpufreq_stats_snapshot_open(struct inode *inode, struct file *file)
+{
+	unsigned int cpu = (unsigned long)inode->i_private;
+	struct cpufreq_stats *stat;
+	struct cpufreq_stats_header *hdr;
+	struct cpufreq_stats_state *states;
+	size_t states_size, trans_size;
+	int i;
+
+	mutex_lock(&cpufreq_stats_snapshot_mutex);
+	stat = per_cpu(cpufreq_stats_table, cpu);
+	if (!stat) {
+		mutex_unlock(&cpufreq_stats_snapshot_mutex);
+		return -ENODEV;
+	}
+
+	cpufreq_stats_update(stat->cpu);
+
+	states_size = stat->state_num * sizeof(*states);
+	trans_size = stat->state_num * stat->state_num *
+		sizeof(struct cpufreq_stats_trans);
+
+	hdr = kmalloc(sizeof(*hdr) + states_size + trans_size, GFP_KERNEL);
+	if (!hdr) {
+		mutex_unlock(&cpufreq_stats_snapshot_mutex);
+		return -ENOMEM;
+	}
+
+	states = (struct cpufreq_stats_state *)(hdr + 1);
+
+	hdr->version = CPUFREQ_STATS_VERSION;
+	hdr->state_num = stat->state_num;
+	hdr->num_supplies = CPUFREQ_STATS_SUPPLIES;
+	hdr->reserved = 0;
+
+	spin_lock(&cpufreq_stats_lock);
+	memcpy(states, stat->states, states_size);
+	for (i = 0; i < stat->state_num; i++) {
+		states[i].freq = stat->freq_table[i];
+		states[i].time_ms = div_u64((u64)stat->time_in_state[i] *
+					    MSEC_PER_SEC, HZ);
+	}
+	/* max_state may be larger than state_num */
+	for (i = 0; i < stat->state_num; i++)
+		memcpy((void *)(states + stat->state_num) +
+		       i * stat->state_num * sizeof(*stat->trans),
+		       &stat->trans[i * stat->max_state],
+		       stat->state_num * sizeof(*stat->trans));
+	spin_unlock(&cpufreq_stats_lock);
+	mutex_unlock(&cpufreq_stats_snapshot_mutex);
+
+	file->private_data = hdr;
+
+	return 0;
+}
+
+static ssize_t cpufreq_stats_snapshot_read(struct file *file,
+		char __user *buf, size_t count, loff_t *ppos)
+{
+	struct cpufreq_stats_header *hdr = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, hdr, sizeof(*hdr) +
+			hdr->state_num * sizeof(struct cpufreq_stats_state) +
+			hdr->state_num * hdr->state_num *
+			sizeof(struct cpufreq_stats_trans));
+}
+
+static int cpufreq_stats_snapshot_release(struct inode *inode,
+					  struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations cpufreq_stats_snapshot_fops = {
+	.open		= cpufreq_stats_snapshot_open,
+	.read		= cpufreq_stats_snapshot_read,
+	.llseek		= default_llseek,
+	.release	= cpufreq_stats_snapshot_release,
+};
+
 static int freq_table_get_index(struct cpufreq_stats *stat, unsigned int freq)
 {
 	int index;
@@ -170,12 +365,20 @@ static int freq_table_get_index(struct cpufreq_stats *stat, unsigned int freq)
  */
 static void cpufreq_stats_free_table(unsigned int cpu)
 {
-	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, cpu);
+	struct cpufreq_stats *stat;
+
+	mutex_lock(&cpufreq_stats_snapshot_mutex);
+	spin_lock(&cpufreq_stats_lock);
+	stat = per_cpu(cpufreq_stats_table, cpu);
+	per_cpu(cpufreq_stats_table, cpu) = NULL;
+	spin_unlock(&cpufreq_stats_lock);
 	if (stat) {
+		debugfs_remove(stat->debugfs);
+		kfree(stat->states);
 		kfree(stat->time_in_state);
 		kfree(stat);
 	}
-	per_cpu(cpufreq_stats_table, cpu) = NULL;
+	mutex_unlock(&cpufreq_stats_snapshot_mutex);
 }
 
 /* must be called early in the CPU removal sequence (before
@@ -237,6 +440,16 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 	}
 	stat->freq_table = (unsigned int *)(stat->time_in_state + count);
 
+	stat->states = kzalloc(count * sizeof(struct cpufreq_stats_state) +
+			count * count * sizeof(struct cpufreq_stats_trans),
+			GFP_KERNEL);
+	if (!stat->states) {
+		kfree(stat->time_in_state);
+		ret = -ENOMEM;
+		goto error_out;
+	}
+	stat->trans = (struct cpufreq_stats_trans *)(stat->states + count);
+
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	stat->trans_table = stat->freq_table + count;
 #endif
@@ -257,6 +470,15 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 	    stat->last_index = 0;
 #endif
 	spin_unlock(&cpufreq_stats_lock);
+	if (!IS_ERR_OR_NULL(cpufreq_stats_debugfs_dir)) {
+		char name[16];
+
+		snprintf(name, sizeof(name), "cpu%u", cpu);
+		stat->debugfs = debugfs_create_file(name, S_IRUGO,
+				cpufreq_stats_debugfs_dir,
+				(void *)(unsigned long)cpu,
+				&cpufreq_stats_snapshot_fops);
+	}
 	cpufreq_cpu_put(data);
 	return 0;
 error_out:
@@ -285,20 +507,84 @@ static int cpufreq_stat_notifier_policy(struct notifier_block *nb,
 	return 0;
 }
 
+/* Called with cpufreq_stats_lock held */
+static void cpufreq_stats_add_latency(struct cpufreq_stats *stat,
+		int old_index, int new_index, s64 latency)
+{
+	struct cpufreq_stats_trans *t;
+
+	t = &stat->trans[old_index * stat->max_state + new_index];
+	t->count++;
+	t->total_ns += latency;
+	if (latency > t->max_ns)
+		t->max_ns = latency;
+}
+
+/*
+ * Drivers doing part of a transition outside the PRECHANGE/POSTCHANGE
+ * window, e.g. ramping a regulator down afterwards, bracket the whole
+ * of it with these so that it all counts towards the transition latency.
+ */
+void cpufreq_stats_transition_begin(unsigned int cpu)
+{
+	struct cpufreq_stats *stat;
+
+	spin_lock(&cpufreq_stats_lock);
+	stat = per_cpu(cpufreq_stats_table, cpu);
+	if (stat) {
+		stat->driver_timed = true;
+		stat->trans_start = ktime_get();
+		stat->trans_from = -1;
+	}
+	spin_unlock(&cpufreq_stats_lock);
+}
+EXPORT_SYMBOL(cpufreq_stats_transition_begin);
+
+void cpufreq_stats_transition_end(unsigned int cpu)
+{
+	struct cpufreq_stats *stat;
+
+	spin_lock(&cpufreq_stats_lock);
+	stat = per_cpu(cpufreq_stats_table, cpu);
+	if (stat && stat->driver_timed) {
+		if (stat->trans_from >= 0)
+			cpufreq_stats_add_latency(stat, stat->trans_from,
+				stat->trans_to, ktime_to_ns(ktime_sub(
+					ktime_get(), stat->trans_start)));
+		stat->driver_timed = false;
+		stat->trans_start.tv64 = 0;
+	}
+	spin_unlock(&cpufreq_stats_lock);
+}
+EXPORT_SYMBOL(cpufreq_stats_transition_end);
+
 static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 		unsigned long val, void *data)
 {
 	struct cpufreq_freqs *freq = data;
 	struct cpufreq_stats *stat;
 	int old_index, new_index;
+	s64 latency = -1;
 
-	if (val != CPUFREQ_POSTCHANGE)
+	if (val != CPUFREQ_PRECHANGE && val != CPUFREQ_POSTCHANGE)
 		return 0;
 
 	stat = per_cpu(cpufreq_stats_table, freq->cpu);
 	if (!stat)
 		return 0;
 
+	if (val == CPUFREQ_PRECHANGE) {
+		if (!stat->driver_timed)
+			stat->trans_start = ktime_get();
+		return 0;
+	}
+
+	if (stat->trans_start.tv64 && !stat->driver_timed) {
+		latency = ktime_to_ns(ktime_sub(ktime_get(),
+						stat->trans_start));
+		stat->trans_start.tv64 = 0;
+	}
+
 	old_index = stat->last_index;
 	new_index = freq_table_get_index(stat, freq->new);
 
@@ -317,6 +603,12 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	stat->trans_table[old_index * stat->max_state + new_index]++;
 #endif
 	stat->total_trans++;
+	if (stat->driver_timed) {
+		/* accounted at cpufreq_stats_transition_end() */
+		stat->trans_from = old_index;
+		stat->trans_to = new_index;
+	} else if (latency >= 0)
+		cpufreq_stats_add_latency(stat, old_index, new_index, latency);
 	spin_unlock(&cpufreq_stats_lock);
 	return 0;
 }
@@ -388,16 +680,20 @@ static int __init cpufreq_stats_init(void)
 	unsigned int cpu;
 
 	spin_lock_init(&cpufreq_stats_lock);
+	cpufreq_stats_debugfs_dir = debugfs_create_dir("cpufreq_stats", NULL);
 	ret = cpufreq_register_notifier(&notifier_policy_block,
 				CPUFREQ_POLICY_NOTIFIER);
-	if (ret)
+	if (ret) {
+		debugfs_remove(cpufreq_stats_debugfs_dir);
 		return ret;
+	}
 
 	ret = cpufreq_register_notifier(&notifier_trans_block,
 				CPUFREQ_TRANSITION_NOTIFIER);
 	if (ret) {
 		cpufreq_unregister_notifier(&notifier_policy_block,
 				CPUFREQ_POLICY_NOTIFIER);
+		debugfs_remove(cpufreq_stats_debugfs_dir);
 		return ret;
 	}
 
@@ -420,6 +716,7 @@ static void __exit cpufreq_stats_exit(void)
 		cpufreq_stats_free_table(cpu);
 		cpufreq_stats_free_sysfs(cpu);
 	}
+	debugfs_remove(cpufreq_stats_debugfs_dir);
 }
 
 #ifdef CONFIG_LIVE_OC
@@ -11,13 +11,25 @@
 #include <linux/device.h>
 #include <linux/miscdevice.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/cpufreq.h>
+#include <linux/jiffies.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
 
-#define CUSTOMVOLTAGE_VERSION 1
+#define CUSTOMVOLTAGE_VERSION 2
 
-extern void customvoltage_updatearmvolt(unsigned long * arm_voltages);
+#define CALIBRATION_STEP 25000
+#define CALIBRATION_MIN_VOLT 750000
+#define CALIBRATION_BUFFER_WORDS (256 * 1024)
+
+extern int customvoltage_updatearmvolt(unsigned long * arm_voltages);
 extern void customvoltage_updateintvolt(unsigned long * int_voltages);
 extern void customvoltage_updatemaxvolt(unsigned long * max_voltages);
 extern int customvoltage_numfreqs(void);
+extern int customvoltage_armvolt_limits(unsigned long * min, unsigned long * max);
 extern void customvoltage_freqvolt(unsigned long * freqs, unsigned long * arm_voltages,
 				   unsigned long * int_voltages, unsigned long * max_voltages);
 
@@ -28,6 +40,8 @@ static unsigned long * int_voltages = NULL;
 static unsigned long * freqs = NULL;
 static unsigned long max_voltages[2] = {0, 0};
 
+static bool calibration_running = false;
+
 ssize_t customvoltage_armvolt_read(struct device * dev, struct device_attribute * attr, char * buf)
 {
     int i, j = 0;
@@ -44,10 +58,22 @@ EXPORT_SYMBOL(customvoltage_armvolt_read);
 ssize_t customvoltage_armvolt_write(struct device * dev, struct device_attribute * attr, const char * buf, size_t size)
 {
     int i = 0, j = 0, next_freq = 0;
-    unsigned long voltage;
+    unsigned long voltage, min_volt, max_volt;
+    unsigned long * voltages;
 
     char buffer[20];
 
+    if (calibration_running)
+	return -EBUSY;
+
+    if (customvoltage_armvolt_limits(&min_volt, &max_volt))
+	return -ENODEV;
+
+    voltages = kmemdup(arm_voltages, num_freqs * sizeof(unsigned long), GFP_KERNEL);
+
+    if (!voltages)
+	return -ENOMEM;
+
     while (1)
 	{
 	    buffer[j] = buf[i];
@@ -61,7 +87,7 @@ ssize_t customvoltage_armvolt_write(struct device * dev, struct device_attribute
 
 		    if (sscanf(buffer, "%lu", &voltage) == 1)
 			{
-			    arm_voltages[next_freq] = voltage * 1000;
+			    voltages[next_freq] = voltage * 1000;
 		
 			    next_freq++;
 			}
@@ -75,6 +101,21 @@ ssize_t customvoltage_armvolt_write(struct device * dev, struct device_attribute
 		}
 	}
 
+    /* the new voltages are programmed right away, reject any the regulator cannot do */
+    for (i = 0; i < num_freqs; i++)
+	{
+	    if (voltages[i] < min_volt || voltages[i] > max_volt)
+		{
+		    kfree(voltages);
+
+		    return -EINVAL;
+		}
+	}
+
+    memcpy(arm_voltages, voltages, num_freqs * sizeof(unsigned long));
+
+    kfree(voltages);
+
     customvoltage_updatearmvolt(arm_voltages);
 
     return size;
@@ -100,6 +141,9 @@ static ssize_t customvoltage_intvolt_write(struct device * dev, struct device_at
 
     char buffer[20];
 
+    if (calibration_running)
+	return -EBUSY;
+
     while (1)
 	{
 	    buffer[j] = buf[i];
@@ -141,6 +185,9 @@ static ssize_t customvoltage_maxarmvolt_write(struct device * dev, struct device
 {
     unsigned long max_volt;
 
+    if (calibration_running)
+	return -EBUSY;
+
     if (sscanf(buf, "%lu", &max_volt) == 1)
 	{
 	    max_voltages[0] = max_volt * 1000;
@@ -160,6 +207,9 @@ static ssize_t customvoltage_maxintvolt_write(struct device * dev, struct device
 {
     unsigned long max_volt;
 
+    if (calibration_running)
+	return -EBUSY;
+
     if (sscanf(buf, "%lu", &max_volt) == 1)
 	{
 	    max_voltages[1] = max_volt * 1000;
@@ -170,6 +220,411 @@ static ssize_t customvoltage_maxintvolt_write(struct device * dev, struct device
     return size;
 }
 
+/*
+ * Undervolt calibration
+ *
+ * For every level inside the current policy limits the CPU is locked to
+ * that frequency and the ARM voltage is lowered in 25 mV steps. At each
+ * step a CPU and memory stress kernel runs for calibration_time ms and
+ * its checksum is compared to the one computed at the starting voltage.
+ * The lowest voltage which passed plus calibration_margin is the result.
+ *
+ * An unstable voltage usually hangs or reboots the device instead of
+ * producing a bad checksum. Every step is logged before it is applied,
+ * so after a crash /proc/last_kmsg tells which voltage was too low.
+ *
+ * The voltages are restored afterwards, the results can be applied by
+ * writing calibrated_arm_volt to arm_volt.
+ */
+enum calibration_state
+    {
+	CALIBRATION_IDLE,
+	CALIBRATION_RUNNING,
+	CALIBRATION_DONE,
+	CALIBRATION_ABORTED,
+	CALIBRATION_FAILED,
+    };
+
+static const char * const calibration_states[] = {"idle", "running", "done", "aborted", "failed"};
+
+static DEFINE_MUTEX(calibration_mutex);
+
+static struct task_struct * calibration_task = NULL;
+
+static enum calibration_state calibration_state = CALIBRATION_IDLE;
+
+static unsigned int calibration_margin = 50;
+
+static unsigned int calibration_time = 3000;
+
+static int calibration_level = -1;
+
+static unsigned long * calibrated_voltages = NULL;
+
+static unsigned long * stable_voltages = NULL;
+
+static u32 * calibration_buffer = NULL;
+
+/*
+ * Fill the buffer from a xorshift generator, then run multiply-accumulate
+ * passes with strided reads over it and fold everything into a checksum.
+ * The buffer is larger than the L2 cache so DRAM is exercised as well.
+ */
+static u32 calibration_stress(u32 seed)
+{
+    u32 x = seed, sum = 0;
+    int i, pass;
+
+    for (i = 0; i < CALIBRATION_BUFFER_WORDS; i++)
+	{
+	    x ^= x << 13;
+	    x ^= x >> 17;
+	    x ^= x << 5;
+	    calibration_buffer[i] = x;
+	}
+
+    for (pass = 0; pass < 4; pass++)
+	{
+	    for (i = 0; i < CALIBRATION_BUFFER_WORDS; i++)
+		{
+		    calibration_buffer[i] = calibration_buffer[i] * 2654435761u +
+			calibration_buffer[(i * 7 + pass * 4093) & (CALIBRATION_BUFFER_WORDS - 1)];
+		    sum = ((sum << 1) | (sum >> 31)) ^ calibration_buffer[i];
+		}
+
+	    cond_resched();
+	}
+
+    return sum;
+}
+
+static void calibration_setfreq(unsigned long min, unsigned long max)
+{
+    struct cpufreq_policy * policy = cpufreq_cpu_get(0);
+
+    if (!policy)
+	return;
+
+    policy->user_policy.min = min;
+    policy->user_policy.max = max;
+
+    cpufreq_cpu_put(policy);
+
+    cpufreq_update_policy(0);
+
+    return;
+}
+
+/* Returns false if the checksum did not match or we were told to stop */
+static bool calibration_test(u32 reference)
+{
+    unsigned long timeout = jiffies + msecs_to_jiffies(calibration_time);
+
+    while (time_before(jiffies, timeout))
+	{
+	    if (kthread_should_stop())
+		return false;
+
+	    if (calibration_stress(0x2545f491) != reference)
+		return false;
+	}
+
+    return true;
+}
+
+/*
+ * Publish the outcome of a run. calibration_stop() waits for us with
+ * calibration_mutex held, so give up on the lock once asked to stop and
+ * leave the outcome to it.
+ */
+static void calibration_finish(enum calibration_state state)
+{
+    while (!mutex_trylock(&calibration_mutex))
+	{
+	    if (kthread_should_stop())
+		return;
+
+	    msleep(1);
+	}
+
+    calibration_level = -1;
+
+    calibration_state = state;
+
+    calibration_running = false;
+
+    mutex_unlock(&calibration_mutex);
+}
+
+static int calibration_thread(void * data)
+{
+    int i, ret = 0;
+    unsigned long policy_min = 0, policy_max = 0, volt;
+    unsigned long * voltages;
+    struct cpufreq_policy * policy;
+    u32 reference;
+
+    voltages = kmemdup(arm_voltages, num_freqs * sizeof(unsigned long), GFP_KERNEL);
+
+    policy = cpufreq_cpu_get(0);
+
+    if (!voltages || !policy)
+	{
+	    if (policy)
+		cpufreq_cpu_put(policy);
+
+	    kfree(voltages);
+
+	    calibration_finish(CALIBRATION_FAILED);
+
+	    goto wait;
+	}
+
+    policy_min = policy->user_policy.min;
+    policy_max = policy->user_policy.max;
+
+    cpufreq_cpu_put(policy);
+
+    /* live OC may have changed the frequencies */
+    customvoltage_freqvolt(freqs, arm_voltages, int_voltages, max_voltages);
+
+    for (i = 0; i < num_freqs; i++)
+	{
+	    calibrated_voltages[i] = arm_voltages[i];
+	    stable_voltages[i] = 0;
+	}
+
+    for (i = 0; i < num_freqs && !kthread_should_stop(); i++)
+	{
+	    if (freqs[i] < policy_min || freqs[i] > policy_max)
+		continue;
+
+	    calibration_level = i;
+
+	    calibration_setfreq(freqs[i], freqs[i]);
+
+	    /* reference checksum at the known good voltage */
+	    reference = calibration_stress(0x2545f491);
+
+	    for (volt = voltages[i]; volt >= CALIBRATION_MIN_VOLT; volt -= CALIBRATION_STEP)
+		{
+		    pr_info("CUSTOMVOLTAGE calibrating %lumhz at %lu mV\n", freqs[i] / 1000, volt / 1000);
+
+		    arm_voltages[i] = volt;
+
+		    /* a voltage that did not make it to the regulator proves nothing */
+		    ret = customvoltage_updatearmvolt(arm_voltages);
+
+		    if (ret)
+			{
+			    pr_err("CUSTOMVOLTAGE failed to apply %lu mV: %d\n", volt / 1000, ret);
+
+			    break;
+			}
+
+		    if (!calibration_test(reference))
+			break;
+
+		    stable_voltages[i] = volt;
+		}
+
+	    /* back to the known good voltage before moving on */
+	    arm_voltages[i] = voltages[i];
+
+	    if (customvoltage_updatearmvolt(arm_voltages))
+		pr_err("CUSTOMVOLTAGE failed to restore %lu mV\n", voltages[i] / 1000);
+
+	    if (ret)
+		{
+		    stable_voltages[i] = 0;
+
+		    break;
+		}
+
+	    if (stable_voltages[i])
+		calibrated_voltages[i] = min(stable_voltages[i] + calibration_margin * 1000, voltages[i]);
+
+	    pr_info("CUSTOMVOLTAGE %lumhz stable at %lu mV, calibrated to %lu mV\n", freqs[i] / 1000,
+		    stable_voltages[i] / 1000, calibrated_voltages[i] / 1000);
+	}
+
+    calibration_setfreq(policy_min, policy_max);
+
+    kfree(voltages);
+
+    calibration_finish(ret || kthread_should_stop() ? CALIBRATION_ABORTED : CALIBRATION_DONE);
+
+ wait:
+    /* kthread_stop() expects us to be around */
+    while (!kthread_should_stop())
+	{
+	    set_current_state(TASK_INTERRUPTIBLE);
+
+	    if (!kthread_should_stop())
+		schedule();
+
+	    __set_current_state(TASK_RUNNING);
+	}
+
+    return 0;
+}
+
+static void calibration_stop(void)
+{
+    if (calibration_task)
+	{
+	    kthread_stop(calibration_task);
+
+	    calibration_task = NULL;
+
+	    /* stopped before it got to calibration_finish() */
+	    if (calibration_state == CALIBRATION_RUNNING)
+		{
+		    calibration_level = -1;
+
+		    calibration_state = CALIBRATION_ABORTED;
+
+		    calibration_running = false;
+		}
+	}
+
+    vfree(calibration_buffer);
+
+    calibration_buffer = NULL;
+
+    return;
+}
+
+static ssize_t customvoltage_calibrate_read(struct device * dev, struct device_attribute * attr, char * buf)
+{
+    int i, j = 0;
+
+    mutex_lock(&calibration_mutex);
+
+    j += sprintf(&buf[j], "state: %s\n", calibration_states[calibration_state]);
+
+    if (calibration_level >= 0)
+	j += sprintf(&buf[j], "level: %lumhz %lu mV\n", freqs[calibration_level] / 1000,
+		     arm_voltages[calibration_level] / 1000);
+
+    if (calibration_state == CALIBRATION_DONE || calibration_state == CALIBRATION_ABORTED)
+	{
+	    for (i = 0; i < num_freqs; i++)
+		{
+		    if (!stable_voltages[i])
+			continue;
+
+		    j += sprintf(&buf[j], "%lumhz: %lu mV (stable %lu mV)\n", freqs[i] / 1000,
+				 calibrated_voltages[i] / 1000, stable_voltages[i] / 1000);
+		}
+	}
+
+    mutex_unlock(&calibration_mutex);
+
+    return j;
+}
+
+static ssize_t customvoltage_calibrate_write(struct device * dev, struct device_attribute * attr, const char * buf, size_t size)
+{
+    unsigned int data;
+
+    if (sscanf(buf, "%u\n", &data) != 1)
+	return -EINVAL;
+
+    mutex_lock(&calibration_mutex);
+
+    /* a finished run only gets cleaned up here */
+    calibration_stop();
+
+    if (data)
+	{
+	    calibration_buffer = vmalloc(CALIBRATION_BUFFER_WORDS * sizeof(u32));
+
+	    if (!calibration_buffer)
+		{
+		    calibration_state = CALIBRATION_FAILED;
+
+		    goto out;
+		}
+
+	    calibration_state = CALIBRATION_RUNNING;
+
+	    calibration_running = true;
+
+	    calibration_task = kthread_run(calibration_thread, NULL, "customvoltage");
+
+	    if (IS_ERR(calibration_task))
+		{
+		    calibration_task = NULL;
+
+		    calibration_state = CALIBRATION_FAILED;
+
+		    calibration_running = false;
+
+		    calibration_stop();
+		}
+	}
+
+ out:
+    mutex_unlock(&calibration_mutex);
+
+    return size;
+}
+
+static ssize_t customvoltage_calibratedarmvolt_read(struct device * dev, struct device_attribute * attr, char * buf)
+{
+    int i, j = 0;
+
+    mutex_lock(&calibration_mutex);
+
+    /* there is nothing to copy to arm_volt before a calibration finished */
+    if (calibration_state != CALIBRATION_DONE && calibration_state != CALIBRATION_ABORTED)
+	{
+	    mutex_unlock(&calibration_mutex);
+
+	    return -ENODATA;
+	}
+
+    for (i = 0; i < num_freqs; i++)
+	j += sprintf(&buf[j], "%lu ", calibrated_voltages[i] / 1000);
+
+    buf[j - 1] = '\n';
+
+    mutex_unlock(&calibration_mutex);
+
+    return j;
+}
+
+static ssize_t customvoltage_calibrationmargin_read(struct device * dev, struct device_attribute * attr, char * buf)
+{
+    return sprintf(buf, "%u mV\n", calibration_margin);
+}
+
+static ssize_t customvoltage_calibrationmargin_write(struct device * dev, struct device_attribute * attr, const char * buf, size_t size)
+{
+    unsigned int data;
+
+    if (sscanf(buf, "%u\n", &data) == 1)
+	calibration_margin = data;
+
+    return size;
+}
+
+static ssize_t customvoltage_calibrationtime_read(struct device * dev, struct device_attribute * attr, char * buf)
+{
+    return sprintf(buf, "%u ms\n", calibration_time);
+}
+
+static ssize_t customvoltage_calibrationtime_write(struct device * dev, struct device_attribute * attr, const char * buf, size_t size)
+{
+    unsigned int data;
+
+    if (sscanf(buf, "%u\n", &data) == 1 && data > 0)
+	calibration_time = data;
+
+    return size;
+}
+
 static ssize_t customvoltage_version(struct device * dev, struct device_attribute * attr, char * buf)
 {
     return sprintf(buf, "%u\n", CUSTOMVOLTAGE_VERSION);
@@ -179,6 +634,10 @@ static DEVICE_ATTR(arm_volt, S_IRUGO | S_IWUGO, customvoltage_armvolt_read, cust
 static DEVICE_ATTR(int_volt, S_IRUGO | S_IWUGO, customvoltage_intvolt_read, customvoltage_intvolt_write);
 static DEVICE_ATTR(max_arm_volt, S_IRUGO | S_IWUGO, customvoltage_maxarmvolt_read, customvoltage_maxarmvolt_write);
 static DEVICE_ATTR(max_int_volt, S_IRUGO | S_IWUGO, customvoltage_maxintvolt_read, customvoltage_maxintvolt_write);
+static DEVICE_ATTR(calibrate, S_IRUGO | S_IWUGO, customvoltage_calibrate_read, customvoltage_calibrate_write);
+static DEVICE_ATTR(calibrated_arm_volt, S_IRUGO, customvoltage_calibratedarmvolt_read, NULL);
+static DEVICE_ATTR(calibration_margin, S_IRUGO | S_IWUGO, customvoltage_calibrationmargin_read, customvoltage_calibrationmargin_write);
+static DEVICE_ATTR(calibration_time, S_IRUGO | S_IWUGO, customvoltage_calibrationtime_read, customvoltage_calibrationtime_write);
 static DEVICE_ATTR(version, S_IRUGO , customvoltage_version, NULL);
 
 static struct attribute *customvoltage_attributes[] = 
@@ -187,6 +646,10 @@ static struct attribute *customvoltage_attributes[] =
 	&dev_attr_int_volt.attr,
 	&dev_attr_max_arm_volt.attr,
 	&dev_attr_max_int_volt.attr,
+	&dev_attr_calibrate.attr,
+	&dev_attr_calibrated_arm_volt.attr,
+	&dev_attr_calibration_margin.attr,
+	&dev_attr_calibration_time.attr,
 	&dev_attr_version.attr,
 	NULL
     };
@@ -228,6 +691,8 @@ static int __init customvoltage_init(void)
     arm_voltages = kzalloc(num_freqs * sizeof(unsigned long), GFP_KERNEL);
     int_voltages = kzalloc(num_freqs * sizeof(unsigned long), GFP_KERNEL);
     freqs = kzalloc(num_freqs * sizeof(unsigned long), GFP_KERNEL);
+    calibrated_voltages = kzalloc(num_freqs * sizeof(unsigned long), GFP_KERNEL);
+    stable_voltages = kzalloc(num_freqs * sizeof(unsigned long), GFP_KERNEL);
 
     customvoltage_freqvolt(freqs, arm_voltages, int_voltages, max_voltages);
 
@@ -10,18 +10,133 @@
 #include <linux/init.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
-#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/math64.h>
 #include <linux/deep_idle.h>
 
-#define DEEPIDLE_VERSION 2
+#define DEEPIDLE_VERSION 4
 
-#define NUM_IDLESTATES 3
+#define NUM_IDLESTATES DEEPIDLE_NUM_STATES
 
-static DEFINE_MUTEX(lock);
+/*
+ * The statistics are kept per CPU and are only ever written from the
+ * idle path of the owning CPU with interrupts disabled, so the writer
+ * side needs no lock at all. Readers take a consistent copy through the
+ * seqcount. A reset bumps reset_gen and each CPU clears its own
+ * statistics on its next update, readers treat stale CPUs as empty.
+ */
+struct deepidle_cpu_stats
+{
+    seqcount_t seq;
+    unsigned int gen;
+    struct deepidle_state_stats state[NUM_IDLESTATES];
+    u64 veto[DEEPIDLE_NUM_VETOS];
+};
+
+static DEFINE_PER_CPU(struct deepidle_cpu_stats, idle_stats);
+
+static atomic_t reset_gen = ATOMIC_INIT(0);
+
+static atomic_t blockers[DEEPIDLE_NUM_VETOS];
 
 static bool deepidle_enabled = false;
 
-static unsigned long long num_idlecalls[NUM_IDLESTATES], time_in_idlestate[NUM_IDLESTATES]; 
+static const char * const idlestate_names[NUM_IDLESTATES] =
+    {
+	"IDLE",
+	"DEEP IDLE (TOP=ON)",
+	"DEEP IDLE (TOP=OFF)",
+    };
+
+static const char * const veto_names[DEEPIDLE_NUM_VETOS] =
+    {
+	"disabled",
+	"power_clock_gating",
+	"suspend",
+	"sdmmc",
+	"usbotg",
+	"rtcint",
+	"idmapos",
+	"bt",
+	"gps",
+	"vibrator",
+	"prediction",
+    };
+
+static struct dentry * deepidle_debugfs_dir;
+
+static inline struct deepidle_cpu_stats * get_cpu_stats_for_update(void)
+{
+    struct deepidle_cpu_stats * stats = &__get_cpu_var(idle_stats);
+    unsigned int gen = atomic_read(&reset_gen);
+
+    if (unlikely(stats->gen != gen))
+	{
+	    memset(stats->state, 0, sizeof(stats->state));
+	    memset(stats->veto, 0, sizeof(stats->veto));
+	    stats->gen = gen;
+	}
+
+    return stats;
+}
+
+static void take_snapshot(struct deepidle_snapshot * snap)
+{
+    int cpu, i, j;
+    unsigned int seq, gen;
+    struct deepidle_cpu_stats * stats;
+    struct deepidle_cpu_stats copy;
+
+    memset(snap, 0, sizeof(*snap));
+
+    snap->version = DEEPIDLE_VERSION;
+    snap->num_states = NUM_IDLESTATES;
+    snap->num_vetos = DEEPIDLE_NUM_VETOS;
+    snap->hist_buckets = DEEPIDLE_HIST_BUCKETS;
+
+    gen = atomic_read(&reset_gen);
+
+    for_each_possible_cpu(cpu)
+	{
+	    stats = &per_cpu(idle_stats, cpu);
+
+	    do {
+		seq = read_seqcount_begin(&stats->seq);
+		memcpy(&copy, stats, sizeof(copy));
+	    } while (read_seqcount_retry(&stats->seq, seq));
+
+	    if (copy.gen != gen)
+		continue;
+
+	    for (i = 0; i < NUM_IDLESTATES; i++)
+		{
+		    struct deepidle_state_stats * dst = &snap->state[i];
+		    struct deepidle_state_stats * src = &copy.state[i];
+
+		    dst->count += src->count;
+		    dst->residency_ns += src->residency_ns;
+		    dst->entry_ns += src->entry_ns;
+		    dst->exit_ns += src->exit_ns;
+		    dst->entry_max_ns = max(dst->entry_max_ns, src->entry_max_ns);
+		    dst->exit_max_ns = max(dst->exit_max_ns, src->exit_max_ns);
+
+		    for (j = 0; j < DEEPIDLE_HIST_BUCKETS; j++)
+			dst->hist[j] += src->hist[j];
+		}
+
+	    for (i = 0; i < DEEPIDLE_NUM_VETOS; i++)
+		snap->veto[i] += copy.veto[i];
+	}
+
+    return;
+}
 
 static ssize_t deepidle_status_read(struct device * dev, struct device_attribute * attr, char * buf)
 {
@@ -32,26 +147,26 @@ static ssize_t deepidle_status_write(struct device * dev, struct device_attribut
 {
     unsigned int data;
 
-    if(sscanf(buf, "%u\n", &data) == 1) 
+    if(sscanf(buf, "%u\n", &data) == 1)
 	{
 	    if (data == 1)
 		{
 		    pr_info("%s: DEEPIDLE enabled\n", __FUNCTION__);
 
 		    deepidle_enabled = true;
-		} 
+		}
 	    else if (data == 0)
 		{
 		    pr_info("%s: DEEPIDLE disabled\n", __FUNCTION__);
 
 		    deepidle_enabled = false;
 		}
-	    else 
+	    else
 		{
 		    pr_info("%s: invalid input range %u\n", __FUNCTION__, data);
 		}
-	} 
-    else 
+	}
+    else
 	{
 	    pr_info("%s: invalid input\n", __FUNCTION__);
 	}
@@ -63,21 +178,25 @@ static ssize_t show_idle_stats(struct device * dev, struct device_attribute * at
 {
     int i;
     unsigned long long msecs_in_idlestate[NUM_IDLESTATES], avg_in_idlestate[NUM_IDLESTATES];
+    struct deepidle_snapshot * snap;
+
+    snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+
+    if (!snap)
+	return -ENOMEM;
 
-    mutex_lock(&lock);
+    take_snapshot(snap);
 
     for (i = 0; i < NUM_IDLESTATES; i++) {
-	msecs_in_idlestate[i] = time_in_idlestate[i] + 500;
-	do_div(msecs_in_idlestate[i], 1000);
-	if (num_idlecalls[i] == 0) {
+	msecs_in_idlestate[i] = div_u64(snap->state[i].residency_ns + 500000, 1000000);
+	if (snap->state[i].count == 0) {
 	    avg_in_idlestate[i] = 0;
 	} else {
-	    avg_in_idlestate[i] = msecs_in_idlestate[i];
-	    do_div(avg_in_idlestate[i], num_idlecalls[i]);
+	    avg_in_idlestate[i] = div64_u64(msecs_in_idlestate[i], snap->state[i].count);
 	}
     }
 
-    mutex_unlock(&lock);
+    kfree(snap);
 
     return sprintf(buf, "idle state             total (average)\n===================================================\nIDLE                   %llums (%llums)\nDEEP IDLE (TOP=ON)     %llums (%llums)\nDEEP IDLE (TOP=OFF)    %llums (%llums)\n",
 		   msecs_in_idlestate[0], avg_in_idlestate[0], msecs_in_idlestate[1], avg_in_idlestate[1], msecs_in_idlestate[2], avg_in_idlestate[2]);
@@ -85,35 +204,27 @@ static ssize_t show_idle_stats(struct device * dev, struct device_attribute * at
 
 static void reset_stats(void)
 {
-    int i;
-
-    for (i = 0; i < NUM_IDLESTATES; i++)
-	{
-	    num_idlecalls[i] = 0;
-	    time_in_idlestate[i] = 0;
-	}
+    atomic_inc(&reset_gen);
 
     return;
-}   
+}
 
 static ssize_t reset_idle_stats(struct device * dev, struct device_attribute * attr, const char * buf, size_t size)
 {
     unsigned int data;
 
-    if(sscanf(buf, "%u\n", &data) == 1) 
+    if(sscanf(buf, "%u\n", &data) == 1)
 	{
 	    if (data == 1)
 		{
-		    mutex_lock(&lock);
 		    reset_stats();
-		    mutex_unlock(&lock);
 		}
-	    else 
+	    else
 		{
 		    pr_info("%s: invalid input range %u\n", __FUNCTION__, data);
 		}
-	} 
-    else 
+	}
+    else
 	{
 	    pr_info("%s: invalid input\n", __FUNCTION__);
 	}
@@ -131,7 +242,7 @@ static DEVICE_ATTR(idle_stats, S_IRUGO , show_idle_stats, NULL);
 static DEVICE_ATTR(reset_stats, S_IWUGO , NULL, reset_idle_stats);
 static DEVICE_ATTR(version, S_IRUGO , deepidle_version, NULL);
 
-static struct attribute *deepidle_attributes[] = 
+static struct attribute *deepidle_attributes[] =
     {
 	&dev_attr_enabled.attr,
 	&dev_attr_idle_stats.attr,
@@ -140,65 +251,229 @@ static struct attribute *deepidle_attributes[] =
 	NULL
     };
 
-static struct attribute_group deepidle_group = 
+static struct attribute_group deepidle_group =
     {
 	.attrs  = deepidle_attributes,
     };
 
-static struct miscdevice deepidle_device = 
+static struct miscdevice deepidle_device =
     {
 	.minor = MISC_DYNAMIC_MINOR,
 	.name = "deepidle",
     };
 
+static int deepidle_stats_show(struct seq_file * m, void * unused)
+{
+    int i, j;
+    struct deepidle_snapshot * snap;
+    struct deepidle_state_stats * st;
+
+    snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+
+    if (!snap)
+	return -ENOMEM;
+
+    take_snapshot(snap);
+
+    for (i = 0; i < NUM_IDLESTATES; i++)
+	{
+	    st = &snap->state[i];
+
+	    seq_printf(m, "%s\n", idlestate_names[i]);
+	    seq_printf(m, "  count        %llu\n", st->count);
+	    seq_printf(m, "  residency    %lluus\n", div_u64(st->residency_ns, 1000));
+	    seq_printf(m, "  entry        %lluus (max %lluns)\n", div_u64(st->entry_ns, 1000), st->entry_max_ns);
+	    seq_printf(m, "  exit         %lluus (max %lluns)\n", div_u64(st->exit_ns, 1000), st->exit_max_ns);
+	    seq_printf(m, "  histogram (us)\n");
+
+	    for (j = 0; j < DEEPIDLE_HIST_BUCKETS; j++)
+		{
+		    if (!st->hist[j])
+			continue;
+
+		    if (j == 0)
+			seq_printf(m, "    %10s %10u %llu\n", "", 0, st->hist[j]);
+		    else if (j == DEEPIDLE_HIST_BUCKETS - 1)
+			seq_printf(m, "    %10u %10s %llu\n", 1U << (j - 1), "", st->hist[j]);
+		    else
+			seq_printf(m, "    %10u %10u %llu\n", 1U << (j - 1), (1U << j) - 1, st->hist[j]);
+		}
+	}
+
+    seq_printf(m, "vetoes\n");
+
+    for (i = 0; i < DEEPIDLE_NUM_VETOS; i++)
+	seq_printf(m, "  %-20s %llu\n", veto_names[i], snap->veto[i]);
+
+    kfree(snap);
+
+    return 0;
+}
+
+static int deepidle_stats_open(struct inode * inode, struct file * file)
+{
+    return single_open(file, deepidle_stats_show, NULL);
+}
+
+static const struct file_operations deepidle_stats_fops =
+    {
+	.open = deepidle_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+    };
+
+static int deepidle_snapshot_open(struct inode * inode, struct file * file)
+{
+    struct deepidle_snapshot * snap;
+
+    snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+
+    if (!snap)
+	return -ENOMEM;
+
+    take_snapshot(snap);
+
+    file->private_data = snap;
+
+    return 0;
+}
+
+static ssize_t deepidle_snapshot_read(struct file * file, char __user * buf, size_t count, loff_t * ppos)
+{
+    return simple_read_from_buffer(buf, count, ppos, file->private_data, sizeof(struct deepidle_snapshot));
+}
+
+static int deepidle_snapshot_release(struct inode * inode, struct file * file)
+{
+    kfree(file->private_data);
+
+    return 0;
+}
+
+static const struct file_operations deepidle_snapshot_fops =
+    {
+	.open = deepidle_snapshot_open,
+	.read = deepidle_snapshot_read,
+	.llseek = default_llseek,
+	.release = deepidle_snapshot_release,
+    };
+
 bool deepidle_is_enabled(void)
 {
     return deepidle_enabled;
 }
 EXPORT_SYMBOL(deepidle_is_enabled);
 
-void report_idle_time(int idle_state, int idle_time)
+/* Called from the idle path with interrupts disabled */
+void report_idle_time(int idle_state, u64 entry_ns, u64 residency_ns, u64 exit_ns)
 {
-    mutex_lock(&lock);
+    struct deepidle_cpu_stats * stats;
+    struct deepidle_state_stats * st;
+    unsigned int usecs, bucket;
 
-    num_idlecalls[idle_state]++;
-    time_in_idlestate[idle_state] += (unsigned long long)idle_time;
+    stats = get_cpu_stats_for_update();
+    st = &stats->state[idle_state];
 
-    if (num_idlecalls[idle_state] == 0 || time_in_idlestate[idle_state] < (unsigned long long)idle_time)
+    if (residency_ns > (u64)UINT_MAX)
+	bucket = DEEPIDLE_HIST_BUCKETS - 1;
+    else
 	{
-	    reset_stats();
+	    usecs = (unsigned int)residency_ns / 1000;
+	    bucket = min_t(unsigned int, fls(usecs), DEEPIDLE_HIST_BUCKETS - 1);
 	}
 
-    mutex_unlock(&lock);
+    write_seqcount_begin(&stats->seq);
+
+    st->count++;
+    st->residency_ns += residency_ns;
+    st->entry_ns += entry_ns;
+    st->exit_ns += exit_ns;
+
+    if (entry_ns > st->entry_max_ns)
+	st->entry_max_ns = entry_ns;
+
+    if (exit_ns > st->exit_max_ns)
+	st->exit_max_ns = exit_ns;
+
+    st->hist[bucket]++;
+
+    write_seqcount_end(&stats->seq);
 
     return;
 }
 EXPORT_SYMBOL(report_idle_time);
 
+/* Called from the idle path with interrupts disabled */
+void report_idle_veto(int reason)
+{
+    struct deepidle_cpu_stats * stats;
+
+    stats = get_cpu_stats_for_update();
+
+    write_seqcount_begin(&stats->seq);
+    stats->veto[reason]++;
+    write_seqcount_end(&stats->seq);
+
+    return;
+}
+EXPORT_SYMBOL(report_idle_veto);
+
+void deepidle_block(int reason)
+{
+    atomic_inc(&blockers[reason]);
+
+    return;
+}
+EXPORT_SYMBOL(deepidle_block);
+
+void deepidle_unblock(int reason)
+{
+    WARN_ON(atomic_dec_return(&blockers[reason]) < 0);
+
+    return;
+}
+EXPORT_SYMBOL(deepidle_unblock);
+
+bool deepidle_is_blocked(int reason)
+{
+    return atomic_read(&blockers[reason]) > 0;
+}
+EXPORT_SYMBOL(deepidle_is_blocked);
+
 static int __init deepidle_init(void)
 {
-    int ret;
+    int ret, cpu;
 
     pr_info("%s misc_register(%s)\n", __FUNCTION__, deepidle_device.name);
 
     ret = misc_register(&deepidle_device);
 
-    if (ret) 
+    if (ret)
 	{
 	    pr_err("%s misc_register(%s) fail\n", __FUNCTION__, deepidle_device.name);
 
 	    return 1;
 	}
 
-    if (sysfs_create_group(&deepidle_device.this_device->kobj, &deepidle_group) < 0) 
+    if (sysfs_create_group(&deepidle_device.this_device->kobj, &deepidle_group) < 0)
 	{
 	    pr_err("%s sysfs_create_group fail\n", __FUNCTION__);
 	    pr_err("Failed to create sysfs group for device (%s)!\n", deepidle_device.name);
 	}
 
-    mutex_lock(&lock);
+    for_each_possible_cpu(cpu)
+	seqcount_init(&per_cpu(idle_stats, cpu).seq);
+
+    deepidle_debugfs_dir = debugfs_create_dir("deepidle", NULL);
+
+    if (!IS_ERR_OR_NULL(deepidle_debugfs_dir))
+	{
+	    debugfs_create_file("stats", S_IRUGO, deepidle_debugfs_dir, NULL, &deepidle_stats_fops);
+	    debugfs_create_file("snapshot", S_IRUGO, deepidle_debugfs_dir, NULL, &deepidle_snapshot_fops);
+	}
+
     reset_stats();
-    mutex_unlock(&lock);
 
     return 0;
 }
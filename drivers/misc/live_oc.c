@@ -11,12 +11,17 @@
 #include <linux/device.h>
 #include <linux/miscdevice.h>
 
-#define LIVEOC_VERSION 1
+#define LIVEOC_VERSION 2
 
 #define MAX_OCVALUE 150
 
-extern void liveoc_update(unsigned int oc_value);
+#define MAX_LEVELS 16
 
+extern int liveoc_update(unsigned int oc_value);
+extern int liveoc_update_levels(const unsigned int * values);
+extern int liveoc_get_levels(unsigned int * values, unsigned long * target, unsigned long * achieved);
+
+/* common oc value of all levels, 0 once oc_levels set them apart */
 static int oc_value = 100;
 
 static ssize_t liveoc_ocvalue_read(struct device * dev, struct device_attribute * attr, char * buf)
@@ -32,25 +37,114 @@ static ssize_t liveoc_ocvalue_write(struct device * dev, struct device_attribute
 	{
 	    if (data >= 100 && data <= MAX_OCVALUE)
 		{
-		    if (data != oc_value)
+		    if (liveoc_update(data))
 			{
-			    oc_value = data;
-		    
-			    liveoc_update(oc_value);
+			    pr_info("%s: oc-value %u gives invalid levels\n", __FUNCTION__, data);
+
+			    return -EINVAL;
 			}
 
+		    oc_value = data;
+
 		    pr_info("LIVEOC oc-value set to %u\n", oc_value);
 		}
 	    else
 		{
 		    pr_info("%s: invalid input range %u\n", __FUNCTION__, data);
+
+		    return -EINVAL;
 		}
 	} 
     else 
 	{
 	    pr_info("%s: invalid input\n", __FUNCTION__);
+
+	    return -EINVAL;
+	}
+
+    return size;
+}
+
+static ssize_t liveoc_oclevels_read(struct device * dev, struct device_attribute * attr, char * buf)
+{
+    int i, num_levels, len = 0;
+
+    unsigned int values[MAX_LEVELS];
+
+    unsigned long target[MAX_LEVELS], achieved[MAX_LEVELS];
+
+    num_levels = liveoc_get_levels(values, target, achieved);
+
+    for (i = 0; i < num_levels; i++)
+	{
+	    len += sprintf(buf + len, "L%i: %u%% %lumhz", i, values[i], target[i] / 1000);
+
+	    if (achieved[i])
+		len += sprintf(buf + len, " (read back %lumhz)\n", achieved[i] / 1000);
+	    else
+		len += sprintf(buf + len, "\n");
+	}
+
+    return len;
+}
+
+/*
+ * Takes one oc value per level starting with L0. The levels from L3
+ * downwards share one APLL setting and follow the value given for L3.
+ */
+static ssize_t liveoc_oclevels_write(struct device * dev, struct device_attribute * attr, const char * buf, size_t size)
+{
+    int i, num_levels, next;
+
+    unsigned int values[MAX_LEVELS];
+
+    unsigned long target[MAX_LEVELS], achieved[MAX_LEVELS];
+
+    num_levels = liveoc_get_levels(values, target, achieved);
+
+    for (i = 0; i < num_levels; i++)
+	{
+	    if (sscanf(buf, "%u%n", &values[i], &next) != 1)
+		{
+		    pr_info("%s: invalid input\n", __FUNCTION__);
+
+		    return -EINVAL;
+		}
+
+	    if (values[i] < 100 || values[i] > MAX_OCVALUE)
+		{
+		    pr_info("%s: invalid input range %u\n", __FUNCTION__, values[i]);
+
+		    return -EINVAL;
+		}
+
+	    buf += next;
 	}
 
+    if (liveoc_update_levels(values))
+	{
+	    pr_info("%s: levels have to stay strictly descending\n", __FUNCTION__);
+
+	    return -EINVAL;
+	}
+
+    /* the levels below L3 follow it, look at what was applied */
+    liveoc_get_levels(values, target, achieved);
+
+    oc_value = values[0];
+
+    for (i = 1; i < num_levels; i++)
+	{
+	    if (values[i] != oc_value)
+		{
+		    oc_value = 0;
+
+		    break;
+		}
+	}
+
+    pr_info("LIVEOC per level oc-values updated\n");
+
     return size;
 }
 
@@ -60,11 +154,13 @@ static ssize_t liveoc_version(struct device * dev, struct device_attribute * att
 }
 
 static DEVICE_ATTR(oc_value, S_IRUGO | S_IWUGO, liveoc_ocvalue_read, liveoc_ocvalue_write);
+static DEVICE_ATTR(oc_levels, S_IRUGO | S_IWUGO, liveoc_oclevels_read, liveoc_oclevels_write);
 static DEVICE_ATTR(version, S_IRUGO , liveoc_version, NULL);
 
 static struct attribute *liveoc_attributes[] = 
     {
 	&dev_attr_oc_value.attr,
+	&dev_attr_oc_levels.attr,
 	&dev_attr_version.attr,
 	NULL
     };
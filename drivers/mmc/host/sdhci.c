@@ -29,6 +29,8 @@
 
 #include <plat/regs-sdhci.h>
 
+#include <linux/deep_idle.h>
+
 #include "sdhci.h"
 
 #define DRIVER_NAME "sdhci"
@@ -107,10 +109,36 @@ static void sdhci_dumpregs(struct sdhci_host *host)
  *                                                                           *
 \*****************************************************************************/
 
+/*
+ * Keep the SoC out of deep idle while the card clock runs, so the idle
+ * path does not have to poll our registers. The clock is only gated
+ * once CMD_INHIBIT and DATA_INHIBIT have cleared (see
+ * sdhci_busy_check_timer()), so this covers commands in flight as well.
+ * Hosts that have to maintain their clock all the time are not taken
+ * into account.
+ */
+static void sdhci_didle_update(struct sdhci_host *host, bool clock_on)
+{
+	if (host->quirks & SDHCI_QUIRK_MUST_MAINTAIN_CLOCK)
+		return;
+
+	if (host->didle_blocking == clock_on)
+		return;
+
+	host->didle_blocking = clock_on;
+
+	if (clock_on)
+		deepidle_block(DEEPIDLE_VETO_SDMMC);
+	else
+		deepidle_unblock(DEEPIDLE_VETO_SDMMC);
+}
+
 static void sdhci_enable_clock_card(struct sdhci_host *host)
 {
 	u16 clk;
 
+	sdhci_didle_update(host, true);
+
 	clk = readw(host->ioaddr + SDHCI_CLOCK_CONTROL);
 	clk |= SDHCI_CLOCK_CARD_EN;
 	writew(clk, host->ioaddr + SDHCI_CLOCK_CONTROL);
@@ -123,6 +151,8 @@ static void sdhci_disable_clock_card(struct sdhci_host *host)
 	clk = readw(host->ioaddr + SDHCI_CLOCK_CONTROL);
 	clk &= ~SDHCI_CLOCK_CARD_EN;
 	writew(clk, host->ioaddr + SDHCI_CLOCK_CONTROL);
+
+	sdhci_didle_update(host, false);
 }
 
 static void sdhci_clear_set_irqs(struct sdhci_host *host, u32 clear, u32 set)
@@ -1095,6 +1125,7 @@ static void sdhci_set_clock(struct sdhci_host *host, unsigned int clock)
 	}
 
 	sdhci_writew(host, 0, SDHCI_CLOCK_CONTROL);
+	sdhci_didle_update(host, false);
 
 	if (clock == 0)
 		goto out;
@@ -1169,6 +1200,7 @@ static void sdhci_set_clock(struct sdhci_host *host, unsigned int clock)
 		mdelay(1);
 	}
 
+	sdhci_didle_update(host, true);
 	clk |= SDHCI_CLOCK_CARD_EN;
 	sdhci_writew(host, clk, SDHCI_CLOCK_CONTROL);
 
@@ -1598,6 +1630,7 @@ static int sdhci_start_signal_voltage_switch(struct mmc_host *mmc,
 			ctrl = sdhci_readw(host, SDHCI_HOST_CONTROL2);
 			if (ctrl & SDHCI_CTRL_VDD_180) {
 				/* Provide SDCLK again and wait for 1ms*/
+				sdhci_didle_update(host, true);
 				clk = sdhci_readw(host, SDHCI_CLOCK_CONTROL);
 				clk |= SDHCI_CLOCK_CARD_EN;
 				sdhci_writew(host, clk, SDHCI_CLOCK_CONTROL);
@@ -2910,6 +2943,7 @@ void sdhci_remove_host(struct sdhci_host *host, int dead)
 	if (host->version >= SDHCI_SPEC_300)
 		del_timer_sync(&host->tuning_timer);
 	del_timer_sync(&host->busy_check_timer);
+	sdhci_didle_update(host, false);
 
 	tasklet_kill(&host->card_tasklet);
 	tasklet_kill(&host->finish_tasklet);
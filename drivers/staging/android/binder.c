@@ -16,9 +16,12 @@
  */
 
 #include <asm/cacheflush.h>
+#include <linux/atomic.h>
+#include <linux/cgroup.h>
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/hrtimer.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -28,17 +31,49 @@
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * Locking, outermost first:
+ *
+ * binder_main_lock	held for read by every ioctl and poll, so that
+ *			processes and threads seen through transactions
+ *			stay around.  Held for write to release a process
+ *			or thread, to set the context manager and to dump
+ *			state; the write side excludes all of the locks
+ *			below.
+ * proc->lock		threads, nodes and refs trees and the buffer
+ *			allocator of one process.  Work is only ever
+ *			removed from the process' lists with it held.  A
+ *			transaction holds both the sender's and the target's
+ *			lock, taken in address order.
+ * node->lock		refcounts and refs list of one node.
+ * proc->inner_lock	work lists, transaction stacks and thread
+ *			counters of one process and the work, async and
+ *			ref state of the nodes it owns.
+ * binder_dead_nodes_lock
+ * binder_page_lru_lock	the list of cached buffer pages of all processes.
+ *
+ * binder_procs_lock protects the list of processes. It nests inside
+ * binder_main_lock and outside proc->lock.
+ */
+static DECLARE_RWSEM(binder_main_lock);
+static DEFINE_MUTEX(binder_procs_lock);
+static DEFINE_SPINLOCK(binder_dead_nodes_lock);
+static DEFINE_SPINLOCK(binder_page_lru_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 
+static LIST_HEAD(binder_page_lru);
+static int binder_page_lru_count;
+
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
@@ -47,7 +82,7 @@ static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -105,6 +140,24 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/*
+ * Buffer pages that are no longer used by any transaction stay mapped
+ * in the kernel and in the process, up to this many per process, so the
+ * next transaction touching them does not have to map them again. The
+ * shrinker hands them back under memory pressure.
+ */
+static unsigned int binder_page_cache_max = 32;
+module_param_named(page_cache_max, binder_page_cache_max, uint,
+		   S_IWUSR | S_IRUGO);
+
+/*
+ * With inherit_priority cleared a synchronous call only passes on the
+ * nice value of the caller, RT policies and cpu groups are ignored.
+ */
+static int binder_inherit_priority = 1;
+module_param_named(inherit_priority, binder_inherit_priority, bool,
+		   S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -146,22 +199,31 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
+static struct binder_page_stats {
+	atomic_t map;		/* pages mapped into kernel and process */
+	atomic_t unmap;		/* pages unmapped from the kernel */
+	atomic_t zap;		/* pages zapped from the process */
+	atomic_t cache_add;	/* pages parked in the cache on free */
+	atomic_t cache_hit;	/* pages taken from the cache on alloc */
+	atomic_t shrink;	/* cached pages freed by the shrinker */
+} binder_page_stats;
+
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
 struct binder_transaction_log_entry {
@@ -183,11 +245,13 @@ struct binder_transaction_log {
 };
 static struct binder_transaction_log binder_transaction_log;
 static struct binder_transaction_log binder_transaction_log_failed;
+static DEFINE_SPINLOCK(binder_transaction_log_lock);
 
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
+	spin_lock(&binder_transaction_log_lock);
 	e = &log->entry[log->next];
 	memset(e, 0, sizeof(*e));
 	log->next++;
@@ -195,6 +259,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 		log->next = 0;
 		log->full = 1;
 	}
+	spin_unlock(&binder_transaction_log_lock);
 	return e;
 }
 
@@ -210,8 +275,29 @@ struct binder_work {
 	} type;
 };
 
+/*
+ * Latency histogram, bucket i counts samples of less than 2^i us, the
+ * last one everything above. Updated and read without locks.
+ */
+#define BINDER_LATENCY_BUCKETS 20
+
+struct binder_latency_hist {
+	atomic_t bucket[BINDER_LATENCY_BUCKETS];
+};
+
+/*
+ * A scheduling policy with the kernel view of its priority (task->prio
+ * scale, 0..MAX_RT_PRIO-1 for RT, MAX_RT_PRIO..MAX_PRIO-1 otherwise),
+ * so that a lower prio is always the more important one.
+ */
+struct binder_priority {
+	unsigned int sched_policy;
+	int prio;
+};
+
 struct binder_node {
 	int debug_id;
+	spinlock_t lock;
 	struct binder_work work;
 	union {
 		struct rb_node rb_node;
@@ -230,8 +316,10 @@ struct binder_node {
 	unsigned pending_weak_ref:1;
 	unsigned has_async_transaction:1;
 	unsigned accept_fds:1;
-	unsigned min_priority:8;
+	struct binder_priority min_priority;
 	struct list_head async_todo;
+	struct binder_latency_hist dispatch_latency;
+	struct binder_latency_hist reply_latency;
 };
 
 struct binder_ref_death {
@@ -273,6 +361,12 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+struct binder_lru_page {
+	struct list_head lru;		/* on binder_page_lru while cached */
+	struct page *page_ptr;
+	struct binder_proc *proc;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -281,6 +375,8 @@ enum binder_deferred_state {
 
 struct binder_proc {
 	struct hlist_node proc_node;
+	struct mutex lock;
+	spinlock_t inner_lock;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -299,7 +395,8 @@ struct binder_proc {
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
+	int pages_cached;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -310,8 +407,10 @@ struct binder_proc {
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
+	struct binder_priority default_priority;
 	struct dentry *debugfs_entry;
+	struct binder_latency_hist dispatch_latency;
+	struct binder_latency_hist reply_latency;
 };
 
 enum {
@@ -352,14 +451,85 @@ struct binder_transaction {
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
+#ifdef CONFIG_CGROUP_SCHED
+	struct cgroup_subsys_state *css;	/* cpu group of the caller */
+	struct cgroup_subsys_state *saved_css;	/* of to_thread before */
+#endif
 	uid_t	sender_euid;
+	ktime_t	send_time;
 };
 
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
+static s64 binder_latency_add(struct binder_latency_hist *hist,
+			      struct binder_latency_hist *proc_hist,
+			      ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int i = us > 0 ? fls64(us) : 0;
+
+	if (i >= BINDER_LATENCY_BUCKETS)
+		i = BINDER_LATENCY_BUCKETS - 1;
+	if (hist)
+		atomic_inc(&hist->bucket[i]);
+	atomic_inc(&proc_hist->bucket[i]);
+	return us;
+}
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
 
+static inline void binder_inner_proc_lock(struct binder_proc *proc)
+{
+	spin_lock(&proc->inner_lock);
+}
+
+static inline void binder_inner_proc_unlock(struct binder_proc *proc)
+{
+	spin_unlock(&proc->inner_lock);
+}
+
+/*
+ * node->proc only changes with binder_main_lock held for write, so it
+ * is stable for everyone who can get here.
+ */
+static void binder_node_lock(struct binder_node *node)
+{
+	spin_lock(&node->lock);
+	if (node->proc)
+		binder_inner_proc_lock(node->proc);
+}
+
+static void binder_node_unlock(struct binder_node *node)
+{
+	if (node->proc)
+		binder_inner_proc_unlock(node->proc);
+	spin_unlock(&node->lock);
+}
+
+static void binder_proc_lock_pair(struct binder_proc *a, struct binder_proc *b)
+{
+	if (a == b) {
+		mutex_lock(&a->lock);
+		return;
+	}
+	if (a > b)
+		swap(a, b);
+	mutex_lock(&a->lock);
+	mutex_lock_nested(&b->lock, SINGLE_DEPTH_NESTING);
+}
+
+static void binder_proc_unlock_pair(struct binder_proc *a,
+				    struct binder_proc *b)
+{
+	if (a != b)
+		mutex_unlock(&b->lock);
+	mutex_unlock(&a->lock);
+}
+
 /*
  * copied from get_unused_fd_flags
  */
@@ -498,21 +668,237 @@ out_unlock:
 	return -EBADF;
 }
 
-static void binder_set_nice(long nice)
+static bool binder_is_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static int binder_to_userspace_prio(int policy, int kernel_prio)
+{
+	if (binder_is_rt_policy(policy))
+		return MAX_USER_RT_PRIO - 1 - kernel_prio;
+	return kernel_prio - MAX_RT_PRIO - 20;
+}
+
+static int binder_to_kernel_prio(int policy, int user_prio)
+{
+	if (binder_is_rt_policy(policy))
+		return MAX_USER_RT_PRIO - 1 - user_prio;
+	return MAX_RT_PRIO + 20 + user_prio;
+}
+
+static struct binder_priority binder_task_priority(struct task_struct *task)
+{
+	struct binder_priority p;
+
+	p.sched_policy = task->policy;
+	p.prio = task->normal_prio;
+	return p;
+}
+
+/*
+ * Move task to the desired policy and priority. With verify set, a task
+ * without CAP_SYS_NICE is held to its RLIMIT_RTPRIO and RLIMIT_NICE the
+ * same way sched_setscheduler() would; restoring a priority the task
+ * had before is never refused.
+ */
+static void binder_do_set_priority(struct task_struct *task,
+				   struct binder_priority desired, bool verify)
+{
+	unsigned int policy = desired.sched_policy;
+	int priority;
+
+	if (task->policy == policy && task->normal_prio == desired.prio)
+		return;
+
+	priority = binder_to_userspace_prio(policy, desired.prio);
+	if (verify && !has_capability_noaudit(task, CAP_SYS_NICE)) {
+		if (binder_is_rt_policy(policy)) {
+			unsigned long max_rtprio =
+				task_rlimit(task, RLIMIT_RTPRIO);
+
+			if (max_rtprio == 0) {
+				policy = SCHED_NORMAL;
+				priority = -20;
+			} else if (priority > max_rtprio)
+				priority = max_rtprio;
+		}
+		if (!binder_is_rt_policy(policy)) {
+			int min_nice = 20 - task_rlimit(task, RLIMIT_NICE);
+
+			if (min_nice > 19) {
+				binder_user_error("binder: %d RLIMIT_NICE not "
+						  "set\n", task->pid);
+				return;
+			}
+			if (priority < min_nice)
+				priority = min_nice;
+		}
+		if (policy != desired.sched_policy ||
+		    binder_to_kernel_prio(policy, priority) != desired.prio)
+			binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+				     "binder: %d: priority %d:%d not allowed "
+				     "use %d:%d instead\n", task->pid,
+				     desired.sched_policy, desired.prio,
+				     policy,
+				     binder_to_kernel_prio(policy, priority));
+	}
+
+	if (binder_is_rt_policy(policy) || task->policy != policy) {
+		struct sched_param param;
+
+		param.sched_priority = binder_is_rt_policy(policy) ?
+				       priority : 0;
+		sched_setscheduler_nocheck(task, policy, &param);
+	}
+	if (!binder_is_rt_policy(policy))
+		set_user_nice(task, priority);
+}
+
+static void binder_set_priority(struct binder_priority desired)
+{
+	binder_do_set_priority(current, desired, true);
+}
+
+static void binder_restore_priority(struct binder_priority desired)
+{
+	binder_do_set_priority(current, desired, false);
+}
+
+#ifdef CONFIG_CGROUP_SCHED
+/*
+ * The cpu group of a caller is carried along with its priority, so that
+ * a call from the foreground is not served with the cpu.shares of a
+ * server thread parked in the background group. Only tasks in the fair
+ * class can switch groups, so this is done before an RT priority is
+ * inherited and undone after it has been dropped again. Switching takes
+ * cgroup_mutex, so it is only done when the groups differ and never with
+ * proc->lock held.
+ */
+static bool binder_in_cgroup(struct cgroup_subsys_state *css)
+{
+	bool ret;
+
+	rcu_read_lock();
+	ret = task_subsys_state(current, cpu_cgroup_subsys_id) == css;
+	rcu_read_unlock();
+	return ret;
+}
+
+static void binder_save_caller_cgroup(struct binder_transaction *t)
 {
-	long min_nice;
-	if (can_nice(current, nice)) {
-		set_user_nice(current, nice);
+	rcu_read_lock();
+	t->css = task_subsys_state(current, cpu_cgroup_subsys_id);
+	if (!css_tryget(t->css))
+		t->css = NULL;
+	rcu_read_unlock();
+}
+
+static void binder_inherit_cgroup(struct binder_transaction *t)
+{
+	struct cgroup_subsys_state *css;
+
+	if (!t->css || binder_in_cgroup(t->css))
 		return;
+	cgroup_lock();
+	css = task_subsys_state(current, cpu_cgroup_subsys_id);
+	if (css != t->css) {
+		css_get(css);
+		if (cgroup_attach_task(t->css->cgroup, current))
+			css_put(css);
+		else
+			t->saved_css = css;
 	}
-	min_nice = 20 - current->signal->rlim[RLIMIT_NICE].rlim_cur;
-	binder_debug(BINDER_DEBUG_PRIORITY_CAP,
-		     "binder: %d: nice value %ld not allowed use "
-		     "%ld instead\n", current->pid, nice, min_nice);
-	set_user_nice(current, min_nice);
-	if (min_nice < 20)
+	cgroup_unlock();
+}
+
+static void binder_restore_cgroup(struct binder_transaction *t)
+{
+	struct cgroup_subsys_state *css = t->saved_css;
+
+	if (!css)
 		return;
-	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
+	t->saved_css = NULL;
+	if (!binder_in_cgroup(css)) {
+		cgroup_lock();
+		cgroup_attach_task(css->cgroup, current);
+		cgroup_unlock();
+	}
+	css_put(css);
+}
+
+static void binder_put_cgroups(struct binder_transaction *t)
+{
+	if (t->css)
+		css_put(t->css);
+	if (t->saved_css)
+		css_put(t->saved_css);
+}
+#else
+static inline void binder_save_caller_cgroup(struct binder_transaction *t)
+{
+}
+
+static inline void binder_inherit_cgroup(struct binder_transaction *t)
+{
+}
+
+static inline void binder_restore_cgroup(struct binder_transaction *t)
+{
+}
+
+static inline void binder_put_cgroups(struct binder_transaction *t)
+{
+}
+#endif
+
+/*
+ * Called by the thread about to handle t, with proc->lock held so that
+ * t->buffer and its node are still around. Returns the priority to run
+ * t with: a synchronous call runs with the priority of the caller, a
+ * oneway call keeps the priority of the thread; either is raised to the
+ * node's minimum if it is lower.
+ */
+static struct binder_priority
+binder_transaction_priority(struct binder_transaction *t,
+			    struct binder_node *node)
+{
+	struct binder_priority desired;
+
+	t->saved_priority = binder_task_priority(current);
+	if (t->flags & TF_ONE_WAY)
+		desired = t->saved_priority;
+	else if (!binder_inherit_priority) {
+		desired.sched_policy = SCHED_NORMAL;
+		desired.prio = binder_is_rt_policy(t->priority.sched_policy) ?
+			       binder_to_kernel_prio(SCHED_NORMAL, 0) :
+			       t->priority.prio;
+	} else
+		desired = t->priority;
+	if (node->min_priority.prio < desired.prio)
+		desired = node->min_priority;
+	return desired;
+}
+
+/*
+ * Switch to what binder_transaction_priority() picked, moving into the
+ * cpu group of the caller first when its priority is inherited. That
+ * may take cgroup_mutex, so do it for a synchronous call without
+ * proc->lock held.
+ */
+static void binder_apply_priority(struct binder_transaction *t,
+				  struct binder_priority desired)
+{
+	if (!(t->flags & TF_ONE_WAY) && binder_inherit_priority)
+		binder_inherit_cgroup(t);
+	binder_set_priority(desired);
+}
+
+static void binder_free_transaction(struct binder_transaction *t)
+{
+	binder_put_cgroups(t);
+	kfree(t);
+	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 }
 
 static size_t binder_buffer_size(struct binder_proc *proc,
@@ -607,6 +993,44 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static struct binder_lru_page *binder_lru_page(struct binder_proc *proc,
+					       void *page_addr)
+{
+	return &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+}
+
+/*
+ * Park a page that is no longer used by any buffer in the cache, still
+ * mapped. Returns 0 if the cache of proc is full. Call with proc->lock
+ * held.
+ */
+static int binder_cache_page(struct binder_proc *proc,
+			     struct binder_lru_page *lru_page)
+{
+	if (proc->pages_cached >= binder_page_cache_max)
+		return 0;
+
+	spin_lock(&binder_page_lru_lock);
+	list_add_tail(&lru_page->lru, &binder_page_lru);
+	binder_page_lru_count++;
+	spin_unlock(&binder_page_lru_lock);
+	proc->pages_cached++;
+	atomic_inc(&binder_page_stats.cache_add);
+	return 1;
+}
+
+/* Call with proc->lock held */
+static void binder_uncache_page(struct binder_proc *proc,
+				struct binder_lru_page *lru_page)
+{
+	BUG_ON(list_empty(&lru_page->lru));
+	spin_lock(&binder_page_lru_lock);
+	list_del_init(&lru_page->lru);
+	binder_page_lru_count--;
+	spin_unlock(&binder_page_lru_lock);
+	proc->pages_cached--;
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -614,6 +1038,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
+	struct binder_lru_page *lru_page;
 	struct page **page;
 	struct mm_struct *mm;
 
@@ -624,6 +1049,32 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	/*
+	 * Serve what we can from the page cache without touching the
+	 * address space of the process.
+	 */
+	if (allocate) {
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+			if (!binder_lru_page(proc, page_addr)->page_ptr)
+				break;
+		if (page_addr == end) {
+			for (page_addr = start; page_addr < end;
+			     page_addr += PAGE_SIZE) {
+				binder_uncache_page(proc,
+					binder_lru_page(proc, page_addr));
+				atomic_inc(&binder_page_stats.cache_hit);
+			}
+			return 0;
+		}
+	} else {
+		while (end > start &&
+		       binder_cache_page(proc,
+				binder_lru_page(proc, end - PAGE_SIZE)))
+			end -= PAGE_SIZE;
+		if (end <= start)
+			return 0;
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -646,9 +1097,15 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
 		int ret;
 		struct page **page_array_ptr;
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		lru_page = binder_lru_page(proc, page_addr);
+		page = &lru_page->page_ptr;
 
-		BUG_ON(*page);
+		if (*page) {
+			/* still mapped, it was only cached */
+			binder_uncache_page(proc, lru_page);
+			atomic_inc(&binder_page_stats.cache_hit);
+			continue;
+		}
 		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
 		if (*page == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -675,6 +1132,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 			goto err_vm_insert_page_failed;
 		}
 		/* vm_insert_page does not seem to increment the refcount */
+		atomic_inc(&binder_page_stats.map);
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -685,12 +1143,15 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 free_range:
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
+		page = &binder_lru_page(proc, page_addr)->page_ptr;
+		if (vma) {
 			zap_page_range(vma, (uintptr_t)page_addr +
 				proc->user_buffer_offset, PAGE_SIZE, NULL);
+			atomic_inc(&binder_page_stats.zap);
+		}
 err_vm_insert_page_failed:
 		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		atomic_inc(&binder_page_stats.unmap);
 err_map_kernel_failed:
 		__free_page(*page);
 		*page = NULL;
@@ -705,6 +1166,85 @@ err_no_vma:
 	return -ENOMEM;
 }
 
+/*
+ * Give cached pages back to the system, oldest first. Processes that
+ * are busy are skipped rather than waited for, and the teardown of a
+ * process is kept away by binder_main_lock.
+ */
+static int binder_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	int count;
+
+	if (nr_to_scan == 0)
+		return binder_page_lru_count;
+
+	if (!down_read_trylock(&binder_main_lock))
+		return -1;
+
+	spin_lock(&binder_page_lru_lock);
+	while (nr_to_scan-- && !list_empty(&binder_page_lru)) {
+		struct binder_lru_page *lru_page;
+		struct binder_proc *proc;
+		struct vm_area_struct *vma;
+		struct mm_struct *mm;
+		void *page_addr;
+
+		lru_page = list_first_entry(&binder_page_lru,
+					    struct binder_lru_page, lru);
+		proc = lru_page->proc;
+		if (!mutex_trylock(&proc->lock)) {
+			list_move_tail(&lru_page->lru, &binder_page_lru);
+			continue;
+		}
+		mm = get_task_mm(proc->tsk);
+		if (mm && !down_write_trylock(&mm->mmap_sem)) {
+			list_move_tail(&lru_page->lru, &binder_page_lru);
+			mutex_unlock(&proc->lock);
+			/* mmput may sleep */
+			spin_unlock(&binder_page_lru_lock);
+			mmput(mm);
+			spin_lock(&binder_page_lru_lock);
+			continue;
+		}
+		list_del_init(&lru_page->lru);
+		binder_page_lru_count--;
+		spin_unlock(&binder_page_lru_lock);
+
+		proc->pages_cached--;
+		page_addr = proc->buffer +
+			(lru_page - proc->pages) * PAGE_SIZE;
+		vma = mm ? proc->vma : NULL;
+		if (vma) {
+			zap_page_range(vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+			atomic_inc(&binder_page_stats.zap);
+		}
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		atomic_inc(&binder_page_stats.unmap);
+		__free_page(lru_page->page_ptr);
+		lru_page->page_ptr = NULL;
+		atomic_inc(&binder_page_stats.shrink);
+
+		if (mm) {
+			up_write(&mm->mmap_sem);
+			mmput(mm);
+		}
+		mutex_unlock(&proc->lock);
+		spin_lock(&binder_page_lru_lock);
+	}
+	count = binder_page_lru_count;
+	spin_unlock(&binder_page_lru_lock);
+	up_read(&binder_main_lock);
+
+	return count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 					      size_t data_size,
 					      size_t offsets_size, int is_async)
@@ -968,13 +1508,16 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_NODE);
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
+	spin_lock_init(&node->lock);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
 	node->work.type = BINDER_WORK_NODE;
 	INIT_LIST_HEAD(&node->work.entry);
 	INIT_LIST_HEAD(&node->async_todo);
+	node->min_priority.sched_policy = SCHED_NORMAL;
+	node->min_priority.prio = binder_to_kernel_prio(SCHED_NORMAL, 0);
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d:%d node %d u%p c%p created\n",
 		     proc->pid, current->pid, node->debug_id,
@@ -982,8 +1525,28 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
-static int binder_inc_node(struct binder_node *node, int strong, int internal,
-			   struct list_head *target_list)
+static void binder_set_node_min_priority(struct binder_node *node,
+					 unsigned long flags)
+{
+	unsigned int policy = (flags & FLAT_BINDER_FLAG_SCHED_POLICY_MASK) >>
+			      FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT;
+	int priority;
+
+	if (binder_is_rt_policy(policy))
+		priority = clamp_t(int, flags & FLAT_BINDER_FLAG_PRIORITY_MASK,
+				   1, MAX_USER_RT_PRIO - 1);
+	else
+		/* a nice value, libbinder passes 0x7f for "don't care" */
+		priority = clamp_t(int,
+				   (s8)(flags & FLAT_BINDER_FLAG_PRIORITY_MASK),
+				   -20, 19);
+	node->min_priority.sched_policy = policy;
+	node->min_priority.prio = binder_to_kernel_prio(policy, priority);
+}
+
+/* Call with binder_node_lock() held */
+static int __binder_inc_node(struct binder_node *node, int strong,
+			     int internal, struct list_head *target_list)
 {
 	if (strong) {
 		if (internal) {
@@ -1017,7 +1580,28 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 	return 0;
 }
 
-static int binder_dec_node(struct binder_node *node, int strong, int internal)
+/*
+ * target_list has to be a work list of the process owning the node,
+ * it is protected by the same inner lock.
+ */
+static int binder_inc_node(struct binder_node *node, int strong, int internal,
+			   struct list_head *target_list)
+{
+	int ret;
+
+	binder_node_lock(node);
+	ret = __binder_inc_node(node, strong, internal, target_list);
+	binder_node_unlock(node);
+	return ret;
+}
+
+/*
+ * Call with binder_node_lock() held. Nodes still attached to a process
+ * are only unlinked by that process under proc->lock, which the caller
+ * may not hold, so a refless node gets queued to its owner instead.
+ * Returns 1 if a dead node has to be freed by the caller.
+ */
+static int __binder_dec_node(struct binder_node *node, int strong, int internal)
 {
 	if (strong) {
 		if (internal)
@@ -1040,26 +1624,50 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 	} else {
 		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
 		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
 			if (node->proc) {
-				rb_erase(&node->rb_node, &node->proc->nodes);
+				if (list_empty(&node->work.entry)) {
+					list_add_tail(&node->work.entry,
+						      &node->proc->todo);
+					wake_up_interruptible(&node->proc->wait);
+				}
 				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: refless node %d deleted\n",
-					     node->debug_id);
+					     "binder: refless node %d queued "
+					     "for deletion\n", node->debug_id);
 			} else {
+				list_del_init(&node->work.entry);
+				spin_lock(&binder_dead_nodes_lock);
 				hlist_del(&node->dead_node);
+				spin_unlock(&binder_dead_nodes_lock);
 				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 					     "binder: dead node %d deleted\n",
 					     node->debug_id);
+				return 1;
 			}
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
 		}
 	}
 
 	return 0;
 }
 
+static void binder_free_node(struct binder_node *node)
+{
+	kfree(node);
+	binder_stats_deleted(BINDER_STAT_NODE);
+}
+
+static int binder_dec_node(struct binder_node *node, int strong, int internal)
+{
+	int free_node;
+
+	binder_node_lock(node);
+	free_node = __binder_dec_node(node, strong, internal);
+	binder_node_unlock(node);
+	if (free_node)
+		binder_free_node(node);
+
+	return 0;
+}
+
 
 static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 					 uint32_t desc)
@@ -1103,7 +1711,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1132,7 +1740,9 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
 	if (node) {
+		binder_node_lock(node);
 		hlist_add_head(&new_ref->node_entry, &node->refs);
+		binder_node_unlock(node);
 
 		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 			     "binder: %d new ref %d desc %d for "
@@ -1147,8 +1757,11 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	return new_ref;
 }
 
+/* Call with ref->proc->lock held */
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	int free_node;
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
@@ -1156,16 +1769,22 @@ static void binder_delete_ref(struct binder_ref *ref)
 
 	rb_erase(&ref->rb_node_desc, &ref->proc->refs_by_desc);
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
+	binder_node_lock(ref->node);
 	if (ref->strong)
-		binder_dec_node(ref->node, 1, 1);
+		__binder_dec_node(ref->node, 1, 1);
 	hlist_del(&ref->node_entry);
-	binder_dec_node(ref->node, 0, 1);
+	free_node = __binder_dec_node(ref->node, 0, 1);
+	binder_node_unlock(ref->node);
+	if (free_node)
+		binder_free_node(ref->node);
 	if (ref->death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
+		binder_inner_proc_lock(ref->proc);
 		list_del(&ref->death->work.entry);
+		binder_inner_proc_unlock(ref->proc);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1228,6 +1847,10 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
+/*
+ * Call with the inner lock of target_thread's process and the proc->lock
+ * of the process owning t->buffer held.
+ */
 static void binder_pop_transaction(struct binder_thread *target_thread,
 				   struct binder_transaction *t)
 {
@@ -1241,10 +1864,10 @@ static void binder_pop_transaction(struct binder_thread *target_thread,
 	t->need_reply = 0;
 	if (t->buffer)
 		t->buffer->transaction = NULL;
-	kfree(t);
-	binder_stats_deleted(BINDER_STAT_TRANSACTION);
+	binder_free_transaction(t);
 }
 
+/* Call with the proc->lock of the process that received t held */
 static void binder_send_failed_reply(struct binder_transaction *t,
 				     uint32_t error_code)
 {
@@ -1253,6 +1876,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	while (1) {
 		target_thread = t->from;
 		if (target_thread) {
+			binder_inner_proc_lock(target_thread->proc);
 			if (target_thread->return_error != BR_OK &&
 			   target_thread->return_error2 == BR_OK) {
 				target_thread->return_error2 =
@@ -1268,6 +1892,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 
 				binder_pop_transaction(target_thread, t);
 				target_thread->return_error = error_code;
+				binder_inner_proc_unlock(target_thread->proc);
 				wake_up_interruptible(&target_thread->wait);
 			} else {
 				printk(KERN_ERR "binder: reply failed, target "
@@ -1275,6 +1900,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 					"already\n", target_thread->proc->pid,
 					target_thread->pid,
 					target_thread->return_error);
+				binder_inner_proc_unlock(target_thread->proc);
 			}
 			return;
 		} else {
@@ -1300,6 +1926,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	}
 }
 
+/* Call with proc->lock held */
 static void binder_transaction_buffer_release(struct binder_proc *proc,
 					      struct binder_buffer *buffer,
 					      size_t *failed_at)
@@ -1389,6 +2016,7 @@ static void binder_transaction(struct binder_proc *proc,
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
+	struct binder_latency_hist *reply_hist = NULL;
 	uint32_t return_error;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
@@ -1400,15 +2028,19 @@ static void binder_transaction(struct binder_proc *proc,
 	e->offsets_size = tr->offsets_size;
 
 	if (reply) {
+		struct binder_priority saved_priority;
+
+		binder_inner_proc_lock(proc);
 		in_reply_to = thread->transaction_stack;
 		if (in_reply_to == NULL) {
+			binder_inner_proc_unlock(proc);
 			binder_user_error("binder: %d:%d got reply transaction "
 					  "with no transaction stack\n",
 					  proc->pid, thread->pid);
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		saved_priority = in_reply_to->saved_priority;
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1418,16 +2050,22 @@ static void binder_transaction(struct binder_proc *proc,
 				in_reply_to->to_proc->pid : 0,
 				in_reply_to->to_thread ?
 				in_reply_to->to_thread->pid : 0);
+			binder_inner_proc_unlock(proc);
+			binder_set_priority(saved_priority);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
 			goto err_bad_call_stack;
 		}
 		thread->transaction_stack = in_reply_to->to_parent;
+		binder_inner_proc_unlock(proc);
+		binder_restore_priority(saved_priority);
+		binder_restore_cgroup(in_reply_to);
 		target_thread = in_reply_to->from;
 		if (target_thread == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		binder_inner_proc_lock(target_thread->proc);
 		if (target_thread->transaction_stack != in_reply_to) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad target transaction stack %d, "
@@ -1436,17 +2074,21 @@ static void binder_transaction(struct binder_proc *proc,
 				target_thread->transaction_stack ?
 				target_thread->transaction_stack->debug_id : 0,
 				in_reply_to->debug_id);
+			binder_inner_proc_unlock(target_thread->proc);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
 			target_thread = NULL;
 			goto err_dead_binder;
 		}
+		binder_inner_proc_unlock(target_thread->proc);
 		target_proc = target_thread->proc;
 	} else {
+		mutex_lock(&proc->lock);
 		if (tr->target.handle) {
 			struct binder_ref *ref;
 			ref = binder_get_ref(proc, tr->target.handle);
 			if (ref == NULL) {
+				mutex_unlock(&proc->lock);
 				binder_user_error("binder: %d:%d got "
 					"transaction to invalid handle\n",
 					proc->pid, thread->pid);
@@ -1457,6 +2099,7 @@ static void binder_transaction(struct binder_proc *proc,
 		} else {
 			target_node = binder_context_mgr_node;
 			if (target_node == NULL) {
+				mutex_unlock(&proc->lock);
 				return_error = BR_DEAD_REPLY;
 				goto err_no_context_mgr_node;
 			}
@@ -1464,13 +2107,24 @@ static void binder_transaction(struct binder_proc *proc,
 		e->to_node = target_node->debug_id;
 		target_proc = target_node->proc;
 		if (target_proc == NULL) {
+			mutex_unlock(&proc->lock);
+			target_node = NULL;
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
-		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		/*
+		 * Our ref may go away as soon as proc->lock is dropped, so
+		 * pin the node here. The reference is handed over to
+		 * t->buffer->target_node once the buffer is allocated.
+		 */
+		binder_inc_node(target_node, 1, 0, NULL);
+		mutex_unlock(&proc->lock);
+		if (!(tr->flags & TF_ONE_WAY)) {
 			struct binder_transaction *tmp;
+
+			binder_inner_proc_lock(proc);
 			tmp = thread->transaction_stack;
-			if (tmp->to_thread != thread) {
+			if (tmp && tmp->to_thread != thread) {
 				binder_user_error("binder: %d:%d got new "
 					"transaction with bad transaction stack"
 					", transaction %d has target %d:%d\n",
@@ -1478,6 +2132,7 @@ static void binder_transaction(struct binder_proc *proc,
 					tmp->to_proc ? tmp->to_proc->pid : 0,
 					tmp->to_thread ?
 					tmp->to_thread->pid : 0);
+				binder_inner_proc_unlock(proc);
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
@@ -1486,6 +2141,7 @@ static void binder_transaction(struct binder_proc *proc,
 					target_thread = tmp->from;
 				tmp = tmp->from_parent;
 			}
+			binder_inner_proc_unlock(proc);
 		}
 	}
 	if (target_thread) {
@@ -1513,7 +2169,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1542,10 +2198,14 @@ static void binder_transaction(struct binder_proc *proc,
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
+	t->priority = binder_task_priority(current);
+	if (!reply && !(t->flags & TF_ONE_WAY))
+		binder_save_caller_cgroup(t);
+	mutex_lock(&target_proc->lock);
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
+		mutex_unlock(&target_proc->lock);
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
@@ -1553,9 +2213,12 @@ static void binder_transaction(struct binder_proc *proc,
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
+	mutex_unlock(&target_proc->lock);
 
+	/*
+	 * The buffer is not visible to the target until the transaction
+	 * is queued, so the copy needs no locks.
+	 */
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
 	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
@@ -1570,6 +2233,8 @@ static void binder_transaction(struct binder_proc *proc,
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
+
+	binder_proc_lock_pair(proc, target_proc);
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1601,7 +2266,7 @@ static void binder_transaction(struct binder_proc *proc,
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+				binder_set_node_min_priority(node, fp->flags);
 				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
@@ -1715,31 +2380,73 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
+
+	/*
+	 * tcomplete must be on our todo list before the target can see t,
+	 * otherwise a fast reply could overtake BR_TRANSACTION_COMPLETE.
+	 */
+	t->work.type = BINDER_WORK_TRANSACTION;
+	t->send_time = ktime_get();
+	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+	binder_inner_proc_lock(proc);
+	list_add_tail(&tcomplete->entry, &thread->todo);
+	if (!reply && !(t->flags & TF_ONE_WAY)) {
+		t->need_reply = 1;
+		t->from_parent = thread->transaction_stack;
+		thread->transaction_stack = t;
+	}
+	binder_inner_proc_unlock(proc);
+
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		binder_inner_proc_lock(target_proc);
+		if (target_thread->transaction_stack != in_reply_to) {
+			/* the caller was failed while we built the reply */
+			binder_inner_proc_unlock(target_proc);
+			binder_inner_proc_lock(proc);
+			list_del(&tcomplete->entry);
+			binder_inner_proc_unlock(proc);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			goto err_dead_target;
+		}
+		/* time spent by us on the call, dispatch included */
+		if (in_reply_to->buffer && in_reply_to->buffer->target_node)
+			reply_hist = &in_reply_to->buffer->target_node->reply_latency;
+		binder_latency_add(reply_hist, &proc->reply_latency,
+				   in_reply_to->send_time);
 		binder_pop_transaction(target_thread, in_reply_to);
+		list_add_tail(&t->work.entry, target_list);
+		binder_inner_proc_unlock(target_proc);
+		trace_binder_reply_send(t, NULL);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
-		t->need_reply = 1;
-		t->from_parent = thread->transaction_stack;
-		thread->transaction_stack = t;
+		binder_inner_proc_lock(target_proc);
+		list_add_tail(&t->work.entry, target_list);
+		binder_inner_proc_unlock(target_proc);
+		trace_binder_transaction_send(t, target_node);
 	} else {
 		BUG_ON(target_node == NULL);
 		BUG_ON(t->buffer->async_transaction != 1);
+		binder_node_lock(target_node);
 		if (target_node->has_async_transaction) {
 			target_list = &target_node->async_todo;
 			target_wait = NULL;
 		} else
 			target_node->has_async_transaction = 1;
+		list_add_tail(&t->work.entry, target_list);
+		binder_node_unlock(target_node);
+		trace_binder_transaction_send(t, target_node);
 	}
-	t->work.type = BINDER_WORK_TRANSACTION;
-	list_add_tail(&t->work.entry, target_list);
-	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
-	list_add_tail(&tcomplete->entry, &thread->todo);
+	/* the target cannot consume t before we drop its proc->lock */
+	binder_proc_unlock_pair(proc, target_proc);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
 	return;
 
+err_copy_data_failed:
+	binder_proc_lock_pair(proc, target_proc);
+err_dead_target:
 err_get_unused_fd_failed:
 err_fget_failed:
 err_fd_not_allowed:
@@ -1748,18 +2455,21 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
-err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
+	binder_proc_unlock_pair(proc, target_proc);
+	/* the node reference was dropped with the buffer */
+	target_node = NULL;
 err_binder_alloc_buf_failed:
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
-	kfree(t);
-	binder_stats_deleted(BINDER_STAT_TRANSACTION);
+	binder_free_transaction(t);
 err_alloc_t_failed:
 err_bad_call_stack:
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
 err_empty_call_stack:
 err_dead_binder:
 err_invalid_target_handle:
@@ -1775,12 +2485,24 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
-	BUG_ON(thread->return_error != BR_OK);
-	if (in_reply_to) {
+	binder_inner_proc_lock(proc);
+	/*
+	 * A failed reply for one of our own outgoing transactions may
+	 * have been posted while we were not holding the lock, keep it.
+	 */
+	if (thread->return_error != BR_OK &&
+	    thread->return_error2 == BR_OK)
+		thread->return_error2 = thread->return_error;
+	if (in_reply_to)
 		thread->return_error = BR_TRANSACTION_COMPLETE;
-		binder_send_failed_reply(in_reply_to, return_error);
-	} else
+	else
 		thread->return_error = return_error;
+	binder_inner_proc_unlock(proc);
+	if (in_reply_to) {
+		mutex_lock(&proc->lock);
+		binder_send_failed_reply(in_reply_to, return_error);
+		mutex_unlock(&proc->lock);
+	}
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1795,9 +2517,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1811,6 +2533,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(target, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
+			mutex_lock(&proc->lock);
 			if (target == 0 && binder_context_mgr_node &&
 			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
 				ref = binder_get_ref_for_node(proc,
@@ -1826,6 +2549,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			} else
 				ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				mutex_unlock(&proc->lock);
 				binder_user_error("binder: %d:%d refcou"
 					"nt change on invalid ref %d\n",
 					proc->pid, thread->pid, target);
@@ -1854,6 +2578,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d %s ref %d desc %d s %d w %d for node %d\n",
 				     proc->pid, thread->pid, debug_string, ref->debug_id,
 				     ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+			mutex_unlock(&proc->lock);
 			break;
 		}
 		case BC_INCREFS_DONE:
@@ -1868,8 +2593,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(cookie, (void * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
+			mutex_lock(&proc->lock);
 			node = binder_get_node(proc, node_ptr);
 			if (node == NULL) {
+				mutex_unlock(&proc->lock);
 				binder_user_error("binder: %d:%d "
 					"%s u%p no match\n",
 					proc->pid, thread->pid,
@@ -1887,8 +2614,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					"BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 					node_ptr, node->debug_id,
 					cookie, node->cookie);
+				mutex_unlock(&proc->lock);
 				break;
 			}
+			binder_node_lock(node);
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
 					binder_user_error("binder: %d:%d "
@@ -1896,6 +2625,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"no pending acquire request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
+					binder_node_unlock(node);
+					mutex_unlock(&proc->lock);
 					break;
 				}
 				node->pending_strong_ref = 0;
@@ -1906,16 +2637,21 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"no pending increfs request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
+					binder_node_unlock(node);
+					mutex_unlock(&proc->lock);
 					break;
 				}
 				node->pending_weak_ref = 0;
 			}
-			binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			/* a live node is never freed from here */
+			__binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			binder_node_unlock(node);
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s node %d ls %d lw %d\n",
 				     proc->pid, thread->pid,
 				     cmd == BC_INCREFS_DONE ? "BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 				     node->debug_id, node->local_strong_refs, node->local_weak_refs);
+			mutex_unlock(&proc->lock);
 			break;
 		}
 		case BC_ATTEMPT_ACQUIRE:
@@ -1933,14 +2669,17 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
 			if (buffer == NULL) {
+				mutex_unlock(&proc->lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
 			if (!buffer->allow_user_free) {
+				mutex_unlock(&proc->lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
@@ -1957,14 +2696,19 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				buffer->transaction = NULL;
 			}
 			if (buffer->async_transaction && buffer->target_node) {
-				BUG_ON(!buffer->target_node->has_async_transaction);
-				if (list_empty(&buffer->target_node->async_todo))
-					buffer->target_node->has_async_transaction = 0;
+				struct binder_node *node = buffer->target_node;
+
+				binder_node_lock(node);
+				BUG_ON(!node->has_async_transaction);
+				if (list_empty(&node->async_todo))
+					node->has_async_transaction = 0;
 				else
-					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+					list_move_tail(node->async_todo.next, &thread->todo);
+				binder_node_unlock(node);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
+			mutex_unlock(&proc->lock);
 			break;
 		}
 
@@ -1983,6 +2727,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_REGISTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			binder_inner_proc_lock(proc);
 			if (thread->looper & BINDER_LOOPER_STATE_ENTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -2000,6 +2745,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				proc->requested_threads_started++;
 			}
 			thread->looper |= BINDER_LOOPER_STATE_REGISTERED;
+			binder_inner_proc_unlock(proc);
 			break;
 		case BC_ENTER_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
@@ -2034,8 +2780,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(cookie, (void __user * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
+			mutex_lock(&proc->lock);
 			ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				mutex_unlock(&proc->lock);
 				binder_user_error("binder: %d:%d %s "
 					"invalid ref %d\n",
 					proc->pid, thread->pid,
@@ -2062,11 +2810,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"FICATION death notific"
 						"ation already set\n",
 						proc->pid, thread->pid);
+					mutex_unlock(&proc->lock);
 					break;
 				}
 				death = kzalloc(sizeof(*death), GFP_KERNEL);
 				if (death == NULL) {
+					mutex_unlock(&proc->lock);
+					binder_inner_proc_lock(proc);
 					thread->return_error = BR_ERROR;
+					binder_inner_proc_unlock(proc);
 					binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 						     "binder: %d:%d "
 						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
@@ -2077,14 +2829,17 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				INIT_LIST_HEAD(&death->work.entry);
 				death->cookie = cookie;
 				ref->death = death;
+				/* node->proc only changes with binder_main_lock held for write */
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+					binder_inner_proc_lock(proc);
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
 						list_add_tail(&ref->death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&ref->death->work.entry, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
+					binder_inner_proc_unlock(proc);
 				}
 			} else {
 				if (ref->death == NULL) {
@@ -2093,6 +2848,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"CATION death notificat"
 						"ion not active\n",
 						proc->pid, thread->pid);
+					mutex_unlock(&proc->lock);
 					break;
 				}
 				death = ref->death;
@@ -2104,9 +2860,11 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"%p != %p\n",
 						proc->pid, thread->pid,
 						death->cookie, cookie);
+					mutex_unlock(&proc->lock);
 					break;
 				}
 				ref->death = NULL;
+				binder_inner_proc_lock(proc);
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
@@ -2119,7 +2877,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
+				binder_inner_proc_unlock(proc);
 			}
+			mutex_unlock(&proc->lock);
 		} break;
 		case BC_DEAD_BINDER_DONE: {
 			struct binder_work *w;
@@ -2129,6 +2889,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 
 			ptr += sizeof(void *);
+			mutex_lock(&proc->lock);
+			binder_inner_proc_lock(proc);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
 				struct binder_ref_death *tmp_death = container_of(w, struct binder_ref_death, work);
 				if (tmp_death->cookie == cookie) {
@@ -2140,6 +2902,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d BC_DEAD_BINDER_DONE %p found %p\n",
 				     proc->pid, thread->pid, cookie, death);
 			if (death == NULL) {
+				binder_inner_proc_unlock(proc);
+				mutex_unlock(&proc->lock);
 				binder_user_error("binder: %d:%d BC_DEAD"
 					"_BINDER_DONE %p not found\n",
 					proc->pid, thread->pid, cookie);
@@ -2156,6 +2920,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			binder_inner_proc_unlock(proc);
+			mutex_unlock(&proc->lock);
 		} break;
 
 		default:
@@ -2172,9 +2938,9 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2201,6 +2967,9 @@ static int binder_thread_read(struct binder_proc *proc,
 
 	int ret = 0;
 	int wait_for_proc_work;
+	ktime_t wait_start;
+	struct binder_transaction *sync_t = NULL;
+	struct binder_priority desired;
 
 	if (*consumed == 0) {
 		if (put_user(BR_NOOP, (uint32_t __user *)ptr))
@@ -2209,22 +2978,33 @@ static int binder_thread_read(struct binder_proc *proc,
 	}
 
 retry:
+	binder_inner_proc_lock(proc);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 				list_empty(&thread->todo);
 
 	if (thread->return_error != BR_OK && ptr < end) {
-		if (thread->return_error2 != BR_OK) {
-			if (put_user(thread->return_error2, (uint32_t __user *)ptr))
+		uint32_t return_error = thread->return_error;
+		uint32_t return_error2 = thread->return_error2;
+
+		binder_inner_proc_unlock(proc);
+		if (return_error2 != BR_OK) {
+			if (put_user(return_error2, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
 			if (ptr == end)
 				goto done;
-			thread->return_error2 = BR_OK;
+			binder_inner_proc_lock(proc);
+			if (thread->return_error2 == return_error2)
+				thread->return_error2 = BR_OK;
+			binder_inner_proc_unlock(proc);
 		}
-		if (put_user(thread->return_error, (uint32_t __user *)ptr))
+		if (put_user(return_error, (uint32_t __user *)ptr))
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
-		thread->return_error = BR_OK;
+		binder_inner_proc_lock(proc);
+		if (thread->return_error == return_error)
+			thread->return_error = BR_OK;
+		binder_inner_proc_unlock(proc);
 		goto done;
 	}
 
@@ -2232,7 +3012,9 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	binder_inner_proc_unlock(proc);
+	up_read(&binder_main_lock);
+	wait_start = ktime_get();
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2243,7 +3025,7 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
+		binder_set_priority(proc->default_priority);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
 				ret = -EAGAIN;
@@ -2256,29 +3038,43 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	down_read(&binder_main_lock);
+	binder_inner_proc_lock(proc);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
+	binder_inner_proc_unlock(proc);
 
 	if (ret)
 		return ret;
+	trace_binder_wakeup(proc->pid, thread->pid, wait_for_proc_work,
+			    ktime_us_delta(ktime_get(), wait_start));
 
+	/*
+	 * Work is only ever taken off our lists with proc->lock held, so
+	 * the entry we peek at stays at the head until we remove it.
+	 */
+	mutex_lock(&proc->lock);
 	while (1) {
 		uint32_t cmd;
 		struct binder_transaction_data tr;
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
 
+		binder_inner_proc_lock(proc);
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
 		else if (!list_empty(&proc->todo) && wait_for_proc_work)
 			w = list_first_entry(&proc->todo, struct binder_work, entry);
 		else {
-			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
+			binder_inner_proc_unlock(proc);
+			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) { /* no data added */
+				mutex_unlock(&proc->lock);
 				goto retry;
+			}
 			break;
 		}
+		binder_inner_proc_unlock(proc);
 
 		if (end - ptr < sizeof(tr) + 4)
 			break;
@@ -2290,7 +3086,7 @@ retry:
 		case BINDER_WORK_TRANSACTION_COMPLETE: {
 			cmd = BR_TRANSACTION_COMPLETE;
 			if (put_user(cmd, (uint32_t __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(uint32_t);
 
 			binder_stat_br(proc, thread, cmd);
@@ -2298,7 +3094,9 @@ retry:
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
 
+			binder_inner_proc_lock(proc);
 			list_del(&w->entry);
+			binder_inner_proc_unlock(proc);
 			kfree(w);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
@@ -2306,8 +3104,12 @@ retry:
 			struct binder_node *node = container_of(w, struct binder_node, work);
 			uint32_t cmd = BR_NOOP;
 			const char *cmd_name;
-			int strong = node->internal_strong_refs || node->local_strong_refs;
-			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+			int strong, weak;
+			int free_node = 0;
+
+			binder_node_lock(node);
+			strong = node->internal_strong_refs || node->local_strong_refs;
+			weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2329,15 +3131,24 @@ retry:
 				cmd_name = "BR_DECREFS";
 				node->has_weak_ref = 0;
 			}
+			if (cmd == BR_NOOP) {
+				list_del_init(&w->entry);
+				if (!weak && !strong) {
+					rb_erase(&node->rb_node, &proc->nodes);
+					free_node = 1;
+				}
+			}
+			binder_node_unlock(node);
+
 			if (cmd != BR_NOOP) {
 				if (put_user(cmd, (uint32_t __user *)ptr))
-					return -EFAULT;
+					goto err_fault;
 				ptr += sizeof(uint32_t);
 				if (put_user(node->ptr, (void * __user *)ptr))
-					return -EFAULT;
+					goto err_fault;
 				ptr += sizeof(void *);
 				if (put_user(node->cookie, (void * __user *)ptr))
-					return -EFAULT;
+					goto err_fault;
 				ptr += sizeof(void *);
 
 				binder_stat_br(proc, thread, cmd);
@@ -2345,15 +3156,12 @@ retry:
 					     "binder: %d:%d %s %d u%p c%p\n",
 					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
 			} else {
-				list_del_init(&w->entry);
-				if (!weak && !strong) {
+				if (free_node) {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p deleted\n",
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
-					rb_erase(&node->rb_node, &proc->nodes);
-					kfree(node);
-					binder_stats_deleted(BINDER_STAT_NODE);
+					binder_free_node(node);
 				} else {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p state unchanged\n",
@@ -2374,10 +3182,10 @@ retry:
 			else
 				cmd = BR_DEAD_BINDER;
 			if (put_user(cmd, (uint32_t __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(uint32_t);
 			if (put_user(death->cookie, (void * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(void *);
 			binder_debug(BINDER_DEBUG_DEATH_NOTIFICATION,
 				     "binder: %d:%d %s %p\n",
@@ -2387,14 +3195,18 @@ retry:
 				      "BR_CLEAR_DEATH_NOTIFICATION_DONE",
 				      death->cookie);
 
+			binder_inner_proc_lock(proc);
 			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
 				list_del(&w->entry);
+				binder_inner_proc_unlock(proc);
 				kfree(death);
 				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
+			} else {
 				list_move(&w->entry, &proc->delivered_death);
+				binder_inner_proc_unlock(proc);
+			}
 			if (cmd == BR_DEAD_BINDER)
-				goto done; /* DEAD_BINDER notifications can cause transactions */
+				goto done_unlock; /* DEAD_BINDER notifications can cause transactions */
 		} break;
 		}
 
@@ -2406,13 +3218,9 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			desired = binder_transaction_priority(t, target_node);
+			if (t->flags & TF_ONE_WAY)
+				binder_apply_priority(t, desired);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2440,13 +3248,22 @@ retry:
 					    sizeof(void *));
 
 		if (put_user(cmd, (uint32_t __user *)ptr))
-			return -EFAULT;
+			goto err_fault;
 		ptr += sizeof(uint32_t);
 		if (copy_to_user(ptr, &tr, sizeof(tr)))
-			return -EFAULT;
+			goto err_fault;
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
+		if (cmd == BR_TRANSACTION) {
+			s64 us = binder_latency_add(
+				&t->buffer->target_node->dispatch_latency,
+				&proc->dispatch_latency, t->send_time);
+			trace_binder_transaction_received(t, proc->pid,
+							  thread->pid, us);
+		} else
+			trace_binder_reply_received(t, proc->pid, thread->pid,
+				ktime_us_delta(ktime_get(), t->send_time));
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
 			     "size %zd-%zd ptr %p-%p\n",
@@ -2458,36 +3275,56 @@ retry:
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
 
+		binder_inner_proc_lock(proc);
 		list_del(&t->work.entry);
 		t->buffer->allow_user_free = 1;
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
 			t->to_thread = thread;
 			thread->transaction_stack = t;
+			binder_inner_proc_unlock(proc);
+			sync_t = t;
 		} else {
+			binder_inner_proc_unlock(proc);
 			t->buffer->transaction = NULL;
-			kfree(t);
-			binder_stats_deleted(BINDER_STAT_TRANSACTION);
+			binder_free_transaction(t);
 		}
 		break;
 	}
 
+done_unlock:
+	mutex_unlock(&proc->lock);
+	/*
+	 * sync_t is on our transaction stack now and only goes away with
+	 * our reply or binder_main_lock held for write. Its buffer can be
+	 * freed by another thread from here on, which is why desired was
+	 * worked out before.
+	 */
+	if (sync_t)
+		binder_apply_priority(sync_t, desired);
 done:
 
 	*consumed = ptr - buffer;
+	binder_inner_proc_lock(proc);
 	if (proc->requested_threads + proc->ready_threads == 0 &&
 	    proc->requested_threads_started < proc->max_threads &&
 	    (thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 	     BINDER_LOOPER_STATE_ENTERED)) /* the user-space code fails to */
 	     /*spawn a new thread if we leave this out */) {
 		proc->requested_threads++;
+		binder_inner_proc_unlock(proc);
 		binder_debug(BINDER_DEBUG_THREADS,
 			     "binder: %d:%d BR_SPAWN_LOOPER\n",
 			     proc->pid, thread->pid);
 		if (put_user(BR_SPAWN_LOOPER, (uint32_t __user *)buffer))
 			return -EFAULT;
-	}
+	} else
+		binder_inner_proc_unlock(proc);
 	return 0;
+
+err_fault:
+	mutex_unlock(&proc->lock);
+	return -EFAULT;
 }
 
 static void binder_release_work(struct list_head *list)
@@ -2521,6 +3358,7 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 	struct rb_node *parent = NULL;
 	struct rb_node **p = &proc->threads.rb_node;
 
+	mutex_lock(&proc->lock);
 	while (*p) {
 		parent = *p;
 		thread = rb_entry(parent, struct binder_thread, rb_node);
@@ -2535,7 +3373,7 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 	if (*p == NULL) {
 		thread = kzalloc(sizeof(*thread), GFP_KERNEL);
 		if (thread == NULL)
-			return NULL;
+			goto out;
 		binder_stats_created(BINDER_STAT_THREAD);
 		thread->proc = proc;
 		thread->pid = current->pid;
@@ -2547,9 +3385,35 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		thread->return_error = BR_OK;
 		thread->return_error2 = BR_OK;
 	}
+out:
+	mutex_unlock(&proc->lock);
 	return thread;
 }
 
+/*
+ * Undo what transactions still waiting for a reply from thread did to
+ * its priority and cpu group, innermost first, so that a thread leaving
+ * without replying does not keep running as its callers. Call from the
+ * thread itself with binder_main_lock held for write.
+ */
+static void binder_restore_thread(struct binder_thread *thread)
+{
+	struct binder_transaction *t = thread->transaction_stack;
+	struct binder_transaction *outermost = NULL;
+
+	while (t) {
+		if (t->to_thread == thread) {
+			binder_restore_cgroup(t);
+			outermost = t;
+			t = t->to_parent;
+		} else
+			t = t->from_parent;
+	}
+	if (outermost)
+		binder_restore_priority(outermost->saved_priority);
+}
+
+/* Call with binder_main_lock held for write */
 static int binder_free_thread(struct binder_proc *proc,
 			      struct binder_thread *thread)
 {
@@ -2598,12 +3462,14 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	down_read(&binder_main_lock);
 	thread = binder_get_thread(proc);
 
+	binder_inner_proc_lock(proc);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	binder_inner_proc_unlock(proc);
+	up_read(&binder_main_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2621,6 +3487,33 @@ static unsigned int binder_poll(struct file *filp,
 	return 0;
 }
 
+/* Call with binder_main_lock held for write */
+static int binder_set_context_mgr(struct binder_proc *proc)
+{
+	if (binder_context_mgr_node != NULL) {
+		printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
+		return -EBUSY;
+	}
+	if (binder_context_mgr_uid != -1) {
+		if (binder_context_mgr_uid != current->cred->euid) {
+			printk(KERN_ERR "binder: BINDER_SET_"
+			       "CONTEXT_MGR bad uid %d != %d\n",
+			       current->cred->euid,
+			       binder_context_mgr_uid);
+			return -EPERM;
+		}
+	} else
+		binder_context_mgr_uid = current->cred->euid;
+	binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
+	if (binder_context_mgr_node == NULL)
+		return -ENOMEM;
+	binder_context_mgr_node->local_weak_refs++;
+	binder_context_mgr_node->local_strong_refs++;
+	binder_context_mgr_node->has_strong_ref = 1;
+	binder_context_mgr_node->has_weak_ref = 1;
+	return 0;
+}
+
 static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int ret;
@@ -2635,7 +3528,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	down_read(&binder_main_lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2687,43 +3580,34 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	}
-	case BINDER_SET_MAX_THREADS:
-		if (copy_from_user(&proc->max_threads, ubuf, sizeof(proc->max_threads))) {
+	case BINDER_SET_MAX_THREADS: {
+		int max_threads;
+
+		if (copy_from_user(&max_threads, ubuf, sizeof(max_threads))) {
 			ret = -EINVAL;
 			goto err;
 		}
+		binder_inner_proc_lock(proc);
+		proc->max_threads = max_threads;
+		binder_inner_proc_unlock(proc);
 		break;
+	}
 	case BINDER_SET_CONTEXT_MGR:
-		if (binder_context_mgr_node != NULL) {
-			printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
-			ret = -EBUSY;
+		up_read(&binder_main_lock);
+		down_write(&binder_main_lock);
+		ret = binder_set_context_mgr(proc);
+		downgrade_write(&binder_main_lock);
+		if (ret)
 			goto err;
-		}
-		if (binder_context_mgr_uid != -1) {
-			if (binder_context_mgr_uid != current->cred->euid) {
-				printk(KERN_ERR "binder: BINDER_SET_"
-				       "CONTEXT_MGR bad uid %d != %d\n",
-				       current->cred->euid,
-				       binder_context_mgr_uid);
-				ret = -EPERM;
-				goto err;
-			}
-		} else
-			binder_context_mgr_uid = current->cred->euid;
-		binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
-		if (binder_context_mgr_node == NULL) {
-			ret = -ENOMEM;
-			goto err;
-		}
-		binder_context_mgr_node->local_weak_refs++;
-		binder_context_mgr_node->local_strong_refs++;
-		binder_context_mgr_node->has_strong_ref = 1;
-		binder_context_mgr_node->has_weak_ref = 1;
 		break;
 	case BINDER_THREAD_EXIT:
 		binder_debug(BINDER_DEBUG_THREADS, "binder: %d:%d exit\n",
 			     proc->pid, thread->pid);
+		up_read(&binder_main_lock);
+		down_write(&binder_main_lock);
+		binder_restore_thread(thread);
 		binder_free_thread(proc, thread);
+		downgrade_write(&binder_main_lock);
 		thread = NULL;
 		break;
 	case BINDER_VERSION:
@@ -2744,7 +3628,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	up_read(&binder_main_lock);
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2781,7 +3665,7 @@ static struct vm_operations_struct binder_vm_ops = {
 
 static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	int ret;
+	int ret, i;
 	struct vm_struct *area;
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
@@ -2833,6 +3717,10 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->pages[i].lru);
+		proc->pages[i].proc = proc;
+	}
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
@@ -2884,14 +3772,16 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
-	binder_stats_created(BINDER_STAT_PROC);
-	hlist_add_head(&proc->proc_node, &binder_procs);
+	mutex_init(&proc->lock);
+	spin_lock_init(&proc->inner_lock);
+	proc->default_priority = binder_task_priority(current);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
+	binder_stats_created(BINDER_STAT_PROC);
+	mutex_lock(&binder_procs_lock);
+	hlist_add_head(&proc->proc_node, &binder_procs);
+	mutex_unlock(&binder_procs_lock);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2940,6 +3830,7 @@ static int binder_release(struct inode *nodp, struct file *filp)
 	return 0;
 }
 
+/* Call with binder_main_lock held for write */
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
@@ -2950,7 +3841,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	mutex_lock(&binder_procs_lock);
 	hlist_del(&proc->proc_node);
+	mutex_unlock(&binder_procs_lock);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder_release: %d context_mgr_node gone\n",
@@ -2983,7 +3876,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 			node->proc = NULL;
 			node->local_strong_refs = 0;
 			node->local_weak_refs = 0;
+			spin_lock(&binder_dead_nodes_lock);
 			hlist_add_head(&node->dead_node, &binder_dead_nodes);
+			spin_unlock(&binder_dead_nodes_lock);
 
 			hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
 				incoming_refs++;
@@ -3035,16 +3930,20 @@ static void binder_deferred_release(struct binder_proc *proc)
 	if (proc->pages) {
 		int i;
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
+			if (proc->pages[i].page_ptr) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
-				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
-					     proc->pid, i,
-					     page_addr);
+				if (!list_empty(&proc->pages[i].lru))
+					binder_uncache_page(proc,
+							    &proc->pages[i]);
+				else
+					binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+						     "binder_release: %d: "
+						     "page %d at %p not freed\n",
+						     proc->pid, i,
+						     page_addr);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
-				__free_page(proc->pages[i]);
+				__free_page(proc->pages[i].page_ptr);
 				page_count++;
 			}
 		}
@@ -3071,7 +3970,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3098,7 +3997,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3122,13 +4021,14 @@ static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
 	seq_printf(m,
-		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
+		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %d:%d r%d",
 		   prefix, t->debug_id, t,
 		   t->from ? t->from->proc->pid : 0,
 		   t->from ? t->from->pid : 0,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
-		   t->code, t->flags, t->priority, t->need_reply);
+		   t->code, t->flags, t->priority.sched_policy,
+		   t->priority.prio, t->need_reply);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3351,17 +4251,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int count = atomic_read(&stats->bc[i]);
+
+		if (count)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], count);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int count = atomic_read(&stats->br[i]);
+
+		if (count)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], count);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3369,14 +4273,30 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
+static void print_binder_page_stats(struct seq_file *m)
+{
+	seq_printf(m, "page cache: %d pages, max %u per proc\n",
+		   binder_page_lru_count, binder_page_cache_max);
+	seq_printf(m, "  map: %d\n  unmap: %d\n  zap: %d\n",
+		   atomic_read(&binder_page_stats.map),
+		   atomic_read(&binder_page_stats.unmap),
+		   atomic_read(&binder_page_stats.zap));
+	seq_printf(m, "  cache add: %d\n  cache hit: %d\n  shrink: %d\n",
+		   atomic_read(&binder_page_stats.cache_add),
+		   atomic_read(&binder_page_stats.cache_hit),
+		   atomic_read(&binder_page_stats.shrink));
+}
+
 static void print_binder_proc_stats(struct seq_file *m,
 				    struct binder_proc *proc)
 {
@@ -3426,6 +4346,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 		}
 	}
 	seq_printf(m, "  pending transactions: %d\n", count);
+	seq_printf(m, "  cached pages: %d\n", proc->pages_cached);
 
 	print_binder_stats(m, "  ", &proc->stats);
 }
@@ -3438,8 +4359,10 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	struct binder_node *node;
 	int do_lock = !binder_debug_no_lock;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	if (do_lock) {
+		down_write(&binder_main_lock);
+		mutex_lock(&binder_procs_lock);
+	}
 
 	seq_puts(m, "binder state:\n");
 
@@ -3450,8 +4373,10 @@ static int binder_state_show(struct seq_file *m, void *unused)
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_main_lock);
+	}
 	return 0;
 }
 
@@ -3461,17 +4386,22 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	struct hlist_node *pos;
 	int do_lock = !binder_debug_no_lock;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	if (do_lock) {
+		down_write(&binder_main_lock);
+		mutex_lock(&binder_procs_lock);
+	}
 
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	print_binder_page_stats(m);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_main_lock);
+	}
 	return 0;
 }
 
@@ -3481,14 +4411,73 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	struct hlist_node *pos;
 	int do_lock = !binder_debug_no_lock;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	if (do_lock) {
+		down_write(&binder_main_lock);
+		mutex_lock(&binder_procs_lock);
+	}
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_main_lock);
+	}
+	return 0;
+}
+
+static void print_binder_latency_hist(struct seq_file *m, const char *prefix,
+				      struct binder_latency_hist *hist)
+{
+	int i, count;
+	int printed = 0;
+
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		count = atomic_read(&hist->bucket[i]);
+		if (!count)
+			continue;
+		if (!printed)
+			seq_printf(m, "%s", prefix);
+		printed = 1;
+		if (i == BINDER_LATENCY_BUCKETS - 1)
+			seq_printf(m, " %uus+:%d", 1U << (i - 1), count);
+		else
+			seq_printf(m, " <%uus:%d", 1U << i, count);
+	}
+	if (printed)
+		seq_puts(m, "\n");
+}
+
+/*
+ * Only the procs list and each proc->lock are taken here, never
+ * binder_main_lock, so reading this does not stall the ioctl path.
+ */
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct binder_node *node;
+	struct hlist_node *pos;
+	struct rb_node *n;
+
+	seq_puts(m, "binder latency:\n");
+	mutex_lock(&binder_procs_lock);
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency_hist(m, "  dispatch:",
+					  &proc->dispatch_latency);
+		print_binder_latency_hist(m, "  reply:", &proc->reply_latency);
+		mutex_lock(&proc->lock);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			node = rb_entry(n, struct binder_node, rb_node);
+			seq_printf(m, "  node %d\n", node->debug_id);
+			print_binder_latency_hist(m, "    dispatch:",
+						  &node->dispatch_latency);
+			print_binder_latency_hist(m, "    reply:",
+						  &node->reply_latency);
+		}
+		mutex_unlock(&proc->lock);
+	}
+	mutex_unlock(&binder_procs_lock);
 	return 0;
 }
 
@@ -3498,11 +4487,11 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3551,6 +4540,7 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(latency);
 
 static int __init binder_init(void)
 {
@@ -3565,6 +4555,7 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
@@ -3591,6 +4582,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 	}
 	return ret;
 }
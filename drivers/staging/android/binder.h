@@ -37,6 +37,14 @@ enum {
 enum {
 	FLAT_BINDER_FLAG_PRIORITY_MASK = 0xff,
 	FLAT_BINDER_FLAG_ACCEPTS_FDS = 0x100,
+	/*
+	 * Scheduling policy of the node's minimum priority, one of
+	 * SCHED_NORMAL, SCHED_FIFO, SCHED_RR or SCHED_BATCH. With an RT
+	 * policy FLAT_BINDER_FLAG_PRIORITY_MASK holds an RT priority
+	 * (1..99) instead of a nice value.
+	 */
+	FLAT_BINDER_FLAG_SCHED_POLICY_MASK = 0x600,
+	FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT = 9,
 };
 
 /*
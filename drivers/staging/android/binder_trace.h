@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * The life of a synchronous call is
+ *
+ *   binder_transaction_send	caller queues BC_TRANSACTION
+ *   binder_wakeup		a thread of the target wakes up
+ *   binder_transaction_received	target reads BR_TRANSACTION
+ *   binder_reply_send		target queues BC_REPLY
+ *   binder_reply_received	caller reads BR_REPLY
+ *
+ * All of them carry the debug_id of the transaction, the received events
+ * also the time since it was queued.
+ */
+DECLARE_EVENT_CLASS(binder_send_class,
+
+	TP_PROTO(struct binder_transaction *t, struct binder_node *target_node),
+
+	TP_ARGS(t, target_node),
+
+	TP_STRUCT__entry(
+		__field(	int,		debug_id	)
+		__field(	int,		target_node	)
+		__field(	int,		to_proc		)
+		__field(	int,		to_thread	)
+		__field(	unsigned int,	code		)
+		__field(	unsigned int,	flags		)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->target_node = target_node ? target_node->debug_id : 0;
+		__entry->to_proc = t->to_proc->pid;
+		__entry->to_thread = t->to_thread ? t->to_thread->pid : 0;
+		__entry->code = t->code;
+		__entry->flags = t->flags;
+	),
+
+	TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d "
+		  "code=0x%x flags=0x%x",
+		  __entry->debug_id, __entry->target_node, __entry->to_proc,
+		  __entry->to_thread, __entry->code, __entry->flags)
+);
+
+DEFINE_EVENT(binder_send_class, binder_transaction_send,
+
+	TP_PROTO(struct binder_transaction *t, struct binder_node *target_node),
+
+	TP_ARGS(t, target_node)
+);
+
+DEFINE_EVENT(binder_send_class, binder_reply_send,
+
+	TP_PROTO(struct binder_transaction *t, struct binder_node *target_node),
+
+	TP_ARGS(t, target_node)
+);
+
+TRACE_EVENT(binder_wakeup,
+
+	TP_PROTO(int proc, int thread, int proc_work, s64 wait_us),
+
+	TP_ARGS(proc, thread, proc_work, wait_us),
+
+	TP_STRUCT__entry(
+		__field(	int,		proc		)
+		__field(	int,		thread		)
+		__field(	int,		proc_work	)
+		__field(	s64,		wait_us		)
+	),
+
+	TP_fast_assign(
+		__entry->proc = proc;
+		__entry->thread = thread;
+		__entry->proc_work = proc_work;
+		__entry->wait_us = wait_us;
+	),
+
+	TP_printk("proc=%d thread=%d proc_work=%d waited=%lldus",
+		  __entry->proc, __entry->thread, __entry->proc_work,
+		  __entry->wait_us)
+);
+
+DECLARE_EVENT_CLASS(binder_receive_class,
+
+	TP_PROTO(struct binder_transaction *t, int proc, int thread,
+		 s64 latency_us),
+
+	TP_ARGS(t, proc, thread, latency_us),
+
+	TP_STRUCT__entry(
+		__field(	int,		debug_id	)
+		__field(	int,		proc		)
+		__field(	int,		thread		)
+		__field(	s64,		latency_us	)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->proc = proc;
+		__entry->thread = thread;
+		__entry->latency_us = latency_us;
+	),
+
+	TP_printk("transaction=%d proc=%d thread=%d latency=%lldus",
+		  __entry->debug_id, __entry->proc, __entry->thread,
+		  __entry->latency_us)
+);
+
+DEFINE_EVENT(binder_receive_class, binder_transaction_received,
+
+	TP_PROTO(struct binder_transaction *t, int proc, int thread,
+		 s64 latency_us),
+
+	TP_ARGS(t, proc, thread, latency_us)
+);
+
+DEFINE_EVENT(binder_receive_class, binder_reply_received,
+
+	TP_PROTO(struct binder_transaction *t, int proc, int thread,
+		 s64 latency_us),
+
+	TP_ARGS(t, proc, thread, latency_us)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../../drivers/staging/android
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE binder_trace
+
+#include <trace/define_trace.h>
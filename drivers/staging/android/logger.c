@@ -21,47 +21,209 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/delay.h>
+#include <linux/vmalloc.h>
+#include <linux/srcu.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+#include <linux/lzo.h>
+#include <linux/workqueue.h>
+#endif
 #include "logger.h"
 
 #include <asm/ioctls.h>
+#include <asm/unaligned.h>
+
+/*
+ * The ring is addressed by free running positions; a position maps to
+ * a buffer offset via logger_offset(). Every entry is stored as a
+ * logger_record header followed by the struct logger_entry and payload
+ * readers get to see, padded to LOGGER_RECORD_ALIGN. Records never wrap
+ * around the end of the buffer, the space left there is filled with a
+ * padding record instead.
+ *
+ * Writers claim space by advancing log->w_pos with cmpxchg, push
+ * log->head past whatever the new record overwrites, fill it in without
+ * any lock held and finally commit it by storing its position in the
+ * record's seq. Readers take a record only once its seq matches their
+ * position and recheck log->head after copying it out: if the head got
+ * past them in the meantime the copy may be torn and they start over
+ * at the head.
+ */
+struct logger_record {
+	__u32	seq;	/* logger_seq() of its position once committed */
+	__u16	len;	/* whole record, header and padding included */
+	__u16	flags;
+};
+
+#define LOGGER_RECORD_PAD	0x1	/* filler, skipped by readers */
+#define LOGGER_RECORD_ALIGN	8
+
+/* never 0, so the zeroed buffer does not look committed at position 0 */
+#define logger_seq(pos)		((__u32)(pos) | 1)
+
+/*
+ * A log can be resized between LOGGER_MIN_SIZE and LOGGER_MAX_SIZE. Every
+ * access to the ring happens between logger_enter() and logger_exit(),
+ * an SRCU read side section that waits while 'resizing' is set. That
+ * lets logger_resize() shut everybody out, move the records over and
+ * switch buffers without adding a shared lock to the write path.
+ */
+#define LOGGER_MIN_SIZE		(16 * 1024)
+#define LOGGER_MAX_SIZE		(4 * 1024 * 1024)
+
+/*
+ * Writes are rate limited per uid and tag by a token bucket. The uid and
+ * tag hash to a set of buckets, and a line is only charged to the bucket
+ * owned by exactly its uid and tag. A bucket changes owner once it has
+ * been quiet long enough to fill up again; lines finding neither their
+ * bucket nor a free one in the set are let through.
+ */
+#define LOGGER_BUCKET_SETS	64
+#define LOGGER_BUCKET_WAYS	4
+#define LOGGER_TAG_LEN		24
+
+struct logger_bucket {
+	uid_t		uid;
+	u32		hash;		/* of uid and tag, 0 if unowned */
+	unsigned long	stamp;		/* jiffies of the last refill */
+	unsigned int	tokens;
+	unsigned long	dropped;	/* lines since it got its owner */
+	char		tag[LOGGER_TAG_LEN];
+};
+
+struct logger_bucket_set {
+	spinlock_t		lock;
+	struct logger_bucket	way[LOGGER_BUCKET_WAYS];
+};
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * The archive trails the ring: a worker copies committed entries out of
+ * it into 'stage' before they are overwritten, and every full stage is
+ * LZO compressed into a logger_block. Blocks are dropped oldest first
+ * once they take more than compress_kb. New readers start with the
+ * oldest block and continue in the ring at the end_pos of the last one.
+ */
+#define LOGGER_BLOCK_SIZE	(16 * 1024)
+
+struct logger_block {
+	struct list_head	list;
+	unsigned long		id;
+	unsigned long		end_pos;	/* ring position after it */
+	size_t			len;		/* compressed */
+	unsigned char		data[0];
+};
+
+struct logger_archive {
+	struct mutex		lock;	/* protects all of the archive */
+	struct list_head	blocks;	/* oldest first */
+	unsigned long		next_id;
+	size_t			bytes;	/* memory used by blocks */
+	unsigned long		a_pos;	/* ring is staged up to here */
+	unsigned char		*stage;
+	size_t			stage_len;
+	unsigned char		*scratch;
+	void			*wrkmem;
+	struct work_struct	work;
+};
+#endif
 
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting. Writers and readers coordinate
+ * through 'w_pos', 'head' and the records themselves, there is no lock.
+ * 'buffer' and 'size' only change under 'resize_mutex' with 'resizing' set.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	atomic_long_t		w_pos;	/* next record is reserved here */
+	atomic_long_t		head;	/* oldest valid record, new readers */
+					/* start here */
 	size_t			size;	/* size of the log */
+	struct srcu_struct	srcu;	/* users of 'buffer' and 'size' */
+	int			resizing;
+	wait_queue_head_t	resize_wq;
+	struct mutex		resize_mutex;
+	int			binary;	/* tags are event ids, not strings */
+	struct logger_bucket_set *buckets;
+	atomic_long_t		dropped;	/* by the rate limiter */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	struct logger_archive	archive;
+#endif
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by 'mutex'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes readers of this file */
+	unsigned long		r_pos;	/* current read position */
+	int			batch;	/* LOGGER_READ_BATCH mode */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	unsigned char		*block;	/* archive block being read, */
+					/* NULL once in the ring */
+	unsigned long		block_id;
+	size_t			block_len;
+	size_t			block_off;
+#endif
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+static inline struct logger_record *logger_record(struct logger_log *log,
+						  unsigned long pos)
+{
+	return (struct logger_record *)(log->buffer + logger_offset(pos));
+}
+
+/* is 'a' before 'b' in position space? */
+static inline int logger_before(unsigned long a, unsigned long b)
+{
+	return (long)(a - b) < 0;
+}
+
+/*
+ * logger_enter - start using the ring of 'log', waiting for a resize to
+ * finish first. Returns the index to hand to logger_exit().
+ */
+static int logger_enter(struct logger_log *log)
+{
+	int idx;
+
+	for (;;) {
+		idx = srcu_read_lock(&log->srcu);
+		if (likely(!ACCESS_ONCE(log->resizing))) {
+			/* pairs with the smp_wmb() in logger_resize() */
+			smp_rmb();
+			return idx;
+		}
+		srcu_read_unlock(&log->srcu, idx);
+		wait_event(log->resize_wq, !ACCESS_ONCE(log->resizing));
+	}
+}
+
+static inline void logger_exit(struct logger_log *log, int idx)
+{
+	srcu_read_unlock(&log->srcu, idx);
+}
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -86,60 +248,352 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_len - Grabs the length of the payload of the next entry starting
- * from 'off'.
+ * logger_readable - is there a committed record, or did the head pass us?
+ * Only a hint, logger_next_record() decides.
+ */
+static int logger_readable(struct logger_log *log, unsigned long pos)
+{
+	if (logger_before(pos, atomic_long_read(&log->head)))
+		return 1;
+	return ACCESS_ONCE(logger_record(log, pos)->seq) == logger_seq(pos);
+}
+
+/*
+ * logger_reader_readable - logger_readable() for 'reader', which might
+ * still be working through the archive
+ */
+static int logger_reader_readable(struct logger_reader *reader)
+{
+	struct logger_log *log = reader->log;
+	int idx, ret = 1;
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	if (reader->block)
+		return 1;
+#endif
+	/* used as a wait condition, so no sleeping in logger_enter() */
+	idx = srcu_read_lock(&log->srcu);
+	if (!ACCESS_ONCE(log->resizing)) {
+		smp_rmb();
+		ret = logger_readable(log, reader->r_pos);
+	}
+	srcu_read_unlock(&log->srcu, idx);
+	return ret;
+}
+
+/*
+ * logger_next_record - find the next entry at or after '*pos', skipping
+ * padding and moving '*pos' up to the head if it was lapped. Returns NULL
+ * if nothing has been committed there yet, otherwise the record and its
+ * length in 'len'. The entry itself still has to be validated with
+ * logger_lapped() after it has been copied.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to own '*pos', e.g. by holding reader->mutex.
  */
-static __u32 get_entry_len(struct logger_log *log, size_t off)
+static struct logger_record *logger_next_record(struct logger_log *log,
+						unsigned long *pos,
+						size_t *len)
 {
-	__u16 val;
+	struct logger_record *rec;
+	unsigned long head;
+	__u16 flags;
+
+	for (;;) {
+		head = atomic_long_read(&log->head);
+		if (logger_before(*pos, head)) {
+			*pos = head;
+			continue;
+		}
 
-	switch (log->size - off) {
-	case 1:
-		memcpy(&val, log->buffer + off, 1);
-		memcpy(((char *) &val) + 1, log->buffer, 1);
-		break;
-	default:
-		memcpy(&val, log->buffer + off, 2);
+		rec = logger_record(log, *pos);
+		if (ACCESS_ONCE(rec->seq) != logger_seq(*pos)) {
+			/* not committed yet, unless it was just overwritten */
+			smp_rmb();
+			if (logger_before(*pos,
+					  atomic_long_read(&log->head)))
+				continue;
+			return NULL;
+		}
+		smp_rmb();
+		*len = ACCESS_ONCE(rec->len);
+		flags = ACCESS_ONCE(rec->flags);
+		smp_rmb();
+		if (logger_before(*pos, atomic_long_read(&log->head)))
+			continue;
+
+		if (!(flags & LOGGER_RECORD_PAD))
+			return rec;
+		*pos += *len;
 	}
+}
 
-	return sizeof(struct logger_entry) + val;
+/*
+ * logger_lapped - was the record at 'pos' overwritten while we looked at it?
+ */
+static inline int logger_lapped(struct logger_log *log, unsigned long pos)
+{
+	smp_rmb();
+	return logger_before(pos, atomic_long_read(&log->head));
 }
 
+/* get_entry_len - size of the entry in 'rec' as readers see it */
+static size_t get_entry_len(struct logger_record *rec, size_t rec_len)
+{
+	struct logger_entry *entry = (struct logger_entry *)(rec + 1);
+	size_t len = sizeof(struct logger_entry) + ACCESS_ONCE(entry->len);
+
+	/* a torn entry is caught by logger_lapped(), just stay in bounds */
+	return min(len, rec_len - sizeof(struct logger_record));
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+static unsigned int logger_compress_kb = 1024;
+
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * logger_archive_reset - drop all blocks and the staged entries
  *
- * Caller must hold log->mutex.
+ * Caller needs to hold ar->lock.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static void logger_archive_reset(struct logger_archive *ar)
 {
+	struct logger_block *blk, *tmp;
+
+	list_for_each_entry_safe(blk, tmp, &ar->blocks, list) {
+		list_del(&blk->list);
+		kfree(blk);
+	}
+	ar->bytes = 0;
+	ar->stage_len = 0;
+	vfree(ar->stage);
+	vfree(ar->scratch);
+	vfree(ar->wrkmem);
+	ar->stage = NULL;
+	ar->scratch = NULL;
+	ar->wrkmem = NULL;
+}
+
+/*
+ * logger_archive_block - compress the stage into a new block, which ends
+ * at ring position 'end_pos', and trim the archive to compress_kb
+ *
+ * Caller needs to hold ar->lock.
+ */
+static void logger_archive_block(struct logger_archive *ar,
+				 unsigned long end_pos)
+{
+	struct logger_block *blk;
 	size_t len;
 
-	/*
-	 * We read from the log in two disjoint operations. First, we read from
-	 * the current read head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
-	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	if (lzo1x_1_compress(ar->stage, ar->stage_len, ar->scratch, &len,
+			     ar->wrkmem) != LZO_E_OK)
+		goto out;
+	blk = kmalloc(sizeof(*blk) + len, GFP_KERNEL);
+	if (!blk)
+		goto out;
+	memcpy(blk->data, ar->scratch, len);
+	blk->len = len;
+	blk->id = ar->next_id++;
+	blk->end_pos = end_pos;
+	list_add_tail(&blk->list, &ar->blocks);
+	ar->bytes += sizeof(*blk) + len;
+
+	while (ar->bytes > logger_compress_kb * 1024) {
+		blk = list_first_entry(&ar->blocks, struct logger_block, list);
+		list_del(&blk->list);
+		ar->bytes -= sizeof(*blk) + blk->len;
+		kfree(blk);
+	}
+out:
+	ar->stage_len = 0;
+}
+
+static void logger_archive_work(struct work_struct *work)
+{
+	struct logger_archive *ar = container_of(work, struct logger_archive,
+						 work);
+	struct logger_log *log = container_of(ar, struct logger_log, archive);
+	struct logger_record *rec;
+	size_t rec_len, len;
+	int idx;
+
+	mutex_lock(&ar->lock);
+	if (!logger_compress_kb) {
+		logger_archive_reset(ar);
+		goto out;
+	}
+	if (!ar->stage) {
+		ar->stage = vmalloc(LOGGER_BLOCK_SIZE);
+		ar->scratch = vmalloc(lzo1x_worst_compress(LOGGER_BLOCK_SIZE));
+		ar->wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+		if (!ar->stage || !ar->scratch || !ar->wrkmem) {
+			logger_archive_reset(ar);
+			goto out;
+		}
+	}
+
+	idx = logger_enter(log);
+	while ((rec = logger_next_record(log, &ar->a_pos, &rec_len))) {
+		len = get_entry_len(rec, rec_len);
+		if (ar->stage_len + len > LOGGER_BLOCK_SIZE)
+			logger_archive_block(ar, ar->a_pos);
+		memcpy(ar->stage + ar->stage_len, rec + 1, len);
+		if (logger_lapped(log, ar->a_pos))
+			continue;
+		ar->stage_len += len;
+		ar->a_pos += rec_len;
+		cond_resched();
+	}
+	logger_exit(log, idx);
+out:
+	mutex_unlock(&ar->lock);
+}
+
+/*
+ * logger_archive_kick - called by writers, gets the worker going once
+ * half the ring has not been staged yet
+ */
+static inline void logger_archive_kick(struct logger_log *log,
+				       unsigned long pos)
+{
+	if (logger_compress_kb &&
+	    pos - ACCESS_ONCE(log->archive.a_pos) > log->size / 2)
+		schedule_work(&log->archive.work);
+}
+
+/*
+ * logger_archive_open - start a new reader on the oldest block, if any
+ */
+static void logger_archive_open(struct logger_log *log,
+				struct logger_reader *reader)
+{
+	struct logger_archive *ar = &log->archive;
+
+	reader->block = NULL;
+	mutex_lock(&ar->lock);
+	if (!list_empty(&ar->blocks)) {
+		reader->block = vmalloc(LOGGER_BLOCK_SIZE);
+		reader->block_id = list_first_entry(&ar->blocks,
+					struct logger_block, list)->id - 1;
+		reader->block_len = 0;
+		reader->block_off = 0;
+	}
+	mutex_unlock(&ar->lock);
+}
+
+/*
+ * logger_archive_next - load the block after the one 'reader' finished.
+ * Returns 0 and moves the reader over to the ring if there is none.
+ *
+ * Caller needs to hold reader->mutex.
+ */
+static int logger_archive_next(struct logger_log *log,
+			       struct logger_reader *reader)
+{
+	struct logger_archive *ar = &log->archive;
+	struct logger_block *blk;
+	size_t len = LOGGER_BLOCK_SIZE;
+
+	mutex_lock(&ar->lock);
+	list_for_each_entry(blk, &ar->blocks, list) {
+		if (blk->id <= reader->block_id)
+			continue;
+		if (lzo1x_decompress_safe(blk->data, blk->len, reader->block,
+					  &len) != LZO_E_OK)
+			break;
+		reader->block_id = blk->id;
+		reader->block_len = len;
+		reader->block_off = 0;
+		reader->r_pos = blk->end_pos;
+		mutex_unlock(&ar->lock);
+		return 1;
+	}
+	mutex_unlock(&ar->lock);
+
+	vfree(reader->block);
+	reader->block = NULL;
+	return 0;
+}
+
+/*
+ * logger_archived_entry - the next archived entry of 'reader', or NULL
+ * if it has moved on to the ring
+ *
+ * Caller needs to hold reader->mutex.
+ */
+static struct logger_entry *logger_archived_entry(struct logger_log *log,
+						  struct logger_reader *reader)
+{
+	while (reader->block) {
+		if (reader->block_off < reader->block_len)
+			return (struct logger_entry *)
+				(reader->block + reader->block_off);
+		logger_archive_next(log, reader);
+	}
+	return NULL;
+}
+
+/*
+ * logger_read_archived - logger_read_record() for readers still in the
+ * archive
+ */
+static ssize_t logger_read_archived(struct logger_log *log,
+				    struct logger_reader *reader,
+				    char __user *buf, size_t count)
+{
+	struct logger_entry *entry = logger_archived_entry(log, reader);
+	size_t len;
+
+	if (!entry)
+		return 0;
+	len = sizeof(struct logger_entry) + entry->len;
+	if (count < len)
+		return -ENOSPC;
+	if (copy_to_user(buf, entry, len))
 		return -EFAULT;
+	reader->block_off += len;
+	return len;
+}
+#else
+static inline void logger_archive_kick(struct logger_log *log,
+				       unsigned long pos)
+{
+}
+#endif
 
-	/*
-	 * Second, we read any remaining bytes, starting back at the head of
-	 * the log.
-	 */
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+/*
+ * logger_read_record - copy the entry at the reader's position in the ring
+ *
+ * Returns the size of the entry, 0 if there is none yet or -ENOSPC if it
+ * does not fit into 'count' bytes.
+ *
+ * Caller needs to hold reader->mutex.
+ */
+static ssize_t logger_read_record(struct logger_log *log,
+				  struct logger_reader *reader,
+				  char __user *buf, size_t count)
+{
+	struct logger_record *rec;
+	size_t rec_len;
+	ssize_t ret;
 
-	reader->r_off = logger_offset(reader->r_off + count);
+	for (;;) {
+		rec = logger_next_record(log, &reader->r_pos, &rec_len);
+		if (!rec)
+			return 0;
 
-	return count;
+		ret = get_entry_len(rec, rec_len);
+		if (count < ret) {
+			if (logger_lapped(log, reader->r_pos))
+				continue;
+			return -ENOSPC;
+		}
+		if (copy_to_user(buf, rec + 1, ret))
+			return -EFAULT;
+		if (logger_lapped(log, reader->r_pos))
+			continue;
+		reader->r_pos += rec_len;
+		return ret;
+	}
 }
 
 /*
@@ -149,171 +603,283 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in LOGGER_READ_BATCH
+ * 	  mode as many whole entries as fit into the buffer
  *
- * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
- * buffer is insufficient to hold next entry.
+ * Optimal read size is LOGGER_ENTRY_MAX_LEN, or anything larger in batch
+ * mode. Will set errno to EINVAL if read buffer is insufficient to hold
+ * next entry.
  */
 static ssize_t logger_read(struct file *file, char __user *buf,
 			   size_t count, loff_t *pos)
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t done = 0;
 	ssize_t ret;
-	DEFINE_WAIT(wait);
-
-start:
-	while (1) {
-		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
+	int idx;
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
-		if (!ret)
-			break;
-
-		if (file->f_flags & O_NONBLOCK) {
-			ret = -EAGAIN;
-			break;
+	mutex_lock(&reader->mutex);
+	for (;;) {
+		ret = 0;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		if (reader->block)
+			ret = logger_read_archived(log, reader, buf + done,
+						   count - done);
+#endif
+		if (!ret) {
+			idx = logger_enter(log);
+			ret = logger_read_record(log, reader, buf + done,
+						 count - done);
+			logger_exit(log, idx);
 		}
-
-		if (signal_pending(current)) {
-			ret = -EINTR;
+		if (ret > 0) {
+			done += ret;
+			if (reader->batch)
+				continue;
 			break;
 		}
+		if (done || ret < 0)
+			break;
 
-		schedule();
+		mutex_unlock(&reader->mutex);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(log->wq,
+					       logger_reader_readable(reader));
+		if (ret)
+			return ret;
+		mutex_lock(&reader->mutex);
 	}
+	mutex_unlock(&reader->mutex);
 
-	finish_wait(&log->wq, &wait);
-	if (ret)
-		return ret;
-
-	mutex_lock(&log->mutex);
-
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
-		goto start;
-	}
+	if (done)
+		return done;
+	return ret == -ENOSPC ? -EINVAL : ret;
+}
 
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
+/*
+ * logger_push_head - move the head up to at least 'pos', a record at a
+ * time. A record still being written a whole lap ago has to be waited
+ * for, its writer owns that space until it commits.
+ */
+static void logger_push_head(struct logger_log *log, unsigned long pos)
+{
+	struct logger_record *rec;
+	unsigned long head;
+	int spins = 0;
+	__u16 len;
+
+	for (;;) {
+		head = atomic_long_read(&log->head);
+		if (!logger_before(head, pos))
+			return;
+
+		rec = logger_record(log, head);
+		if (ACCESS_ONCE(rec->seq) != logger_seq(head)) {
+			if (++spins < 1000)
+				cpu_relax();
+			else
+				msleep(1);
+			continue;
+		}
+		smp_rmb();
+		len = ACCESS_ONCE(rec->len);
+		atomic_long_cmpxchg(&log->head, head, head + len);
 	}
-
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
-
-out:
-	mutex_unlock(&log->mutex);
-
-	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
- *
- * Caller must hold log->mutex.
+ * logger_reserve - claim 'len' bytes for a record and make sure nobody
+ * reads what used to be there any more. Returns the position of the
+ * record, which is the caller's until it commits it.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static unsigned long logger_reserve(struct logger_log *log, size_t len)
 {
-	size_t count = 0;
+	unsigned long pos, start;
+	size_t room;
 
 	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+		pos = atomic_long_read(&log->w_pos);
+		room = log->size - logger_offset(pos);
+		start = room < len ? pos + room : pos;
+	} while (atomic_long_cmpxchg(&log->w_pos, pos, start + len) != pos);
+
+	/* the cmpxchg in here orders the head update before our stores */
+	logger_push_head(log, start + len - log->size);
+	if (start != pos) {
+		struct logger_record *pad = logger_record(log, pos);
+
+		pad->len = room;
+		pad->flags = LOGGER_RECORD_PAD;
+		smp_wmb();
+		pad->seq = logger_seq(pos);
+	}
 
-	return off;
+	return start;
 }
 
 /*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
+ * logger_commit - publish the record at 'pos' to readers
  */
-static inline int clock_interval(size_t a, size_t b, size_t c)
+static void logger_commit(struct logger_log *log, unsigned long pos,
+			  size_t len, __u16 flags)
 {
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
-	}
+	struct logger_record *rec = logger_record(log, pos);
 
-	return 0;
+	rec->len = len;
+	rec->flags = flags;
+	smp_wmb();
+	rec->seq = logger_seq(pos);
+
+	/* pairs with the barrier in prepare_to_wait() of the readers */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 }
 
+static unsigned int logger_ratelimit;
+module_param_named(ratelimit, logger_ratelimit, uint, S_IWUSR | S_IRUGO);
+MODULE_PARM_DESC(ratelimit, "lines per second per uid and tag, 0 for no limit");
+
+static unsigned int logger_ratelimit_burst = 200;
+module_param_named(ratelimit_burst, logger_ratelimit_burst, uint,
+		   S_IWUSR | S_IRUGO);
+
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
+ * logger_get_tag - copy the tag of the entry about to be written from
+ * 'iov' into 'tag'. Text logs have it as a string after the priority
+ * byte, binary ones start with an event id.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void logger_get_tag(struct logger_log *log, const struct iovec *iov,
+			   unsigned long nr_segs, char *tag)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	char peek[1 + LOGGER_TAG_LEN];
+	size_t n = 0, len;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	while (nr_segs-- > 0 && n < sizeof(peek)) {
+		len = min_t(size_t, iov->iov_len, sizeof(peek) - n);
+		if (copy_from_user(peek + n, iov->iov_base, len))
+			break;
+		n += len;
+		iov++;
+	}
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	if (log->binary) {
+		if (n >= sizeof(u32))
+			snprintf(tag, LOGGER_TAG_LEN, "#%u",
+				 get_unaligned_le32(peek));
+		else
+			tag[0] = '\0';
+		return;
+	}
+	len = n > 1 ? strnlen(peek + 1, min_t(size_t, n - 1,
+					      LOGGER_TAG_LEN - 1)) : 0;
+	memcpy(tag, peek + 1, len);
+	tag[len] = '\0';
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * logger_bucket_refill - add the tokens earned since the last refill
  *
- * The caller needs to hold log->mutex.
+ * Caller needs to hold b->lock.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void logger_bucket_refill(struct logger_bucket *b, unsigned int rate,
+				 unsigned int burst)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
+	unsigned long elapsed = jiffies - b->stamp;
+	u64 add = div_u64((u64)elapsed * rate, HZ);
+
+	if (add >= burst - min(b->tokens, burst)) {
+		b->tokens = burst;
+		b->stamp = jiffies;
+	} else if (add) {
+		b->tokens += add;
+		/* keep the fraction of a token earned so far */
+		b->stamp += div_u64(add * HZ, rate);
+	}
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
+ * logger_bucket_get - find the bucket of 'uid' and 'tag' in set 's', or
+ * take over a free one for them. Returns NULL if every bucket of the set
+ * is owned by someone else still being limited.
  *
- * Returns 'count' on success, negative error code on failure.
+ * Caller needs to hold s->lock.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static struct logger_bucket *logger_bucket_get(struct logger_bucket_set *s,
+					       uid_t uid, const char *tag,
+					       u32 hash, unsigned int rate,
+					       unsigned int burst)
 {
-	size_t len;
+	struct logger_bucket *b, *free = NULL;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	for (b = s->way; b < s->way + LOGGER_BUCKET_WAYS; b++) {
+		if (b->hash == hash && b->uid == uid && !strcmp(b->tag, tag)) {
+			logger_bucket_refill(b, rate, burst);
+			return b;
+		}
+		if (!b->hash) {
+			free = b;
+			continue;
+		}
+		logger_bucket_refill(b, rate, burst);
+		/* keep the ones with drops to report for as long as we can */
+		if (b->tokens == burst &&
+		    (!free || (free->hash && free->dropped && !b->dropped)))
+			free = b;
+	}
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
+	if (free) {
+		free->hash = hash;
+		free->uid = uid;
+		free->stamp = jiffies;
+		free->tokens = burst;
+		free->dropped = 0;
+		strcpy(free->tag, tag);
+	}
+	return free;
+}
 
-	log->w_off = logger_offset(log->w_off + count);
+/*
+ * logger_ratelimit_ok - charge a line to the bucket of the current uid and
+ * the tag in 'iov'. Returns 0 if it has to be dropped.
+ */
+static int logger_ratelimit_ok(struct logger_log *log, const struct iovec *iov,
+			       unsigned long nr_segs)
+{
+	unsigned int rate = ACCESS_ONCE(logger_ratelimit);
+	unsigned int burst = max(ACCESS_ONCE(logger_ratelimit_burst), 1U);
+	char tag[LOGGER_TAG_LEN];
+	struct logger_bucket_set *s;
+	struct logger_bucket *b;
+	uid_t uid;
+	u32 hash;
+	int ok = 1;
+
+	if (!rate)
+		return 1;
+
+	logger_get_tag(log, iov, nr_segs, tag);
+	uid = current_uid();
+	/* 0 marks unowned buckets */
+	hash = jhash(tag, strlen(tag), uid) | 1;
+	s = &log->buckets[(hash >> 1) & (LOGGER_BUCKET_SETS - 1)];
+
+	spin_lock(&s->lock);
+	b = logger_bucket_get(s, uid, tag, hash, rate, burst);
+	if (b) {
+		ok = b->tokens > 0;
+		if (ok)
+			b->tokens--;
+		else
+			b->dropped++;
+	}
+	spin_unlock(&s->lock);
 
-	return count;
+	if (!ok)
+		atomic_long_inc(&log->dropped);
+	return ok;
 }
 
 /*
@@ -325,60 +891,135 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
-	struct logger_entry header;
+	struct logger_entry *entry;
 	struct timespec now;
+	unsigned long pos;
+	size_t rec_len;
 	ssize_t ret = 0;
+	size_t payload;
+	int idx;
 
-	now = current_kernel_time();
-
-	header.pid = current->tgid;
-	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
-	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	payload = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 
 	/* null writes succeed, return zero */
-	if (unlikely(!header.len))
+	if (unlikely(!payload))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	/* dropped lines look written, the caller must not retry them */
+	if (!logger_ratelimit_ok(log, iov, nr_segs))
+		return payload;
 
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	rec_len = ALIGN(sizeof(struct logger_record) +
+			sizeof(struct logger_entry) + payload,
+			LOGGER_RECORD_ALIGN);
+	idx = logger_enter(log);
+	pos = logger_reserve(log, rec_len);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	now = current_kernel_time();
+	entry = (struct logger_entry *)(logger_record(log, pos) + 1);
+	entry->len = payload;
+	entry->__pad = 0;
+	entry->pid = current->tgid;
+	entry->tid = current->pid;
+	entry->sec = now.tv_sec;
+	entry->nsec = now.tv_nsec;
 
 	while (nr_segs-- > 0) {
 		size_t len;
-		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		len = min_t(size_t, iov->iov_len, payload - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		if (unlikely(len && copy_from_user(entry->msg + ret,
+						   iov->iov_base, len))) {
+			/* the space is ours anyway, hide it from readers */
+			logger_commit(log, pos, rec_len, LOGGER_RECORD_PAD);
+			logger_exit(log, idx);
+			return -EFAULT;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
+	}
+
+	logger_commit(log, pos, rec_len, 0);
+	logger_archive_kick(log, pos + rec_len);
+	logger_exit(log, idx);
+
+	return ret;
+}
+
+/*
+ * logger_resize_head - the oldest record that can stay when the ring
+ * shrinks to 'size' with the same positions: everything after it has to
+ * fit and no record may straddle a multiple of 'size'. Growing keeps all.
+ */
+static unsigned long logger_resize_head(struct logger_log *log,
+					unsigned long w_pos, size_t size)
+{
+	unsigned long pos, head = w_pos;
+	__u16 len;
+
+	for (pos = atomic_long_read(&log->head); pos != w_pos; pos += len) {
+		len = logger_record(log, pos)->len;
+		if (w_pos - pos > size)
+			continue;
+		if (head == w_pos)
+			head = pos;
+		if ((pos ^ (pos + len - 1)) & ~(size - 1))
+			head = pos + len;
 	}
+	return head;
+}
 
-	mutex_unlock(&log->mutex);
+/*
+ * logger_resize - move 'log' into a new buffer of 'size' bytes, keeping
+ * as many of the newest entries as fit. Records keep their positions, so
+ * readers and the archive carry on where they were.
+ */
+static int logger_resize(struct logger_log *log, unsigned long size)
+{
+	unsigned char *buffer, *old;
+	unsigned long w_pos, head, pos;
+	__u16 len;
+
+	if (!is_power_of_2(size) || size < LOGGER_MIN_SIZE ||
+	    size > LOGGER_MAX_SIZE)
+		return -EINVAL;
+
+	buffer = vzalloc(size);
+	if (!buffer)
+		return -ENOMEM;
+
+	mutex_lock(&log->resize_mutex);
+	log->resizing = 1;
+	/* after this every record is committed and nobody looks at them */
+	synchronize_srcu(&log->srcu);
+
+	w_pos = atomic_long_read(&log->w_pos);
+	head = logger_resize_head(log, w_pos, size);
+	for (pos = head; pos != w_pos; pos += len) {
+		len = logger_record(log, pos)->len;
+		memcpy(buffer + (pos & (size - 1)), logger_record(log, pos),
+		       len);
+	}
 
-	/* wake up any blocked readers */
+	old = log->buffer;
+	log->buffer = buffer;
+	log->size = size;
+	atomic_long_set(&log->head, head);
+	smp_wmb();
+	log->resizing = 0;
+	mutex_unlock(&log->resize_mutex);
+
+	wake_up_all(&log->resize_wq);
 	wake_up_interruptible(&log->wq);
+	vfree(old);
 
-	return ret;
+	printk(KERN_INFO "logger: resized log '%s' to %luK\n",
+	       log->misc.name, size >> 10);
+	return 0;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -409,12 +1050,12 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_pos = atomic_long_read(&log->head);
+		reader->batch = 0;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		logger_archive_open(log, reader);
+#endif
 
 		file->private_data = reader;
 	} else
@@ -432,7 +1073,9 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		vfree(reader->block);
+#endif
 		kfree(reader);
 	}
 
@@ -462,10 +1105,8 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	if (logger_reader_readable(reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
@@ -474,9 +1115,14 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_record *rec;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	struct logger_entry *entry;
+#endif
+	unsigned long head;
+	size_t rec_len;
 	long ret = -ENOTTY;
-
-	mutex_lock(&log->mutex);
+	int idx;
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -488,10 +1134,18 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		/* record headers and padding included */
+		head = atomic_long_read(&log->head);
+		if (logger_before(reader->r_pos, head))
+			ret = atomic_long_read(&log->w_pos) - head;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret = atomic_long_read(&log->w_pos) - reader->r_pos;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		mutex_lock(&reader->mutex);
+		if (reader->block)
+			ret += reader->block_len - reader->block_off;
+		mutex_unlock(&reader->mutex);
+#endif
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -499,25 +1153,64 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		mutex_lock(&reader->mutex);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		entry = logger_archived_entry(log, reader);
+		if (entry) {
+			ret = sizeof(struct logger_entry) + entry->len;
+			mutex_unlock(&reader->mutex);
+			break;
+		}
+#endif
+		idx = logger_enter(log);
+		do {
+			rec = logger_next_record(log, &reader->r_pos, &rec_len);
+			ret = rec ? get_entry_len(rec, rec_len) : 0;
+		} while (rec && logger_lapped(log, reader->r_pos));
+		logger_exit(log, idx);
+		mutex_unlock(&reader->mutex);
+		break;
+	case LOGGER_SET_READ_MODE:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		if (arg != LOGGER_READ_ONE && arg != LOGGER_READ_BATCH) {
+			ret = -EINVAL;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = arg == LOGGER_READ_BATCH;
+		ret = 0;
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers notice they were lapped and move up to the head */
+		idx = logger_enter(log);
+		logger_push_head(log, atomic_long_read(&log->w_pos));
+		logger_exit(log, idx);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		mutex_lock(&log->archive.lock);
+		logger_archive_reset(&log->archive);
+		mutex_unlock(&log->archive.lock);
+#endif
 		ret = 0;
 		break;
+	case LOGGER_SET_LOG_BUF_SIZE:
+		if (!capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
+		ret = logger_resize(log, arg);
+		break;
+	case LOGGER_GET_DROPPED:
+		ret = atomic_long_read(&log->dropped);
+		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
@@ -533,14 +1226,12 @@ static const struct file_operations logger_fops = {
 };
 
 /*
- * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * Defines a log structure with name 'NAME' and an initial size of 'SIZE'
+ * bytes, which must be a power of two between LOGGER_MIN_SIZE and
+ * LOGGER_MAX_SIZE. The buffer is allocated by init_log().
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -548,11 +1239,12 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
-	.head = 0, \
+	.w_pos = ATOMIC_LONG_INIT(0), \
+	.head = ATOMIC_LONG_INIT(0), \
 	.size = SIZE, \
+	.resize_wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .resize_wq), \
+	.resize_mutex = __MUTEX_INITIALIZER(VAR .resize_mutex), \
+	.dropped = ATOMIC_LONG_INIT(0), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 256*1024)
@@ -573,21 +1265,136 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
-static int __init init_log(struct logger_log *log)
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * The archive is only dropped by its worker, which writers only kick once
+ * half the ring is due, so kick every log when compress_kb drops to 0.
+ */
+static int logger_compress_kb_set(const char *val,
+				  const struct kernel_param *kp)
 {
+	struct logger_log *logs[] = {
+		&log_main, &log_events, &log_radio, &log_system
+	};
+	int ret = param_set_uint(val, kp);
+	int i;
+
+	if (ret || logger_compress_kb)
+		return ret;
+	for (i = 0; i < ARRAY_SIZE(logs); i++)
+		if (logs[i]->buffer)	/* init_log() has set up the work */
+			schedule_work(&logs[i]->archive.work);
+	return 0;
+}
+
+static struct kernel_param_ops logger_compress_kb_ops = {
+	.set = logger_compress_kb_set,
+	.get = param_get_uint,
+};
+module_param_cb(compress_kb, &logger_compress_kb_ops, &logger_compress_kb,
+		S_IWUSR | S_IRUGO);
+#endif
+
+static inline struct logger_log *dev_get_log(struct device *dev)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+
+	return container_of(misc, struct logger_log, misc);
+}
+
+static ssize_t buffer_size_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%zu\n", dev_get_log(dev)->size);
+}
+
+static ssize_t buffer_size_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	unsigned long size;
 	int ret;
 
+	ret = strict_strtoul(buf, 0, &size);
+	if (!ret)
+		ret = logger_resize(dev_get_log(dev), size);
+	return ret ? ret : count;
+}
+
+static DEVICE_ATTR(buffer_size, S_IWUSR | S_IRUGO, buffer_size_show,
+		   buffer_size_store);
+
+/* total, then the uid, tag and count of every bucket that dropped lines */
+static ssize_t dropped_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct logger_log *log = dev_get_log(dev);
+	struct logger_bucket_set *s;
+	struct logger_bucket *b;
+	ssize_t len;
+
+	len = sprintf(buf, "%ld\n", atomic_long_read(&log->dropped));
+	for (s = log->buckets; s < log->buckets + LOGGER_BUCKET_SETS; s++) {
+		spin_lock(&s->lock);
+		for (b = s->way; b < s->way + LOGGER_BUCKET_WAYS; b++)
+			if (b->dropped)
+				len += scnprintf(buf + len, PAGE_SIZE - len,
+						 "%u %s %lu\n", b->uid,
+						 b->tag, b->dropped);
+		spin_unlock(&s->lock);
+	}
+	return len;
+}
+
+static DEVICE_ATTR(dropped, S_IRUGO, dropped_show, NULL);
+
+static int __init init_log(struct logger_log *log)
+{
+	int i, ret;
+
+	log->buffer = vzalloc(log->size);
+	log->buckets = kcalloc(LOGGER_BUCKET_SETS, sizeof(*log->buckets),
+			       GFP_KERNEL);
+	if (!log->buffer || !log->buckets) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	for (i = 0; i < LOGGER_BUCKET_SETS; i++)
+		spin_lock_init(&log->buckets[i].lock);
+	ret = init_srcu_struct(&log->srcu);
+	if (ret)
+		goto err_free;
+	log->binary = !strcmp(log->misc.name, LOGGER_LOG_EVENTS);
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	mutex_init(&log->archive.lock);
+	INIT_LIST_HEAD(&log->archive.blocks);
+	INIT_WORK(&log->archive.work, logger_archive_work);
+#endif
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
-		return ret;
+		goto err_srcu;
 	}
 
+	if (device_create_file(log->misc.this_device, &dev_attr_buffer_size) ||
+	    device_create_file(log->misc.this_device, &dev_attr_dropped))
+		printk(KERN_WARNING "logger: no sysfs attributes for log "
+		       "'%s'\n", log->misc.name);
+
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
 
 	return 0;
+
+err_srcu:
+	cleanup_srcu_struct(&log->srcu);
+err_free:
+	kfree(log->buckets);
+	vfree(log->buffer);
+	return ret;
 }
 
 static int __init logger_init(void)
@@ -45,5 +45,15 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_MODE		_IO(__LOGGERIO, 5) /* LOGGER_READ_* */
+#define LOGGER_SET_LOG_BUF_SIZE		_IO(__LOGGERIO, 6) /* resize log */
+#define LOGGER_GET_DROPPED		_IO(__LOGGERIO, 7) /* rate limited */
+
+/*
+ * By default read() returns exactly one entry. In batch mode it returns
+ * as many whole entries as fit into the buffer, one after the other.
+ */
+#define LOGGER_READ_ONE			0
+#define LOGGER_READ_BATCH		1
 
 #endif /* _LINUX_LOGGER_H */
@@ -16,6 +16,18 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept in one list per oom_adj, maintained on fork, exit and
+ * oom_adj changes, so choosing a victim only looks at the processes of the
+ * highest oom_adj that has any instead of at every process in the system.
+ *
+ * With /sys/module/lowmemorykiller/parameters/pressure_mode set the decision
+ * also looks at how memory is doing rather than only at how much is left:
+ * anonymous memory that can still go to swap (worth what zram saves on it)
+ * counts as free as long as reclaim gets back a reasonable share of what it
+ * scans, free memory that is falling fast is charged ahead of time, and a
+ * level that started killing stays in effect until memory has recovered by
+ * a margin above its threshold.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +47,13 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,12 +74,200 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+/*
+ * lowmem_buckets - thread group leaders by oom_adj, OOM_DISABLE first
+ *
+ * Protected by tasklist_lock. Only filled once lowmem_init() has put the
+ * processes that existed before into them and set lowmem_tracking.
+ */
+#define LOWMEM_BUCKETS		(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+static struct list_head lowmem_buckets[LOWMEM_BUCKETS];
+static bool lowmem_tracking;
+
+/* victim selection statistics, writable to reset them */
+static DEFINE_SPINLOCK(lowmem_stats_lock);
+static unsigned long lowmem_scan_count;
+static unsigned long lowmem_scan_us;
+static unsigned long lowmem_scan_max_ns;
+static unsigned long lowmem_scan_tasks;
+
+/* pressure mode tunables */
+static bool lowmem_pressure_mode;
+static int lowmem_min_efficiency = 20;		/* percent */
+static int lowmem_lookahead_ms = 500;
+static int lowmem_hysteresis = 10;		/* percent */
+
+/*
+ * lowmem_pressure - memory trend, refreshed at most every LOWMEM_SAMPLE
+ *
+ * Sampled by whoever gets lowmem_sample_lock first, the rest use the
+ * previous values. level is the minfree level that last caused a kill, -1
+ * if memory has recovered since.
+ */
+#define LOWMEM_SAMPLE		(HZ / 10)
+#define LOWMEM_MIN_SCAN		32
+#define LOWMEM_ZRAM_GAIN	50	/* percent, until zram has data */
+
+static DEFINE_MUTEX(lowmem_sample_lock);
+static struct {
+	unsigned long stamp;
+	unsigned long scan;
+	unsigned long steal;
+	long free;
+	int efficiency;		/* percent of scanned pages reclaimed */
+	long decline;		/* free pages lost per second */
+	int swap_gain;		/* percent of a page freed by swapping it */
+	int level;
+} lowmem_pressure = {
+	.efficiency = 100,
+	.swap_gain = 100,
+	.level = -1,
+};
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
+static inline struct list_head *lowmem_bucket(int oom_adj)
+{
+	return &lowmem_buckets[clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX) -
+			       OOM_DISABLE];
+}
+
+void lowmem_task_add(struct task_struct *p)
+{
+	if (lowmem_tracking)
+		list_add_tail(&p->lowmem_node,
+			      lowmem_bucket(p->signal->oom_adj));
+}
+
+void lowmem_task_del(struct task_struct *p)
+{
+	if (lowmem_tracking)
+		list_del_init(&p->lowmem_node);
+}
+
+/* de_thread() made 'new' the group leader instead of 'old' */
+void lowmem_task_replace(struct task_struct *old, struct task_struct *new)
+{
+	if (lowmem_tracking) {
+		list_replace(&old->lowmem_node, &new->lowmem_node);
+		INIT_LIST_HEAD(&old->lowmem_node);
+	}
+}
+
+void lowmem_oom_adj_changed(struct task_struct *p)
+{
+	struct task_struct *leader;
+
+	write_lock_irq(&tasklist_lock);
+	if (lowmem_tracking && pid_alive(p)) {
+		leader = p->group_leader;
+		if (!list_empty(&leader->lowmem_node))
+			list_move_tail(&leader->lowmem_node,
+				       lowmem_bucket(leader->signal->oom_adj));
+	}
+	write_unlock_irq(&tasklist_lock);
+}
+
+extern void zram_get_total_stats(u64 *orig_size, u64 *mem_used);
+
+/* percent of a page that swapping it out gives back */
+static int lowmem_swap_gain(void)
+{
+	void (*get_stats)(u64 *, u64 *);
+	u64 orig, used;
+	int gain;
+
+	get_stats = symbol_get(zram_get_total_stats);
+	if (!get_stats)
+		return 100;
+	get_stats(&orig, &used);
+	symbol_put(zram_get_total_stats);
+
+	if (!orig)
+		return LOWMEM_ZRAM_GAIN;
+	if (used >= orig)
+		return 0;
+	gain = 100 - div64_u64(used * 100, orig);
+	return gain;
+}
+
+#ifdef CONFIG_VM_EVENT_COUNTERS
+static void lowmem_reclaim_events(unsigned long *scan, unsigned long *steal)
+{
+	unsigned long events[NR_VM_EVENT_ITEMS];
+	int z;
+
+	all_vm_events(events);
+	*scan = 0;
+	*steal = 0;
+	for (z = 0; z < MAX_NR_ZONES; z++) {
+		*scan += events[PGSCAN_KSWAPD_NORMAL - ZONE_NORMAL + z] +
+			events[PGSCAN_DIRECT_NORMAL - ZONE_NORMAL + z];
+		*steal += events[PGSTEAL_NORMAL - ZONE_NORMAL + z];
+	}
+}
+#else
+static void lowmem_reclaim_events(unsigned long *scan, unsigned long *steal)
+{
+	*scan = 0;
+	*steal = 0;
+}
+#endif
+
+static void lowmem_sample(int other_free)
+{
+	unsigned long now = jiffies;
+	unsigned long elapsed, scan, steal;
+
+	if (time_before(now, lowmem_pressure.stamp + LOWMEM_SAMPLE) ||
+	    !mutex_trylock(&lowmem_sample_lock))
+		return;
+	elapsed = now - lowmem_pressure.stamp;
+	if (elapsed < LOWMEM_SAMPLE)
+		goto out;
+
+	lowmem_reclaim_events(&scan, &steal);
+	scan -= lowmem_pressure.scan;
+	steal -= lowmem_pressure.steal;
+	/* too little scanning to judge by, keep the last verdict */
+	if (scan >= LOWMEM_MIN_SCAN || elapsed > HZ) {
+		lowmem_pressure.efficiency = scan < LOWMEM_MIN_SCAN ? 100 :
+			min_t(unsigned long, steal * 100 / scan, 100);
+		lowmem_pressure.scan += scan;
+		lowmem_pressure.steal += steal;
+	}
+
+	/* a stale previous sample says nothing about the current trend */
+	if (elapsed > 10 * HZ)
+		lowmem_pressure.decline = 0;
+	else
+		lowmem_pressure.decline = max(lowmem_pressure.free - other_free,
+					      0L) * HZ / (long)elapsed;
+	lowmem_pressure.free = other_free;
+
+	lowmem_pressure.swap_gain = lowmem_swap_gain();
+	lowmem_pressure.stamp = now;
+out:
+	mutex_unlock(&lowmem_sample_lock);
+}
+
+/* anonymous pages that swap can still take, in pages actually freed */
+static long lowmem_swap_credit(void)
+{
+	long anon;
+
+	if (lowmem_pressure.efficiency < lowmem_min_efficiency)
+		return 0;
+	anon = global_page_state(NR_ACTIVE_ANON) +
+		global_page_state(NR_INACTIVE_ANON);
+	return min(nr_swap_pages, anon) * lowmem_pressure.swap_gain / 100;
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -79,6 +286,53 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+/*
+ * Pick the minfree level in pressure mode. Returns its oom_adj, or
+ * OOM_ADJUST_MAX + 1 if nothing needs to die, and why in *reason. The
+ * swap credit counted as free is returned in *creditp.
+ */
+static int lowmem_pressure_adj(int array_size, int other_free, int other_file,
+			       long *creditp, const char **reason)
+{
+	long credit, avail, predicted;
+	int level = lowmem_pressure.level;
+	int i;
+
+	lowmem_sample(other_free);
+	credit = *creditp = lowmem_swap_credit();
+	avail = other_free + credit;
+	predicted = avail - lowmem_pressure.decline * lowmem_lookahead_ms /
+								MSEC_PER_SEC;
+
+	for (i = 0; i < array_size; i++) {
+		if (other_file >= lowmem_minfree[i] ||
+		    predicted >= (long)lowmem_minfree[i])
+			continue;
+		if (avail >= (long)lowmem_minfree[i])
+			*reason = "predicted";
+		else if (!credit && nr_swap_pages > 0 &&
+			 lowmem_pressure.efficiency < lowmem_min_efficiency)
+			*reason = "thrashing";
+		else
+			*reason = "minfree";
+		lowmem_pressure.level = i;
+		return lowmem_adj[i];
+	}
+
+	/* keep killing at the last level until it is clear by a margin */
+	if (level >= 0 && level < array_size) {
+		long margin = lowmem_minfree[level] *
+				(100 + lowmem_hysteresis) / 100;
+
+		if (other_file < margin && avail < margin) {
+			*reason = "hysteresis";
+			return lowmem_adj[level];
+		}
+	}
+	lowmem_pressure.level = -1;
+	return OOM_ADJUST_MAX + 1;
+}
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *p;
@@ -89,10 +343,16 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
+	int oom_adj;
+	unsigned long scanned = 0;
+	ktime_t start, delta;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
+	const char *reason = "minfree";
+	long credit = 0, decline = 0;
+	int efficiency = 0;
 
 	/*
 	 * If we already have a death outstanding, then
@@ -109,11 +369,18 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
+	if (lowmem_pressure_mode) {
+		min_adj = lowmem_pressure_adj(array_size, other_free,
+					      other_file, &credit, &reason);
+		efficiency = lowmem_pressure.efficiency;
+		decline = lowmem_pressure.decline;
+	} else {
+		for (i = 0; i < array_size; i++) {
+			if (other_free < lowmem_minfree[i] &&
+			    other_file < lowmem_minfree[i]) {
+				min_adj = lowmem_adj[i];
+				break;
+			}
 		}
 	}
 	if (sc->nr_to_scan > 0)
@@ -131,45 +398,50 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_adj = min_adj;
 
+	start = ktime_get();
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+	/* the largest process of the highest oom_adj that has one */
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj && !selected;
+	     oom_adj--) {
+		list_for_each_entry(p, lowmem_bucket(oom_adj), lowmem_node) {
+			struct mm_struct *mm;
+
+			scanned++;
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+			if (tasksize <= 0)
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			if (selected && tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm, oom_adj,
+				     tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	delta = ktime_sub(ktime_get(), start);
+	spin_lock(&lowmem_stats_lock);
+	lowmem_scan_count++;
+	lowmem_scan_us += ktime_to_us(delta);
+	lowmem_scan_tasks += scanned;
+	if (ktime_to_ns(delta) > lowmem_scan_max_ns)
+		lowmem_scan_max_ns = ktime_to_ns(delta);
+	spin_unlock(&lowmem_stats_lock);
 	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
+		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d, "
+			     "%s\n", selected->pid, selected->comm,
+			     selected_oom_adj, selected_tasksize, reason);
+		trace_lowmem_kill(selected, selected_oom_adj, selected_tasksize,
+				  min_adj, reason, other_free, other_file,
+				  credit, efficiency, decline);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
@@ -188,6 +460,23 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
+	write_lock_irq(&tasklist_lock);
+	for_each_process(p)
+		list_add_tail(&p->lowmem_node,
+			      lowmem_bucket(p->signal->oom_adj));
+	lowmem_tracking = true;
+	write_unlock_irq(&tasklist_lock);
+
+	lowmem_reclaim_events(&lowmem_pressure.scan, &lowmem_pressure.steal);
+	lowmem_pressure.free = global_page_state(NR_FREE_PAGES);
+	lowmem_pressure.stamp = jiffies;
+
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
@@ -205,6 +494,16 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(scan_count, lowmem_scan_count, ulong, S_IRUGO | S_IWUSR);
+module_param_named(scan_us, lowmem_scan_us, ulong, S_IRUGO | S_IWUSR);
+module_param_named(scan_max_ns, lowmem_scan_max_ns, ulong, S_IRUGO | S_IWUSR);
+module_param_named(scan_tasks, lowmem_scan_tasks, ulong, S_IRUGO | S_IWUSR);
+module_param_named(pressure_mode, lowmem_pressure_mode, bool,
+		   S_IRUGO | S_IWUSR);
+module_param_named(min_efficiency, lowmem_min_efficiency, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(lookahead_ms, lowmem_lookahead_ms, int, S_IRUGO | S_IWUSR);
+module_param_named(hysteresis, lowmem_hysteresis, int, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_LOWMEMORYKILLER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * One event per SIGKILL sent. free and file are the page counts the
+ * minfree levels were compared against, credit what swap was still
+ * expected to give back, efficiency the percentage of scanned pages
+ * reclaimed and decline the pages per second free memory was falling
+ * at. The last three are only filled in pressure mode.
+ */
+TRACE_EVENT(lowmem_kill,
+
+	TP_PROTO(struct task_struct *p, int oom_adj, int tasksize, int min_adj,
+		 const char *reason, int free, int file, long credit,
+		 int efficiency, long decline),
+
+	TP_ARGS(p, oom_adj, tasksize, min_adj, reason, free, file, credit,
+		efficiency, decline),
+
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__array(char, comm, TASK_COMM_LEN)
+		__field(int, oom_adj)
+		__field(int, tasksize)
+		__field(int, min_adj)
+		__field(const char *, reason)
+		__field(int, free)
+		__field(int, file)
+		__field(long, credit)
+		__field(int, efficiency)
+		__field(long, decline)
+	),
+
+	TP_fast_assign(
+		__entry->pid = p->pid;
+		memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->oom_adj = oom_adj;
+		__entry->tasksize = tasksize;
+		__entry->min_adj = min_adj;
+		__entry->reason = reason;
+		__entry->free = free;
+		__entry->file = file;
+		__entry->credit = credit;
+		__entry->efficiency = efficiency;
+		__entry->decline = decline;
+	),
+
+	TP_printk("pid=%d comm=%s adj=%d size=%d min_adj=%d reason=%s "
+		  "free=%d file=%d credit=%ld efficiency=%d decline=%ld",
+		  __entry->pid, __entry->comm, __entry->oom_adj,
+		  __entry->tasksize, __entry->min_adj, __entry->reason,
+		  __entry->free, __entry->file, __entry->credit,
+		  __entry->efficiency, __entry->decline)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../../drivers/staging/android
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+
+#include <trace/define_trace.h>
@@ -21,6 +21,7 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/err.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
@@ -28,8 +29,10 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
 #include <linux/lzo.h>
+#include <linux/lz4.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -42,6 +45,25 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
+/* Available compression algorithms, the first one is the default */
+const struct zram_backend zram_backends[] = {
+	{
+		.name = "lzo",
+		.workmem_size = LZO1X_1_MEM_COMPRESS,
+		.compress = lzo1x_1_compress,
+		.decompress = lzo1x_decompress_safe,
+	},
+#ifdef CONFIG_ZRAM_LZ4
+	{
+		.name = "lz4",
+		.workmem_size = LZ4_MEM_COMPRESS,
+		.compress = lz4_compress,
+		.decompress = lz4_decompress_safe,
+	},
+#endif
+	{ }
+};
+
 static void zram_stat_inc(u32 *v)
 {
 	*v = *v + 1;
@@ -89,21 +111,143 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+/* Drop a reference, the last one frees the object and accounts for it */
+static void zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return;
+	}
+	hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->size);
+	kfree(entry);
+}
+
+/* Whether entry holds page, buf takes the decompressed object */
+static int zram_dedup_match(struct zram *zram, struct zram_entry *entry,
+				struct page *page, unsigned char *buf)
+{
+	int match;
+	size_t clen = PAGE_SIZE;
+	unsigned char *user_mem, *cmem;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->size == PAGE_SIZE) {
+		user_mem = kmap_atomic(page, KM_USER0);
+		match = !memcmp(cmem, user_mem, PAGE_SIZE);
+		kunmap_atomic(user_mem, KM_USER0);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+		return match;
+	}
+
+	match = !zram->backend->decompress(cmem, entry->size, buf, &clen) &&
+		clen == PAGE_SIZE;
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	if (!match)
+		return 0;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	match = !memcmp(buf, user_mem, PAGE_SIZE);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	return match;
+}
+
+/*
+ * Find a stored object holding page, whose checksum is given, and take a
+ * reference on it. buf needs room for a page. Candidates are compared
+ * with dedup_lock dropped; the reference held meanwhile keeps them in
+ * the table, so the walk can carry on from there.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram,
+				struct page *page, u32 checksum,
+				unsigned char *buf)
+{
+	struct hlist_head *head;
+	struct hlist_node *pos;
+	struct zram_entry *entry, *prev = NULL;
+
+	head = &zram->dedup_table[checksum & ((1 << zram->dedup_bits) - 1)];
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos, head, node) {
+		if (entry->checksum != checksum)
+			continue;
+
+		entry->refcount++;
+		spin_unlock(&zram->dedup_lock);
+
+		if (prev)
+			zram_dedup_put(zram, prev);
+		if (zram_dedup_match(zram, entry, page, buf))
+			return entry;
+		prev = entry;
+
+		spin_lock(&zram->dedup_lock);
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	if (prev)
+		zram_dedup_put(zram, prev);
+
+	return NULL;
+}
+
+/* Make a newly stored object available to later identical pages */
+static struct zram_entry *zram_dedup_add(struct zram *zram,
+				unsigned long handle, size_t len, u32 checksum)
+{
+	struct zram_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (unlikely(!entry))
+		return NULL;
+
+	entry->handle = handle;
+	entry->refcount = 1;
+	entry->pages = 0;
+	entry->checksum = checksum;
+	entry->size = len;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, &zram->dedup_table[checksum &
+					((1 << zram->dedup_bits) - 1)]);
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/* zsmalloc object of a page that has one, table_lock held */
+static unsigned long zram_get_handle(struct zram *zram, u32 index)
+{
+	unsigned long handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		return ((struct zram_entry *)handle)->handle;
+
+	return handle;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,15 +277,73 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Writeback work sits in the swap-out path and backing device reads in
+ * the swap-in path, so they need a rescuer to make progress under
+ * memory pressure.
+ */
+static struct workqueue_struct *zram_wb_wq;
+
+/* A free block on the backing device, 0 if it is full */
+static unsigned long zram_wb_alloc_block(struct zram *zram)
+{
+	unsigned long block;
+
+	spin_lock(&zram->wb_bitmap_lock);
+	block = find_next_zero_bit(zram->wb_bitmap, zram->wb_nr_blocks,
+				   zram->wb_cursor);
+	if (block >= zram->wb_nr_blocks)
+		block = find_next_zero_bit(zram->wb_bitmap,
+					   zram->wb_nr_blocks, 1);
+	if (block < zram->wb_nr_blocks) {
+		__set_bit(block, zram->wb_bitmap);
+		zram->wb_cursor = block + 1;
+	} else
+		block = 0;
+	spin_unlock(&zram->wb_bitmap_lock);
+
+	return block;
+}
+
+static void zram_wb_free_block(struct zram *zram, unsigned long block)
+{
+	spin_lock(&zram->wb_bitmap_lock);
+	__clear_bit(block, zram->wb_bitmap);
+	spin_unlock(&zram->wb_bitmap_lock);
+}
+#else
+static inline void zram_wb_free_block(struct zram *zram,
+				unsigned long block) { }
+#endif
+
+/* Called with table_lock held for writing */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	unsigned long handle = zram->table[index].handle;
+	u32 clen = zram->table[index].size;
+
+	/* Whatever the page held, a writeback of it is void now */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_wb_free_block(zram, handle);
+		zram_stat_dec(&zram->stats.pages_wb);
+		zram->table[index].handle = 0;
+		return;
+	}
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	/* No memory is allocated for these either, handle is the word */
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram_stat_dec(&zram->stats.pages_same);
+		zram->table[index].handle = 0;
+		return;
+	}
 
-	if (unlikely(!page)) {
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -154,27 +356,27 @@ static void zram_free_page(struct zram *zram, size_t index)
 	}
 
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
-	}
+	} else if (clen <= PAGE_SIZE / 2)
+		zram_stat_dec(&zram->stats.good_compress);
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		struct zram_entry *entry = (struct zram_entry *)handle;
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		if (--entry->pages)
+			zram_stat_dec(&zram->stats.pages_dedup);
+		zram_dedup_put(zram, entry);
+	} else {
+		zs_free(zram->mem_pool, handle);
+		zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+	}
 
-out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 }
 
 static void handle_zero_page(struct page *page)
@@ -188,22 +390,234 @@ static void handle_zero_page(struct page *page)
 	flush_dcache_page(page);
 }
 
+static void handle_same_page(struct page *page, unsigned long element)
+{
+	unsigned int pos;
+	unsigned long *user_mem;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*user_mem); pos++)
+		user_mem[pos] = element;
+	kunmap_atomic(user_mem, KM_USER0);
+
+	flush_dcache_page(page);
+}
+
 static void handle_uncompressed_page(struct zram *zram,
 				struct page *page, u32 index)
 {
 	unsigned char *user_mem, *cmem;
+	unsigned long handle = zram_get_handle(zram, index);
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
 
 	flush_dcache_page(page);
 }
 
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	spin_lock(&zram->stream_lock);
+	while (list_empty(&zram->idle_streams)) {
+		spin_unlock(&zram->stream_lock);
+		wait_event(zram->stream_wait,
+			   !list_empty(&zram->idle_streams));
+		spin_lock(&zram->stream_lock);
+	}
+	zstrm = list_first_entry(&zram->idle_streams,
+				 struct zram_stream, list);
+	list_del(&zstrm->list);
+	spin_unlock(&zram->stream_lock);
+
+	return zstrm;
+}
+
+static void zram_stream_put(struct zram *zram, struct zram_stream *zstrm)
+{
+	spin_lock(&zram->stream_lock);
+	list_add(&zstrm->list, &zram->idle_streams);
+	spin_unlock(&zram->stream_lock);
+
+	wake_up(&zram->stream_wait);
+}
+
+static void zram_stream_free(struct zram_stream *zstrm)
+{
+	kfree(zstrm->workmem);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zram_stream *zram_stream_alloc(size_t workmem_size)
+{
+	struct zram_stream *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->workmem = kzalloc(workmem_size, GFP_KERNEL);
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!zstrm->workmem || !zstrm->buffer) {
+		zram_stream_free(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Backing device I/O of one writeback batch or page read, the submitter
+ * holds a reference on pending until all bios are submitted.
+ */
+struct zram_wb_io {
+	atomic_t pending;
+	int error;
+	struct completion done;
+};
+
+static void zram_wb_io_init(struct zram_wb_io *io)
+{
+	atomic_set(&io->pending, 1);
+	io->error = 0;
+	init_completion(&io->done);
+}
+
+static void zram_wb_end_io(struct bio *bio, int err)
+{
+	struct zram_wb_io *io = bio->bi_private;
+
+	if (err)
+		io->error = err;
+	bio_put(bio);
+	if (atomic_dec_and_test(&io->pending))
+		complete(&io->done);
+}
+
+static struct bio *zram_wb_bio(struct zram *zram, struct zram_wb_io *io,
+				unsigned long block, int nr_pages)
+{
+	struct bio *bio = bio_alloc(GFP_NOIO, nr_pages);
+
+	bio->bi_bdev = zram->wb_bdev;
+	bio->bi_sector = (sector_t)block << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_wb_end_io;
+	bio->bi_private = io;
+
+	return bio;
+}
+
+static void zram_wb_submit(int rw, struct bio *bio)
+{
+	struct zram_wb_io *io = bio->bi_private;
+
+	atomic_inc(&io->pending);
+	submit_bio(rw, bio);
+}
+
+static int zram_wb_wait(struct zram_wb_io *io)
+{
+	if (!atomic_dec_and_test(&io->pending))
+		wait_for_completion(&io->done);
+
+	return io->error;
+}
+
+/*
+ * Write pages to the given blocks, runs of adjacent blocks go out as one
+ * bio. All bios are in flight together, returns once they are done.
+ */
+static int zram_wb_write(struct zram *zram, struct page **pages,
+				unsigned long *blocks, int n)
+{
+	struct zram_wb_io io;
+	struct bio *bio = NULL;
+	int i = 0;
+
+	zram_wb_io_init(&io);
+
+	while (i < n) {
+		if (bio && blocks[i] != blocks[i - 1] + 1) {
+			zram_wb_submit(WRITE, bio);
+			bio = NULL;
+		}
+		if (!bio)
+			bio = zram_wb_bio(zram, &io, blocks[i], n - i);
+		if (bio_add_page(bio, pages[i], PAGE_SIZE, 0) != PAGE_SIZE) {
+			/* queue limit hit, the page starts the next bio */
+			zram_wb_submit(WRITE, bio);
+			bio = NULL;
+			continue;
+		}
+		i++;
+	}
+	if (bio)
+		zram_wb_submit(WRITE, bio);
+
+	return zram_wb_wait(&io);
+}
+
+struct zram_wb_read {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long block;
+	int error;
+};
+
+static void zram_wb_read_work(struct work_struct *work)
+{
+	struct zram_wb_read *rd = container_of(work, struct zram_wb_read,
+					       work);
+	struct zram_wb_io io;
+	struct bio *bio;
+
+	zram_wb_io_init(&io);
+	bio = zram_wb_bio(rd->zram, &io, rd->block, 1);
+	bio_add_page(bio, rd->page, PAGE_SIZE, 0);
+	zram_wb_submit(READ, bio);
+
+	rd->error = zram_wb_wait(&io);
+}
+
+/*
+ * Read a page back from the backing device. We are called from our
+ * make_request function, where bios submitted to another device are only
+ * started after we return, so the read is done by a worker.
+ */
+static int zram_wb_read(struct zram *zram, struct page *page,
+				unsigned long block)
+{
+	struct zram_wb_read rd = {
+		.zram = zram,
+		.page = page,
+		.block = block,
+	};
+
+	INIT_WORK_ONSTACK(&rd.work, zram_wb_read_work);
+	queue_work(zram_wb_wq, &rd.work);
+	flush_work(&rd.work);
+	destroy_work_on_stack(&rd.work);
+
+	zram_stat64_inc(zram, &zram->stats.wb_reads);
+
+	return rd.error;
+}
+#else
+static inline int zram_wb_read(struct zram *zram, struct page *page,
+				unsigned long block)
+{
+	return -EIO;
+}
+#endif
+
 static void zram_read(struct zram *zram, struct bio *bio)
 {
 
@@ -218,19 +632,68 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		int ret;
 		size_t clen;
 		struct page *page;
-		struct zobj_header *zheader;
+		unsigned long handle;
 		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
 
+again:
+		read_lock(&zram->table_lock);
+
+		/*
+		 * Readers only ever clear this flag, so doing it under the
+		 * read lock cannot lose another update of the flags.
+		 */
+		if (unlikely(zram_test_flag(zram, index, ZRAM_IDLE)))
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+			unsigned long block = zram->table[index].handle;
+
+			read_unlock(&zram->table_lock);
+			ret = zram_wb_read(zram, page, block);
+
+			/* The block may have been freed and reused meanwhile */
+			read_lock(&zram->table_lock);
+			if (!zram_test_flag(zram, index, ZRAM_WB) ||
+			    zram->table[index].handle != block) {
+				read_unlock(&zram->table_lock);
+				goto again;
+			}
+			read_unlock(&zram->table_lock);
+
+			if (unlikely(ret)) {
+				pr_err("Backing device read failed! err=%d, "
+					"page=%u\n", ret, index);
+				zram_stat64_inc(zram,
+						&zram->stats.failed_reads);
+				goto out;
+			}
+
+			flush_dcache_page(page);
+			index++;
+			continue;
+		}
+
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+			read_unlock(&zram->table_lock);
 			handle_zero_page(page);
 			index++;
 			continue;
 		}
 
+		if (zram_test_flag(zram, index, ZRAM_SAME)) {
+			handle = zram->table[index].handle;
+			read_unlock(&zram->table_lock);
+			handle_same_page(page, handle);
+			index++;
+			continue;
+		}
+
 		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
+		handle = zram_get_handle(zram, index);
+		if (unlikely(!handle)) {
+			read_unlock(&zram->table_lock);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
 			handle_zero_page(page);
@@ -241,6 +704,7 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 			handle_uncompressed_page(zram, page, index);
+			read_unlock(&zram->table_lock);
 			index++;
 			continue;
 		}
@@ -248,19 +712,18 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		user_mem = kmap_atomic(page, KM_USER0);
 		clen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+		ret = zram->backend->decompress(cmem,
+			zram->table[index].size, user_mem, &clen);
 
+		zs_unmap_object(zram->mem_pool, handle);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+
+		read_unlock(&zram->table_lock);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
@@ -279,6 +742,314 @@ out:
 	bio_io_error(bio);
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Pick page index for writeback if mode asks for it and copy its
+ * uncompressed contents to buf. Pages merely found idle in an idle pass
+ * are only marked, they go out in the next pass unless accessed before.
+ * The page is claimed under the write lock and copied under the read
+ * lock, which is enough to keep its object from being freed.
+ */
+static int zram_wb_prepare(struct zram *zram, u32 index, int mode,
+				struct page *buf)
+{
+	int ret;
+	size_t clen = PAGE_SIZE;
+	unsigned long handle;
+	unsigned char *user_mem, *cmem;
+
+	write_lock(&zram->table_lock);
+
+	handle = zram->table[index].handle;
+	if (!handle || zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		goto out_skip;
+
+	if (!((mode & ZRAM_WB_HUGE) &&
+	      zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		if (!(mode & ZRAM_WB_IDLE))
+			goto out_skip;
+		if (!zram_test_flag(zram, index, ZRAM_IDLE)) {
+			zram_set_flag(zram, index, ZRAM_IDLE);
+			goto out_skip;
+		}
+	}
+
+	zram_set_flag(zram, index, ZRAM_UNDER_WB);
+	write_unlock(&zram->table_lock);
+
+	read_lock(&zram->table_lock);
+
+	/* Overwritten or discarded meanwhile, zram_free_page() cleared it */
+	if (!zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+		read_unlock(&zram->table_lock);
+		return 0;
+	}
+
+	handle = zram_get_handle(zram, index);
+	user_mem = kmap_atomic(buf, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		memcpy(user_mem, cmem, PAGE_SIZE);
+		ret = 0;
+	} else
+		ret = zram->backend->decompress(cmem,
+			zram->table[index].size, user_mem, &clen);
+	zs_unmap_object(zram->mem_pool, handle);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	read_unlock(&zram->table_lock);
+
+	if (likely(!ret))
+		return 1;
+
+	pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+	write_lock(&zram->table_lock);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+out_skip:
+	write_unlock(&zram->table_lock);
+	return 0;
+}
+
+/*
+ * Write the prepared pages out and let those that did not change
+ * meanwhile drop their memory. Returns -ENOSPC once the backing device
+ * is full.
+ */
+static int zram_wb_flush(struct zram *zram, struct page **pages,
+				u32 *indices, int n)
+{
+	unsigned long blocks[ZRAM_WB_BATCH];
+	int i, err, nr_blocks;
+
+	for (nr_blocks = 0; nr_blocks < n; nr_blocks++) {
+		blocks[nr_blocks] = zram_wb_alloc_block(zram);
+		if (!blocks[nr_blocks])
+			break;
+	}
+
+	err = nr_blocks ? zram_wb_write(zram, pages, blocks, nr_blocks) : 0;
+	if (unlikely(err))
+		pr_err("Backing device write failed! err=%d\n", err);
+	else
+		zram_stat64_add(zram, &zram->stats.wb_writes, nr_blocks);
+
+	for (i = 0; i < n; i++) {
+		u32 index = indices[i];
+
+		write_lock(&zram->table_lock);
+		if (i < nr_blocks && !err &&
+		    zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_free_page(zram, index);
+			zram->table[index].handle = blocks[i];
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram_stat_inc(&zram->stats.pages_wb);
+		} else {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			if (i < nr_blocks)
+				zram_wb_free_block(zram, blocks[i]);
+		}
+		write_unlock(&zram->table_lock);
+	}
+
+	return nr_blocks < n ? -ENOSPC : 0;
+}
+
+/*
+ * Write out the pages mode asks for among the count pages in list, or
+ * the first count pages of the device without a list, in batches of up
+ * to ZRAM_WB_BATCH pages.
+ */
+static void __zram_writeback(struct zram *zram, int mode,
+				const u32 *list, size_t count)
+{
+	struct page *pages[ZRAM_WB_BATCH];
+	u32 indices[ZRAM_WB_BATCH];
+	size_t i, index;
+	int n = 0, nr_pages;
+
+	mutex_lock(&zram->wb_lock);
+
+	for (nr_pages = 0; nr_pages < ZRAM_WB_BATCH; nr_pages++) {
+		pages[nr_pages] = alloc_page(GFP_NOIO | __GFP_NOWARN);
+		if (!pages[nr_pages])
+			break;
+	}
+
+	for (i = 0; nr_pages && i < count; i++) {
+		index = list ? list[i] : i;
+		if (zram_wb_prepare(zram, index, mode, pages[n]))
+			indices[n++] = index;
+		if (n == nr_pages) {
+			n = 0;
+			if (zram_wb_flush(zram, pages, indices, nr_pages))
+				break;
+		}
+		cond_resched();
+	}
+	if (n)
+		zram_wb_flush(zram, pages, indices, n);
+
+	while (nr_pages--)
+		__free_page(pages[nr_pages]);
+
+	mutex_unlock(&zram->wb_lock);
+}
+
+/* One pass over the whole device */
+void zram_writeback(struct zram *zram, int mode)
+{
+	__zram_writeback(zram, mode, NULL, zram->disksize >> PAGE_SHIFT);
+}
+
+/* Write out just the huge pages recorded by zram_wb_huge_stored() */
+static void zram_wb_huge_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, wb_huge_work);
+	u32 huge[ZRAM_WB_BATCH];
+	int n;
+
+	spin_lock(&zram->wb_huge_lock);
+	n = zram->nr_wb_huge;
+	memcpy(huge, zram->wb_huge, n * sizeof(*huge));
+	zram->nr_wb_huge = 0;
+	spin_unlock(&zram->wb_huge_lock);
+
+	__zram_writeback(zram, ZRAM_WB_HUGE, huge, n);
+}
+
+static void zram_wb_idle_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(to_delayed_work(work), struct zram,
+					 wb_idle_work);
+
+	zram_writeback(zram, ZRAM_WB_HUGE | ZRAM_WB_IDLE);
+	zram_wb_start(zram);
+}
+
+/* (Re)arm idle writeback, a no-op while a pass is already pending */
+void zram_wb_start(struct zram *zram)
+{
+	if (zram->wb_bdev && zram->wb_idle_secs)
+		queue_delayed_work(zram_wb_wq, &zram->wb_idle_work,
+				   zram->wb_idle_secs * HZ);
+}
+
+/*
+ * Note huge page index and write out the noted ones once a batch worth
+ * piled up. Those stored while the list is full are left to idle
+ * writeback; the ones noted may have been overwritten by then, which
+ * zram_wb_prepare() sorts out.
+ */
+static void zram_wb_huge_stored(struct zram *zram, u32 index)
+{
+	int n;
+
+	if (!zram->wb_bdev)
+		return;
+
+	spin_lock(&zram->wb_huge_lock);
+	n = zram->nr_wb_huge;
+	if (n < ZRAM_WB_BATCH)
+		zram->wb_huge[zram->nr_wb_huge++] = index;
+	spin_unlock(&zram->wb_huge_lock);
+
+	if (n == ZRAM_WB_BATCH - 1)
+		queue_work(zram_wb_wq, &zram->wb_huge_work);
+}
+
+static void zram_wb_stop(struct zram *zram)
+{
+	cancel_delayed_work_sync(&zram->wb_idle_work);
+	cancel_work_sync(&zram->wb_huge_work);
+	zram->nr_wb_huge = 0;
+}
+
+/* Open path as backing device, called before the device is initialized */
+int zram_wb_open(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_blocks, *bitmap;
+	char *wb_path;
+
+	wb_path = kstrdup(path, GFP_KERNEL);
+	if (!wb_path)
+		return -ENOMEM;
+
+	bdev = blkdev_get_by_path(wb_path, FMODE_READ | FMODE_WRITE |
+				  FMODE_EXCL, zram);
+	if (IS_ERR(bdev)) {
+		kfree(wb_path);
+		return PTR_ERR(bdev);
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap = nr_blocks > 1 ? vzalloc(BITS_TO_LONGS(nr_blocks) *
+					 sizeof(long)) : NULL;
+	if (!bitmap) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		kfree(wb_path);
+		return nr_blocks > 1 ? -ENOMEM : -EINVAL;
+	}
+	/* block 0 is never used, so a handle of 0 keeps meaning no data */
+	__set_bit(0, bitmap);
+
+	zram_wb_close(zram);
+	zram->wb_bdev = bdev;
+	zram->wb_path = wb_path;
+	zram->wb_bitmap = bitmap;
+	zram->wb_nr_blocks = nr_blocks;
+	zram->wb_cursor = 1;
+
+	return 0;
+}
+
+void zram_wb_close(struct zram *zram)
+{
+	if (!zram->wb_bdev)
+		return;
+
+	blkdev_put(zram->wb_bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->wb_bitmap);
+	kfree(zram->wb_path);
+	zram->wb_bdev = NULL;
+	zram->wb_path = NULL;
+	zram->wb_bitmap = NULL;
+	zram->wb_nr_blocks = 0;
+}
+
+static void zram_wb_init(struct zram *zram)
+{
+	spin_lock_init(&zram->wb_bitmap_lock);
+	spin_lock_init(&zram->wb_huge_lock);
+	mutex_init(&zram->wb_lock);
+	INIT_DELAYED_WORK(&zram->wb_idle_work, zram_wb_idle_work);
+	INIT_WORK(&zram->wb_huge_work, zram_wb_huge_work);
+}
+
+static int __init zram_wb_create_wq(void)
+{
+	zram_wb_wq = alloc_workqueue("zram_wb", WQ_MEM_RECLAIM, 0);
+	if (!zram_wb_wq)
+		return -ENOMEM;
+	return 0;
+}
+
+static void zram_wb_destroy_wq(void)
+{
+	destroy_workqueue(zram_wb_wq);
+}
+#else
+static inline void zram_wb_huge_stored(struct zram *zram, u32 index) { }
+static inline void zram_wb_stop(struct zram *zram) { }
+static inline void zram_wb_init(struct zram *zram) { }
+static inline void zram_wb_start(struct zram *zram) { }
+static inline void zram_wb_close(struct zram *zram) { }
+static inline int zram_wb_create_wq(void) { return 0; }
+static inline void zram_wb_destroy_wq(void) { }
+#endif
+
 static void zram_write(struct zram *zram, struct bio *bio)
 {
 	int i;
@@ -290,42 +1061,63 @@ static void zram_write(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		u32 offset;
+		u32 checksum = 0;
 		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+		bool uncompressed = false;
+		unsigned long handle = 0, element;
+		struct zram_entry *entry = NULL;
+		struct zram_stream *zstrm;
+		struct page *page;
+		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
-
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
 
 		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
+		if (page_same_filled(user_mem, &element)) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
+			write_lock(&zram->table_lock);
+			zram_free_page(zram, index);
+			if (!element) {
+				zram_stat_inc(&zram->stats.pages_zero);
+				zram_set_flag(zram, index, ZRAM_ZERO);
+			} else {
+				zram->table[index].handle = element;
+				zram_stat_inc(&zram->stats.pages_same);
+				zram_set_flag(zram, index, ZRAM_SAME);
+			}
+			write_unlock(&zram->table_lock);
 			index++;
 			continue;
 		}
+		if (zram->use_dedup)
+			checksum = jhash(user_mem, PAGE_SIZE, 0);
+		kunmap_atomic(user_mem, KM_USER0);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		zstrm = zram_stream_get(zram);
+
+		/*
+		 * An identical page stored earlier has its object shared
+		 * instead of compressing this one again.
+		 */
+		if (zram->use_dedup) {
+			entry = zram_dedup_find(zram, page, checksum,
+						zstrm->buffer);
+			if (entry) {
+				zram_stream_put(zram, zstrm);
+				zram_stat64_inc(zram, &zram->stats.dedup_hits);
+				clen = entry->size;
+				uncompressed = clen == PAGE_SIZE;
+				goto store;
+			}
+		}
 
+		user_mem = kmap_atomic(page, KM_USER0);
+		ret = zram->backend->compress(user_mem, PAGE_SIZE,
+					zstrm->buffer, &clen, zstrm->workmem);
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		if (unlikely(ret)) {
+			zram_stream_put(zram, zstrm);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
@@ -338,62 +1130,67 @@ static void zram_write(struct zram *zram, struct bio *bio)
 		 */
 		if (unlikely(clen > max_zpage_size)) {
 			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+			uncompressed = true;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+		handle = zs_malloc(zram->mem_pool, clen);
+		if (unlikely(!handle)) {
+			zram_stream_put(zram, zstrm);
 			pr_info("Error allocating memory for compressed "
 				"page: %u, size=%zu\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
-memstore:
-		zram->table[index].offset = offset;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+		if (unlikely(uncompressed)) {
+			user_mem = kmap_atomic(page, KM_USER0);
+			memcpy(cmem, user_mem, PAGE_SIZE);
+			kunmap_atomic(user_mem, KM_USER0);
+		} else
+			memcpy(cmem, zstrm->buffer, clen);
+		zs_unmap_object(zram->mem_pool, handle);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		zram_stream_put(zram, zstrm);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+		/* Without an entry the page just keeps the object to itself */
+		if (zram->use_dedup)
+			entry = zram_dedup_add(zram, handle, clen, checksum);
 
-		memcpy(cmem, src, clen);
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+
+store:
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+		write_lock(&zram->table_lock);
+
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		zram_free_page(zram, index);
+
+		if (entry) {
+			zram->table[index].handle = (unsigned long)entry;
+			zram_set_flag(zram, index, ZRAM_DEDUP);
+			if (entry->pages++)
+				zram_stat_inc(&zram->stats.pages_dedup);
+		} else
+			zram->table[index].handle = handle;
+		zram->table[index].size = clen;
+		if (unlikely(uncompressed)) {
+			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+			zram_stat_inc(&zram->stats.pages_expand);
+		}
 
 		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
 		zram_stat_inc(&zram->stats.pages_stored);
 		if (clen <= PAGE_SIZE / 2)
 			zram_stat_inc(&zram->stats.good_compress);
 
-		mutex_unlock(&zram->lock);
+		write_unlock(&zram->table_lock);
+
+		if (unlikely(uncompressed))
+			zram_wb_huge_stored(zram, index);
 		index++;
 	}
 
@@ -460,36 +1257,45 @@ void zram_reset_device(struct zram *zram)
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	zram_wb_stop(zram);
+
+	/* Free compression streams, all idle once I/O has stopped */
+	while (!list_empty(&zram->idle_streams)) {
+		struct zram_stream *zstrm;
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+		zstrm = list_first_entry(&zram->idle_streams,
+					 struct zram_stream, list);
+		list_del(&zstrm->list);
+		zram_stream_free(zstrm);
+	}
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		unsigned long handle = zram->table[index].handle;
 
-		if (!page)
+		if (!handle || zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+		if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			zram_dedup_put(zram, (struct zram_entry *)handle);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	vfree(zram->dedup_table);
+	zram->dedup_table = NULL;
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+	/* Blocks written back go with the table */
+	zram_wb_close(zram);
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -500,6 +1306,7 @@ void zram_reset_device(struct zram *zram)
 int zram_init_device(struct zram *zram)
 {
 	int ret;
+	unsigned int i;
 	size_t num_pages;
 
 	mutex_lock(&zram->init_lock);
@@ -511,18 +1318,17 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
+	for (i = 0; i < zram->max_streams; i++) {
+		struct zram_stream *zstrm;
 
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
-		goto fail;
+		zstrm = zram_stream_alloc(zram->backend->workmem_size);
+
+		if (!zstrm) {
+			pr_err("Error allocating compression stream %u\n", i);
+			ret = -ENOMEM;
+			goto fail;
+		}
+		list_add(&zstrm->list, &zram->idle_streams);
 	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
@@ -535,12 +1341,25 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	if (zram->use_dedup) {
+		/* about eight stored pages per bucket when full */
+		zram->dedup_bits = ilog2((num_pages >> 3) | 1);
+		zram->dedup_table = vzalloc(sizeof(*zram->dedup_table) <<
+					    zram->dedup_bits);
+		if (!zram->dedup_table) {
+			pr_err("Error allocating zram dedup table\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -548,6 +1367,7 @@ int zram_init_device(struct zram *zram)
 	}
 
 	zram->init_done = 1;
+	zram_wb_start(zram);
 	mutex_unlock(&zram->init_lock);
 
 	pr_debug("Initialization done!\n");
@@ -561,12 +1381,41 @@ fail:
 	return ret;
 }
 
+/*
+ * Bytes of data stored in all initialized devices and the memory they
+ * take up, as shown by orig_data_size and mem_used_total. Devices being
+ * set up or reset right now are skipped rather than waited for, this is
+ * called from the lowmemorykiller in reclaim.
+ */
+void zram_get_total_stats(u64 *orig_size, u64 *mem_used)
+{
+	unsigned int i;
+
+	*orig_size = 0;
+	*mem_used = 0;
+	for (i = 0; i < num_devices; i++) {
+		struct zram *zram = &devices[i];
+
+		if (!mutex_trylock(&zram->init_lock))
+			continue;
+		if (zram->init_done) {
+			*orig_size += (u64)zram->stats.pages_stored
+							<< PAGE_SHIFT;
+			*mem_used += zs_get_total_size_bytes(zram->mem_pool);
+		}
+		mutex_unlock(&zram->init_lock);
+	}
+}
+EXPORT_SYMBOL_GPL(zram_get_total_stats);
+
 void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->table_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->table_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1428,16 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->table_lock);
+	spin_lock_init(&zram->dedup_lock);
+	zram_wb_init(zram);
+	INIT_LIST_HEAD(&zram->idle_streams);
+	spin_lock_init(&zram->stream_lock);
+	init_waitqueue_head(&zram->stream_wait);
+	zram->max_streams = num_online_cpus();
+	zram->backend = &zram_backends[0];
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -671,6 +1527,10 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	ret = zram_wb_create_wq();
+	if (ret)
+		goto unregister;
+
 	if (!num_devices) {
 		pr_info("num_devices not specified. Using default: 1\n");
 		num_devices = 1;
@@ -681,7 +1541,7 @@ static int __init zram_init(void)
 	devices = kzalloc(num_devices * sizeof(struct zram), GFP_KERNEL);
 	if (!devices) {
 		ret = -ENOMEM;
-		goto unregister;
+		goto destroy_wq;
 	}
 
 	for (dev_id = 0; dev_id < num_devices; dev_id++) {
@@ -696,6 +1556,8 @@ free_devices:
 	while (dev_id)
 		destroy_device(&devices[--dev_id]);
 	kfree(devices);
+destroy_wq:
+	zram_wb_destroy_wq();
 unregister:
 	unregister_blkdev(zram_major, "zram");
 out:
@@ -713,11 +1575,13 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_wb_close(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(devices);
+	zram_wb_destroy_wq();
 	pr_debug("Cleanup done!\n");
 }
 
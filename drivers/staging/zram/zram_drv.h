@@ -17,8 +17,11 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +29,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -50,9 +41,8 @@ static const unsigned default_disksize_perc_ram = 25;
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * NOTE: max_zpage_size must be less than or equal to
+ * ZS_MAX_ALLOC_SIZE, which also holds incompressible pages.
  */
 
 /*-- End of configurable params */
@@ -63,6 +53,9 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 #define ZRAM_LOGICAL_BLOCK_SIZE	4096
 
+/* Pages written back with one bio, also what makes huge pages go out */
+#define ZRAM_WB_BATCH		32
+
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
 	/* Page is stored uncompressed */
@@ -71,6 +64,21 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is one word repeated, the word is kept in handle */
+	ZRAM_SAME,
+
+	/* handle points to a zram_entry shared with identical pages */
+	ZRAM_DEDUP,
+
+	/* Page lives on the backing device, handle is its block there */
+	ZRAM_WB,
+
+	/* Page is being written back, cleared if it changes meanwhile */
+	ZRAM_UNDER_WB,
+
+	/* Page was not accessed since the last idle writeback pass */
+	ZRAM_IDLE,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -78,12 +86,26 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	unsigned long handle;	/* zsmalloc object, 0 if none */
+	u16 size;	/* object size (PAGE_SIZE if uncompressed) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/*
+ * A stored object shared by all identical pages, hashed by a checksum of
+ * the uncompressed page. pages is the number of table entries pointing
+ * at it, refcount those plus writers comparing against it.
+ */
+struct zram_entry {
+	struct hlist_node node;
+	unsigned long handle;
+	unsigned long refcount;	/* protected by dedup_lock */
+	unsigned long pages;	/* protected by table_lock */
+	u32 checksum;
+	u16 size;
+};
+
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
 	u64 num_reads;		/* failed + successful */
@@ -92,20 +114,58 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 dedup_hits;		/* no. of writes that found a stored copy */
+	u64 wb_reads;		/* no. of pages read from backing device */
+	u64 wb_writes;		/* no. of pages written to backing device */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of other single word filled pages */
+	u32 pages_dedup;	/* no. of pages sharing an object stored
+				   for another page */
+	u32 pages_wb;		/* no. of pages on the backing device */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 };
 
+/*
+ * Compression algorithm, chosen per device before it is initialized.
+ * Both functions return 0 on success, *dst_len is the size of dst on
+ * entry to decompress.
+ */
+struct zram_backend {
+	const char *name;
+	size_t workmem_size;
+	int (*compress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *workmem);
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+};
+
+/*
+ * Compression working memory and output buffer. Writers take an idle one
+ * from the device for the time it takes to compress a page and copy the
+ * result out, so up to max_streams pages are compressed in parallel.
+ */
+struct zram_stream {
+	struct list_head list;
+	void *workmem;
+	void *buffer;		/* two pages, compression may expand */
+};
+
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	const struct zram_backend *backend;
+	struct list_head idle_streams;
+	spinlock_t stream_lock;	/* protect idle_streams */
+	wait_queue_head_t stream_wait;
+	unsigned int max_streams;
 	struct table *table;
+	rwlock_t table_lock;	/* protect table and 32-bit stats */
+	int use_dedup;
+	struct hlist_head *dedup_table;
+	unsigned int dedup_bits;
+	spinlock_t dedup_lock;	/* protect dedup_table and refcounts */
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -118,15 +178,45 @@ struct zram {
 	u64 disksize;	/* bytes */
 
 	struct zram_stats stats;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Backing device, set before init, NULL if there is none */
+	struct block_device *wb_bdev;
+	char *wb_path;
+	unsigned long *wb_bitmap;	/* blocks in use, block 0 is never */
+	unsigned long wb_nr_blocks;
+	unsigned long wb_cursor;	/* where to look for a free block */
+	spinlock_t wb_bitmap_lock;
+	struct mutex wb_lock;		/* one writeback pass at a time */
+	unsigned int wb_idle_secs;	/* 0 disables idle writeback */
+	struct delayed_work wb_idle_work;
+	struct work_struct wb_huge_work;
+	spinlock_t wb_huge_lock;	/* protect wb_huge and nr_wb_huge */
+	u32 wb_huge[ZRAM_WB_BATCH];	/* huge pages stored since then */
+	int nr_wb_huge;
+#endif
 };
 
 extern struct zram *devices;
 extern unsigned int num_devices;
+extern const struct zram_backend zram_backends[];
 #ifdef CONFIG_SYSFS
 extern struct attribute_group zram_disk_attr_group;
 #endif
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern void zram_get_total_stats(u64 *orig_size, u64 *mem_used);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* What a writeback pass writes out */
+#define ZRAM_WB_HUGE	0x1	/* pages stored uncompressed */
+#define ZRAM_WB_IDLE	0x2	/* pages idle since the previous pass */
+
+extern int zram_wb_open(struct zram *zram, const char *path);
+extern void zram_wb_close(struct zram *zram);
+extern void zram_wb_start(struct zram *zram);
+extern void zram_writeback(struct zram *zram, int mode);
+#endif
 
 #endif
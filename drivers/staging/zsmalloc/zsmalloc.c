@@ -0,0 +1,643 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Locking: class->lock protects the zspages of a class, their free lists
+ * and object headers. pool->migrate_lock is taken for reading to turn a
+ * handle into a location and keep it valid, and for writing by
+ * compaction, which takes the class lock inside it. zs_map_object()
+ * keeps it, and preemption, until zs_unmap_object().
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static unsigned int get_class_idx(size_t size)
+{
+	if (size < ZS_MIN_ALLOC_SIZE)
+		return 0;
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/* number of pages per zspage that wastes the least space at the end */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, best = 1, best_usage = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned int bytes = i * PAGE_SIZE;
+		unsigned int usage = (bytes - bytes % size) * 100 / bytes;
+
+		if (usage > best_usage) {
+			best_usage = usage;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static unsigned long obj_location(struct zspage *zspage, unsigned int idx)
+{
+	return (page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS) | idx;
+}
+
+static struct zspage *location_to_zspage(unsigned long loc,
+					unsigned int *idx)
+{
+	*idx = loc & OBJ_INDEX_MASK;
+	return (struct zspage *)page_private(pfn_to_page(loc >>
+							 OBJ_INDEX_BITS));
+}
+
+static unsigned long handle_location(unsigned long handle)
+{
+	return *(unsigned long *)handle;
+}
+
+/* page holding byte 'offset' of object idx, and where in it */
+static struct page *obj_page(struct size_class *class, struct zspage *zspage,
+			unsigned int idx, unsigned int offset,
+			unsigned int *page_offset)
+{
+	unsigned long off = (unsigned long)idx * class->size + offset;
+
+	*page_offset = off & ~PAGE_MASK;
+	return zspage->pages[off >> PAGE_SHIFT];
+}
+
+static unsigned long obj_get_header(struct size_class *class,
+			struct zspage *zspage, unsigned int idx)
+{
+	unsigned int off;
+	unsigned long header;
+	struct page *page = obj_page(class, zspage, idx, 0, &off);
+	void *addr = kmap_atomic(page, KM_USER0);
+
+	header = *(unsigned long *)(addr + off);
+	kunmap_atomic(addr, KM_USER0);
+
+	return header;
+}
+
+static void obj_set_header(struct size_class *class, struct zspage *zspage,
+			unsigned int idx, unsigned long header)
+{
+	unsigned int off;
+	struct page *page = obj_page(class, zspage, idx, 0, &off);
+	void *addr = kmap_atomic(page, KM_USER0);
+
+	*(unsigned long *)(addr + off) = header;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/* copy the data part of an object, which may span pages, to or from buf */
+static void obj_copy(struct size_class *class, struct zspage *zspage,
+			unsigned int idx, char *buf, bool to_obj)
+{
+	unsigned int done = ZS_HANDLE_SIZE;
+
+	while (done < class->size) {
+		unsigned int off, len;
+		struct page *page = obj_page(class, zspage, idx, done, &off);
+		char *addr;
+
+		len = min_t(unsigned int, class->size - done, PAGE_SIZE - off);
+		addr = kmap_atomic(page, KM_USER1);
+		if (to_obj)
+			memcpy(addr + off, buf, len);
+		else
+			memcpy(buf, addr + off, len);
+		kunmap_atomic(addr, KM_USER1);
+
+		buf += len;
+		done += len;
+	}
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	if (!zspage->inuse)
+		return ZS_EMPTY;
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse * ZS_ALMOST_FULL_DEN <=
+	    class->objs_per_zspage * ZS_ALMOST_FULL_NUM)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/* move zspage to the list matching its use, unlink it once unused */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	list_del(&zspage->list);
+	if (newfg != ZS_EMPTY)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	unsigned int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+/* A new zspage with all objects chained on its free list */
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+			struct size_class *class)
+{
+	struct zspage *zspage;
+	unsigned int i, idx;
+	void *addr = NULL;
+	int mapped = -1;
+
+	zspage = kzalloc(sizeof(*zspage),
+			 pool->flags & ~(__GFP_HIGHMEM | __GFP_MOVABLE));
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page = alloc_page(pool->flags);
+
+		if (!page) {
+			while (i--)
+				__free_page(zspage->pages[i]);
+			kfree(zspage);
+			return NULL;
+		}
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+	}
+
+	for (idx = 0; idx < class->objs_per_zspage; idx++) {
+		unsigned long off = (unsigned long)idx * class->size;
+
+		if ((off >> PAGE_SHIFT) != mapped) {
+			if (addr)
+				kunmap_atomic(addr, KM_USER0);
+			mapped = off >> PAGE_SHIFT;
+			addr = kmap_atomic(zspage->pages[mapped], KM_USER0);
+		}
+		*(unsigned long *)(addr + (off & ~PAGE_MASK)) =
+			(idx + 1) << OBJ_TAG_BITS;
+	}
+	kunmap_atomic(addr, KM_USER0);
+
+	zspage->class_idx = class->index;
+	zspage->freeobj = 0;
+	zspage->fullness = ZS_ALMOST_EMPTY;
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+
+	return zspage;
+}
+
+/* take a free object of zspage for handle, with class->lock held */
+static unsigned int obj_alloc(struct size_class *class, struct zspage *zspage,
+			unsigned long handle)
+{
+	unsigned int idx = zspage->freeobj;
+
+	zspage->freeobj = obj_get_header(class, zspage, idx) >> OBJ_TAG_BITS;
+	obj_set_header(class, zspage, idx, handle | OBJ_ALLOCATED_TAG);
+	*(unsigned long *)handle = obj_location(zspage, idx);
+	zspage->inuse++;
+	class->objs_used++;
+
+	return idx;
+}
+
+/* give back object idx of zspage, with class->lock held */
+static enum fullness_group obj_free(struct size_class *class,
+			struct zspage *zspage, unsigned int idx)
+{
+	obj_set_header(class, zspage, idx, zspage->freeobj << OBJ_TAG_BITS);
+	zspage->freeobj = idx;
+	zspage->inuse--;
+	class->objs_used--;
+
+	return fix_fullness_group(class, zspage);
+}
+
+/* the zspage new objects should go to, fuller ones first */
+static struct zspage *find_get_zspage(struct size_class *class,
+			struct zspage *skip)
+{
+	static const enum fullness_group order[] = {
+		ZS_ALMOST_FULL, ZS_ALMOST_EMPTY,
+	};
+	struct zspage *zspage;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(order); i++)
+		list_for_each_entry(zspage, &class->fullness_list[order[i]],
+				    list)
+			if (zspage != skip)
+				return zspage;
+
+	return NULL;
+}
+
+/**
+ * zs_malloc - Allocate an object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of the object
+ *
+ * Returns a handle for the object or 0 if no memory could be allocated
+ * or size is larger than ZS_MAX_ALLOC_SIZE. Use zs_map_object() to get
+ * at the contents.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned long handle;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = (unsigned long)kmem_cache_alloc(pool->handle_cache,
+			pool->flags & ~(__GFP_HIGHMEM | __GFP_MOVABLE));
+	if (!handle)
+		return 0;
+
+	class = &pool->classes[get_class_idx(size + ZS_HANDLE_SIZE)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class, NULL);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(pool->handle_cache, (void *)handle);
+			return 0;
+		}
+		spin_lock(&class->lock);
+		list_add(&zspage->list,
+			 &class->fullness_list[ZS_ALMOST_EMPTY]);
+		class->objs_allocated += class->objs_per_zspage;
+	}
+
+	obj_alloc(class, zspage, handle);
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+
+	if (unlikely(!handle))
+		return;
+
+	read_lock(&pool->migrate_lock);
+	zspage = location_to_zspage(handle_location(handle), &idx);
+	class = &pool->classes[zspage->class_idx];
+	spin_lock(&class->lock);
+	read_unlock(&pool->migrate_lock);
+
+	if (obj_free(class, zspage, idx) == ZS_EMPTY) {
+		class->objs_allocated -= class->objs_per_zspage;
+		spin_unlock(&class->lock);
+		free_zspage(pool, class, zspage);
+	} else
+		spin_unlock(&class->lock);
+
+	kmem_cache_free(pool->handle_cache, (void *)handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - Get at the contents of an object.
+ * @pool: pool the object belongs to
+ * @handle: handle returned by zs_malloc()
+ * @mm: how the mapping is going to be used
+ *
+ * The object stays where it is until zs_unmap_object(), which has to
+ * follow before sleeping or mapping another object of the pool.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct zs_map_area *area;
+	struct size_class *class;
+	struct zspage *zspage;
+	struct page *page;
+	unsigned int idx, off;
+
+	area = get_cpu_ptr(pool->map_area);
+	read_lock(&pool->migrate_lock);
+
+	zspage = location_to_zspage(handle_location(handle), &idx);
+	class = &pool->classes[zspage->class_idx];
+	page = obj_page(class, zspage, idx, 0, &off);
+
+	if (off + class->size <= PAGE_SIZE) {
+		area->vaddr = kmap_atomic(page, KM_USER1);
+		return area->vaddr + off + ZS_HANDLE_SIZE;
+	}
+
+	area->vaddr = NULL;
+	area->mode = mm;
+	area->class = class;
+	area->zspage = zspage;
+	area->idx = idx;
+	if (mm != ZS_MM_WO)
+		obj_copy(class, zspage, idx, area->buf, false);
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_map_area *area = this_cpu_ptr(pool->map_area);
+
+	if (area->vaddr)
+		kunmap_atomic(area->vaddr, KM_USER1);
+	else if (area->mode != ZS_MM_RO)
+		obj_copy(area->class, area->zspage, area->idx, area->buf,
+			 true);
+
+	read_unlock(&pool->migrate_lock);
+	put_cpu_ptr(pool->map_area);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* zspages worth of free objects in a class */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	return (class->objs_allocated - class->objs_used) /
+		class->objs_per_zspage;
+}
+
+/*
+ * Move the objects of the emptiest zspages into the fullest ones until
+ * the class has less than a zspage of free objects left over.
+ */
+static unsigned long zs_compact_class(struct zs_pool *pool,
+			struct size_class *class)
+{
+	/* nothing can be mapped while we hold migrate_lock for writing */
+	char *buf = per_cpu_ptr(pool->map_area, 0)->buf;
+	struct list_head *almost_empty;
+	unsigned long freed = 0;
+
+	write_lock(&pool->migrate_lock);
+	spin_lock(&class->lock);
+	almost_empty = &class->fullness_list[ZS_ALMOST_EMPTY];
+
+	while (zs_can_compact(class) && !list_empty(almost_empty)) {
+		struct zspage *src;
+		unsigned int idx;
+
+		/* the list is in allocation order, the tail is oldest */
+		src = list_entry(almost_empty->prev, struct zspage, list);
+		for (idx = 0; src->inuse; idx++) {
+			unsigned long header;
+			struct zspage *dst;
+
+			header = obj_get_header(class, src, idx);
+			if (!(header & OBJ_ALLOCATED_TAG))
+				continue;
+			dst = find_get_zspage(class, src);
+			if (!dst)
+				goto out;
+
+			obj_copy(class, src, idx, buf, false);
+			obj_copy(class, dst, obj_alloc(class, dst,
+				 header & ~OBJ_ALLOCATED_TAG), buf, true);
+			fix_fullness_group(class, dst);
+			obj_free(class, src, idx);
+		}
+
+		class->objs_allocated -= class->objs_per_zspage;
+		free_zspage(pool, class, src);
+		freed += class->pages_per_zspage;
+
+		if (need_resched() || spin_needbreak(&class->lock)) {
+			spin_unlock(&class->lock);
+			write_unlock(&pool->migrate_lock);
+			cond_resched();
+			write_lock(&pool->migrate_lock);
+			spin_lock(&class->lock);
+		}
+	}
+out:
+	spin_unlock(&class->lock);
+	write_unlock(&pool->migrate_lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Free zspages by packing objects more densely.
+ * @pool: pool to compact
+ *
+ * Returns the number of pages given back. Objects keep their handles,
+ * their contents must not be mapped while this runs.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed = 0;
+	int i;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		struct size_class *class = &pool->classes[i];
+
+		if (!zs_can_compact(class))
+			continue;
+		freed += zs_compact_class(pool, class);
+		cond_resched();
+	}
+	atomic_long_add(freed, &pool->pages_compacted);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/* pages that compaction could give back right now */
+static unsigned long zs_compactable_pages(struct zs_pool *pool)
+{
+	unsigned long pages = 0;
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		pages += zs_can_compact(class) * class->pages_per_zspage;
+	}
+
+	return pages;
+}
+
+static int zs_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					    shrinker);
+
+	if (sc->nr_to_scan > 0)
+		zs_compact(pool);
+
+	return min_t(unsigned long, zs_compactable_pages(pool), INT_MAX);
+}
+
+static void zs_free_map_areas(struct zs_pool *pool)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+	free_percpu(pool->map_area);
+}
+
+/*
+ * Create a memory pool. zspage pages are allocated with flags, handles
+ * with the same flags minus __GFP_HIGHMEM.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	struct zs_pool *pool;
+	int i, cpu;
+
+	pool = kzalloc(roundup(sizeof(*pool), PAGE_SIZE), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+		int fg;
+
+		spin_lock_init(&class->lock);
+		class->index = i;
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / class->size;
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	pool->flags = flags;
+	rwlock_init(&pool->migrate_lock);
+	atomic_long_set(&pool->pages_allocated, 0);
+	atomic_long_set(&pool->pages_compacted, 0);
+
+	pool->name = kasprintf(GFP_KERNEL, "zs_handle-%s", name);
+	if (!pool->name)
+		goto free_pool;
+
+	pool->handle_cache = kmem_cache_create(pool->name, ZS_HANDLE_SIZE,
+					       0, 0, NULL);
+	if (!pool->handle_cache)
+		goto free_name;
+
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->map_area)
+		goto free_cache;
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_CLASS_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto free_areas;
+	}
+
+	pool->shrinker.shrink = zs_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+
+free_areas:
+	zs_free_map_areas(pool);
+free_cache:
+	kmem_cache_destroy(pool->handle_cache);
+free_name:
+	kfree(pool->name);
+free_pool:
+	kfree(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/* All objects have to be freed before */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	unregister_shrinker(&pool->shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+		int fg;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (!list_empty(&class->fullness_list[fg])) {
+				pr_warning("zsmalloc: %s: class %u still in "
+					   "use\n", pool->name, class->size);
+				break;
+			}
+		}
+	}
+
+	zs_free_map_areas(pool);
+	kmem_cache_destroy(pool->handle_cache);
+	kfree(pool->name);
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+u64 zs_get_compacted_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_compacted) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_compacted_bytes);
@@ -0,0 +1,127 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+/*
+ * Objects of a size class are laid out back to back over a zspage, a
+ * group of up to ZS_MAX_PAGES_PER_ZSPAGE pages, so they may cross from one
+ * page into the next. Every object starts with a header word: the handle
+ * with OBJ_ALLOCATED_TAG set while it is in use, the index of the next
+ * free object shifted by OBJ_TAG_BITS while it is free. Class sizes are
+ * multiples of ZS_SIZE_CLASS_DELTA, so a header never crosses a page.
+ *
+ * A handle is the address of a word holding the location of the object,
+ * the pfn of the first page of its zspage and its index there. Moving
+ * the object only has to update that word.
+ */
+#define ZS_MAX_ZSPAGE_ORDER	2
+#define ZS_MAX_PAGES_PER_ZSPAGE	(1 << ZS_MAX_ZSPAGE_ORDER)
+
+#define ZS_HANDLE_SIZE		sizeof(unsigned long)
+#define ZS_MIN_ALLOC_SHIFT	5
+#define ZS_MIN_ALLOC_SIZE	(1 << ZS_MIN_ALLOC_SHIFT)
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_MAX_CLASS_SIZE	ALIGN(ZS_MAX_ALLOC_SIZE + ZS_HANDLE_SIZE, \
+				      ZS_SIZE_CLASS_DELTA)
+#define ZS_SIZE_CLASSES		((ZS_MAX_CLASS_SIZE - ZS_MIN_ALLOC_SIZE) / \
+				 ZS_SIZE_CLASS_DELTA + 1)
+
+#define OBJ_INDEX_BITS		(PAGE_SHIFT + ZS_MAX_ZSPAGE_ORDER - \
+				 ZS_MIN_ALLOC_SHIFT)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+
+#define OBJ_ALLOCATED_TAG	1UL
+#define OBJ_TAG_BITS		1
+
+/*
+ * A zspage is kept on the list of its class matching how many of its
+ * objects are used, or freed right away once none are.
+ */
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+/* More than this fraction of objects in use makes a zspage almost full */
+#define ZS_ALMOST_FULL_NUM	3
+#define ZS_ALMOST_FULL_DEN	4
+
+struct zspage {
+	struct list_head list;
+	unsigned int class_idx;
+	unsigned int inuse;		/* allocated objects */
+	unsigned int freeobj;		/* first free object */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	spinlock_t lock;		/* protect everything below */
+	unsigned int index;
+	unsigned int size;		/* object size including header */
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	unsigned long objs_allocated;	/* in all zspages of the class */
+	unsigned long objs_used;
+};
+
+/*
+ * Per-CPU state between zs_map_object() and zs_unmap_object(). Objects
+ * within one page are mapped in place at vaddr, ones spanning two pages
+ * are copied to buf.
+ */
+struct zs_map_area {
+	char *buf;
+	void *vaddr;
+	enum zs_mapmode mode;
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+};
+
+struct zs_pool {
+	char *name;			/* of the handle cache */
+	gfp_t flags;			/* for zspage pages */
+	struct kmem_cache *handle_cache;
+	struct zs_map_area __percpu *map_area;
+
+	/*
+	 * Taken for reading to look up and access an object by its handle,
+	 * for writing to move objects around.
+	 */
+	rwlock_t migrate_lock;
+
+	atomic_long_t pages_allocated;
+	atomic_long_t pages_compacted;
+	struct shrinker shrinker;
+
+	struct size_class classes[ZS_SIZE_CLASSES];
+};
+
+#endif
@@ -34,6 +34,10 @@
 #include <linux/vmalloc.h>
 #include <linux/proc_fs.h>
 #include <asm/uaccess.h>
+
+#ifdef CONFIG_CPU_DIDLE
+#include <linux/deep_idle.h>
+#endif
 #if	defined(CONFIG_USB_GADGET_S3C_OTGD_DMA_MODE) /* DMA mode */
 #define OTG_DMA_MODE		1
 
@@ -428,7 +432,14 @@ int s3c_vbus_enable(struct usb_gadget *gadget, int enable)
 			udc_disable(dev);
 			clk_disable(otg_clock);
 			s3c_udc_power(dev, 0);
+#ifdef CONFIG_CPU_DIDLE
+			deepidle_unblock(DEEPIDLE_VETO_USBOTG);
+#endif
 		} else {
+#ifdef CONFIG_CPU_DIDLE
+			/* no didle while a B-session may be valid */
+			deepidle_block(DEEPIDLE_VETO_USBOTG);
+#endif
 			s3c_udc_power(dev, 1);
 			clk_enable(otg_clock);
 			udc_reinit(dev);
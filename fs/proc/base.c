@@ -1148,6 +1148,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		lowmem_oom_adj_changed(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1283,6 +1285,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		lowmem_oom_adj_changed(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
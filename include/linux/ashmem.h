@@ -32,6 +32,30 @@ struct ashmem_pin {
 	__u32 len;	/* length forward from offset, in bytes, page-aligned */
 };
 
+/* ASHMEM_GET_PURGE_STATS for one area, ASHMEM_GET_GLOBAL_PURGE_STATS */
+struct ashmem_purge_stats {
+	__u64 bytes_purged;	/* since open, or since boot */
+	__u32 purge_count;	/* unpinned ranges purged */
+	__u32 ms_since_purge;	/* ASHMEM_NEVER_PURGED if none was */
+};
+
+#define ASHMEM_NEVER_PURGED	0xffffffff
+
+/* Levels of struct ashmem_pressure */
+#define ASHMEM_PRESSURE_RECLAIM	1	/* reclaim looked at unpinned pages */
+#define ASHMEM_PRESSURE_PURGED	2	/* and purged some of them */
+
+/*
+ * What read() on the fd of ASHMEM_GET_PRESSURE_FD returns. It blocks until
+ * something happened since the last read() and polls readable then.
+ */
+struct ashmem_pressure {
+	__u32 level;		/* highest ASHMEM_PRESSURE_* since last read */
+	__u32 events;		/* number of them since last read */
+	__u64 unpinned_bytes;	/* still on the LRU, i.e. purgeable */
+	__u64 bytes_purged;	/* since boot */
+};
+
 #define __ASHMEMIOC		0x77
 
 #define ASHMEM_SET_NAME		_IOW(__ASHMEMIOC, 1, char[ASHMEM_NAME_LEN])
@@ -44,5 +68,9 @@ struct ashmem_pin {
 #define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
 #define ASHMEM_GET_PIN_STATUS	_IO(__ASHMEMIOC, 9)
 #define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+#define ASHMEM_GET_PURGE_STATS	_IOR(__ASHMEMIOC, 11, struct ashmem_purge_stats)
+#define ASHMEM_GET_GLOBAL_PURGE_STATS \
+	_IOR(__ASHMEMIOC, 12, struct ashmem_purge_stats)
+#define ASHMEM_GET_PRESSURE_FD	_IO(__ASHMEMIOC, 13) /* O_CLOEXEC, O_NONBLOCK */
 
 #endif	/* _LINUX_ASHMEM_H */
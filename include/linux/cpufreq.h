@@ -196,6 +196,9 @@ extern int __cpufreq_driver_target(struct cpufreq_policy *policy,
 extern int __cpufreq_driver_getavg(struct cpufreq_policy *policy,
 				   unsigned int cpu);
 
+extern int cpufreq_driver_get_voltage(unsigned int cpu, unsigned int freq,
+				      unsigned long *uv);
+
 int cpufreq_register_governor(struct cpufreq_governor *governor);
 void cpufreq_unregister_governor(struct cpufreq_governor *governor);
 
@@ -231,6 +234,12 @@ struct cpufreq_driver {
 	unsigned int (*getavg)	(struct cpufreq_policy *policy,
 				 unsigned int cpu);
 	int	(*bios_limit)	(int cpu, unsigned int *limit);
+	/*
+	 * Supply voltages in uV used at freq, at most CPUFREQ_MAX_SUPPLIES.
+	 * Returns the number of supplies. Called in atomic context.
+	 */
+	int	(*get_voltage)	(unsigned int cpu, unsigned int freq,
+				 unsigned long *uv);
 
 	int	(*exit)		(struct cpufreq_policy *policy);
 	int	(*suspend)	(struct cpufreq_policy *policy);
@@ -238,6 +247,8 @@ struct cpufreq_driver {
 	struct freq_attr	**attr;
 };
 
+#define CPUFREQ_MAX_SUPPLIES	2
+
 /* flags */
 
 #define CPUFREQ_STICKY		0x01	/* the driver isn't removed even if
@@ -0,0 +1,57 @@
+/* include/linux/cpufreq_stats.h */
+
+#ifndef _LINUX_CPUFREQ_STATS_H
+#define _LINUX_CPUFREQ_STATS_H
+
+#include <linux/types.h>
+
+#define CPUFREQ_STATS_VERSION	1
+#define CPUFREQ_STATS_SUPPLIES	2
+
+/*
+ * Binary layout of debugfs cpufreq_stats/cpuN: the header, state_num
+ * state records and then a state_num x state_num matrix of transition
+ * records, indexed [from * state_num + to].
+ */
+struct cpufreq_stats_header {
+	__u32 version;
+	__u32 state_num;
+	__u32 num_supplies;
+	__u32 reserved;
+};
+
+/*
+ * volt_sq_time integrates the square of each supply voltage over the
+ * time spent in the state. Times the frequency and the switched
+ * capacitance it gives the dynamic energy: mV^2 * ms * MHz * nF = pJ.
+ */
+struct cpufreq_stats_state {
+	__u32 freq;					/* kHz */
+	__u32 volt[CPUFREQ_STATS_SUPPLIES];		/* uV, last seen */
+	__u32 reserved;
+	__u64 time_ms;
+	__u64 volt_sq_time[CPUFREQ_STATS_SUPPLIES];	/* mV^2 * ms */
+};
+
+/*
+ * Measured over the driver's whole transition if it brackets it with
+ * cpufreq_stats_transition_begin/end(), from CPUFREQ_PRECHANGE to
+ * CPUFREQ_POSTCHANGE otherwise.
+ */
+struct cpufreq_stats_trans {
+	__u32 count;
+	__u32 max_ns;
+	__u64 total_ns;
+};
+
+#ifdef __KERNEL__
+#ifdef CONFIG_CPU_FREQ_STAT
+void cpufreq_stats_transition_begin(unsigned int cpu);
+void cpufreq_stats_transition_end(unsigned int cpu);
+#else
+static inline void cpufreq_stats_transition_begin(unsigned int cpu) { }
+static inline void cpufreq_stats_transition_end(unsigned int cpu) { }
+#endif
+#endif
+
+#endif
@@ -3,7 +3,83 @@
 #ifndef _LINUX_DEEPIDLE_H
 #define _LINUX_DEEPIDLE_H
 
+#include <linux/types.h>
+
+#define DEEPIDLE_NUM_STATES	3
+#define DEEPIDLE_HIST_BUCKETS	24
+
+/* Idle states as reported by the platform cpuidle driver */
+enum deepidle_state {
+	DEEPIDLE_STATE_IDLE = 0,
+	DEEPIDLE_STATE_TOP_ON,
+	DEEPIDLE_STATE_TOP_OFF,
+};
+
+/*
+ * Reasons why a deeper idle state was refused. The first group
+ * forces plain IDLE, the second group limits DIDLE to TOP=ON.
+ * DEEPIDLE_VETO_PREDICTION counts the governor choosing a shallower
+ * state than allowed because the expected idle period was too short.
+ */
+enum deepidle_veto {
+	DEEPIDLE_VETO_DISABLED = 0,
+	DEEPIDLE_VETO_POWER_CLOCK_GATING,
+	DEEPIDLE_VETO_SUSPEND,
+	DEEPIDLE_VETO_SDMMC,
+	DEEPIDLE_VETO_USBOTG,
+	DEEPIDLE_VETO_RTCINT,
+	DEEPIDLE_VETO_IDMAPOS,
+	DEEPIDLE_VETO_BT,
+	DEEPIDLE_VETO_GPS,
+	DEEPIDLE_VETO_VIBRATOR,
+	DEEPIDLE_VETO_PREDICTION,
+	DEEPIDLE_NUM_VETOS,
+};
+
+/*
+ * Per-state accounting. Times are in nanoseconds, residency histogram
+ * bucket n counts idle periods of [2^(n-1), 2^n) microseconds with the
+ * last bucket collecting everything longer.
+ */
+struct deepidle_state_stats {
+	__u64 count;
+	__u64 residency_ns;
+	__u64 entry_ns;
+	__u64 entry_max_ns;
+	__u64 exit_ns;
+	__u64 exit_max_ns;
+	__u64 hist[DEEPIDLE_HIST_BUCKETS];
+};
+
+/* Layout of the binary snapshot exported through debugfs */
+struct deepidle_snapshot {
+	__u32 version;
+	__u32 num_states;
+	__u32 num_vetos;
+	__u32 hist_buckets;
+	struct deepidle_state_stats state[DEEPIDLE_NUM_STATES];
+	__u64 veto[DEEPIDLE_NUM_VETOS];
+};
+
+#ifdef __KERNEL__
 bool deepidle_is_enabled(void);
-void report_idle_time(int idle_state, int idle_time);
+void report_idle_time(int idle_state, u64 entry_ns, u64 residency_ns, u64 exit_ns);
+void report_idle_veto(int reason);
+
+/*
+ * Drivers announce activity that must keep the SoC out of didle, e.g.
+ * deepidle_block(DEEPIDLE_VETO_SDMMC), instead of having the idle path
+ * poll their registers. Calls are counted and have to be balanced.
+ */
+#ifdef CONFIG_CPU_DIDLE
+void deepidle_block(int reason);
+void deepidle_unblock(int reason);
+bool deepidle_is_blocked(int reason);
+#else
+static inline void deepidle_block(int reason) { }
+static inline void deepidle_unblock(int reason) { }
+static inline bool deepidle_is_blocked(int reason) { return false; }
+#endif
+#endif
 
 #endif
@@ -0,0 +1,43 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *
+ *  LZ4 block format compressor and decompressor, see lib/lz4/lz4defs.h
+ *  for the format. Decompression is considerably faster than LZO1X at a
+ *  slightly lower compression ratio.
+ *
+ *  Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_LOG) * sizeof(u32))
+
+#define lz4_worst_compress(x)	((x) + ((x) / 255) + 16)
+
+/*
+ * This requires 'workmem' of size LZ4_MEM_COMPRESS, which does not need
+ * to be initialized, and 'dst' of at least lz4_worst_compress(src_len).
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression, *dst_len is the size of 'dst' on entry and the
+ * number of bytes produced on return. Malformed input that would read
+ * or write out of bounds fails with LZ4_E_ERROR.
+ */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+
+/*
+ * Return values (< 0 = Error)
+ */
+#define LZ4_E_OK		0
+#define LZ4_E_ERROR		(-1)
+
+#endif
@@ -234,6 +234,43 @@ DEFINE_EVENT(power_domain, power_domain_target,
 
 	TP_ARGS(name, state, cpu_id)
 );
+
+/*
+ * Raw load sample as seen by the sampling cpufreq governors. Times are
+ * in usecs since the previous sample, freq in kHz. Recorded traces can
+ * be replayed by tools/power/cpufreq-sim.
+ */
+TRACE_EVENT(cpufreq_load_sample,
+
+	TP_PROTO(unsigned int cpu_id, unsigned int wall, unsigned int idle,
+		 unsigned int iowait, unsigned int freq, unsigned int screen_off),
+
+	TP_ARGS(cpu_id, wall, idle, iowait, freq, screen_off),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cpu_id		)
+		__field(	u32,		wall		)
+		__field(	u32,		idle		)
+		__field(	u32,		iowait		)
+		__field(	u32,		freq		)
+		__field(	u32,		screen_off	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu_id = cpu_id;
+		__entry->wall = wall;
+		__entry->idle = idle;
+		__entry->iowait = iowait;
+		__entry->freq = freq;
+		__entry->screen_off = screen_off;
+	),
+
+	TP_printk("cpu_id=%lu wall=%lu idle=%lu iowait=%lu freq=%lu screen_off=%lu",
+		  (unsigned long)__entry->cpu_id, (unsigned long)__entry->wall,
+		  (unsigned long)__entry->idle, (unsigned long)__entry->iowait,
+		  (unsigned long)__entry->freq,
+		  (unsigned long)__entry->screen_off)
+);
 #endif /* _TRACE_POWER_H */
 
 /* This part must be outside protection */
@@ -0,0 +1,172 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  Single pass greedy matcher: a hash of the next four bytes indexes the
+ *  last position they were seen at, a match is taken if that is within
+ *  MAX_DISTANCE and really starts with the same four bytes. The table is
+ *  not cleared between calls, stale entries are caught by the same checks.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const unsigned char *p)
+{
+	return (get_unaligned((const u32 *)p) * 2654435761U) >>
+		(32 - LZ4_HASH_LOG);
+}
+
+/* number of equal bytes at p and ref, not going past limit */
+static inline size_t lz4_count(const unsigned char *p,
+			       const unsigned char *ref,
+			       const unsigned char *limit)
+{
+	const unsigned char *start = p;
+
+	while (p + sizeof(unsigned long) <= limit) {
+		unsigned long diff = get_unaligned((const unsigned long *)p) ^
+			get_unaligned((const unsigned long *)ref);
+
+		if (diff) {
+#ifdef __LITTLE_ENDIAN
+			p += __ffs(diff) >> 3;
+#else
+			p += (BITS_PER_LONG - 1 - __fls(diff)) >> 3;
+#endif
+			return p - start;
+		}
+		p += sizeof(unsigned long);
+		ref += sizeof(unsigned long);
+	}
+	while (p < limit && *p == *ref) {
+		p++;
+		ref++;
+	}
+	return p - start;
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	const unsigned char *ip = src, *anchor = src, *ref;
+	unsigned char *op = dst, *token;
+	u32 *table = wrkmem;
+	size_t len;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	table[lz4_hash(ip)] = 0;
+	ip++;
+
+	for (;;) {
+		const unsigned char *next = ip;
+		unsigned int misses = 1 << SKIP_STRENGTH;
+
+		/* find a match */
+		do {
+			u32 h;
+
+			ip = next;
+			next += misses++ >> SKIP_STRENGTH;
+			if (unlikely(next > mflimit))
+				goto last_literals;
+			h = lz4_hash(ip);
+			ref = src + table[h];
+			table[h] = ip - src;
+		} while (ref >= ip || ip - ref > MAX_DISTANCE ||
+			 get_unaligned((const u32 *)ref) !=
+			 get_unaligned((const u32 *)ip));
+
+		/* extend it backwards over the pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		len = ip - anchor;
+		token = op++;
+		if (len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, len - RUN_MASK);
+		} else
+			*token = len << ML_BITS;
+		memcpy(op, anchor, len);
+		op += len;
+
+		for (;;) {
+			put_unaligned_le16(ip - ref, op);
+			op += 2;
+
+			ip += MINMATCH;
+			len = lz4_count(ip, ref + MINMATCH, matchlimit);
+			ip += len;
+			if (len >= ML_MASK) {
+				*token += ML_MASK;
+				op = lz4_put_length(op, len - ML_MASK);
+			} else
+				*token += len;
+
+			anchor = ip;
+			if (ip > mflimit)
+				goto last_literals;
+
+			table[lz4_hash(ip - 2)] = ip - 2 - src;
+
+			/* a match right away needs no literals */
+			{
+				u32 h = lz4_hash(ip);
+
+				ref = src + table[h];
+				table[h] = ip - src;
+			}
+			if (ref >= ip || ip - ref > MAX_DISTANCE ||
+			    get_unaligned((const u32 *)ref) !=
+			    get_unaligned((const u32 *)ip))
+				break;
+			token = op++;
+			*token = 0;
+		}
+		ip++;
+	}
+
+last_literals:
+	len = iend - anchor;
+	if (len >= RUN_MASK) {
+		*op++ = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, len - RUN_MASK);
+	} else
+		*op++ = len << ML_BITS;
+	memcpy(op, anchor, len);
+	op += len;
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
@@ -0,0 +1,113 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+/* add the length bytes following a nibble of 15, fails past iend */
+static inline int lz4_get_length(const unsigned char **ipp,
+				 const unsigned char *iend, size_t *len)
+{
+	const unsigned char *ip = *ipp;
+	unsigned int s;
+
+	do {
+		if (unlikely(ip >= iend))
+			return LZ4_E_ERROR;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return LZ4_E_OK;
+}
+
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char * const iend = src + src_len;
+	unsigned char * const oend = dst + *dst_len;
+	const unsigned char *ip = src;
+	unsigned char *op = dst;
+	const unsigned char *ref;
+	unsigned int token;
+	size_t len, offset;
+
+	for (;;) {
+		if (unlikely(ip >= iend))
+			goto error;
+		token = *ip++;
+
+		/* literals */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && lz4_get_length(&ip, iend, &len))
+			goto error;
+		if (unlikely(len > (size_t)(iend - ip) ||
+			     len > (size_t)(oend - op)))
+			goto error;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* the last sequence has no match */
+		if (ip == iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			goto error;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > (size_t)(op - dst)))
+			goto error;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && lz4_get_length(&ip, iend, &len))
+			goto error;
+		len += MINMATCH;
+		if (unlikely(len > (size_t)(oend - op)))
+			goto error;
+
+		/* the match may overlap what it produces */
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else if (offset >= sizeof(u64)) {
+			unsigned char * const mend = op + len;
+
+			while (mend - op >= sizeof(u64)) {
+				put_unaligned(get_unaligned((const u64 *)ref),
+					      (u64 *)op);
+				op += sizeof(u64);
+				ref += sizeof(u64);
+			}
+			while (op < mend)
+				*op++ = *ref++;
+		} else {
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+
+error:
+	*dst_len = op - dst;
+	return LZ4_E_ERROR;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
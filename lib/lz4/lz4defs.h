@@ -0,0 +1,31 @@
+/*
+ *  lz4defs.h -- LZ4 block format
+ *
+ *  Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  A block is a series of sequences. Each starts with a token byte, the
+ *  high nibble the number of literals and the low nibble the match length
+ *  minus MINMATCH, 15 meaning that more length bytes follow (each adding
+ *  up to 255, the first one below 255 ends it). The literals come next,
+ *  then the little endian 16-bit offset of the match back from the
+ *  current position, then the extra match length bytes. The last
+ *  sequence only has literals. It holds at least LASTLITERALS bytes and
+ *  no match starts less than MFLIMIT bytes before the end of the input.
+ */
+
+#define MINMATCH	4
+#define LASTLITERALS	5
+#define MFLIMIT		(8 + MINMATCH)
+#define MAX_DISTANCE	0xffff
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/* search step grows by one every 1 << SKIP_STRENGTH misses in a row */
+#define SKIP_STRENGTH	6
@@ -27,6 +27,10 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/rbtree.h>
+#include <linux/poll.h>
+#include <linux/anon_inodes.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,43 +41,78 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
-	struct list_head unpinned_list;	/* list of all ashmem areas */
+	struct rb_root unpinned_root;	/* unpinned ranges, by pgstart */
+	struct mutex mutex;		/* protects the area and its ranges */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	unsigned long purged_pages;	/* purge statistics */
+	unsigned long purge_count;
+	unsigned long last_purge;	/* jiffies, if purge_count */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex', `lru' also by ashmem_lru_lock
+ *
+ * The ranges of an area never overlap, so sorting them by pgstart sorts
+ * them by pgend as well and the first range ending at or after a page is
+ * found with a single descent of the tree.
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and lru_count
+ *
+ * Lock Ordering: asma->mutex -> i_mutex -> i_alloc_sem
+ *                asma->mutex -> ashmem_lru_lock
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * The shrinker walks the LRU with ashmem_lru_lock held and only trylocks
+ * the areas, so it never waits for an ioctl.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/* Purge statistics since boot, protected by ashmem_lru_lock */
+static unsigned long purged_pages;
+static unsigned long purge_count;
+static unsigned long last_purge;
+
+/*
+ * Memory pressure notification: every ASHMEM_GET_PRESSURE_FD file tracks
+ * how far it has seen these two counters. Reclaim looking at our pages
+ * bumps the first one, at most once per PRESSURE_INTERVAL, actually
+ * purging some bumps the second.
+ */
+#define PRESSURE_INTERVAL	(HZ / 10)
+
+static atomic_t pressure_reclaim_seq = ATOMIC_INIT(0);
+static atomic_t pressure_purge_seq = ATOMIC_INIT(0);
+static unsigned long pressure_stamp;
+static DECLARE_WAIT_QUEUE_HEAD(pressure_wait);
+
+struct ashmem_watcher {
+	int reclaim_seq;
+	int purge_seq;
+};
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -102,6 +141,7 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
+/* lru_add and lru_del - caller must hold ashmem_lru_lock */
 static inline void lru_add(struct ashmem_range *range)
 {
 	list_add_tail(&range->lru, &ashmem_lru_list);
@@ -114,21 +154,52 @@ static inline void lru_del(struct ashmem_range *range)
 	lru_count -= range_size(range);
 }
 
+/*
+ * range_first - the first unpinned range of 'asma' that ends at or after
+ * 'page', or NULL
+ *
+ * Caller must hold asma->mutex.
+ */
+static struct ashmem_range *range_first(struct ashmem_area *asma, size_t page)
+{
+	struct rb_node *n = asma->unpinned_root.rb_node;
+	struct ashmem_range *range, *first = NULL;
+
+	while (n) {
+		range = rb_entry(n, struct ashmem_range, node);
+		if (range_before_page(range, page))
+			n = n->rb_right;
+		else {
+			first = range;
+			n = n->rb_left;
+		}
+	}
+
+	return first;
+}
+
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *n = rb_next(&range->node);
+
+	return n ? rb_entry(n, struct ashmem_range, node) : NULL;
+}
+
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
 		       size_t start, size_t end)
 {
+	struct rb_node **p = &asma->unpinned_root.rb_node;
+	struct rb_node *parent = NULL;
 	struct ashmem_range *range;
 
 	range = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
@@ -140,26 +211,46 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgend = end;
 	range->purged = purged;
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	while (*p) {
+		parent = *p;
+		if (start < rb_entry(parent, struct ashmem_range,
+				     node)->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned_root);
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_add(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 
 	return 0;
 }
 
+/*
+ * range_del - remove a range from its area and the LRU and free it
+ *
+ * Caller must hold asma->mutex.
+ */
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
-	if (range_on_lru(range))
+	rb_erase(&range->node, &range->asma->unpinned_root);
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 	kmem_cache_free(ashmem_range_cachep, range);
 }
 
 /*
- * range_shrink - shrinks a range
+ * range_shrink - shrinks a range, the order in the tree stays the same
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -169,8 +260,11 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -186,7 +280,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	asma->unpinned_root = RB_ROOT;
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -197,12 +292,12 @@ static int ashmem_open(struct inode *inode, struct file *file)
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *n;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
+	while ((n = rb_first(&asma->unpinned_root)))
+		range_del(rb_entry(n, struct ashmem_range, node));
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -217,7 +312,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -238,7 +333,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -247,7 +342,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -268,7 +363,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -285,7 +380,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -328,10 +423,20 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/*
+ * ashmem_pressure - count a pressure event in 'seq' and wake up the pressure
+ * fds waiting for one
+ */
+static void ashmem_pressure(atomic_t *seq)
+{
+	atomic_inc(seq);
+	wake_up_interruptible(&pressure_wait);
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -345,33 +450,71 @@ out:
  *
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * pages freed. Areas busy in an ioctl are skipped instead of waited for,
+ * their ranges go to the tail of the LRU.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
+	struct ashmem_area *asma;
+	unsigned long busy = 0, purged = 0;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
 		return -1;
-	if (!sc->nr_to_scan)
+	if (!sc->nr_to_scan) {
+		/* reclaim is about to come for our pages, tell the owners */
+		if (lru_count &&
+		    time_after(jiffies, pressure_stamp + PRESSURE_INTERVAL)) {
+			pressure_stamp = jiffies;
+			ashmem_pressure(&pressure_reclaim_seq);
+		}
 		return lru_count;
+	}
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	spin_lock(&ashmem_lru_lock);
+	while (!list_empty(&ashmem_lru_list) && busy < lru_count) {
+		struct inode *inode;
+		loff_t start, end;
+		size_t size;
+
+		range = list_first_entry(&ashmem_lru_list, struct ashmem_range,
+					 lru);
+		asma = range->asma;
+		if (!mutex_trylock(&asma->mutex)) {
+			busy += range_size(range);
+			list_move_tail(&range->lru, &ashmem_lru_list);
+			continue;
+		}
 
-		vmtruncate_range(inode, start, end);
+		/* the area holds on to the range until we unlock it */
 		range->purged = ASHMEM_WAS_PURGED;
 		lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
 
-		sc->nr_to_scan -= range_size(range);
+		inode = asma->file->f_dentry->d_inode;
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE - 1;
+		vmtruncate_range(inode, start, end);
+		size = range_size(range);
+		asma->purged_pages += size;
+		asma->purge_count++;
+		asma->last_purge = jiffies;
+		mutex_unlock(&asma->mutex);
+
+		spin_lock(&ashmem_lru_lock);
+		purged_pages += size;
+		purge_count++;
+		last_purge = jiffies;
+		purged += size;
+		sc->nr_to_scan -= size;
 		if (sc->nr_to_scan <= 0)
 			break;
 	}
-	mutex_unlock(&ashmem_mutex);
+	spin_unlock(&ashmem_lru_lock);
+
+	if (purged)
+		ashmem_pressure(&pressure_purge_seq);
 
 	return lru_count;
 }
@@ -381,11 +524,134 @@ static struct shrinker ashmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 4,
 };
 
+static void fill_purge_stats(struct ashmem_purge_stats *stats,
+			     unsigned long pages, unsigned long count,
+			     unsigned long last)
+{
+	stats->bytes_purged = (__u64) pages * PAGE_SIZE;
+	stats->purge_count = count;
+	stats->ms_since_purge = ASHMEM_NEVER_PURGED;
+	if (count)
+		stats->ms_since_purge = min_t(unsigned int,
+				jiffies_to_msecs(jiffies - last),
+				ASHMEM_NEVER_PURGED - 1);
+}
+
+static int get_purge_stats(struct ashmem_area *asma, void __user *p)
+{
+	struct ashmem_purge_stats stats;
+
+	if (asma) {
+		mutex_lock(&asma->mutex);
+		fill_purge_stats(&stats, asma->purged_pages, asma->purge_count,
+				 asma->last_purge);
+		mutex_unlock(&asma->mutex);
+	} else {
+		spin_lock(&ashmem_lru_lock);
+		fill_purge_stats(&stats, purged_pages, purge_count,
+				 last_purge);
+		spin_unlock(&ashmem_lru_lock);
+	}
+
+	if (unlikely(copy_to_user(p, &stats, sizeof(stats))))
+		return -EFAULT;
+	return 0;
+}
+
+static inline int watcher_pending(struct ashmem_watcher *w)
+{
+	return w->reclaim_seq != atomic_read(&pressure_reclaim_seq) ||
+	       w->purge_seq != atomic_read(&pressure_purge_seq);
+}
+
+static ssize_t pressure_read(struct file *file, char __user *buf,
+			     size_t len, loff_t *pos)
+{
+	struct ashmem_watcher *w = file->private_data;
+	struct ashmem_pressure ev;
+	int reclaim, purge, ret;
+
+	if (len < sizeof(ev))
+		return -EINVAL;
+
+	if (!watcher_pending(w)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(pressure_wait,
+					       watcher_pending(w));
+		if (ret)
+			return ret;
+	}
+
+	reclaim = atomic_read(&pressure_reclaim_seq);
+	purge = atomic_read(&pressure_purge_seq);
+	ev.level = purge != w->purge_seq ? ASHMEM_PRESSURE_PURGED :
+					   ASHMEM_PRESSURE_RECLAIM;
+	ev.events = (reclaim - w->reclaim_seq) + (purge - w->purge_seq);
+	w->reclaim_seq = reclaim;
+	w->purge_seq = purge;
+
+	spin_lock(&ashmem_lru_lock);
+	ev.unpinned_bytes = (__u64) lru_count * PAGE_SIZE;
+	ev.bytes_purged = (__u64) purged_pages * PAGE_SIZE;
+	spin_unlock(&ashmem_lru_lock);
+
+	if (unlikely(copy_to_user(buf, &ev, sizeof(ev))))
+		return -EFAULT;
+	return sizeof(ev);
+}
+
+static unsigned int pressure_poll(struct file *file, poll_table *wait)
+{
+	struct ashmem_watcher *w = file->private_data;
+
+	poll_wait(file, &pressure_wait, wait);
+	return watcher_pending(w) ? POLLIN | POLLRDNORM : 0;
+}
+
+static int pressure_release(struct inode *ignored, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations ashmem_pressure_fops = {
+	.read = pressure_read,
+	.poll = pressure_poll,
+	.release = pressure_release,
+	.llseek = noop_llseek,
+};
+
+/*
+ * get_pressure_fd - a new file that becomes readable on memory pressure,
+ * see struct ashmem_pressure
+ */
+static int get_pressure_fd(unsigned long flags)
+{
+	struct ashmem_watcher *w;
+	int fd;
+
+	if (flags & ~(O_CLOEXEC | O_NONBLOCK))
+		return -EINVAL;
+
+	w = kmalloc(sizeof(*w), GFP_KERNEL);
+	if (unlikely(!w))
+		return -ENOMEM;
+	w->reclaim_seq = atomic_read(&pressure_reclaim_seq);
+	w->purge_seq = atomic_read(&pressure_purge_seq);
+
+	fd = anon_inode_getfd("[ashmem_pressure]", &ashmem_pressure_fops, w,
+			      O_RDONLY | flags);
+	if (fd < 0)
+		kfree(w);
+	return fd;
+}
+
 static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -400,7 +666,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -408,7 +674,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -422,7 +688,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -431,7 +697,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -448,7 +714,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -457,16 +723,18 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
+	for (range = range_first(asma, pgstart); range; range = next) {
+		next = range_next(range);
+
 		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
+		if (range->pgstart > pgend)
 			break;
 
 		/*
@@ -510,8 +778,8 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 			 * more complicated, we allocate a new range for the
 			 * second half and adjust the first chunk's endpoint.
 			 */
-			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
+			range_alloc(asma, range->purged, pgend + 1,
+				    range->pgend);
 			range_shrink(range, range->pgstart, pgstart - 1);
 			break;
 		}
@@ -523,17 +791,18 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
+	for (range = range_first(asma, pgstart); range; range = next) {
+		next = range_next(range);
+
+		/* short circuit: nothing after here touches us */
+		if (range->pgstart > pgend)
 			break;
 
 		/*
@@ -547,35 +816,26 @@ restart:
 			pgend = max_t(size_t, range->pgend, pgend);
 			purged |= range->purged;
 			range_del(range);
-			goto restart;
 		}
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, pgstart, pgend);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
-
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
+	struct ashmem_range *range = range_first(asma, pgstart);
 
-	return ret;
+	if (range && range->pgstart <= pgend)
+		return ASHMEM_IS_UNPINNED;
+	return ASHMEM_IS_PINNED;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -607,7 +867,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -621,7 +881,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -671,6 +931,15 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ashmem_shrink(&ashmem_shrinker, &sc);
 		}
 		break;
+	case ASHMEM_GET_PURGE_STATS:
+		ret = get_purge_stats(asma, (void __user *) arg);
+		break;
+	case ASHMEM_GET_GLOBAL_PURGE_STATS:
+		ret = get_purge_stats(NULL, (void __user *) arg);
+		break;
+	case ASHMEM_GET_PRESSURE_FD:
+		ret = get_pressure_fd(arg);
+		break;
 	}
 
 	return ret;
@@ -0,0 +1,268 @@
+/*
+ * ashmembench -- measure ASHMEM_PIN/ASHMEM_UNPIN rates on areas with
+ * thousands of unpinned ranges, optionally while memory is reclaimed.
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * Every worker thread creates its own area, touches all of its pages and
+ * unpins every other one, which leaves pages / 2 separate unpinned ranges.
+ * It then keeps pinning and unpinning one of those pages at random, so
+ * the number of ranges stays the same. The run is repeated for every
+ * thread count given with -t and the total number of pin and unpin
+ * calls per second is reported. With -R a reclaimer thread purges all
+ * ashmem caches (needs CAP_SYS_ADMIN) every -i microseconds during the
+ * run, which also shows how long a purge takes while the areas are busy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <linux/types.h>
+
+#include "../../include/linux/ashmem.h"
+
+#define MAX_THREAD_COUNTS	16
+#define MAX_THREADS		64
+
+static int duration = 5;		/* s */
+static int pages = 4096;		/* per area */
+static int reclaim;
+static int reclaim_us = 1000;
+static int thread_counts[MAX_THREAD_COUNTS] = { 1, 2, 4 };
+static int nr_thread_counts = 3;
+static long page_size;
+
+static volatile int stop;
+
+struct worker {
+	int fd;
+	char *map;
+	unsigned int seed;
+	unsigned long count;
+	unsigned long purged;
+	pthread_t tid;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static int pin_ioctl(int fd, int cmd, int page)
+{
+	struct ashmem_pin pin = {
+		.offset = page * page_size,
+		.len = page_size,
+	};
+	int ret = ioctl(fd, cmd, &pin);
+
+	if (ret < 0)
+		die(cmd == ASHMEM_PIN ? "ASHMEM_PIN" : "ASHMEM_UNPIN");
+	return ret;
+}
+
+static void setup_area(struct worker *w)
+{
+	size_t size = (size_t)pages * page_size;
+	char name[ASHMEM_NAME_LEN] = "ashmembench";
+	int i;
+
+	w->fd = open("/dev/ashmem", O_RDWR);
+	if (w->fd < 0)
+		die("/dev/ashmem");
+	if (ioctl(w->fd, ASHMEM_SET_NAME, name) < 0)
+		die("ASHMEM_SET_NAME");
+	if (ioctl(w->fd, ASHMEM_SET_SIZE, size) < 0)
+		die("ASHMEM_SET_SIZE");
+	w->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      w->fd, 0);
+	if (w->map == MAP_FAILED)
+		die("mmap");
+	memset(w->map, 0x5a, size);
+	for (i = 0; i < pages; i += 2)
+		pin_ioctl(w->fd, ASHMEM_UNPIN, i);
+}
+
+static void teardown_area(struct worker *w)
+{
+	munmap(w->map, (size_t)pages * page_size);
+	close(w->fd);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+
+	while (!stop) {
+		int page = (rand_r(&w->seed) % (pages / 2)) * 2;
+
+		if (pin_ioctl(w->fd, ASHMEM_PIN, page) == ASHMEM_WAS_PURGED) {
+			/* the page is zero filled again, put it back */
+			w->map[page * page_size] = 0x5a;
+			w->purged++;
+		}
+		pin_ioctl(w->fd, ASHMEM_UNPIN, page);
+		w->count += 2;
+	}
+	return NULL;
+}
+
+struct reclaimer {
+	unsigned long calls;
+	double max_ms;
+	pthread_t tid;
+};
+
+static void *reclaim_thread(void *arg)
+{
+	struct reclaimer *r = arg;
+	int fd = open("/dev/ashmem", O_RDWR);
+
+	if (fd < 0)
+		die("/dev/ashmem");
+	while (!stop) {
+		struct timeval start, now;
+		double ms;
+
+		gettimeofday(&start, NULL);
+		if (ioctl(fd, ASHMEM_PURGE_ALL_CACHES) < 0)
+			die("ASHMEM_PURGE_ALL_CACHES");
+		gettimeofday(&now, NULL);
+		ms = (now.tv_sec - start.tv_sec) * 1e3 +
+			(now.tv_usec - start.tv_usec) / 1e3;
+		if (ms > r->max_ms)
+			r->max_ms = ms;
+		r->calls++;
+		usleep(reclaim_us);
+	}
+	close(fd);
+	return NULL;
+}
+
+static void run(int threads)
+{
+	struct worker workers[MAX_THREADS];
+	struct reclaimer r = { 0, 0.0 };
+	unsigned long total = 0, purged = 0;
+	struct timeval start, now;
+	double elapsed;
+	int i;
+
+	for (i = 0; i < threads; i++) {
+		setup_area(&workers[i]);
+		workers[i].seed = i + 1;
+		workers[i].count = 0;
+		workers[i].purged = 0;
+	}
+
+	stop = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&workers[i].tid, NULL, worker_thread,
+				   &workers[i]))
+			die("pthread_create");
+	if (reclaim && pthread_create(&r.tid, NULL, reclaim_thread, &r))
+		die("pthread_create");
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		total += workers[i].count;
+		purged += workers[i].purged;
+	}
+	if (reclaim)
+		pthread_join(r.tid, NULL);
+	gettimeofday(&now, NULL);
+	elapsed = (now.tv_sec - start.tv_sec) +
+		(now.tv_usec - start.tv_usec) / 1e6;
+
+	for (i = 0; i < threads; i++)
+		teardown_area(&workers[i]);
+
+	printf("%7d %14.0f %14.0f %10lu %10lu %12.2f\n", threads,
+	       total / elapsed, total / elapsed / threads, purged,
+	       r.calls, r.max_ms);
+	fflush(stdout);
+}
+
+static void parse_thread_counts(char *arg)
+{
+	char *tok;
+
+	nr_thread_counts = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		int n = atoi(tok);
+
+		if (n < 1 || n > MAX_THREADS ||
+		    nr_thread_counts == MAX_THREAD_COUNTS) {
+			fprintf(stderr, "bad thread count %s\n", tok);
+			exit(1);
+		}
+		thread_counts[nr_thread_counts++] = n;
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: ashmembench [-R] [-i us] [-d seconds] [-p pages] "
+		"[-t n,n,...]\n"
+		"  -R  purge all ashmem caches concurrently (needs root)\n"
+		"  -i  pause between purges in us (default 1000)\n"
+		"  -d  duration of every run (default 5)\n"
+		"  -p  pages per area, half of them unpinned (default 4096)\n"
+		"  -t  thread counts to sweep, one area each "
+		"(default 1,2,4)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "Ri:d:p:t:")) != -1) {
+		switch (opt) {
+		case 'R':
+			reclaim = 1;
+			break;
+		case 'i':
+			reclaim_us = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'p':
+			pages = atoi(optarg);
+			break;
+		case 't':
+			parse_thread_counts(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (duration < 1 || pages < 2 || reclaim_us < 0)
+		usage();
+	page_size = sysconf(_SC_PAGESIZE);
+
+	printf("%d pages per area (%d unpinned ranges), %d s per run%s\n",
+	       pages, pages / 2, duration,
+	       reclaim ? ", concurrent purges" : "");
+	printf("threads    pin+unpin/s     per thread     purged   "
+	       "reclaims  max purge ms\n");
+	for (i = 0; i < nr_thread_counts; i++)
+		run(thread_counts[i]);
+	return 0;
+}
@@ -0,0 +1,335 @@
+/*
+ * binderbench -- measure binder transaction throughput between
+ * independent client/server process pairs.
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * Every pair consists of a server process publishing one binder object
+ * under "binderbench.<n>" and a client process looking it up. Both run
+ * the same number of threads; every client thread sends synchronous
+ * transactions of the requested payload size as fast as it can and the
+ * server threads answer them with a 4 byte reply. The run is repeated
+ * for every thread count given with -t and the total number of round
+ * trips per second over all pairs is reported.
+ *
+ * The services are registered with the servicemanager (this needs
+ * root). With -m binderbench becomes the context manager itself, which
+ * is useful on a device where the servicemanager has been stopped.
+ *
+ * Only the raw driver interface of drivers/staging/android/binder.h is
+ * used, no libbinder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "binderutil.h"
+
+#define MAX_THREAD_COUNTS	16
+
+#define BENCH_PING		(('_' << 24) | ('P' << 16) | ('N' << 8) | 'G')
+
+static int duration = 5;		/* s */
+static int payload = 32;		/* bytes */
+static int pairs = 1;
+static int become_mgr;
+static int thread_counts[MAX_THREAD_COUNTS] = { 1, 2, 4, 8 };
+static int nr_thread_counts = 4;
+
+static void *server_thread(void *arg)
+{
+	struct bb_proc *bp = arg;
+	struct free_and_send w;
+	uint32_t status = 0;
+	size_t wsize = 0;
+
+	bb_cmd(bp, BC_ENTER_LOOPER);
+	for (;;) {
+		struct binder_transaction_data tr;
+
+		if (bb_wait(bp, &w, wsize, &tr) != BR_TRANSACTION) {
+			wsize = 0;
+			continue;
+		}
+		w.free_cmd = BC_FREE_BUFFER;
+		w.free_ptr = tr.data.ptr.buffer;
+		w.cmd = BC_REPLY;
+		memset(&w.tr, 0, sizeof(w.tr));
+		w.tr.data_size = sizeof(status);
+		w.tr.data.ptr.buffer = &status;
+		wsize = sizeof(w);
+	}
+	return NULL;
+}
+
+static void run_server(int pair, int threads, int ready_fd)
+{
+	static int object;
+	struct bb_proc bp;
+	char name[32];
+	pthread_t tid;
+	int i;
+
+	bb_open(&bp, 0);
+	snprintf(name, sizeof(name), "binderbench.%d", pair);
+	svcmgr_add(&bp, name, &object);
+	for (i = 1; i < threads; i++)
+		if (pthread_create(&tid, NULL, server_thread, &bp))
+			die("pthread_create");
+	if (write(ready_fd, "", 1) != 1)
+		die("write");
+	close(ready_fd);
+	server_thread(&bp);
+}
+
+struct client {
+	struct bb_proc *bp;
+	signed long handle;
+	volatile int *stop;
+	unsigned long count;
+	pthread_t tid;
+};
+
+static void *client_thread(void *arg)
+{
+	struct client *c = arg;
+	struct free_and_send w;
+	struct parcel p;
+	size_t wsize;
+
+	parcel_init(&p);
+	memset(p.data, 0x5a, payload);
+	p.size = payload;
+
+	memset(&w, 0, sizeof(w));
+	w.cmd = BC_TRANSACTION;
+	w.tr.target.handle = c->handle;
+	w.tr.code = BENCH_PING;
+	parcel_to_tr(&p, &w.tr);
+
+	/* the first call has no reply buffer to free yet */
+	wsize = sizeof(w) - offsetof(struct free_and_send, cmd);
+	while (!*c->stop) {
+		struct binder_transaction_data reply;
+		uint8_t *wbuf = (uint8_t *)&w + sizeof(w) - wsize;
+
+		if (bb_wait(c->bp, wbuf, wsize, &reply) != BR_REPLY) {
+			fprintf(stderr, "transaction failed\n");
+			exit(1);
+		}
+		c->count++;
+		w.free_cmd = BC_FREE_BUFFER;
+		w.free_ptr = reply.data.ptr.buffer;
+		wsize = sizeof(w);
+	}
+	if (wsize == sizeof(w))
+		bb_write(c->bp, &w, offsetof(struct free_and_send, cmd));
+	return NULL;
+}
+
+static void run_client(int pair, int threads, int result_fd)
+{
+	static volatile int stop;
+	struct client clients[64];
+	unsigned long total = 0;
+	struct timeval start, now;
+	struct bb_proc bp;
+	signed long handle;
+	char name[32];
+	double elapsed;
+	int i;
+
+	bb_open(&bp, 0);
+	snprintf(name, sizeof(name), "binderbench.%d", pair);
+	handle = svcmgr_lookup(&bp, name);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < threads; i++) {
+		clients[i].bp = &bp;
+		clients[i].handle = handle;
+		clients[i].stop = &stop;
+		clients[i].count = 0;
+		if (pthread_create(&clients[i].tid, NULL, client_thread,
+				   &clients[i]))
+			die("pthread_create");
+	}
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < threads; i++) {
+		pthread_join(clients[i].tid, NULL);
+		total += clients[i].count;
+	}
+	gettimeofday(&now, NULL);
+	elapsed = (now.tv_sec - start.tv_sec) +
+		(now.tv_usec - start.tv_usec) / 1e6;
+
+	total = total / elapsed;
+	if (write(result_fd, &total, sizeof(total)) != sizeof(total))
+		die("write");
+	close(result_fd);
+}
+
+static unsigned long run(int threads)
+{
+	pid_t servers[64], clients[64];
+	int result[2];
+	unsigned long total = 0, rate;
+	int i;
+
+	for (i = 0; i < pairs; i++) {
+		int ready[2];
+		char c;
+
+		if (pipe(ready))
+			die("pipe");
+		servers[i] = fork();
+		if (servers[i] < 0)
+			die("fork");
+		if (servers[i] == 0) {
+			close(ready[0]);
+			run_server(i, threads, ready[1]);
+			exit(0);
+		}
+		close(ready[1]);
+		if (read(ready[0], &c, 1) != 1) {
+			fprintf(stderr, "server %d failed to start\n", i);
+			exit(1);
+		}
+		close(ready[0]);
+	}
+
+	if (pipe(result))
+		die("pipe");
+	for (i = 0; i < pairs; i++) {
+		clients[i] = fork();
+		if (clients[i] < 0)
+			die("fork");
+		if (clients[i] == 0) {
+			close(result[0]);
+			run_client(i, threads, result[1]);
+			exit(0);
+		}
+	}
+	close(result[1]);
+	for (i = 0; i < pairs; i++) {
+		if (read(result[0], &rate, sizeof(rate)) != sizeof(rate)) {
+			fprintf(stderr, "client failed\n");
+			exit(1);
+		}
+		total += rate;
+	}
+	close(result[0]);
+
+	for (i = 0; i < pairs; i++) {
+		waitpid(clients[i], NULL, 0);
+		kill(servers[i], SIGKILL);
+		waitpid(servers[i], NULL, 0);
+	}
+	return total;
+}
+
+static void parse_thread_counts(char *arg)
+{
+	char *tok;
+
+	nr_thread_counts = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		int n = atoi(tok);
+
+		if (n < 1 || n > 64 || nr_thread_counts == MAX_THREAD_COUNTS) {
+			fprintf(stderr, "bad thread count %s\n", tok);
+			exit(1);
+		}
+		thread_counts[nr_thread_counts++] = n;
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: binderbench [-m] [-d seconds] [-s payload] "
+		"[-P pairs] [-t n,n,...]\n"
+		"  -m  act as context manager instead of using servicemanager\n"
+		"  -d  duration of every run (default 5)\n"
+		"  -s  transaction payload in bytes (default 32)\n"
+		"  -P  number of independent client/server pairs (default 1)\n"
+		"  -t  thread counts per process to sweep (default 1,2,4,8)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	pid_t registry = 0;
+	unsigned long base = 0;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "md:s:P:t:")) != -1) {
+		switch (opt) {
+		case 'm':
+			become_mgr = 1;
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 's':
+			payload = atoi(optarg);
+			break;
+		case 'P':
+			pairs = atoi(optarg);
+			break;
+		case 't':
+			parse_thread_counts(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (duration < 1 || payload < 0 || payload > MAX_PAYLOAD ||
+	    pairs < 1 || pairs > 64)
+		usage();
+
+	if (become_mgr) {
+		registry = fork();
+		if (registry < 0)
+			die("fork");
+		if (registry == 0) {
+			run_registry();
+			exit(0);
+		}
+		/* give it a moment to claim the context manager */
+		usleep(200000);
+	}
+
+	printf("%d pair(s), %d byte payload, %d s per run\n",
+	       pairs, payload, duration);
+	printf("threads    transactions/s    per pair    scaling\n");
+	for (i = 0; i < nr_thread_counts; i++) {
+		unsigned long rate = run(thread_counts[i]);
+
+		if (!base)
+			base = rate ? rate : 1;
+		printf("%7d %18lu %11lu %9.2fx\n", thread_counts[i], rate,
+		       rate / pairs, (double)rate / base);
+		fflush(stdout);
+	}
+
+	if (registry) {
+		kill(registry, SIGKILL);
+		waitpid(registry, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * binderpi -- measure binder reply latency of a high priority caller
+ * served by a background thread while the CPUs are busy, with and
+ * without priority inheritance in the driver.
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * The server opens the driver at nice 19, so its binder thread drops
+ * back to that whenever it waits for work, and optionally moves itself
+ * into a background cpu cgroup (-g). Every call makes it spin for the
+ * given amount of work before replying. The client calls it from a
+ * SCHED_FIFO thread (or at nice -10 with -r 0) at a steady pace while
+ * one nice 0 hog per CPU keeps the machine busy. The run is done once
+ * with /sys/module/binder/parameters/inherit_priority cleared and once
+ * with it set, the previous setting is restored at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "binderutil.h"
+
+#define INHERIT_PARAM	"/sys/module/binder/parameters/inherit_priority"
+#define MAX_HOGS	32
+
+#define PI_CALL		(('_' << 24) | ('P' << 16) | ('I' << 8) | 'C')
+
+static int calls = 200;
+static int work_us = 2000;
+static int interval_us = 10000;
+static int nr_hogs = -1;
+static int rt_prio = 50;
+static const char *bg_cgroup;
+static int become_mgr;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void spin_us(int us)
+{
+	uint64_t end = now_ns() + (uint64_t)us * 1000;
+
+	while (now_ns() < end)
+		;
+}
+
+static void join_cgroup(const char *tasks)
+{
+	char buf[16];
+	int fd, len;
+
+	fd = open(tasks, O_WRONLY);
+	if (fd < 0)
+		die(tasks);
+	len = snprintf(buf, sizeof(buf), "%ld", (long)syscall(SYS_gettid));
+	if (write(fd, buf, len) != len)
+		die(tasks);
+	close(fd);
+}
+
+static void run_server(int ready_fd)
+{
+	static int object;
+	struct bb_proc bp;
+	struct free_and_send w;
+	uint32_t status = 0;
+	size_t wsize = 0;
+
+	if (setpriority(PRIO_PROCESS, 0, 19))
+		die("setpriority");
+	if (bg_cgroup)
+		join_cgroup(bg_cgroup);
+	bb_open(&bp, 0);
+	svcmgr_add(&bp, "binderpi", &object);
+	bb_cmd(&bp, BC_ENTER_LOOPER);
+	if (write(ready_fd, "", 1) != 1)
+		die("write");
+	close(ready_fd);
+
+	for (;;) {
+		struct binder_transaction_data tr;
+
+		if (bb_wait(&bp, &w, wsize, &tr) != BR_TRANSACTION) {
+			wsize = 0;
+			continue;
+		}
+		spin_us(work_us);
+		w.free_cmd = BC_FREE_BUFFER;
+		w.free_ptr = tr.data.ptr.buffer;
+		w.cmd = BC_REPLY;
+		memset(&w.tr, 0, sizeof(w.tr));
+		w.tr.data_size = sizeof(status);
+		w.tr.data.ptr.buffer = &status;
+		wsize = sizeof(w);
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run_client(int result_fd)
+{
+	uint64_t *lat;
+	struct bb_proc bp;
+	struct parcel p;
+	signed long handle;
+	int i;
+
+	lat = calloc(calls, sizeof(*lat));
+	if (!lat)
+		die("calloc");
+	if (rt_prio) {
+		struct sched_param param = { .sched_priority = rt_prio };
+
+		if (sched_setscheduler(0, SCHED_FIFO, &param))
+			die("sched_setscheduler");
+	} else if (setpriority(PRIO_PROCESS, 0, -10))
+		die("setpriority");
+
+	bb_open(&bp, 0);
+	handle = svcmgr_lookup(&bp, "binderpi");
+	parcel_init(&p);
+	parcel_put_u32(&p, 0);
+
+	for (i = 0; i < calls; i++) {
+		struct binder_transaction_data reply;
+		uint64_t start = now_ns();
+
+		if (bb_call(&bp, handle, PI_CALL, &p, &reply) != BR_REPLY) {
+			fprintf(stderr, "transaction failed\n");
+			exit(1);
+		}
+		lat[i] = now_ns() - start;
+		bb_free(&bp, &reply);
+		usleep(interval_us);
+	}
+
+	qsort(lat, calls, sizeof(*lat), cmp_u64);
+	if (write(result_fd, lat, calls * sizeof(*lat)) !=
+	    (ssize_t)(calls * sizeof(*lat)))
+		die("write");
+	close(result_fd);
+}
+
+static int set_inherit(int on)
+{
+	char c = on ? 'Y' : 'N';
+	int fd, ret;
+
+	fd = open(INHERIT_PARAM, O_RDWR);
+	if (fd < 0)
+		return -1;
+	ret = write(fd, &c, 1) == 1 ? 0 : -1;
+	close(fd);
+	return ret;
+}
+
+static int get_inherit(void)
+{
+	char c = 'Y';
+	int fd;
+
+	fd = open(INHERIT_PARAM, O_RDONLY);
+	if (fd >= 0) {
+		if (read(fd, &c, 1) != 1)
+			c = 'Y';
+		close(fd);
+	}
+	return c == 'Y' || c == '1';
+}
+
+static void run(int inherit)
+{
+	pid_t server, client, hogs[MAX_HOGS];
+	uint64_t *lat, sum = 0;
+	int ready[2], result[2];
+	ssize_t got = 0;
+	char c;
+	int i;
+
+	if (set_inherit(inherit))
+		die(INHERIT_PARAM);
+
+	if (pipe(ready))
+		die("pipe");
+	server = fork();
+	if (server < 0)
+		die("fork");
+	if (server == 0) {
+		close(ready[0]);
+		run_server(ready[1]);
+		exit(0);
+	}
+	close(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		exit(1);
+	}
+	close(ready[0]);
+
+	for (i = 0; i < nr_hogs; i++) {
+		hogs[i] = fork();
+		if (hogs[i] < 0)
+			die("fork");
+		if (hogs[i] == 0)
+			for (;;)
+				;
+	}
+
+	if (pipe(result))
+		die("pipe");
+	client = fork();
+	if (client < 0)
+		die("fork");
+	if (client == 0) {
+		close(result[0]);
+		run_client(result[1]);
+		exit(0);
+	}
+	close(result[1]);
+
+	lat = calloc(calls, sizeof(*lat));
+	if (!lat)
+		die("calloc");
+	while (got < (ssize_t)(calls * sizeof(*lat))) {
+		ssize_t n = read(result[0], (char *)lat + got,
+				 calls * sizeof(*lat) - got);
+
+		if (n <= 0) {
+			fprintf(stderr, "client failed\n");
+			exit(1);
+		}
+		got += n;
+	}
+	close(result[0]);
+
+	waitpid(client, NULL, 0);
+	for (i = 0; i < nr_hogs; i++) {
+		kill(hogs[i], SIGKILL);
+		waitpid(hogs[i], NULL, 0);
+	}
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+
+	for (i = 0; i < calls; i++)
+		sum += lat[i];
+	printf("%-8s %9llu %9llu %9llu %9llu %9llu\n",
+	       inherit ? "on" : "off",
+	       (unsigned long long)lat[0] / 1000,
+	       (unsigned long long)(sum / calls) / 1000,
+	       (unsigned long long)lat[calls / 2] / 1000,
+	       (unsigned long long)lat[calls * 99 / 100] / 1000,
+	       (unsigned long long)lat[calls - 1] / 1000);
+	fflush(stdout);
+	free(lat);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: binderpi [-m] [-n calls] [-w work_us] [-i interval_us] "
+		"[-H hogs] [-r rtprio] [-g tasks]\n"
+		"  -m  act as context manager instead of using servicemanager\n"
+		"  -n  number of calls per run (default 200)\n"
+		"  -w  work done by the server per call in us (default 2000)\n"
+		"  -i  pause between calls in us (default 10000)\n"
+		"  -H  number of nice 0 CPU hogs (default one per CPU)\n"
+		"  -r  SCHED_FIFO priority of the caller, 0 for nice -10 "
+		"(default 50)\n"
+		"  -g  cgroup tasks file to put the server in, e.g.\n"
+		"      /dev/cpuctl/bg_non_interactive/tasks\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	pid_t registry = 0;
+	int saved, opt;
+
+	while ((opt = getopt(argc, argv, "mn:w:i:H:r:g:")) != -1) {
+		switch (opt) {
+		case 'm':
+			become_mgr = 1;
+			break;
+		case 'n':
+			calls = atoi(optarg);
+			break;
+		case 'w':
+			work_us = atoi(optarg);
+			break;
+		case 'i':
+			interval_us = atoi(optarg);
+			break;
+		case 'H':
+			nr_hogs = atoi(optarg);
+			break;
+		case 'r':
+			rt_prio = atoi(optarg);
+			break;
+		case 'g':
+			bg_cgroup = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (nr_hogs < 0)
+		nr_hogs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (calls < 1 || work_us < 0 || interval_us < 0 ||
+	    nr_hogs > MAX_HOGS || rt_prio < 0 || rt_prio > 99)
+		usage();
+
+	if (become_mgr) {
+		registry = fork();
+		if (registry < 0)
+			die("fork");
+		if (registry == 0) {
+			run_registry();
+			exit(0);
+		}
+		/* give it a moment to claim the context manager */
+		usleep(200000);
+	}
+
+	saved = get_inherit();
+	printf("%d calls, %d us work, %d hog(s), caller %s %d%s%s\n",
+	       calls, work_us, nr_hogs, rt_prio ? "SCHED_FIFO" : "nice",
+	       rt_prio ? rt_prio : -10, bg_cgroup ? ", server in " : "",
+	       bg_cgroup ? bg_cgroup : "");
+	printf("inherit   min(us)   avg(us)   p50(us)   p99(us)   max(us)\n");
+	run(0);
+	run(1);
+	set_inherit(saved);
+
+	if (registry) {
+		kill(registry, SIGKILL);
+		waitpid(registry, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Raw binder helpers shared by the programs in tools/binder.
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "binderutil.h"
+
+static const char *svcmgr_id = "android.os.IServiceManager";
+
+void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+void bb_open(struct bb_proc *bp, int max_threads)
+{
+	struct binder_version vers;
+
+	bp->fd = open(BINDER_DEV, O_RDWR);
+	if (bp->fd < 0)
+		die(BINDER_DEV);
+	if (ioctl(bp->fd, BINDER_VERSION, &vers) < 0)
+		die("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version %ld, expected %d\n",
+			vers.protocol_version, BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	bp->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, bp->fd, 0);
+	if (bp->map == MAP_FAILED)
+		die("mmap");
+	/* we start our threads ourselves, no BR_SPAWN_LOOPER please */
+	if (ioctl(bp->fd, BINDER_SET_MAX_THREADS, &max_threads) < 0)
+		die("BINDER_SET_MAX_THREADS");
+}
+
+int bb_write_read(struct bb_proc *bp, void *wbuf, size_t wsize,
+			 void *rbuf, size_t rsize, size_t *rconsumed)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = wsize;
+	bwr.write_consumed = 0;
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rsize;
+	bwr.read_consumed = 0;
+
+	do {
+		ret = ioctl(bp->fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+	if (rconsumed)
+		*rconsumed = bwr.read_consumed;
+	return ret;
+}
+
+void bb_write(struct bb_proc *bp, void *wbuf, size_t wsize)
+{
+	if (bb_write_read(bp, wbuf, wsize, NULL, 0, NULL) < 0)
+		die("BINDER_WRITE_READ");
+}
+
+void bb_cmd(struct bb_proc *bp, uint32_t cmd)
+{
+	bb_write(bp, &cmd, sizeof(cmd));
+}
+
+/*
+ * Read until a transaction or reply arrives. Reference count requests
+ * for our objects are acknowledged on the way. Returns the BR_ code.
+ */
+uint32_t bb_wait(struct bb_proc *bp, void *wbuf, size_t wsize,
+			struct binder_transaction_data *tr)
+{
+	uint32_t rbuf[64];
+
+	for (;;) {
+		size_t consumed;
+		uint8_t *ptr, *end;
+
+		if (bb_write_read(bp, wbuf, wsize, rbuf, sizeof(rbuf),
+				  &consumed) < 0)
+			die("BINDER_WRITE_READ");
+		wsize = 0;
+
+		ptr = (uint8_t *)rbuf;
+		end = ptr + consumed;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(uint32_t);
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+			case BR_SPAWN_LOOPER:
+				break;
+			case BR_INCREFS:
+			case BR_ACQUIRE: {
+				struct {
+					uint32_t cmd;
+					struct binder_ptr_cookie pc;
+				} done;
+
+				done.cmd = cmd == BR_INCREFS ?
+					BC_INCREFS_DONE : BC_ACQUIRE_DONE;
+				memcpy(&done.pc, ptr, sizeof(done.pc));
+				bb_write(bp, &done, sizeof(done));
+				ptr += sizeof(struct binder_ptr_cookie);
+				break;
+			}
+			case BR_RELEASE:
+			case BR_DECREFS:
+				ptr += sizeof(struct binder_ptr_cookie);
+				break;
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(tr, ptr, sizeof(*tr));
+				return cmd;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				return cmd;
+			default:
+				fprintf(stderr, "unexpected binder return %x\n",
+					cmd);
+				exit(1);
+			}
+		}
+	}
+}
+
+void parcel_init(struct parcel *p)
+{
+	p->size = 0;
+	p->nr_offsets = 0;
+}
+
+void parcel_put_u32(struct parcel *p, uint32_t v)
+{
+	memcpy(p->data + p->size, &v, sizeof(v));
+	p->size += sizeof(v);
+}
+
+void parcel_put_string16(struct parcel *p, const char *s)
+{
+	size_t len = strlen(s), i;
+	uint16_t *d;
+
+	parcel_put_u32(p, len);
+	d = (uint16_t *)(p->data + p->size);
+	for (i = 0; i < len; i++)
+		d[i] = s[i];
+	d[len] = 0;
+	p->size += ((len + 1) * 2 + 3) & ~3;
+}
+
+void parcel_put_obj(struct parcel *p, unsigned long type,
+			   void *binder, signed long handle)
+{
+	struct flat_binder_object obj;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = type;
+	obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	if (type == BINDER_TYPE_BINDER) {
+		obj.binder = binder;
+		obj.cookie = binder;
+	} else
+		obj.handle = handle;
+	p->offsets[p->nr_offsets++] = p->size;
+	memcpy(p->data + p->size, &obj, sizeof(obj));
+	p->size += sizeof(obj);
+}
+
+void parcel_to_tr(struct parcel *p, struct binder_transaction_data *tr)
+{
+	tr->data_size = p->size;
+	tr->offsets_size = p->nr_offsets * sizeof(size_t);
+	tr->data.ptr.buffer = p->data;
+	tr->data.ptr.offsets = p->offsets;
+}
+
+/* compare a string16 at *pos with s and advance *pos past it */
+int tr_string16_eq(const struct binder_transaction_data *tr,
+			  size_t *pos, const char *s)
+{
+	const uint8_t *data = tr->data.ptr.buffer;
+	const uint16_t *d;
+	uint32_t len;
+	size_t i;
+	int eq;
+
+	if (*pos + sizeof(len) > tr->data_size)
+		return 0;
+	memcpy(&len, data + *pos, sizeof(len));
+	*pos += sizeof(len);
+	if (*pos + (len + 1) * 2 > tr->data_size)
+		return 0;
+	d = (const uint16_t *)(data + *pos);
+	eq = len == strlen(s);
+	for (i = 0; eq && i < len; i++)
+		eq = d[i] == (uint8_t)s[i];
+	*pos += ((len + 1) * 2 + 3) & ~3;
+	return eq;
+}
+
+void tr_get_string16(const struct binder_transaction_data *tr,
+			    size_t *pos, char *buf, size_t size)
+{
+	const uint8_t *data = tr->data.ptr.buffer;
+	const uint16_t *d;
+	uint32_t len;
+	size_t i;
+
+	buf[0] = '\0';
+	if (*pos + sizeof(len) > tr->data_size)
+		return;
+	memcpy(&len, data + *pos, sizeof(len));
+	*pos += sizeof(len);
+	if (*pos + (len + 1) * 2 > tr->data_size)
+		return;
+	d = (const uint16_t *)(data + *pos);
+	for (i = 0; i < len && i < size - 1; i++)
+		buf[i] = d[i];
+	buf[i] = '\0';
+	*pos += ((len + 1) * 2 + 3) & ~3;
+}
+
+/* handle of the first object in a received transaction, 0 if none */
+signed long tr_get_handle(const struct binder_transaction_data *tr)
+{
+	const struct flat_binder_object *obj;
+	size_t off;
+
+	if (tr->offsets_size < sizeof(size_t))
+		return 0;
+	off = *(const size_t *)tr->data.ptr.offsets;
+	obj = (const struct flat_binder_object *)
+		((const uint8_t *)tr->data.ptr.buffer + off);
+	if (obj->type != BINDER_TYPE_HANDLE)
+		return 0;
+	return obj->handle;
+}
+
+uint32_t bb_call(struct bb_proc *bp, uint32_t handle, uint32_t code,
+			struct parcel *p, struct binder_transaction_data *reply)
+{
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data tr;
+	} w;
+
+	memset(&w, 0, sizeof(w));
+	w.cmd = BC_TRANSACTION;
+	w.tr.target.handle = handle;
+	w.tr.code = code;
+	parcel_to_tr(p, &w.tr);
+	return bb_wait(bp, &w, sizeof(w), reply);
+}
+
+void bb_free(struct bb_proc *bp, const struct binder_transaction_data *tr)
+{
+	struct free_and_send w;
+
+	w.free_cmd = BC_FREE_BUFFER;
+	w.free_ptr = tr->data.ptr.buffer;
+	bb_write(bp, &w, offsetof(struct free_and_send, cmd));
+}
+
+/*
+ * Take our own references on a handle we just received, the ones the
+ * driver added for the transfer go away with the buffer.
+ */
+void bb_acquire(struct bb_proc *bp, signed long handle)
+{
+	uint32_t w[4] = { BC_INCREFS, handle, BC_ACQUIRE, handle };
+
+	bb_write(bp, w, sizeof(w));
+}
+
+static void svcmgr_header(struct parcel *p, const char *name)
+{
+	parcel_init(p);
+	parcel_put_u32(p, 0);		/* strict mode policy */
+	parcel_put_string16(p, svcmgr_id);
+	parcel_put_string16(p, name);
+}
+
+void svcmgr_add(struct bb_proc *bp, const char *name, void *object)
+{
+	struct binder_transaction_data reply;
+	struct parcel p;
+
+	svcmgr_header(&p, name);
+	parcel_put_obj(&p, BINDER_TYPE_BINDER, object, 0);
+	if (bb_call(bp, 0, SVC_MGR_ADD_SERVICE, &p, &reply) != BR_REPLY) {
+		fprintf(stderr, "adding %s failed\n", name);
+		exit(1);
+	}
+	bb_free(bp, &reply);
+}
+
+signed long svcmgr_lookup(struct bb_proc *bp, const char *name)
+{
+	struct binder_transaction_data reply;
+	signed long handle = 0;
+	struct parcel p;
+	int tries;
+
+	for (tries = 0; tries < 50 && !handle; tries++) {
+		svcmgr_header(&p, name);
+		if (bb_call(bp, 0, SVC_MGR_CHECK_SERVICE, &p, &reply) != BR_REPLY)
+			break;
+		handle = tr_get_handle(&reply);
+		if (handle)
+			bb_acquire(bp, handle);
+		bb_free(bp, &reply);
+		if (!handle)
+			usleep(100000);
+	}
+	if (!handle) {
+		fprintf(stderr, "service %s not found\n", name);
+		exit(1);
+	}
+	return handle;
+}
+
+/*
+ * Minimal context manager for -m: remembers the handles added and hands
+ * them out again, nothing else.
+ */
+void run_registry(void)
+{
+	static struct {
+		char name[64];
+		signed long handle;
+	} services[MAX_SERVICES];
+	int nr_services = 0;
+	struct bb_proc bp;
+	struct free_and_send w;
+
+	bb_open(&bp, 0);
+	if (ioctl(bp.fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		die("BINDER_SET_CONTEXT_MGR");
+	bb_cmd(&bp, BC_ENTER_LOOPER);
+
+	for (;;) {
+		struct binder_transaction_data tr;
+		struct parcel reply;
+		char name[64];
+		size_t pos = sizeof(uint32_t);
+		int i;
+
+		if (bb_wait(&bp, NULL, 0, &tr) != BR_TRANSACTION)
+			continue;
+
+		parcel_init(&reply);
+		if (tr_string16_eq(&tr, &pos, svcmgr_id)) {
+			tr_get_string16(&tr, &pos, name, sizeof(name));
+			for (i = 0; i < nr_services; i++)
+				if (!strcmp(services[i].name, name))
+					break;
+			if (tr.code == SVC_MGR_ADD_SERVICE) {
+				signed long handle = tr_get_handle(&tr);
+
+				if (handle && i < MAX_SERVICES) {
+					bb_acquire(&bp, handle);
+					strcpy(services[i].name, name);
+					services[i].handle = handle;
+					if (i == nr_services)
+						nr_services++;
+				}
+				parcel_put_u32(&reply, 0);
+			} else if (i < nr_services) {
+				parcel_put_obj(&reply, BINDER_TYPE_HANDLE,
+					       NULL, services[i].handle);
+			} else
+				parcel_put_u32(&reply, 0);
+		} else
+			parcel_put_u32(&reply, 0);
+
+		w.free_cmd = BC_FREE_BUFFER;
+		w.free_ptr = tr.data.ptr.buffer;
+		w.cmd = BC_REPLY;
+		memset(&w.tr, 0, sizeof(w.tr));
+		parcel_to_tr(&reply, &w.tr);
+		/* reply lives on our stack, so send it right away */
+		bb_write(&bp, &w, sizeof(w));
+	}
+}
+
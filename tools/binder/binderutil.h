@@ -0,0 +1,87 @@
+/*
+ * Raw binder helpers shared by the programs in tools/binder.
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#ifndef _BINDERUTIL_H
+#define _BINDERUTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "binder.h"
+
+#define BINDER_DEV		"/dev/binder"
+#define MAP_SIZE		(128 * 1024)
+#define MAX_SERVICES		64
+#define MAX_PAYLOAD		(64 * 1024)
+
+/* IServiceManager transaction codes */
+#define SVC_MGR_GET_SERVICE	1
+#define SVC_MGR_CHECK_SERVICE	2
+#define SVC_MGR_ADD_SERVICE	3
+
+struct bb_proc {
+	int fd;
+	void *map;
+};
+
+/* a parcel as written by libbinder, just big enough for our needs */
+struct parcel {
+	uint8_t data[256 + MAX_PAYLOAD];
+	size_t size;
+	size_t offsets[4];
+	int nr_offsets;
+};
+
+/*
+ * BC_FREE_BUFFER followed by an optional BC_TRANSACTION or BC_REPLY. Like
+ * the command buffers below this relies on the unpadded 32 bit layout.
+ */
+struct free_and_send {
+	uint32_t free_cmd;
+	const void *free_ptr;
+	uint32_t cmd;
+	struct binder_transaction_data tr;
+};
+
+void die(const char *msg);
+
+void bb_open(struct bb_proc *bp, int max_threads);
+int bb_write_read(struct bb_proc *bp, void *wbuf, size_t wsize,
+		  void *rbuf, size_t rsize, size_t *rconsumed);
+void bb_write(struct bb_proc *bp, void *wbuf, size_t wsize);
+void bb_cmd(struct bb_proc *bp, uint32_t cmd);
+uint32_t bb_wait(struct bb_proc *bp, void *wbuf, size_t wsize,
+		 struct binder_transaction_data *tr);
+uint32_t bb_call(struct bb_proc *bp, uint32_t handle, uint32_t code,
+		 struct parcel *p, struct binder_transaction_data *reply);
+void bb_free(struct bb_proc *bp, const struct binder_transaction_data *tr);
+void bb_acquire(struct bb_proc *bp, signed long handle);
+
+void parcel_init(struct parcel *p);
+void parcel_put_u32(struct parcel *p, uint32_t v);
+void parcel_put_string16(struct parcel *p, const char *s);
+void parcel_put_obj(struct parcel *p, unsigned long type,
+		    void *binder, signed long handle);
+void parcel_to_tr(struct parcel *p, struct binder_transaction_data *tr);
+
+int tr_string16_eq(const struct binder_transaction_data *tr,
+		   size_t *pos, const char *s);
+void tr_get_string16(const struct binder_transaction_data *tr,
+		     size_t *pos, char *buf, size_t size);
+signed long tr_get_handle(const struct binder_transaction_data *tr);
+
+void svcmgr_add(struct bb_proc *bp, const char *name, void *object);
+signed long svcmgr_lookup(struct bb_proc *bp, const char *name);
+
+/* serve as context manager for -m, never returns */
+void run_registry(void);
+
+#endif /* _BINDERUTIL_H */
@@ -0,0 +1,347 @@
+/*
+ * loggerbench -- measure how many lines per second the /dev/log devices
+ * take from concurrent writers while logcat style readers drain them.
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * Every writer thread logs lines the way liblog does, one writev() of
+ * priority, tag and message per line, as fast as it can. Every reader
+ * thread has the log open for reading and does blocking reads of one
+ * entry each, like logcat. The run is repeated for every writer count
+ * given with -w and the total lines written and read per second are
+ * reported. With -b the readers use LOGGER_READ_BATCH and get as many
+ * entries per read() as fit into 64K.
+ *
+ * With -c the log is filled for the given duration first and then drained
+ * by a fresh nonblocking reader, which shows how many entries the log
+ * retains (more than the ring holds with CONFIG_ANDROID_LOGGER_COMPRESS)
+ * and how fast a reader gets them out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+
+#include "logger.h"
+
+#define MAX_WRITER_COUNTS	16
+#define MAX_THREADS		64
+#define BATCH_BUF		(64 * 1024)
+
+static int duration = 5;		/* s */
+static int msg_size = 64;		/* bytes */
+static int nr_readers = 1;
+static int batch;
+static int capacity;
+static const char *log_name = "main";
+static int writer_counts[MAX_WRITER_COUNTS] = { 1, 2, 4, 8 };
+static int nr_writer_counts = 4;
+
+static volatile int stop;
+
+struct worker {
+	int fd;
+	unsigned long count;
+	pthread_t tid;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static int open_log(int flags)
+{
+	char path[64];
+	int fd;
+
+	snprintf(path, sizeof(path), "/dev/log/%s", log_name);
+	fd = open(path, flags);
+	if (fd < 0)
+		die(path);
+	return fd;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char prio = 4;		/* ANDROID_LOG_INFO */
+	char tag[] = "loggerbench";
+	char msg[LOGGER_ENTRY_MAX_PAYLOAD];
+	struct iovec iov[3];
+
+	memset(msg, 'x', msg_size);
+	msg[msg_size] = '\0';
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = tag;
+	iov[1].iov_len = sizeof(tag);
+	iov[2].iov_base = msg;
+	iov[2].iov_len = msg_size + 1;
+
+	while (!stop) {
+		if (writev(w->fd, iov, 3) < 0 && errno != EINTR)
+			die("writev");
+		w->count++;
+	}
+	return NULL;
+}
+
+static void set_read_mode(int fd)
+{
+	if (batch && ioctl(fd, LOGGER_SET_READ_MODE, LOGGER_READ_BATCH) < 0)
+		die("LOGGER_SET_READ_MODE");
+}
+
+/* number of entries in what one read() returned */
+static unsigned long count_entries(const char *buf, ssize_t len)
+{
+	unsigned long n = 0;
+	ssize_t off = 0;
+
+	while (off < len) {
+		const struct logger_entry *e =
+			(const struct logger_entry *)(buf + off);
+
+		off += sizeof(*e) + e->len;
+		n++;
+	}
+	return n;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct worker *r = arg;
+	size_t size = batch ? BATCH_BUF : LOGGER_ENTRY_MAX_LEN;
+	char *buf = malloc(size);
+
+	if (!buf)
+		die("malloc");
+
+	while (!stop) {
+		ssize_t ret = read(r->fd, buf, size);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			die("read");
+		}
+		r->count += count_entries(buf, ret);
+	}
+	free(buf);
+	return NULL;
+}
+
+static void run(int nr_writers)
+{
+	struct worker writers[MAX_THREADS], readers[MAX_THREADS];
+	unsigned long written = 0, read_total = 0;
+	struct timeval start, now;
+	double elapsed;
+	int i;
+
+	stop = 0;
+	for (i = 0; i < nr_readers; i++) {
+		readers[i].fd = open_log(O_RDONLY);
+		set_read_mode(readers[i].fd);
+		readers[i].count = 0;
+		if (pthread_create(&readers[i].tid, NULL, reader_thread,
+				   &readers[i]))
+			die("pthread_create");
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_writers; i++) {
+		writers[i].fd = open_log(O_WRONLY);
+		writers[i].count = 0;
+		if (pthread_create(&writers[i].tid, NULL, writer_thread,
+				   &writers[i]))
+			die("pthread_create");
+	}
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < nr_writers; i++) {
+		pthread_join(writers[i].tid, NULL);
+		close(writers[i].fd);
+		written += writers[i].count;
+	}
+	gettimeofday(&now, NULL);
+	/* one more line gets the readers out of read() to notice stop */
+	if (nr_readers) {
+		static const char line[] = "\4loggerbench\0done";
+		int fd = open_log(O_WRONLY);
+
+		if (write(fd, line, sizeof(line)) < 0)
+			die("write");
+		close(fd);
+	}
+	for (i = 0; i < nr_readers; i++) {
+		pthread_join(readers[i].tid, NULL);
+		close(readers[i].fd);
+		read_total += readers[i].count;
+	}
+	elapsed = (now.tv_sec - start.tv_sec) +
+		(now.tv_usec - start.tv_usec) / 1e6;
+
+	printf("%7d %14.0f %14.0f %16.0f\n", nr_writers, written / elapsed,
+	       written / elapsed / nr_writers,
+	       nr_readers ? read_total / elapsed / nr_readers : 0.0);
+	fflush(stdout);
+}
+
+static void run_capacity(void)
+{
+	struct worker writers[MAX_THREADS];
+	static char buf[BATCH_BUF];
+	size_t size = batch ? BATCH_BUF : LOGGER_ENTRY_MAX_LEN;
+	unsigned long entries = 0, bytes = 0, calls = 0;
+	struct timeval start, now;
+	double elapsed;
+	int fd, i, nr_writers = writer_counts[0];
+	long ring;
+
+	stop = 0;
+	for (i = 0; i < nr_writers; i++) {
+		writers[i].fd = open_log(O_WRONLY);
+		writers[i].count = 0;
+		if (pthread_create(&writers[i].tid, NULL, writer_thread,
+				   &writers[i]))
+			die("pthread_create");
+	}
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < nr_writers; i++) {
+		pthread_join(writers[i].tid, NULL);
+		close(writers[i].fd);
+	}
+	/* let the archive catch up */
+	sleep(1);
+
+	fd = open_log(O_RDONLY | O_NONBLOCK);
+	set_read_mode(fd);
+	ring = ioctl(fd, LOGGER_GET_LOG_BUF_SIZE);
+	gettimeofday(&start, NULL);
+	for (;;) {
+		ssize_t ret = read(fd, buf, size);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			die("read");
+		}
+		entries += count_entries(buf, ret);
+		bytes += ret;
+		calls++;
+	}
+	gettimeofday(&now, NULL);
+	close(fd);
+	elapsed = (now.tv_sec - start.tv_sec) +
+		(now.tv_usec - start.tv_usec) / 1e6;
+
+	printf("ring size          %ld bytes\n", ring);
+	printf("entries retained   %lu (%lu bytes, %.2fx the ring)\n",
+	       entries, bytes, ring > 0 ? (double)bytes / ring : 0.0);
+	printf("drained in         %lu read() calls, %.0f entries/s\n",
+	       calls, elapsed > 0 ? entries / elapsed : 0.0);
+}
+
+static void parse_writer_counts(char *arg)
+{
+	char *tok;
+
+	nr_writer_counts = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		int n = atoi(tok);
+
+		if (n < 1 || n > MAX_THREADS ||
+		    nr_writer_counts == MAX_WRITER_COUNTS) {
+			fprintf(stderr, "bad writer count %s\n", tok);
+			exit(1);
+		}
+		writer_counts[nr_writer_counts++] = n;
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: loggerbench [-bc] [-l log] [-d seconds] [-s size] "
+		"[-r readers] [-w n,n,...]\n"
+		"  -b  readers use LOGGER_READ_BATCH\n"
+		"  -c  fill the log, then report what a new reader gets\n"
+		"  -l  log to use, main, radio, events or system "
+		"(default main)\n"
+		"  -d  duration of every run (default 5)\n"
+		"  -s  message size in bytes (default 64)\n"
+		"  -r  number of concurrent readers (default 1)\n"
+		"  -w  writer thread counts to sweep (default 1,2,4,8)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "bcl:d:s:r:w:")) != -1) {
+		switch (opt) {
+		case 'b':
+			batch = 1;
+			break;
+		case 'c':
+			capacity = 1;
+			break;
+		case 'l':
+			log_name = optarg;
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 's':
+			msg_size = atoi(optarg);
+			break;
+		case 'r':
+			nr_readers = atoi(optarg);
+			break;
+		case 'w':
+			parse_writer_counts(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (duration < 1 || msg_size < 0 || nr_readers < 0 ||
+	    nr_readers > MAX_THREADS ||
+	    msg_size > (int)LOGGER_ENTRY_MAX_PAYLOAD - 16)
+		usage();
+
+	if (capacity) {
+		printf("/dev/log/%s, %d byte messages, %d writer(s), "
+		       "%s reads\n", log_name, msg_size, writer_counts[0],
+		       batch ? "batched" : "single");
+		run_capacity();
+		return 0;
+	}
+
+	printf("/dev/log/%s, %d byte messages, %d %s reader(s), "
+	       "%d s per run\n", log_name, msg_size, nr_readers,
+	       batch ? "batch" : "single", duration);
+	printf("writers        lines/s     per writer  read/s per reader\n");
+	for (i = 0; i < nr_writer_counts; i++)
+		run(writer_counts[i]);
+	return 0;
+}
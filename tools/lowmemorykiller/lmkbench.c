@@ -0,0 +1,211 @@
+/*
+ * lmkbench -- measure what a lowmemorykiller shrinker call costs with
+ * hundreds of processes around.
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * Starts the given number of idle processes, each holding some anonymous
+ * memory, and spreads them over oom_adj 1 to 15 like the cached and
+ * background apps of a busy phone. A hog at oom_adj 0 then allocates
+ * memory until it reaches its limit or gets killed itself, which drives
+ * the lowmemorykiller into killing the idle processes. The victim
+ * selection statistics of the driver (scan_count, scan_us, scan_max_ns
+ * and scan_tasks in /sys/module/lowmemorykiller/parameters) are reset
+ * before and reported after the run. Needs root.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define PARAM_DIR	"/sys/module/lowmemorykiller/parameters/"
+#define MAX_PROCS	2048
+#define CHUNK		(1024 * 1024)
+
+static int nr_procs = 300;
+static int proc_kb = 512;
+static int hog_mb = 1024;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void write_file(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY);
+
+	if (fd < 0)
+		die(path);
+	if (write(fd, val, strlen(val)) != (ssize_t)strlen(val))
+		die(path);
+	close(fd);
+}
+
+static unsigned long read_param(const char *name)
+{
+	char path[128], buf[32];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), PARAM_DIR "%s", name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die(path);
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0)
+		die(path);
+	buf[len] = '\0';
+	close(fd);
+	return strtoul(buf, NULL, 10);
+}
+
+static void reset_param(const char *name)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), PARAM_DIR "%s", name);
+	write_file(path, "0");
+}
+
+static void set_oom_adj(pid_t pid, int adj)
+{
+	char path[64], val[16];
+
+	snprintf(path, sizeof(path), "/proc/%d/oom_adj", pid);
+	snprintf(val, sizeof(val), "%d", adj);
+	write_file(path, val);
+}
+
+static void touch(size_t size)
+{
+	char *p = malloc(size);
+
+	if (!p)
+		die("malloc");
+	memset(p, 0x5a, size);
+}
+
+static pid_t spawn_idle(void)
+{
+	pid_t pid = fork();
+
+	if (pid < 0)
+		die("fork");
+	if (pid == 0) {
+		touch((size_t)proc_kb * 1024);
+		for (;;)
+			pause();
+	}
+	return pid;
+}
+
+/* returns 1 if the hog got killed before reaching its limit */
+static int run_hog(void)
+{
+	pid_t pid = fork();
+	int status;
+
+	if (pid < 0)
+		die("fork");
+	if (pid == 0) {
+		int i;
+
+		for (i = 0; i < hog_mb; i++)
+			touch(CHUNK);
+		exit(0);
+	}
+	set_oom_adj(pid, 0);
+	if (waitpid(pid, &status, 0) < 0)
+		die("waitpid");
+	return WIFSIGNALED(status);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: lmkbench [-n procs] [-m kb] [-H mb]\n"
+		"  -n  number of idle processes (default 300)\n"
+		"  -m  memory every idle process holds in KB (default 512)\n"
+		"  -H  most memory the hog allocates in MB (default 1024)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static pid_t pids[MAX_PROCS];
+	unsigned long count, us, max_ns, tasks;
+	int opt, i, killed = 0, hog_killed;
+
+	while ((opt = getopt(argc, argv, "n:m:H:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_procs = atoi(optarg);
+			break;
+		case 'm':
+			proc_kb = atoi(optarg);
+			break;
+		case 'H':
+			hog_mb = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (nr_procs < 1 || nr_procs > MAX_PROCS || proc_kb < 0 || hog_mb < 1)
+		usage();
+
+	/* we must outlive everything we start */
+	set_oom_adj(getpid(), -16);
+	for (i = 0; i < nr_procs; i++) {
+		pids[i] = spawn_idle();
+		set_oom_adj(pids[i], 1 + i % 15);
+	}
+	/* let them touch their memory */
+	sleep(1);
+
+	reset_param("scan_count");
+	reset_param("scan_us");
+	reset_param("scan_max_ns");
+	reset_param("scan_tasks");
+
+	hog_killed = run_hog();
+
+	count = read_param("scan_count");
+	us = read_param("scan_us");
+	max_ns = read_param("scan_max_ns");
+	tasks = read_param("scan_tasks");
+
+	for (i = 0; i < nr_procs; i++) {
+		int status;
+
+		if (waitpid(pids[i], &status, WNOHANG) == pids[i]) {
+			killed++;
+			continue;
+		}
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+
+	printf("%d idle processes of %d KB, hog of up to %d MB%s\n",
+	       nr_procs, proc_kb, hog_mb, hog_killed ? " (killed)" : "");
+	printf("victim selections  %lu\n", count);
+	printf("avg per selection  %.1f us, %.1f processes looked at\n",
+	       count ? (double)us / count : 0.0,
+	       count ? (double)tasks / count : 0.0);
+	printf("max per selection  %.1f us\n", max_ns / 1000.0);
+	printf("idle processes killed %d\n", killed);
+	return 0;
+}
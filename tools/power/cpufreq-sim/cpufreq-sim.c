@@ -0,0 +1,703 @@
+/*
+ * cpufreq-sim -- replay a recorded CPU load trace against the sampling
+ * cpufreq governors and the S5PV210 frequency/voltage table.
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * The input is the text output of the power:cpufreq_load_sample trace
+ * event, recorded on the device with e.g.
+ *
+ *	echo 1 > /sys/kernel/debug/tracing/events/power/cpufreq_load_sample/enable
+ *	cat /sys/kernel/debug/tracing/trace_pipe > load.trace
+ *
+ * Every sample is turned into an amount of work (busy time times the
+ * frequency it ran at) arriving at a constant rate during the sample.
+ * The simulated CPU executes that work at the frequency chosen by the
+ * simulated governor, so work that does not fit is queued and shows up
+ * as load in the following samples. The lazy governor uses the very
+ * same decision code as the kernel (drivers/cpufreq/cpufreq_lazy.h),
+ * ondemand, conservative and interactive are modelled after their
+ * default behaviour.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "cpufreq_lazy.h"
+
+#define MAX_FREQS	16
+#define STEP_US		250
+
+struct freq_level {
+	unsigned int freq;	/* kHz */
+	unsigned int arm_volt;	/* uV */
+	unsigned int int_volt;	/* uV */
+};
+
+/* s5pv210_freq_table and dvs_conf of arch/arm/mach-s5pv210/cpufreq.c */
+static struct freq_level levels[MAX_FREQS] = {
+	{ 1400000, 1450000, 1250000 },
+	{ 1200000, 1350000, 1150000 },
+	{ 1000000, 1250000, 1100000 },
+	{  800000, 1200000, 1100000 },
+	{  400000, 1050000, 1100000 },
+	{  200000,  950000, 1100000 },
+	{  100000,  950000, 1000000 },
+};
+static int nr_levels = 7;
+
+struct sample {
+	double time;		/* s, trace timestamp */
+	unsigned int wall;	/* us */
+	unsigned int idle;	/* us */
+	unsigned int iowait;	/* us */
+	unsigned int freq;	/* kHz */
+	unsigned int screen_off;
+};
+
+static struct sample *samples;
+static int nr_samples;
+
+enum governor {
+	GOV_LAZY,
+	GOV_ONDEMAND,
+	GOV_CONSERVATIVE,
+	GOV_INTERACTIVE,
+	NR_GOVERNORS,
+};
+
+static const char * const governor_names[NR_GOVERNORS] = {
+	"lazy", "ondemand", "conservative", "interactive",
+};
+
+static struct {
+	unsigned int policy_min;
+	unsigned int policy_max;
+	unsigned int sampling_rate;
+	unsigned int up_threshold;
+	unsigned int down_differential;
+	unsigned int down_threshold;
+	unsigned int min_timeinstate;
+	unsigned int screenoff_maxfreq;
+	unsigned int io_is_busy;
+	unsigned int freq_step;
+	unsigned int go_hispeed_load;
+	unsigned int hispeed_freq;
+	unsigned int min_sample_time;
+	unsigned int transition_latency;
+	int cpu;
+	/* energy model */
+	double arm_ceff;	/* nF */
+	double arm_leak;	/* mW at 1V */
+	double int_power;	/* mW at 1.1V */
+} opts = {
+	.policy_min = 100000,
+	.policy_max = 1000000,
+	.freq_step = 5,
+	.down_threshold = 20,
+	.go_hispeed_load = 95,
+	.min_sample_time = 20000,
+	.transition_latency = 40,
+	.arm_ceff = 0.32,
+	.arm_leak = 20.0,
+	.int_power = 60.0,
+};
+
+/* Explicitly set on the command line, otherwise per-governor default */
+static unsigned int user_sampling_rate, user_up_threshold;
+static unsigned int user_down_differential, user_min_timeinstate;
+
+struct result {
+	double time_in_state[MAX_FREQS];	/* us */
+	unsigned int transitions;
+	double energy;				/* uJ */
+	double backlog_max;			/* us at max freq */
+	unsigned int spikes;
+	double spike_latency_sum;		/* us */
+	double spike_latency_max;		/* us */
+	double work_left;			/* kHz * us */
+};
+
+static int level_of(unsigned int freq)
+{
+	int i;
+
+	for (i = 0; i < nr_levels; i++)
+		if (levels[i].freq == freq)
+			return i;
+
+	return nr_levels - 1;
+}
+
+/* Lowest frequency >= target (CPUFREQ_RELATION_L) */
+static unsigned int table_target_l(unsigned int target)
+{
+	unsigned int best = 0;
+	int i;
+
+	for (i = 0; i < nr_levels; i++) {
+		unsigned int f = levels[i].freq;
+
+		if (f < opts.policy_min || f > opts.policy_max)
+			continue;
+		if (f >= target && (!best || f < best))
+			best = f;
+	}
+
+	return best ? best : opts.policy_max;
+}
+
+/* Highest frequency <= target (CPUFREQ_RELATION_H) */
+static unsigned int table_target_h(unsigned int target)
+{
+	unsigned int best = 0;
+	int i;
+
+	for (i = 0; i < nr_levels; i++) {
+		unsigned int f = levels[i].freq;
+
+		if (f < opts.policy_min || f > opts.policy_max)
+			continue;
+		if (f <= target && f > best)
+			best = f;
+	}
+
+	return best ? best : opts.policy_min;
+}
+
+/* Power in mW of the ARM and INT domains at the given level */
+static double level_power(int level, double busy_fraction)
+{
+	double varm = levels[level].arm_volt / 1000000.0;
+	double vint = levels[level].int_volt / 1000000.0;
+	double fmhz = levels[level].freq / 1000.0;
+	double p;
+
+	/* C * V^2 * f with C in nF and f in MHz gives mW */
+	p = opts.arm_ceff * varm * varm * fmhz * busy_fraction;
+	p += opts.arm_leak * varm;
+	p += opts.int_power * (vint * vint) / (1.1 * 1.1);
+
+	return p;
+}
+
+struct governor_state {
+	enum governor gov;
+	unsigned int cur;
+	double next_sample;		/* us */
+	double last_sample;		/* us */
+	double wall, idle, iowait;	/* us since last sample */
+	double change_time;		/* us, interactive */
+	double idle_since_change;	/* us, interactive */
+	double wall_since_change;	/* us, interactive */
+};
+
+static unsigned int sample_rate_of(enum governor gov)
+{
+	if (user_sampling_rate)
+		return user_sampling_rate;
+
+	switch (gov) {
+	case GOV_LAZY:
+		return 15000;
+	case GOV_ONDEMAND:
+		return 40000;
+	case GOV_CONSERVATIVE:
+		return 40000;
+	default:
+		return 20000;
+	}
+}
+
+static unsigned int up_threshold_of(enum governor gov)
+{
+	if (user_up_threshold)
+		return user_up_threshold;
+
+	switch (gov) {
+	case GOV_LAZY:
+		return 90;
+	case GOV_ONDEMAND:
+		return 95;
+	default:
+		return 80;
+	}
+}
+
+static unsigned int down_differential_of(void)
+{
+	return user_down_differential ? user_down_differential : 3;
+}
+
+static unsigned int min_timeinstate_of(void)
+{
+	unsigned int rate = sample_rate_of(GOV_LAZY);
+	unsigned int mtis;
+
+	mtis = user_min_timeinstate ? user_min_timeinstate :
+		opts.transition_latency * 1000;
+
+	return mtis > rate ? mtis : rate;
+}
+
+/* Returns the new frequency and sets the delay until the next sample */
+static unsigned int governor_sample(struct governor_state *gs,
+				    unsigned int screen_off,
+				    unsigned int *delay)
+{
+	unsigned int wall = (unsigned int)gs->wall;
+	unsigned int idle = (unsigned int)gs->idle;
+	unsigned int iowait = (unsigned int)gs->iowait;
+	unsigned int freq_next = gs->cur;
+	enum lazy_action action;
+	int load;
+
+	*delay = sample_rate_of(gs->gov);
+
+	load = lazy_sample_load(wall, idle, iowait, opts.io_is_busy);
+
+	switch (gs->gov) {
+	case GOV_LAZY:
+		if (screen_off && opts.screenoff_maxfreq) {
+			*delay = min_timeinstate_of();
+			return opts.policy_max;
+		}
+		if (load < 0)
+			break;
+		action = lazy_decide(load * gs->cur, gs->cur, opts.policy_min,
+				     opts.policy_max, up_threshold_of(gs->gov),
+				     down_differential_of(), &freq_next);
+		/* no powersave_bias here, so raising at max is a no-op */
+		if (action == LAZY_KEEP ||
+		    (action == LAZY_RAISE && gs->cur == opts.policy_max))
+			return gs->cur;
+		*delay = min_timeinstate_of();
+		return freq_next == opts.policy_max ?
+			table_target_h(freq_next) : table_target_l(freq_next);
+
+	case GOV_ONDEMAND:
+		if (load < 0)
+			break;
+		if (lazy_decide(load * gs->cur, gs->cur, opts.policy_min,
+				opts.policy_max, up_threshold_of(gs->gov),
+				down_differential_of(), &freq_next) ==
+		    LAZY_KEEP)
+			return gs->cur;
+		return freq_next == opts.policy_max ?
+			table_target_h(freq_next) : table_target_l(freq_next);
+
+	case GOV_CONSERVATIVE:
+		if (load < 0)
+			break;
+		if ((unsigned int)load > up_threshold_of(gs->gov)) {
+			freq_next = gs->cur + opts.policy_max * opts.freq_step / 100;
+			if (freq_next > opts.policy_max)
+				freq_next = opts.policy_max;
+			return table_target_h(freq_next) > gs->cur ?
+				table_target_h(freq_next) :
+				table_target_l(gs->cur + 1);
+		}
+		if ((unsigned int)load < opts.down_threshold - 10) {
+			unsigned int step = opts.policy_max * opts.freq_step / 100;
+
+			freq_next = gs->cur > step ? gs->cur - step : opts.policy_min;
+			if (freq_next < opts.policy_min)
+				freq_next = opts.policy_min;
+			return table_target_l(freq_next) < gs->cur ?
+				table_target_l(freq_next) :
+				table_target_h(gs->cur - 1);
+		}
+		break;
+
+	case GOV_INTERACTIVE: {
+		double since = gs->wall_since_change;
+		int load_since_change = -1;
+
+		if (since > 0 && gs->idle_since_change <= since)
+			load_since_change = (int)(100 * (since -
+				gs->idle_since_change) / since);
+		if (load_since_change > load)
+			load = load_since_change;
+		if (load < 0)
+			break;
+
+		if ((unsigned int)load >= opts.go_hispeed_load) {
+			if (gs->cur == opts.policy_min)
+				freq_next = opts.hispeed_freq ?
+					opts.hispeed_freq : opts.policy_max;
+			else
+				freq_next = opts.policy_max * load / 100;
+		} else {
+			freq_next = gs->cur * load / 100;
+		}
+
+		freq_next = table_target_h(freq_next);
+
+		if (freq_next < gs->cur &&
+		    gs->last_sample - gs->change_time < opts.min_sample_time)
+			return gs->cur;
+
+		return freq_next;
+	}
+
+	default:
+		break;
+	}
+
+	return gs->cur;
+}
+
+static void simulate(enum governor gov, struct result *res)
+{
+	struct governor_state gs;
+	double now = 0, backlog = 0, stall = 0;
+	unsigned int delay;
+	int spike_pending = 0, i;
+	double spike_start = 0;
+	unsigned int spike_need = 0;
+	double prev_rate = 0;
+
+	memset(res, 0, sizeof(*res));
+	memset(&gs, 0, sizeof(gs));
+
+	gs.gov = gov;
+	gs.cur = samples[0].freq ? table_target_h(samples[0].freq) :
+		opts.policy_min;
+	gs.next_sample = sample_rate_of(gov);
+
+	for (i = 0; i < nr_samples; i++) {
+		struct sample *s = &samples[i];
+		double busy = s->wall > s->idle ? s->wall - s->idle : 0;
+		/* work per us arriving during this sample */
+		double rate = s->wall ? busy * s->freq / s->wall : 0;
+		double io_ratio = s->wall > busy ?
+			(double)s->iowait / (s->wall - busy) : 0;
+		double t;
+
+		if (io_ratio > 1)
+			io_ratio = 1;
+
+		/* A spike is demand rising above what we currently run at */
+		if (!spike_pending && rate > gs.cur && prev_rate <= gs.cur) {
+			spike_pending = 1;
+			spike_start = now;
+			spike_need = table_target_l((unsigned int)rate);
+			res->spikes++;
+		}
+		prev_rate = rate;
+
+		for (t = 0; t < s->wall; t += STEP_US) {
+			double dt = s->wall - t < STEP_US ? s->wall - t : STEP_US;
+			double run = dt, done, busy_dt;
+			int lvl = level_of(gs.cur);
+
+			if (stall > 0) {
+				double st = stall < run ? stall : run;
+
+				stall -= st;
+				run -= st;
+			}
+
+			backlog += rate * dt;
+			done = backlog < gs.cur * run ? backlog : gs.cur * run;
+			backlog -= done;
+			busy_dt = done / gs.cur + (dt - run);
+
+			gs.wall += dt;
+			gs.idle += dt - busy_dt;
+			gs.iowait += (dt - busy_dt) * io_ratio;
+			gs.wall_since_change += dt;
+			gs.idle_since_change += dt - busy_dt;
+
+			res->time_in_state[lvl] += dt;
+			res->energy += level_power(lvl, busy_dt / dt) * dt / 1000.0;
+
+			if (backlog / opts.policy_max > res->backlog_max)
+				res->backlog_max = backlog / opts.policy_max;
+
+			now += dt;
+
+			if (spike_pending && gs.cur >= spike_need) {
+				double lat = now - spike_start;
+
+				res->spike_latency_sum += lat;
+				if (lat > res->spike_latency_max)
+					res->spike_latency_max = lat;
+				spike_pending = 0;
+			}
+
+			if (now >= gs.next_sample) {
+				unsigned int next;
+
+				gs.last_sample = now;
+				next = governor_sample(&gs, s->screen_off, &delay);
+
+				if (next != gs.cur) {
+					gs.cur = next;
+					gs.change_time = now;
+					gs.wall_since_change = 0;
+					gs.idle_since_change = 0;
+					stall += opts.transition_latency;
+					res->transitions++;
+				}
+
+				gs.wall = gs.idle = gs.iowait = 0;
+				gs.next_sample = now + delay;
+			}
+		}
+	}
+
+	/* A spike still pending at the end never got served */
+	if (spike_pending)
+		res->spikes--;
+
+	res->work_left = backlog;
+}
+
+static void print_result(enum governor gov, struct result *res)
+{
+	double total = 0;
+	int i;
+
+	for (i = 0; i < nr_levels; i++)
+		total += res->time_in_state[i];
+
+	printf("governor %s\n", governor_names[gov]);
+	printf("  %-10s %12s %8s\n", "freq", "time(ms)", "%");
+
+	for (i = 0; i < nr_levels; i++)
+		printf("  %-10u %12.1f %7.2f%%\n", levels[i].freq,
+		       res->time_in_state[i] / 1000.0,
+		       total ? 100.0 * res->time_in_state[i] / total : 0);
+
+	printf("  transitions        %u\n", res->transitions);
+	printf("  energy             %.1f mJ (%.1f mW average)\n",
+	       res->energy / 1000.0, total ? res->energy / total * 1000.0 : 0);
+	printf("  load spikes        %u\n", res->spikes);
+	printf("  spike latency      %.2f ms average, %.2f ms max\n",
+	       res->spikes ? res->spike_latency_sum / res->spikes / 1000.0 : 0,
+	       res->spike_latency_max / 1000.0);
+	printf("  max queued work    %.2f ms at max freq\n",
+	       res->backlog_max / 1000.0);
+	printf("  work left at end   %.2f ms at max freq\n",
+	       res->work_left / opts.policy_max / 1000.0);
+}
+
+/*
+ * Parse one line of trace output, e.g.
+ * kworker/0:1-25 [000] 1234.567890: cpufreq_load_sample: cpu_id=0 wall=15000 ...
+ */
+static int parse_line(char *line, struct sample *s)
+{
+	char *ev, *p, *ts;
+	unsigned int cpu = 0;
+
+	ev = strstr(line, "cpufreq_load_sample:");
+	if (!ev)
+		return 0;
+
+	memset(s, 0, sizeof(*s));
+
+	/* timestamp is the token ending in ':' right before the event */
+	*ev = '\0';
+	ts = strrchr(line, ' ');
+	while (ts && ts > line && ts[1] == '\0') {
+		*ts = '\0';
+		ts = strrchr(line, ' ');
+	}
+	if (ts)
+		s->time = strtod(ts + 1, NULL);
+
+	p = ev + strlen("cpufreq_load_sample:");
+
+	while ((p = strchr(p, '=')) != NULL) {
+		char *key = p;
+		unsigned int val = strtoul(p + 1, NULL, 10);
+
+		while (key > line && key[-1] != ' ')
+			key--;
+
+		if (!strncmp(key, "cpu_id=", 7))
+			cpu = val;
+		else if (!strncmp(key, "wall=", 5))
+			s->wall = val;
+		else if (!strncmp(key, "idle=", 5))
+			s->idle = val;
+		else if (!strncmp(key, "iowait=", 7))
+			s->iowait = val;
+		else if (!strncmp(key, "freq=", 5))
+			s->freq = val;
+		else if (!strncmp(key, "screen_off=", 11))
+			s->screen_off = val;
+		p++;
+	}
+
+	if ((int)cpu != opts.cpu || !s->wall || !s->freq)
+		return 0;
+
+	return 1;
+}
+
+static int read_trace(FILE *f)
+{
+	char line[1024];
+	int size = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		struct sample s;
+
+		if (!parse_line(line, &s))
+			continue;
+
+		if (nr_samples == size) {
+			size = size ? size * 2 : 4096;
+			samples = realloc(samples, size * sizeof(*samples));
+			if (!samples) {
+				perror("realloc");
+				return -1;
+			}
+		}
+
+		samples[nr_samples++] = s;
+	}
+
+	return nr_samples ? 0 : -1;
+}
+
+/* "freq_khz arm_uv int_uv" per line, e.g. from custom_voltage */
+static int read_table(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[256];
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	nr_levels = 0;
+
+	while (fgets(line, sizeof(line), f) && nr_levels < MAX_FREQS) {
+		struct freq_level *l = &levels[nr_levels];
+
+		if (sscanf(line, "%u %u %u", &l->freq, &l->arm_volt,
+			   &l->int_volt) == 3)
+			nr_levels++;
+	}
+
+	fclose(f);
+
+	return nr_levels ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] [trace]\n"
+		"  -g gov     lazy, ondemand, conservative, interactive or all\n"
+		"  -c cpu     cpu to replay (default 0)\n"
+		"  -t file    frequency table, 'freq_khz arm_uv int_uv' per line\n"
+		"  -m khz     policy min (default 100000)\n"
+		"  -M khz     policy max (default 1000000)\n"
+		"  -r us      sampling_rate / timer_rate\n"
+		"  -u pct     up_threshold\n"
+		"  -d pct     down_differential\n"
+		"  -T us      min_timeinstate (lazy)\n"
+		"  -s         screenoff_maxfreq (lazy)\n"
+		"  -i         io_is_busy\n"
+		"  -H khz     hispeed_freq (interactive)\n"
+		"  -l us      transition latency (default 40)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct result res;
+	FILE *f = stdin;
+	int gov = -1, opt, i;
+
+	while ((opt = getopt(argc, argv, "g:c:t:m:M:r:u:d:T:siH:l:h")) != -1) {
+		switch (opt) {
+		case 'g':
+			for (i = 0; i < NR_GOVERNORS; i++)
+				if (!strcmp(optarg, governor_names[i]))
+					gov = i;
+			if (gov < 0 && strcmp(optarg, "all"))
+				usage(argv[0]);
+			break;
+		case 'c':
+			opts.cpu = atoi(optarg);
+			break;
+		case 't':
+			if (read_table(optarg))
+				return 1;
+			break;
+		case 'm':
+			opts.policy_min = strtoul(optarg, NULL, 10);
+			break;
+		case 'M':
+			opts.policy_max = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			user_sampling_rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'u':
+			user_up_threshold = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			user_down_differential = strtoul(optarg, NULL, 10);
+			break;
+		case 'T':
+			user_min_timeinstate = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			opts.screenoff_maxfreq = 1;
+			break;
+		case 'i':
+			opts.io_is_busy = 1;
+			break;
+		case 'H':
+			opts.hispeed_freq = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			opts.transition_latency = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	if (read_trace(f)) {
+		fprintf(stderr, "no cpufreq_load_sample events for cpu %d\n",
+			opts.cpu);
+		return 1;
+	}
+
+	printf("%d samples, %.1f s of trace\n", nr_samples,
+	       samples[nr_samples - 1].time - samples[0].time);
+
+	for (i = 0; i < NR_GOVERNORS; i++) {
+		if (gov >= 0 && gov != i)
+			continue;
+		simulate(i, &res);
+		print_result(i, &res);
+	}
+
+	return 0;
+}
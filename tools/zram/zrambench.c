@@ -0,0 +1,434 @@
+/*
+ * zrambench -- measure write (swap-out) and read (swap-in) throughput and
+ * compression ratio of a zram device with several concurrent writers and
+ * readers, optionally for every compression algorithm.
+ *
+ * Copyright (C) 2011 Ezekeel <notezekeel@googlemail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * The device is split into one region per thread. Every thread writes its
+ * region with O_DIRECT in -b KB requests, then all of them read it back
+ * and check what they get. Page contents are random for the first -c
+ * percent and constant for the rest, so the ratio zram achieves can be
+ * steered roughly like that of real swap. With -f the pages are taken
+ * from a corpus file instead, which -S fills with the anonymous memory
+ * of a running process. The run is repeated for every thread count given
+ * with -t. The device has to be set up (disksize, max_comp_streams) and
+ * must not be in use, its contents are destroyed. With -a it is reset
+ * and set up again with each of the given algorithms, which needs root.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <linux/fs.h>
+
+#define MAX_THREAD_COUNTS	16
+#define MAX_THREADS		64
+#define MAX_ALGORITHMS		8
+
+static const char *device = "/dev/zram0";
+static int block_kb = 4;
+static int random_pct = 30;
+static int thread_counts[MAX_THREAD_COUNTS] = { 1, 2, 4 };
+static int nr_thread_counts = 3;
+static char *algorithms[MAX_ALGORITHMS];
+static int nr_algorithms;
+static const char *corpus_file;
+static char *corpus;
+static size_t corpus_pages;
+static char sysfs_dir[64];
+static long page_size;
+static unsigned long long dev_size;
+
+static pthread_barrier_t barrier;
+
+struct worker {
+	int fd;
+	off_t start;
+	size_t len;
+	char *buf;
+	unsigned long errors;
+	double write_s;
+	double read_s;
+	pthread_t tid;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now_s(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * The page at offset, synthetic ones are tagged with it so misplaced
+ * data is noticed. Corpus pages are used as they are.
+ */
+static void fill_page(char *page, off_t offset)
+{
+	unsigned int seed = offset / page_size + 1;
+	long random_len = page_size * random_pct / 100;
+	long i;
+
+	if (corpus) {
+		memcpy(page, corpus + (offset / page_size % corpus_pages) *
+		       page_size, page_size);
+		return;
+	}
+	for (i = 0; i < random_len; i++)
+		page[i] = rand_r(&seed);
+	memset(page + random_len, 0x5a, page_size - random_len);
+	memcpy(page, &offset, sizeof(offset));
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	size_t block = (size_t)block_kb << 10;
+	char *check;
+	double start;
+	off_t off;
+	long i;
+
+	check = malloc(page_size);
+	if (!check)
+		die("malloc");
+
+	pthread_barrier_wait(&barrier);
+	start = now_s();
+	for (off = w->start; off < w->start + w->len; off += block) {
+		for (i = 0; i < block; i += page_size)
+			fill_page(w->buf + i, off + i);
+		if (pwrite(w->fd, w->buf, block, off) != block)
+			die("pwrite");
+	}
+	if (fsync(w->fd))
+		die("fsync");
+	w->write_s = now_s() - start;
+
+	pthread_barrier_wait(&barrier);
+	start = now_s();
+	for (off = w->start; off < w->start + w->len; off += block) {
+		if (pread(w->fd, w->buf, block, off) != block)
+			die("pread");
+		for (i = 0; i < block; i += page_size) {
+			fill_page(check, off + i);
+			if (memcmp(check, w->buf + i, page_size))
+				w->errors++;
+		}
+	}
+	w->read_s = now_s() - start;
+
+	free(check);
+	return NULL;
+}
+
+static unsigned long long sysfs_read(const char *name)
+{
+	char path[128], buf[32];
+	int fd, len;
+
+	snprintf(path, sizeof(path), "%s/%s", sysfs_dir, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die(path);
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0)
+		die(path);
+	buf[len] = '\0';
+	close(fd);
+	return strtoull(buf, NULL, 10);
+}
+
+static void sysfs_write(const char *name, const char *val)
+{
+	char path[128];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", sysfs_dir, name);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		die(path);
+	if (write(fd, val, strlen(val)) != strlen(val))
+		die(path);
+	close(fd);
+}
+
+/* start over with an empty device using the given algorithm */
+static void setup_device(const char *algorithm)
+{
+	char size[32];
+
+	snprintf(size, sizeof(size), "%llu", dev_size);
+	sysfs_write("reset", "1");
+	sysfs_write("comp_algorithm", algorithm);
+	sysfs_write("disksize", size);
+}
+
+static void run(const char *algorithm, int threads)
+{
+	struct worker workers[MAX_THREADS];
+	size_t block = (size_t)block_kb << 10;
+	size_t len = dev_size / threads / block * block;
+	unsigned long long orig, compr;
+	double write_s = 0, read_s = 0, mb;
+	unsigned long errors = 0;
+	int i;
+
+	if (!len) {
+		fprintf(stderr, "device too small for %d threads\n", threads);
+		exit(1);
+	}
+	if (algorithm)
+		setup_device(algorithm);
+	/* the main thread waits with the workers to sample the stats */
+	if (pthread_barrier_init(&barrier, NULL, threads + 1))
+		die("pthread_barrier_init");
+
+	for (i = 0; i < threads; i++) {
+		struct worker *w = &workers[i];
+
+		w->fd = open(device, O_RDWR | O_DIRECT);
+		if (w->fd < 0)
+			die(device);
+		w->start = (off_t)i * len;
+		w->len = len;
+		w->errors = 0;
+		if (posix_memalign((void **)&w->buf, page_size, block))
+			die("posix_memalign");
+	}
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&workers[i].tid, NULL, worker_thread,
+				   &workers[i]))
+			die("pthread_create");
+	pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+	orig = sysfs_read("orig_data_size");
+	compr = sysfs_read("compr_data_size");
+	for (i = 0; i < threads; i++) {
+		struct worker *w = &workers[i];
+
+		pthread_join(w->tid, NULL);
+		if (w->write_s > write_s)
+			write_s = w->write_s;
+		if (w->read_s > read_s)
+			read_s = w->read_s;
+		errors += w->errors;
+		free(w->buf);
+		close(w->fd);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	mb = (double)len * threads / (1 << 20);
+	printf("%-9s %7d %10.0f %7.2f %12.1f %12.1f %8lu\n",
+	       algorithm ? algorithm : "-", threads, mb,
+	       compr ? (double)orig / compr : 0.0, mb / write_s,
+	       mb / read_s, errors);
+	fflush(stdout);
+}
+
+static void parse_thread_counts(char *arg)
+{
+	char *tok;
+
+	nr_thread_counts = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		int n = atoi(tok);
+
+		if (n < 1 || n > MAX_THREADS ||
+		    nr_thread_counts == MAX_THREAD_COUNTS) {
+			fprintf(stderr, "bad thread count %s\n", tok);
+			exit(1);
+		}
+		thread_counts[nr_thread_counts++] = n;
+	}
+}
+
+static void parse_algorithms(char *arg)
+{
+	char *tok;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (nr_algorithms == MAX_ALGORITHMS) {
+			fprintf(stderr, "too many algorithms\n");
+			exit(1);
+		}
+		algorithms[nr_algorithms++] = tok;
+	}
+}
+
+static void load_corpus(void)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(corpus_file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st))
+		die(corpus_file);
+	corpus_pages = st.st_size / page_size;
+	if (!corpus_pages) {
+		fprintf(stderr, "%s: less than a page\n", corpus_file);
+		exit(1);
+	}
+	corpus = malloc(corpus_pages * page_size);
+	if (!corpus)
+		die("malloc");
+	if (read(fd, corpus, corpus_pages * page_size) !=
+	    (ssize_t)(corpus_pages * page_size))
+		die(corpus_file);
+	close(fd);
+}
+
+/* copy the private writable anonymous mappings of pid to corpus_file */
+static void save_corpus(const char *pid)
+{
+	char path[64], line[512], *page;
+	unsigned long start, end, addr, pages = 0;
+	FILE *maps;
+	int mem, out;
+
+	snprintf(path, sizeof(path), "/proc/%s/maps", pid);
+	maps = fopen(path, "r");
+	if (!maps)
+		die(path);
+	snprintf(path, sizeof(path), "/proc/%s/mem", pid);
+	mem = open(path, O_RDONLY);
+	if (mem < 0)
+		die(path);
+	out = open(corpus_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0)
+		die(corpus_file);
+	page = malloc(page_size);
+	if (!page)
+		die("malloc");
+
+	while (fgets(line, sizeof(line), maps)) {
+		char perms[5], name[256] = "";
+
+		if (sscanf(line, "%lx-%lx %4s %*s %*s %*s %255s", &start,
+			   &end, perms, name) < 3)
+			continue;
+		if (strcmp(perms, "rw-p") ||
+		    (name[0] && strcmp(name, "[heap]") &&
+		     strcmp(name, "[stack]")))
+			continue;
+		for (addr = start; addr < end; addr += page_size) {
+			if (pread(mem, page, page_size, addr) != page_size)
+				break;
+			if (write(out, page, page_size) != page_size)
+				die(corpus_file);
+			pages++;
+		}
+	}
+	printf("%lu pages of %s saved to %s\n", pages, pid, corpus_file);
+	free(page);
+	close(out);
+	close(mem);
+	fclose(maps);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: zrambench [-D device] [-b kb] [-c percent] "
+		"[-f corpus [-S pid]] [-a alg,alg,...] [-t n,n,...]\n"
+		"  -D  zram device, overwritten (default /dev/zram0)\n"
+		"  -b  request size in KB, multiple of the page size "
+		"(default 4)\n"
+		"  -c  percent of every page that is random (default 30)\n"
+		"  -f  take page contents from this file\n"
+		"  -S  save the anonymous memory of pid to the -f file "
+		"and exit\n"
+		"  -a  reset the device and run with each compression "
+		"algorithm\n"
+		"  -t  thread counts to sweep (default 1,2,4)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *save_pid = NULL;
+	int opt, fd, i, j;
+
+	while ((opt = getopt(argc, argv, "D:b:c:f:S:a:t:")) != -1) {
+		switch (opt) {
+		case 'D':
+			device = optarg;
+			break;
+		case 'b':
+			block_kb = atoi(optarg);
+			break;
+		case 'c':
+			random_pct = atoi(optarg);
+			break;
+		case 'f':
+			corpus_file = optarg;
+			break;
+		case 'S':
+			save_pid = optarg;
+			break;
+		case 'a':
+			parse_algorithms(optarg);
+			break;
+		case 't':
+			parse_thread_counts(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	page_size = sysconf(_SC_PAGESIZE);
+	if (block_kb < 1 || ((long)block_kb << 10) % page_size ||
+	    random_pct < 0 || random_pct > 100 || (save_pid && !corpus_file))
+		usage();
+
+	if (save_pid) {
+		save_corpus(save_pid);
+		return 0;
+	}
+	if (corpus_file)
+		load_corpus();
+	snprintf(sysfs_dir, sizeof(sysfs_dir), "/sys/block/%s",
+		 strrchr(device, '/') ? strrchr(device, '/') + 1 : device);
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0)
+		die(device);
+	if (ioctl(fd, BLKGETSIZE64, &dev_size))
+		die("BLKGETSIZE64");
+	close(fd);
+
+	if (corpus)
+		printf("%s, %llu MB, %d KB requests, %zu pages from %s\n",
+		       device, dev_size >> 20, block_kb, corpus_pages,
+		       corpus_file);
+	else
+		printf("%s, %llu MB, %d KB requests, %d%% random per page\n",
+		       device, dev_size >> 20, block_kb, random_pct);
+	printf("algorithm threads         MB   ratio   write MB/s    "
+	       "read MB/s   errors\n");
+	for (i = 0; i < (nr_algorithms ? nr_algorithms : 1); i++)
+		for (j = 0; j < nr_thread_counts; j++)
+			run(nr_algorithms ? algorithms[i] : NULL,
+			    thread_counts[j]);
+	return 0;
+}